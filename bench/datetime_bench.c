@@ -0,0 +1,199 @@
+/**
+ * RFC 3339 日時パーサーのマイクロベンチマーク
+ *
+ * 乱数で作った日時（オフセット・小数秒・日付だけ・範囲外の値を含む）を、以前の validate_datetime() と
+ * 同じ sscanf による解析、rfc3339_parse_fields()、rfc3339_parse_batch() で繰り返し解析し、
+ * 1件あたりの時間を比較します。先に、パーサーの結果が timegm() と一致すること、
+ * 範囲外の値を拒否すること、rfc3339_parse() と rfc3339_parse_batch() の結果（オフセットのない
+ * 日時を無効とすることを含む）が一致することを確認します。
+ *
+ * ビルドと実行（リポジトリのルートで）:
+ *   gcc -O2 -std=gnu11 -I. -DCALENDAR_IMPORT_NO_MAIN bench/datetime_bench.c \
+ *       -o datetime_bench -lcurl -ljson-c -pthread
+ *   ./datetime_bench [日時の数] [繰り返し回数]
+ */
+
+#include "../calender_import.c"
+
+#define DEFAULT_COUNT 100000
+#define DEFAULT_ITERATIONS 20
+
+static const char* const bench_invalid[] = {
+    "2024-99-01T10:00:00Z", "2024-02-30T10:00:00Z", "2023-02-29", "2024-01-01T24:00:00Z",
+    "2024-01-01T10:60:00Z", "2024-01-01T10:00:61Z", "2024-01-01T10:00:00+24:00", "2024-01-01T10:00:00+0900",
+    "2024-01-01T10:00:00.Z", "2024-1-01T10:00:00Z", "2024-01-01X10:00:00Z", "2024-01-01T10:00:00Zjunk",
+    "", "2024-01-01T10:00",
+};
+
+// rfc3339_parse() と rfc3339_parse_batch() で結果（有効・無効と時刻）が一致しなければならない日時
+// （SSE2 で処理する形と1文字ずつ解析する形の両方を含む）
+static const char* const bench_agree[] = {
+    "2024-01-01T10:00:00Z", "2024-01-01T10:00:00", "2024-01-01t10:00:00", "2024-01-01 10:00:00",
+    "2024-01-01t10:00:00z", "2024-01-01 10:00:00+09:00", "2024-01-01T10:00:00.123", "2024-01-01T10:00:00.5-03:30",
+    "2024-02-29", "2024-12-31T23:59:60Z", "2024-12-31T23:59:60", "0000-01-01T00:00:00Z",
+};
+
+static unsigned long long bench_state = 1;
+
+/**
+ * 0以上 n 未満の乱数を返す関数（xorshift64*）
+ */
+static unsigned long bench_random(unsigned long n) {
+    bench_state ^= bench_state >> 12;
+    bench_state ^= bench_state << 25;
+    bench_state ^= bench_state >> 27;
+    return (unsigned long)((bench_state * 2685821657736338717ULL) >> 33) % n;
+}
+
+/**
+ * 比較対象: 以前の validate_datetime() と同じ sscanf による解析に、timegm() による変換を加えた関数
+ */
+static long long bench_sscanf(const char* text) {
+    int year, month, day, hour, minute, second;
+    if (sscanf(text, "%d-%d-%dT%d:%d:%d", &year, &month, &day, &hour, &minute, &second) != 6) {
+        return RFC3339_INVALID;
+    }
+    struct tm tm = { .tm_year = year - 1900, .tm_mon = month - 1, .tm_mday = day,
+                     .tm_hour = hour, .tm_min = minute, .tm_sec = second };
+    return (long long)timegm(&tm);
+}
+
+static double bench_elapsed_ns(const struct timespec* a, const struct timespec* b) {
+    return (b->tv_sec - a->tv_sec) * 1e9 + (b->tv_nsec - a->tv_nsec);
+}
+
+int main(int argc, char* argv[]) {
+    long count = (argc > 1) ? atol(argv[1]) : DEFAULT_COUNT;
+    long iterations = (argc > 2) ? atol(argv[2]) : DEFAULT_ITERATIONS;
+    if (count <= 0 || iterations <= 0) {
+        fprintf(stderr, "使用方法: %s [日時の数] [繰り返し回数]\n", argv[0]);
+        return 1;
+    }
+
+    // パーサーの結果を timegm() と比べる（UTC で書いた日時をオフセット付きに書き直したものも同じ時刻になる）
+    for (long i = 0; i < 200000; i++) {
+        struct tm tm = { .tm_year = (int)bench_random(10000) - 1900, .tm_mon = (int)bench_random(12),
+                         .tm_mday = 1 + (int)bench_random(28), .tm_hour = (int)bench_random(24),
+                         .tm_min = (int)bench_random(60), .tm_sec = (int)bench_random(60) };
+        long long expected = (long long)timegm(&tm);
+        char utc[RFC3339_UTC_SIZE];
+        char shifted[64];
+        rfc3339_format_utc(expected, utc);
+        int offset = (int)bench_random(24 * 60) - 12 * 60;
+        long long local = expected + offset * 60LL;
+        struct tm ltm;
+        gmtime_r(&(time_t){ (time_t)local }, &ltm);
+        snprintf(shifted, sizeof(shifted), "%04d-%02d-%02dT%02d:%02d:%02d.5%c%02d:%02d", ltm.tm_year + 1900,
+                 ltm.tm_mon + 1, ltm.tm_mday, ltm.tm_hour, ltm.tm_min, ltm.tm_sec, offset < 0 ? '-' : '+',
+                 abs(offset) / 60, abs(offset) % 60);
+        long long parsed_utc, parsed_shifted;
+        if (ltm.tm_year + 1900 < 0 || ltm.tm_year + 1900 > 9999) {
+            continue;  // オフセットをずらした結果が西暦0〜9999年の外に出た
+        }
+        if (rfc3339_parse(utc, &parsed_utc) != 0 || parsed_utc != expected ||
+            rfc3339_parse(shifted, &parsed_shifted) != 0 || parsed_shifted != expected) {
+            fprintf(stderr, "エラー: 変換結果が一致しません: %s %s（期待値 %lld）\n", utc, shifted, expected);
+            return 1;
+        }
+    }
+    for (size_t i = 0; i < sizeof(bench_invalid) / sizeof(bench_invalid[0]); i++) {
+        long long epoch;
+        if (rfc3339_parse_batch(&bench_invalid[i], NULL, 1, &epoch) != 0 || rfc3339_parse(bench_invalid[i], &epoch) == 0 ||
+            validate_datetime(bench_invalid[i])) {
+            fprintf(stderr, "エラー: 無効な日時を受け付けました: %s\n", bench_invalid[i]);
+            return 1;
+        }
+    }
+    for (size_t i = 0; i < sizeof(bench_agree) / sizeof(bench_agree[0]); i++) {
+        long long single = RFC3339_INVALID;
+        long long batched;
+        rfc3339_parse(bench_agree[i], &single);
+        rfc3339_parse_batch(&bench_agree[i], NULL, 1, &batched);
+        if (single != batched) {
+            fprintf(stderr, "エラー: rfc3339_parse() と rfc3339_parse_batch() の結果が一致しません: %s（%lld / %lld）\n",
+                    bench_agree[i], single, batched);
+            return 1;
+        }
+    }
+
+    // API が返す形に近い日時を用意する（日付だけ、小数秒、オフセット、範囲外の値を含む）
+    char (*storage)[64] = malloc(count * sizeof(*storage));
+    const char** texts = malloc(count * sizeof(*texts));
+    size_t* lengths = malloc(count * sizeof(*lengths));
+    long long* scalar = malloc(count * sizeof(*scalar));
+    long long* batch = malloc(count * sizeof(*batch));
+    if (!storage || !texts || !lengths || !scalar || !batch) {
+        fprintf(stderr, "エラー: メモリ割り当てに失敗しました\n");
+        return 1;
+    }
+    static const char* const zones[] = { "Z", "+09:00", "-07:00", "+05:30", "" };
+    for (long i = 0; i < count; i++) {
+        int year = 2000 + (int)bench_random(40);
+        int month = 1 + (int)bench_random(bench_random(100) == 0 ? 99 : 12);
+        int day = 1 + (int)bench_random(31);
+        if (bench_random(10) == 0) {
+            snprintf(storage[i], sizeof(storage[i]), "%04d-%02d-%02d", year, month, day);
+        } else {
+            snprintf(storage[i], sizeof(storage[i]), "%04d-%02d-%02dT%02d:%02d:%02d%s%s", year, month, day,
+                     (int)bench_random(24), (int)bench_random(60), (int)bench_random(60),
+                     bench_random(5) == 0 ? ".250" : "", zones[bench_random(5)]);
+        }
+        texts[i] = storage[i];
+        lengths[i] = strlen(storage[i]);
+    }
+
+    size_t valid = 0;
+    for (long i = 0; i < count; i++) {
+        if (rfc3339_parse(texts[i], &scalar[i]) != 0) {
+            scalar[i] = RFC3339_INVALID;
+        }
+        valid += (scalar[i] != RFC3339_INVALID);
+    }
+    if (rfc3339_parse_batch(texts, lengths, count, batch) != valid || memcmp(scalar, batch, count * sizeof(*batch)) != 0) {
+        fprintf(stderr, "エラー: 1件ずつの解析とまとめての解析の結果が一致しません\n");
+        return 1;
+    }
+
+    struct timespec t0, t1, t2, t3;
+    long long checksum = 0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (long n = 0; n < iterations; n++) {
+        for (long i = 0; i < count; i++) {
+            checksum += bench_sscanf(texts[i]);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    for (long n = 0; n < iterations; n++) {
+        for (long i = 0; i < count; i++) {
+            struct rfc3339_time t;
+            if (rfc3339_parse_fields(texts[i], lengths[i], &t) == 0) {
+                checksum += rfc3339_to_epoch(&t);
+            }
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t2);
+    for (long n = 0; n < iterations; n++) {
+        checksum += (long long)rfc3339_parse_batch(texts, lengths, count, batch);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t3);
+
+    double total = (double)count * iterations;
+    double sscanf_ns = bench_elapsed_ns(&t0, &t1) / total;
+    double scalar_ns = bench_elapsed_ns(&t1, &t2) / total;
+    double batch_ns = bench_elapsed_ns(&t2, &t3) / total;
+    printf("日時 %ld 件（有効 %zu 件）× %ld 回（checksum %lld）\n", count, valid, iterations, checksum);
+    printf("sscanf + timegm : %7.1f ns/件\n", sscanf_ns);
+    printf("rfc3339 (1件ずつ): %7.1f ns/件  %.2f 倍\n", scalar_ns, sscanf_ns / scalar_ns);
+#ifdef __SSE2__
+    printf("rfc3339 (SSE2)   : %7.1f ns/件  %.2f 倍\n", batch_ns, sscanf_ns / batch_ns);
+#else
+    printf("rfc3339 (まとめて): %7.1f ns/件  %.2f 倍\n", batch_ns, sscanf_ns / batch_ns);
+#endif
+
+    free(storage);
+    free(texts);
+    free(lengths);
+    free(scalar);
+    free(batch);
+    return 0;
+}
@@ -0,0 +1,165 @@
+/**
+ * ベンチマーク用のイベントコーパス（JSONL）を生成するツール
+ *
+ * 実際のカレンダーに近い大きさの項目を持つイベントを、乱数の種から決まった内容で生成します。
+ * タイトルは10〜60文字（一部は日本語）、説明は約6割のイベントに0〜1500バイト、
+ * 場所は約半数、参加者は0〜8人、リマインダーの上書きは約3割、繰り返しは約15%、
+ * 終日イベントは約1割に付けます。
+ *
+ * ビルドと実行（リポジトリのルートで。通常は make bench から呼ばれます）:
+ *   gcc -O2 -std=gnu11 -I. -DCALENDAR_IMPORT_NO_MAIN bench/gen_corpus.c \
+ *       -o bench/gen_corpus -lcurl -ljson-c -pthread
+ *   bench/gen_corpus 100000 [乱数の種] > corpus.jsonl
+ */
+
+#include "../calender_import.c"
+
+static const char* const corpus_words[] = {
+    "weekly", "sync", "review", "planning", "design", "retro", "standup", "customer", "call", "roadmap",
+    "budget", "hiring", "interview", "launch", "migration", "incident", "postmortem", "offsite", "demo", "training",
+    "定例", "会議", "打ち合わせ", "レビュー", "面談", "研修", "共有", "進捗", "確認", "企画",
+};
+
+static const char* const corpus_zones[] = {
+    "Asia/Tokyo", "America/Los_Angeles", "Europe/London", "UTC", "Australia/Sydney",
+};
+
+static const char* const corpus_locations[] = {
+    "東京オフィス 12F 会議室A", "Conference Room 4B, Building 40", "https://meet.example.com/abc-defg-hij",
+    "大阪支社 セミナールーム", "Cafe on 3rd floor",
+};
+
+static unsigned long long corpus_state;
+
+/**
+ * 0以上 n 未満の乱数を返す関数（xorshift64*）
+ */
+static unsigned long corpus_random(unsigned long n) {
+    corpus_state ^= corpus_state >> 12;
+    corpus_state ^= corpus_state << 25;
+    corpus_state ^= corpus_state >> 27;
+    return (unsigned long)((corpus_state * 2685821657736338717ULL) >> 33) % n;
+}
+
+/**
+ * 単語を並べて、おおよそ指定したバイト数の文を作る関数
+ *
+ * @param multiline 文の区切りに改行を入れるかどうか（説明文用）
+ */
+static void corpus_sentence(struct string_buffer* out, size_t target, int multiline) {
+    out->len = 0;
+    string_buffer_append(out, "", 0);
+    while (out->len < target) {
+        const char* word = corpus_words[corpus_random(sizeof(corpus_words) / sizeof(corpus_words[0]))];
+        if (out->len > 0) {
+            if (multiline && corpus_random(12) == 0) {
+                string_buffer_append(out, ".\n", 2);
+            } else {
+                string_buffer_append(out, " ", 1);
+            }
+        }
+        string_buffer_append(out, word, strlen(word));
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2 || atol(argv[1]) <= 0) {
+        fprintf(stderr, "使用方法: %s イベント数 [乱数の種]\n", argv[0]);
+        return 1;
+    }
+    unsigned long count = strtoul(argv[1], NULL, 10);
+    unsigned long long seed = (argc > 2) ? strtoull(argv[2], NULL, 10) : 1;
+    corpus_state = seed ? seed : 1;
+
+    struct string_buffer json = {0};
+    struct string_buffer summary = {0};
+    struct string_buffer description = {0};
+    char ical_uid[96];
+    char start[32], end[32], start_date[16], end_date[16];
+    char emails[8][64];
+    char names[8][32];
+    char source_id[32];
+    struct event_attendee attendees[8];
+    struct event_reminder reminders[2] = { { "popup", 10 }, { "email", 1440 } };
+    const char* recurrence[1];
+    struct event_property private_props[2] = { { "source", "bench-corpus" }, { "sourceId", source_id } };
+
+    // 出力が大きいため、標準出力のバッファを広げる
+    static char out_buffer[1 << 20];
+    setvbuf(stdout, out_buffer, _IOFBF, sizeof(out_buffer));
+
+    for (unsigned long n = 1; n <= count; n++) {
+        struct event_fields event;
+        memset(&event, 0, sizeof(event));
+        event.reminders_use_default = -1;
+        event.sequence = -1;
+
+        snprintf(ical_uid, sizeof(ical_uid), "bench-%llu-%lu@example.com", seed, n);
+        event.ical_uid = ical_uid;
+        corpus_sentence(&summary, 10 + corpus_random(50), 0);
+        event.summary = summary.data;
+        if (corpus_random(10) < 6) {
+            corpus_sentence(&description, corpus_random(1500), 1);
+            event.description = description.data;
+        }
+        if (corpus_random(2) == 0) {
+            event.location = corpus_locations[corpus_random(sizeof(corpus_locations) / sizeof(corpus_locations[0]))];
+        }
+
+        int month = 1 + (int)corpus_random(12);
+        int day = 1 + (int)corpus_random(28);
+        if (corpus_random(10) == 0) {
+            snprintf(start_date, sizeof(start_date), "2025-%02d-%02d", month, day);
+            snprintf(end_date, sizeof(end_date), "2025-%02d-%02d", month, day + 1);
+            event.start.date = start_date;
+            event.end.date = end_date;
+        } else {
+            int hour = 8 + (int)corpus_random(10);
+            int minutes = 30 * (1 + (int)corpus_random(4));
+            snprintf(start, sizeof(start), "2025-%02d-%02dT%02d:%02d:00", month, day, hour, 0);
+            snprintf(end, sizeof(end), "2025-%02d-%02dT%02d:%02d:00", month, day,
+                     hour + minutes / 60, minutes % 60);
+            const char* zone = corpus_zones[corpus_random(sizeof(corpus_zones) / sizeof(corpus_zones[0]))];
+            event.start.date_time = start;
+            event.start.time_zone = zone;
+            event.end.date_time = end;
+            event.end.time_zone = zone;
+        }
+
+        event.attendee_count = corpus_random(9);
+        for (size_t i = 0; i < event.attendee_count; i++) {
+            snprintf(emails[i], sizeof(emails[i]), "user%lu@example.com", corpus_random(100000));
+            snprintf(names[i], sizeof(names[i]), "User %lu", corpus_random(100000));
+            attendees[i].email = emails[i];
+            attendees[i].display_name = corpus_random(2) ? names[i] : NULL;
+            attendees[i].optional = corpus_random(5) == 0;
+        }
+        event.attendees = attendees;
+
+        if (corpus_random(10) < 3) {
+            event.reminders_use_default = 0;
+            event.reminders = reminders;
+            event.reminder_count = 1 + corpus_random(2);
+        }
+        if (corpus_random(100) < 15) {
+            recurrence[0] = corpus_random(2) ? "RRULE:FREQ=WEEKLY;COUNT=10" : "RRULE:FREQ=DAILY;INTERVAL=2;COUNT=5";
+            event.recurrence = recurrence;
+            event.recurrence_count = 1;
+        }
+        snprintf(source_id, sizeof(source_id), "crm-%09lu", n);
+        event.private_properties = private_props;
+        event.private_count = 2;
+
+        if (json_write_event(&json, &event) != 0) {
+            fprintf(stderr, "エラー: イベントの生成に失敗しました\n");
+            return 1;
+        }
+        fwrite(json.data, 1, json.len, stdout);
+        fputc('\n', stdout);
+    }
+
+    free(json.data);
+    free(summary.data);
+    free(description.data);
+    return fflush(stdout) == 0 ? 0 : 1;
+}
@@ -0,0 +1,466 @@
+/**
+ * 一括インポートのエンドツーエンド・ベンチマーク
+ *
+ * bench/mock_server を子プロセスとして起動し、コーパスを並行インポートエンジンで
+ * 同時実行数を変えながら送信します。実行ごとに次の値をJSONで出力します。
+ *   - events_per_sec: 1秒あたりのイベント数
+ *   - latency_us: 転送時間（CURLINFO_TOTAL_TIME_T）のイベント単位のパーセンタイル
+ *   - cpu_us_per_event: このプロセスのCPU時間（user + sys）/ イベント数（模擬サーバーは含まない）
+ *   - allocations_per_event: malloc/calloc/realloc の呼び出し回数 / イベント数（libcurl と json-c を含む）
+ *   - peak_rss_kb: 実行中の最大RSS（実行ごとに /proc/self/clear_refs でリセットする）
+ *
+ * ビルドと実行（リポジトリのルートで。通常は make bench から呼ばれます）:
+ *   gcc -O2 -std=gnu11 -I. -DCALENDAR_IMPORT_NO_MAIN bench/import_bench.c \
+ *       -o bench/import_bench -lcurl -ljson-c -pthread
+ *   bench/import_bench --corpus corpus.jsonl --mock bench/mock_server --concurrency 1,16,64 > result.json
+ *
+ * 一括インポートは1行ごとに結果を標準出力に表示するため、計測中の標準出力は /dev/null に捨てます
+ * （表示のコストは計測に含まれます）。結果のJSONは元の標準出力か --output のファイルに書き出します。
+ */
+
+#include "../calender_import.c"
+
+#include <limits.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#ifndef BENCH_VERSION
+#define BENCH_VERSION "unknown"
+#endif
+
+#define MAX_RUNS 32
+
+// malloc の差し替え: glibc の実体を呼び出し、確保の回数だけ数える
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t nmemb, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+extern void __libc_free(void* ptr);
+
+static atomic_ulong g_bench_allocations;
+
+void* malloc(size_t size) {
+    atomic_fetch_add_explicit(&g_bench_allocations, 1, memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t nmemb, size_t size) {
+    atomic_fetch_add_explicit(&g_bench_allocations, 1, memory_order_relaxed);
+    return __libc_calloc(nmemb, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+    atomic_fetch_add_explicit(&g_bench_allocations, 1, memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+
+void free(void* ptr) {
+    __libc_free(ptr);
+}
+
+/**
+ * ベンチマークの設定
+ */
+struct bench_options {
+    const char* corpus;             // 入力のコーパス（JSONL）
+    const char* mock;               // 模擬サーバーの実行ファイル
+    const char* server;             // 起動済みのサーバーのURL（指定した場合は模擬サーバーを起動しない）
+    const char* output;             // 結果の出力先（NULLの場合は標準出力）
+    int concurrency[MAX_RUNS];
+    int run_count;
+    int batch_size;
+    long latency_ms;                // 模擬サーバーの応答遅延
+    long jitter_ms;
+    const char* http_version;
+};
+
+/**
+ * 1回の実行で記録するレイテンシ（イベント単位、マイクロ秒）
+ */
+struct latency_samples {
+    unsigned int* values;
+    size_t count;
+    size_t cap;
+    unsigned long http1_transfers;  // HTTP/1.x で行われた転送の数
+    unsigned long http2_transfers;  // HTTP/2 で行われた転送の数
+};
+
+/**
+ * 転送の完了ごとに呼び出され、含まれるイベント数だけレイテンシを記録する関数
+ */
+static void bench_on_transfer(void* arg, CURL* handle, int event_count, long long total_us) {
+    struct latency_samples* samples = arg;
+    long version = 0;
+    if (curl_easy_getinfo(handle, CURLINFO_HTTP_VERSION, &version) == CURLE_OK) {
+        if (version == CURL_HTTP_VERSION_2_0) {
+            samples->http2_transfers++;
+        } else if (version != 0) {
+            samples->http1_transfers++;
+        }
+    }
+    if (samples->count + event_count > samples->cap) {
+        size_t cap = samples->cap ? samples->cap * 2 : 65536;
+        while (cap < samples->count + event_count) {
+            cap *= 2;
+        }
+        unsigned int* values = realloc(samples->values, cap * sizeof(unsigned int));
+        if (!values) {
+            return;
+        }
+        samples->values = values;
+        samples->cap = cap;
+    }
+    for (int i = 0; i < event_count; i++) {
+        samples->values[samples->count++] = (unsigned int)(total_us > UINT_MAX ? UINT_MAX : total_us);
+    }
+}
+
+static int compare_uint(const void* a, const void* b) {
+    unsigned int x = *(const unsigned int*)a;
+    unsigned int y = *(const unsigned int*)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * ソート済みのサンプルからパーセンタイルを求める関数（nearest-rank 法）
+ */
+static unsigned int percentile(const struct latency_samples* samples, double p) {
+    if (samples->count == 0) {
+        return 0;
+    }
+    size_t rank = (size_t)(p / 100.0 * samples->count + 0.999999);
+    if (rank < 1) {
+        rank = 1;
+    }
+    return samples->values[(rank > samples->count ? samples->count : rank) - 1];
+}
+
+/**
+ * 最大RSSの記録をリセットする関数（Linux 4.0 以降）
+ */
+static void reset_peak_rss(void) {
+    int fd = open("/proc/self/clear_refs", O_WRONLY);
+    if (fd >= 0) {
+        if (write(fd, "5", 1) < 0) {
+            // 古いカーネルでは書き込めない。その場合はプロセス開始からの最大値になる
+        }
+        close(fd);
+    }
+}
+
+/**
+ * 最大RSS（VmHWM）をKB単位で取得する関数
+ */
+static long peak_rss_kb(void) {
+    FILE* f = fopen("/proc/self/status", "r");
+    char line[256];
+    long kb = -1;
+    while (f && fgets(line, sizeof(line), f)) {
+        if (strncmp(line, "VmHWM:", 6) == 0) {
+            kb = strtol(line + 6, NULL, 10);
+            break;
+        }
+    }
+    if (f) {
+        fclose(f);
+    }
+    if (kb < 0) {
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        kb = usage.ru_maxrss;
+    }
+    return kb;
+}
+
+static double cpu_seconds(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+static double wall_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * 模擬サーバーを起動し、待ち受けているURLを取得する関数
+ *
+ * @return 子プロセスのID、失敗時は-1
+ */
+static pid_t start_mock(const struct bench_options* options, char* base_url, size_t base_url_size) {
+    int pipe_fd[2];
+    if (pipe(pipe_fd) != 0) {
+        return -1;
+    }
+    char latency[32], jitter[32];
+    snprintf(latency, sizeof(latency), "%ld", options->latency_ms);
+    snprintf(jitter, sizeof(jitter), "%ld", options->jitter_ms);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(pipe_fd[1], STDOUT_FILENO);
+        close(pipe_fd[0]);
+        close(pipe_fd[1]);
+        execl(options->mock, options->mock, "--port", "0", "--no-store",
+              "--latency-ms", latency, "--jitter-ms", jitter, (char*)NULL);
+        fprintf(stderr, "エラー: %s を起動できません: %s\n", options->mock, strerror(errno));
+        _exit(127);
+    }
+    close(pipe_fd[1]);
+    if (pid < 0) {
+        close(pipe_fd[0]);
+        return -1;
+    }
+
+    // 最初の行 "mock_server: http://127.0.0.1:PORT で待ち受けています" からURLを取り出す
+    char line[256];
+    FILE* f = fdopen(pipe_fd[0], "r");
+    const char* url = (f && fgets(line, sizeof(line), f)) ? strstr(line, "http://") : NULL;
+    if (f) {
+        fclose(f);
+    }
+    if (url == NULL) {
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+        return -1;
+    }
+    snprintf(base_url, base_url_size, "%.*s", (int)strcspn(url, " \n"), url);
+    return pid;
+}
+
+/**
+ * 作業ディレクトリに config.json と token.json を書き出す関数
+ */
+static int write_client_files(const char* base_url) {
+    FILE* f = fopen(CONFIG_FILE, "w");
+    if (!f) {
+        return -1;
+    }
+    fprintf(f,
+            "{\"client_id\":\"bench\",\"client_secret\":\"bench\",\"redirect_uri\":\"urn:ietf:wg:oauth:2.0:oob\",\n"
+            " \"refresh_token\":\"bench\",\"calendar_id\":\"bench@example.com\",\n"
+            " \"auth_url\":\"%s/o/oauth2/v2/auth\",\"token_url\":\"%s/token\",\n"
+            " \"api_base_url\":\"%s/calendar/v3\",\"batch_url\":\"%s/batch/calendar/v3\"}\n",
+            base_url, base_url, base_url, base_url);
+    fclose(f);
+
+    f = fopen(TOKEN_FILE, "w");
+    if (!f) {
+        return -1;
+    }
+    fprintf(f, "{\"access_token\":\"bench\",\"expires_in\":86400,\"created_at\":%lld}\n", (long long)time(NULL));
+    fclose(f);
+    return 0;
+}
+
+/**
+ * 1回分のインポートを実行し、結果をJSONで書き出す関数
+ */
+static int bench_run(const struct bench_options* options, int concurrency, FILE* out, int first) {
+    const struct app_config* current = config_acquire();
+    struct app_config config = *current;
+    config.tuning.concurrency = concurrency;
+    config.tuning.batch_size = options->batch_size;
+
+    struct latency_samples samples = {0};
+    struct jsonl_reader jsonl;
+    struct ics_reader ics;
+    struct import_source source;
+    struct import_engine engine;
+    if (import_source_open(&source, options->corpus, &jsonl, &ics) != 0) {
+        config_release(current);
+        return -1;
+    }
+    if (import_engine_init(&engine, &config) != 0) {
+        import_source_close(&source);
+        config_release(current);
+        return -1;
+    }
+    engine.on_transfer = bench_on_transfer;
+    engine.on_transfer_arg = &samples;
+
+    reset_peak_rss();
+    unsigned long allocations_before = atomic_load(&g_bench_allocations);
+    unsigned long response_before = atomic_load(&g_response_allocations);
+    unsigned long chunks_before = atomic_load(&g_arena_chunk_allocations);
+    double cpu_before = cpu_seconds();
+    double wall_before = wall_seconds();
+
+    int status = import_engine_run(&engine, &source);
+
+    double wall = wall_seconds() - wall_before;
+    double cpu = cpu_seconds() - cpu_before;
+    unsigned long allocations = atomic_load(&g_bench_allocations) - allocations_before;
+    unsigned long response_allocations = atomic_load(&g_response_allocations) - response_before;
+    unsigned long chunks = atomic_load(&g_arena_chunk_allocations) - chunks_before;
+    long rss = peak_rss_kb();
+    unsigned long events = engine.succeeded + engine.failed;
+    unsigned long succeeded = engine.succeeded;
+    unsigned long failed = engine.failed;
+    unsigned long requests = engine.requests;
+    import_engine_cleanup(&engine);
+    import_source_close(&source);
+    config_release(current);
+
+    qsort(samples.values, samples.count, sizeof(unsigned int), compare_uint);
+    // 要求したバージョンではなく、実際に使われたバージョンを記録する
+    const char* negotiated = samples.http2_transfers == 0 ? (samples.http1_transfers ? "1.1" : "none")
+                             : samples.http1_transfers == 0 ? "2"
+                                                            : "mixed";
+    double per_event = events ? 1.0 / events : 0.0;
+    fprintf(out,
+            "%s    {\"concurrency\": %d, \"batch_size\": %d, \"http_version\": \"%s\", \"requested_http_version\": \"%s\",\n"
+            "     \"events\": %lu, \"succeeded\": %lu, \"failed\": %lu, \"requests\": %lu, \"wall_sec\": %.3f,\n"
+            "     \"events_per_sec\": %.1f,\n"
+            "     \"latency_us\": {\"p50\": %u, \"p95\": %u, \"p99\": %u, \"p99_9\": %u, \"max\": %u},\n"
+            "     \"cpu_us_per_event\": %.2f, \"allocations_per_event\": %.2f,\n"
+            "     \"response_buffer_allocations\": %lu, \"arena_chunk_allocations\": %lu, \"peak_rss_kb\": %ld}",
+            first ? "" : ",\n", concurrency, options->batch_size, negotiated, options->http_version,
+            events, succeeded, failed, requests, wall,
+            wall > 0 ? events / wall : 0.0,
+            percentile(&samples, 50), percentile(&samples, 95), percentile(&samples, 99), percentile(&samples, 99.9),
+            samples.count ? samples.values[samples.count - 1] : 0,
+            cpu * 1e6 * per_event, allocations * per_event, response_allocations, chunks, rss);
+    fflush(out);
+    fprintf(stderr, "concurrency %d: %.1f イベント/秒, p99 %u us, %.2f 回/イベントの確保\n",
+            concurrency, wall > 0 ? events / wall : 0.0, percentile(&samples, 99), allocations * per_event);
+
+    free(samples.values);
+    return (status == 0 && failed == 0) ? 0 : -1;
+}
+
+static void print_bench_usage(const char* prog) {
+    fprintf(stderr,
+            "使用方法: %s --corpus FILE [オプション]\n"
+            "  --corpus FILE        インポートするJSONLファイル（bench/gen_corpus で生成）\n"
+            "  --mock PATH          起動する模擬サーバー（既定: bench/mock_server）\n"
+            "  --server URL         起動済みのサーバーを使う（例: http://127.0.0.1:8080）\n"
+            "  --concurrency LIST   同時実行数をカンマ区切りで指定（既定: 1,4,16,64）\n"
+            "  --batch-size N       バッチサイズ（既定: 1）\n"
+            "  --latency-ms MS      模擬サーバーの応答遅延（既定: 2）\n"
+            "  --jitter-ms MS       模擬サーバーの応答遅延の揺らぎ（既定: 0）\n"
+            "  --http-version V     2、1.1 または h2c（既定: 模擬サーバーでは 1.1、--server では 2。\n"
+            "                       模擬サーバーで HTTP/2 を測る場合は h2c。結果には実際に使われたバージョンを記録します）\n"
+            "  --output FILE        結果のJSONの出力先（既定: 標準出力）\n",
+            prog);
+}
+
+int main(int argc, char* argv[]) {
+    static struct option long_options[] = {
+        {"corpus", required_argument, 0, 'i'},
+        {"mock", required_argument, 0, 'm'},
+        {"server", required_argument, 0, 'S'},
+        {"concurrency", required_argument, 0, 'c'},
+        {"batch-size", required_argument, 0, 'b'},
+        {"latency-ms", required_argument, 0, 'l'},
+        {"jitter-ms", required_argument, 0, 'j'},
+        {"http-version", required_argument, 0, 'v'},
+        {"output", required_argument, 0, 'o'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+    struct bench_options options = {
+        .mock = "bench/mock_server",
+        .batch_size = 1,
+        .latency_ms = 2,
+    };
+    const char* concurrency_list = "1,4,16,64";
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "i:m:S:c:b:l:j:v:o:h", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'i': options.corpus = optarg; break;
+        case 'm': options.mock = optarg; break;
+        case 'S': options.server = optarg; break;
+        case 'c': concurrency_list = optarg; break;
+        case 'b': options.batch_size = atoi(optarg); break;
+        case 'l': options.latency_ms = atol(optarg); break;
+        case 'j': options.jitter_ms = atol(optarg); break;
+        case 'v': options.http_version = optarg; break;
+        case 'o': options.output = optarg; break;
+        default: print_bench_usage(argv[0]); return opt == 'h' ? 0 : 1;
+        }
+    }
+    for (const char* p = concurrency_list; *p && options.run_count < MAX_RUNS; p += strcspn(p, ",") + (p[strcspn(p, ",")] == ',')) {
+        options.concurrency[options.run_count++] = atoi(p);
+    }
+    if (options.http_version == NULL) {
+        // 模擬サーバーは平文なので、"2"（TLS のみ HTTP/2）では HTTP/1.1 になる
+        options.http_version = options.server ? "2" : "1.1";
+    }
+    long http_version = parse_http_version(options.http_version);
+    if (options.corpus == NULL || options.run_count == 0 || http_version < 0) {
+        print_bench_usage(argv[0]);
+        return 1;
+    }
+
+    // 相対パスは作業ディレクトリに移る前に絶対パスにしておく
+    char corpus_path[PATH_MAX], mock_path[PATH_MAX];
+    if (realpath(options.corpus, corpus_path) == NULL) {
+        fprintf(stderr, "エラー: %s が見つかりません\n", options.corpus);
+        return 1;
+    }
+    options.corpus = corpus_path;
+    if (options.server == NULL) {
+        if (realpath(options.mock, mock_path) == NULL) {
+            fprintf(stderr, "エラー: %s が見つかりません（make bench/mock_server でビルドしてください）\n", options.mock);
+            return 1;
+        }
+        options.mock = mock_path;
+    }
+    FILE* out = options.output ? fopen(options.output, "w") : fdopen(dup(STDOUT_FILENO), "w");
+    if (out == NULL) {
+        fprintf(stderr, "エラー: 結果の出力先を開けません\n");
+        return 1;
+    }
+
+    char base_url[256];
+    pid_t mock_pid = -1;
+    if (options.server) {
+        snprintf(base_url, sizeof(base_url), "%s", options.server);
+    } else if ((mock_pid = start_mock(&options, base_url, sizeof(base_url))) < 0) {
+        fprintf(stderr, "エラー: 模擬サーバーを起動できません\n");
+        return 1;
+    }
+
+    char work_dir[] = "/tmp/calendar_import_bench_XXXXXX";
+    if (mkdtemp(work_dir) == NULL || chdir(work_dir) != 0 || write_client_files(base_url) != 0 ||
+        config_init() != 0 || http_session_init(http_version) != 0 || token_cache_init(0) != 0) {
+        fprintf(stderr, "エラー: ベンチマークの準備に失敗しました\n");
+        if (mock_pid > 0) {
+            kill(mock_pid, SIGTERM);
+            waitpid(mock_pid, NULL, 0);
+        }
+        return 1;
+    }
+    if (freopen("/dev/null", "w", stdout) == NULL) {
+        fprintf(stderr, "エラー: 標準出力を切り替えられません\n");
+    }
+
+    fprintf(out, "{\"benchmark\": \"import\", \"version\": \"%s\", \"corpus\": \"%s\", \"server\": \"%s\",\n"
+                 " \"mock_latency_ms\": %ld, \"mock_jitter_ms\": %ld,\n \"runs\": [\n",
+            BENCH_VERSION, options.corpus, options.server ? options.server : "mock_server",
+            options.latency_ms, options.jitter_ms);
+    int result = 0;
+    for (int i = 0; i < options.run_count; i++) {
+        if (bench_run(&options, options.concurrency[i], out, i == 0) != 0) {
+            result = 1;
+        }
+    }
+    fprintf(out, "\n ]}\n");
+    fclose(out);
+
+    token_cache_shutdown();
+    http_session_cleanup();
+    config_shutdown();
+    unlink(CONFIG_FILE);
+    unlink(TOKEN_FILE);
+    rmdir(work_dir);
+    if (mock_pid > 0) {
+        kill(mock_pid, SIGTERM);
+        waitpid(mock_pid, NULL, 0);
+    }
+    return result;
+}
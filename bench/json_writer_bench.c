@@ -0,0 +1,221 @@
+/**
+ * イベントJSON生成のマイクロベンチマーク
+ *
+ * 同じイベントを json_write_event() と json-c のオブジェクト構築＋文字列化で繰り返し生成し、
+ * 1件あたりの時間を比較します。両者の出力が同じJSONを表すことも確認します。
+ *
+ * ビルドと実行（リポジトリのルートで）:
+ *   gcc -O2 -std=gnu11 -I. -DCALENDAR_IMPORT_NO_MAIN bench/json_writer_bench.c \
+ *       -o json_writer_bench -lcurl -ljson-c -pthread
+ *   ./json_writer_bench [繰り返し回数]
+ */
+
+#include "../calender_import.c"
+
+#define DEFAULT_ITERATIONS 200000
+
+static const char* const bench_recurrence[] = {
+    "RRULE:FREQ=WEEKLY;BYDAY=MO,WE,FR;COUNT=30",
+    "EXDATE;TZID=Asia/Tokyo:20240115T100000",
+};
+
+static const struct event_attendee bench_attendees[] = {
+    { "alice@example.com", "Alice \"Al\" Example", 0 },
+    { "bob@example.com", "Bob", 1 },
+    { "carol@example.com", NULL, 0 },
+};
+
+static const struct event_reminder bench_reminders[] = {
+    { "popup", 10 },
+    { "email", 1440 },
+};
+
+static const struct event_property bench_private[] = {
+    { "source", "bulk-import" },
+    { "sourceId", "crm-000123456" },
+};
+
+static const struct event_property bench_shared[] = {
+    { "project", "カレンダー移行" },
+};
+
+/**
+ * ベンチマークに使うイベントを用意する関数
+ */
+static void bench_event(struct event_fields* event) {
+    memset(event, 0, sizeof(*event));
+    event->ical_uid = "bench-0001@example.com";
+    event->summary = "週次定例ミーティング (Weekly sync)";
+    event->description =
+        "Agenda:\n"
+        "1. Status updates from each team, including \"blocked\" items\n"
+        "2. Review of the migration plan for C:\\calendars\\export\n"
+        "3. 次回までの課題の確認\n"
+        "Please join a few minutes early so we can start on time.";
+    event->location = "東京オフィス 12F 会議室A";
+    event->status = "confirmed";
+    event->start.date_time = "2024-01-08T10:00:00";
+    event->start.time_zone = "Asia/Tokyo";
+    event->end.date_time = "2024-01-08T11:00:00";
+    event->end.time_zone = "Asia/Tokyo";
+    event->recurrence = bench_recurrence;
+    event->recurrence_count = sizeof(bench_recurrence) / sizeof(bench_recurrence[0]);
+    event->attendees = bench_attendees;
+    event->attendee_count = sizeof(bench_attendees) / sizeof(bench_attendees[0]);
+    event->reminders_use_default = 0;
+    event->reminders = bench_reminders;
+    event->reminder_count = sizeof(bench_reminders) / sizeof(bench_reminders[0]);
+    event->private_properties = bench_private;
+    event->private_count = sizeof(bench_private) / sizeof(bench_private[0]);
+    event->shared_properties = bench_shared;
+    event->shared_count = sizeof(bench_shared) / sizeof(bench_shared[0]);
+    event->sequence = 3;
+}
+
+/**
+ * json-c で日時オブジェクトを作成する関数
+ */
+static struct json_object* bench_jsonc_time(const struct event_time* when) {
+    struct json_object* obj = json_object_new_object();
+    if (when->date) {
+        json_object_object_add(obj, "date", json_object_new_string(when->date));
+    }
+    if (when->date_time) {
+        json_object_object_add(obj, "dateTime", json_object_new_string(when->date_time));
+    }
+    if (when->time_zone) {
+        json_object_object_add(obj, "timeZone", json_object_new_string(when->time_zone));
+    }
+    return obj;
+}
+
+/**
+ * 比較対象: json-c でオブジェクトを組み立ててから文字列化する関数
+ *
+ * @param event イベントの項目
+ * @param out 文字列化したJSONを受け取るバッファ
+ */
+static void bench_jsonc_event(const struct event_fields* event, struct string_buffer* out) {
+    struct json_object* root = json_object_new_object();
+    json_object_object_add(root, "iCalUID", json_object_new_string(event->ical_uid));
+    json_object_object_add(root, "summary", json_object_new_string(event->summary));
+    json_object_object_add(root, "description", json_object_new_string(event->description));
+    json_object_object_add(root, "location", json_object_new_string(event->location));
+    json_object_object_add(root, "status", json_object_new_string(event->status));
+    json_object_object_add(root, "start", bench_jsonc_time(&event->start));
+    json_object_object_add(root, "end", bench_jsonc_time(&event->end));
+
+    struct json_object* recurrence = json_object_new_array();
+    for (size_t i = 0; i < event->recurrence_count; i++) {
+        json_object_array_add(recurrence, json_object_new_string(event->recurrence[i]));
+    }
+    json_object_object_add(root, "recurrence", recurrence);
+
+    struct json_object* attendees = json_object_new_array();
+    for (size_t i = 0; i < event->attendee_count; i++) {
+        struct json_object* attendee = json_object_new_object();
+        json_object_object_add(attendee, "email", json_object_new_string(event->attendees[i].email));
+        if (event->attendees[i].display_name) {
+            json_object_object_add(attendee, "displayName", json_object_new_string(event->attendees[i].display_name));
+        }
+        if (event->attendees[i].optional) {
+            json_object_object_add(attendee, "optional", json_object_new_boolean(1));
+        }
+        json_object_array_add(attendees, attendee);
+    }
+    json_object_object_add(root, "attendees", attendees);
+
+    struct json_object* reminders = json_object_new_object();
+    struct json_object* overrides = json_object_new_array();
+    json_object_object_add(reminders, "useDefault", json_object_new_boolean(event->reminders_use_default));
+    for (size_t i = 0; i < event->reminder_count; i++) {
+        struct json_object* reminder = json_object_new_object();
+        json_object_object_add(reminder, "method", json_object_new_string(event->reminders[i].method));
+        json_object_object_add(reminder, "minutes", json_object_new_int(event->reminders[i].minutes));
+        json_object_array_add(overrides, reminder);
+    }
+    json_object_object_add(reminders, "overrides", overrides);
+    json_object_object_add(root, "reminders", reminders);
+
+    struct json_object* extended = json_object_new_object();
+    struct json_object* private_props = json_object_new_object();
+    struct json_object* shared_props = json_object_new_object();
+    for (size_t i = 0; i < event->private_count; i++) {
+        json_object_object_add(private_props, event->private_properties[i].key,
+                               json_object_new_string(event->private_properties[i].value));
+    }
+    for (size_t i = 0; i < event->shared_count; i++) {
+        json_object_object_add(shared_props, event->shared_properties[i].key,
+                               json_object_new_string(event->shared_properties[i].value));
+    }
+    json_object_object_add(extended, "private", private_props);
+    json_object_object_add(extended, "shared", shared_props);
+    json_object_object_add(root, "extendedProperties", extended);
+    json_object_object_add(root, "sequence", json_object_new_int(event->sequence));
+
+    size_t len;
+    const char* json = json_object_to_json_string_length(root, JSON_C_TO_STRING_PLAIN, &len);
+    out->len = 0;
+    string_buffer_append(out, json, len);
+    json_object_put(root);
+}
+
+/**
+ * 2つのJSON文字列が同じ値を表すかを確認する関数
+ */
+static int bench_same_json(const char* a, const char* b) {
+    struct json_object* x = json_tokener_parse(a);
+    struct json_object* y = json_tokener_parse(b);
+    int same = (x != NULL && y != NULL && json_object_equal(x, y));
+    json_object_put(x);
+    json_object_put(y);
+    return same;
+}
+
+int main(int argc, char* argv[]) {
+    long iterations = (argc > 1) ? atol(argv[1]) : DEFAULT_ITERATIONS;
+    if (iterations <= 0) {
+        fprintf(stderr, "使用方法: %s [繰り返し回数]\n", argv[0]);
+        return 1;
+    }
+
+    struct event_fields event;
+    bench_event(&event);
+    struct string_buffer writer_out = {0};
+    struct string_buffer jsonc_out = {0};
+
+    if (json_write_event(&writer_out, &event) != 0) {
+        return 1;
+    }
+    bench_jsonc_event(&event, &jsonc_out);
+    if (!bench_same_json(writer_out.data, jsonc_out.data)) {
+        fprintf(stderr, "エラー: 出力が一致しません\nwriter: %s\njson-c: %s\n", writer_out.data, jsonc_out.data);
+        return 1;
+    }
+
+    struct timespec t0, t1, t2;
+    size_t checksum = 0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (long i = 0; i < iterations; i++) {
+        json_write_event(&writer_out, &event);
+        checksum += writer_out.len;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    for (long i = 0; i < iterations; i++) {
+        bench_jsonc_event(&event, &jsonc_out);
+        checksum += jsonc_out.len;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t2);
+
+    double writer_ns = ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / iterations;
+    double jsonc_ns = ((t2.tv_sec - t1.tv_sec) * 1e9 + (t2.tv_nsec - t1.tv_nsec)) / iterations;
+
+    printf("イベント1件のJSON: %zu バイト、%ld 回（checksum %zu）\n", writer_out.len, iterations, checksum);
+    printf("json_writer: %8.1f ns/件  %7.1f MB/s\n", writer_ns, writer_out.len / writer_ns * 1e3);
+    printf("json-c     : %8.1f ns/件  %7.1f MB/s\n", jsonc_ns, jsonc_out.len / jsonc_ns * 1e3);
+    printf("速度比     : %.2f 倍\n", jsonc_ns / writer_ns);
+
+    free(writer_out.data);
+    free(jsonc_out.data);
+    return 0;
+}
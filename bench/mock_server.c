@@ -0,0 +1,2574 @@
+/**
+ * Google Calendar API / OAuth 2.0 のローカル模擬サーバー
+ *
+ * 実際のAPIの割り当て量を使わずに、ネットワークのないLinux環境で
+ * calender_import の一括インポートのスループットとレイテンシを測るためのサーバーです。
+ * epoll を使った1スレッドのHTTPサーバーで、HTTP/1.1（Keep-Alive とパイプライン）と
+ * 平文のHTTP/2（h2c。Upgrade: h2c による切り替えと、事前知識で始める接続の両方）に対応します。
+ * TLSには対応しないため、クライアントは http:// のURLで接続してください
+ * （HTTP/2 で測る場合はクライアントに --http-version h2c を指定します）。
+ *
+ * h2c は calender_import の HTTP/2 の経路を動かすための簡易実装で、HTTP/2 の性能の基準にはなりません。
+ * 1スレッドで全接続を処理し、応答ヘッダーを動的テーブルに登録せず、応答本文を送信待ちのバッファと
+ * DATA フレームへ2回コピーし、ストリームの優先度も扱いません。そのため同じ条件でも HTTP/1.1 より遅くなることがあり
+ * （同時実行数16で h2c 5166 イベント/秒に対して HTTP/1.1 7995 イベント/秒）、HTTP/1.1 との比較は
+ * 機能と接続数の確認にとどめてください。HPACK とフロー制御の実装は bench/h2c_check
+ * （make bench-h2c-check）で libcurl / nghttp2 と突き合わせて確かめます。
+ * --h2-window BYTES で受信ウィンドウ（SETTINGS_INITIAL_WINDOW_SIZE と接続全体のウィンドウ）を変えられます。
+ *
+ * 対応するエンドポイント（/calendars/ より前のパスは問わない）:
+ *   GET    .../auth                                   認証画面の代わりに認証コードを表示する
+ *   POST   /token                                     authorization_code / refresh_token
+ *   POST   .../calendars/{calendarId}/events/import   iCalUID が同じイベントは上書きする
+ *   POST   .../calendars/{calendarId}/events          events.insert（id が重複すると409）
+ *   GET    .../calendars/{calendarId}/events          events.list（maxResults, pageToken, showDeleted, syncToken,
+ *                                                      timeMin, timeMax。オフセットのない日時はUTCとみなす）
+ *   GET    .../calendars/{calendarId}/events/{id}     events.get
+ *   PATCH  .../calendars/{calendarId}/events/{id}     events.patch（トップレベルのキーを上書きする）
+ *   DELETE .../calendars/{calendarId}/events/{id}     events.delete
+ *   POST   /batch/...                                 multipart/mixed のバッチリクエスト
+ *
+ * --decorate ZONE を指定すると、保存するイベントを実際のAPIと同じように書き直す
+ * （reminders、eventType、sequence を補い、dateTime をカレンダーのタイムゾーン ZONE のオフセットで書き直し、
+ * start / end に timeZone を補う）。同期で内容を比べる処理が、APIの書き直しに影響されないことを確かめるために使う。
+ *
+ * ビルド（リポジトリのルートで）:
+ *   gcc -O2 -std=gnu11 -I. bench/mock_server.c -o mock_server -ljson-c
+ *
+ * クライアントの config.json で接続先を差し替えます（PORT は起動時に表示されるポート）:
+ *   "auth_url": "http://127.0.0.1:PORT/o/oauth2/v2/auth",
+ *   "token_url": "http://127.0.0.1:PORT/token",
+ *   "api_base_url": "http://127.0.0.1:PORT/calendar/v3",
+ *   "batch_url": "http://127.0.0.1:PORT/batch/calendar/v3"
+ */
+
+#define _GNU_SOURCE  // accept4(), memmem() のために必要
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "json-c/json.h"
+
+#define DEFAULT_PORT 8080
+#define MAX_EVENTS 256
+#define READ_CHUNK 65536
+#define MAX_REQUEST_SIZE (64 * 1024 * 1024)
+#define DEFAULT_PAGE_SIZE 250
+#define MAX_PAGE_SIZE 2500
+#define MAX_BATCH_PARTS 1000
+
+#define H2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define H2_PREFACE_LEN 24
+#define H2_FRAME_HEADER_SIZE 9
+#define H2_MAX_FRAME_SIZE 16384         // 受け付けるフレームの最大長（SETTINGS_MAX_FRAME_SIZE の既定値のまま）
+#define H2_MAX_HEADER_BLOCK (1024 * 1024)
+#define H2_MAX_STREAMS 256              // 1接続で同時に開けるストリーム数（SETTINGS_MAX_CONCURRENT_STREAMS）
+#define H2_DEFAULT_WINDOW 65535
+#define H2_RECEIVE_WINDOW 0x40000000L   // クライアントに許す送信量の既定値（受信に合わせて補充する）
+#define HPACK_TABLE_SIZE 4096           // HPACK の動的テーブルの大きさ（SETTINGS_HEADER_TABLE_SIZE の既定値）
+
+#define H2_DATA 0x0
+#define H2_HEADERS 0x1
+#define H2_RST_STREAM 0x3
+#define H2_SETTINGS 0x4
+#define H2_PING 0x6
+#define H2_GOAWAY 0x7
+#define H2_WINDOW_UPDATE 0x8
+#define H2_CONTINUATION 0x9
+
+#define H2_FLAG_END_STREAM 0x1
+#define H2_FLAG_ACK 0x1
+#define H2_FLAG_END_HEADERS 0x4
+#define H2_FLAG_PADDED 0x8
+#define H2_FLAG_PRIORITY 0x20
+
+/**
+ * 可変長バッファ
+ */
+struct buffer {
+    char* data;
+    size_t len;
+    size_t cap;
+};
+
+/**
+ * バッファの領域を必要なサイズ以上に広げる関数
+ * 模擬サーバーではメモリ不足から回復しても意味がないため、失敗時は終了する
+ */
+static void buffer_reserve(struct buffer* buf, size_t needed) {
+    if (needed <= buf->cap) {
+        return;
+    }
+    size_t cap = buf->cap ? buf->cap : 1024;
+    while (cap < needed) {
+        cap *= 2;
+    }
+    char* data = realloc(buf->data, cap);
+    if (!data) {
+        fprintf(stderr, "エラー: メモリ割り当てに失敗しました\n");
+        exit(1);
+    }
+    buf->data = data;
+    buf->cap = cap;
+}
+
+static void buffer_append(struct buffer* buf, const char* data, size_t len) {
+    buffer_reserve(buf, buf->len + len + 1);
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+    buf->data[buf->len] = '\0';
+}
+
+static void buffer_appendf(struct buffer* buf, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int needed = vsnprintf(NULL, 0, fmt, args);
+    va_end(args);
+    if (needed < 0) {
+        return;
+    }
+    buffer_reserve(buf, buf->len + needed + 1);
+    va_start(args, fmt);
+    vsnprintf(buf->data + buf->len, needed + 1, fmt, args);
+    va_end(args);
+    buf->len += needed;
+}
+
+/**
+ * バッファの先頭 n バイトを捨てる関数
+ */
+static void buffer_consume(struct buffer* buf, size_t n) {
+    memmove(buf->data, buf->data + n, buf->len - n);
+    buf->len -= n;
+}
+
+/**
+ * サーバーの設定
+ */
+struct mock_options {
+    const char* bind_address;       // 待ち受けるアドレス
+    int port;                       // 待ち受けるポート（0の場合は空いているポート）
+    long latency_ms;                // APIリクエストの応答を遅らせる時間
+    long jitter_ms;                 // latency_ms に加える一様乱数の幅
+    double slow_rate;               // slow_ms だけさらに遅らせるリクエストの割合（テールレイテンシ用）
+    long slow_ms;
+    double error_rate;              // 5xx を返すリクエストの割合
+    int error_status;               // 返す5xxのステータス
+    double rate_limit_rate;         // レート制限エラーを返すリクエストの割合
+    int rate_limit_status;          // レート制限エラーのステータス（429 または 403）
+    long retry_after;               // レート制限エラーの Retry-After（0の場合は付けない）
+    long max_inflight;              // 同時に応答待ちにできるリクエスト数（超えた分はレート制限エラー、0は無制限）
+    long token_ttl;                 // 発行するアクセストークンの有効期間（秒）
+    int store;                      // イベントを保存するかどうか
+    const char* decorate;           // APIと同じようにイベントを書き直す場合のカレンダーのタイムゾーン（NULLは書き直さない）
+    long h2_window;                 // HTTP/2 でクライアントに許す送信量（ストリームごとと接続全体）
+    unsigned long long seed;        // 乱数の種
+};
+
+static struct mock_options g_options = {
+    .bind_address = "127.0.0.1",
+    .port = DEFAULT_PORT,
+    .error_status = 503,
+    .rate_limit_status = 429,
+    .retry_after = 1,
+    .token_ttl = 3600,
+    .store = 1,
+    .h2_window = H2_RECEIVE_WINDOW,
+    .seed = 1,
+};
+
+/**
+ * 集計
+ */
+struct mock_stats {
+    unsigned long connections;
+    unsigned long h2_connections;   // うち HTTP/2 で始まった接続
+    unsigned long requests;         // 受け付けたHTTPリクエスト数（バッチは1件）
+    unsigned long api_calls;        // APIの呼び出し数（バッチ内の各リクエストを含む）
+    unsigned long batches;
+    unsigned long tokens;
+    unsigned long status_2xx;
+    unsigned long status_4xx;
+    unsigned long status_5xx;
+    unsigned long injected_errors;
+    unsigned long injected_rate_limits;
+    unsigned long inflight_rejects;
+    unsigned long h2_window_updates_sent;       // 受信ウィンドウの補充（ストリームと接続全体）
+    unsigned long h2_window_updates_received;
+    unsigned long h2_continuations;             // CONTINUATION フレームに分かれたヘッダーブロックの数
+    unsigned long h2_window_waits;              // 送信ウィンドウが尽きて応答本文の送信を待った回数
+};
+
+static struct mock_stats g_stats;
+static volatile sig_atomic_t g_stop;
+
+static unsigned long long g_random_state;
+
+/**
+ * 0以上1未満の乱数を返す関数（xorshift64*）
+ */
+static double random_unit(void) {
+    g_random_state ^= g_random_state >> 12;
+    g_random_state ^= g_random_state << 25;
+    g_random_state ^= g_random_state >> 27;
+    return (double)((g_random_state * 2685821657736338717ULL) >> 11) / 9007199254740992.0;
+}
+
+static long long monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * 保存されたイベント
+ */
+struct stored_event {
+    char* id;
+    char* ical_uid;
+    struct json_object* resource;   // イベントリソース全体
+    unsigned long long updated_seq; // 最後に変更されたときの通し番号
+    int deleted;
+    long long start_time;           // 開始時刻（UNIX時間、timeMin / timeMax の絞り込み用）
+    long long end_time;             // 終了時刻
+};
+
+/**
+ * 文字列キーからイベントを引くハッシュ表（オープンアドレス法）
+ * キーはイベント自身の id または ical_uid を指す
+ */
+struct event_map {
+    struct map_slot {
+        const char* key;
+        struct stored_event* event;
+    }* slots;
+    size_t cap;
+    size_t count;
+};
+
+/**
+ * カレンダー
+ * イベントは作成順に保持し、events.list はその順で返す
+ */
+struct mock_calendar {
+    char* id;
+    struct stored_event** events;
+    size_t count;
+    size_t cap;
+    struct event_map by_id;
+    struct event_map by_uid;
+    struct mock_calendar* next;
+};
+
+static struct mock_calendar* g_calendars;
+static unsigned long long g_change_seq;
+static unsigned long g_next_event_id;
+static unsigned long g_next_token;
+static unsigned long g_sync_epoch;      // 同期トークンに埋め込む起動ごとの値（再起動前のトークンは410にする）
+
+static size_t hash_string(const char* s) {
+    size_t h = 14695981039346656037ULL;
+    for (; *s; s++) {
+        h = (h ^ (unsigned char)*s) * 1099511628211ULL;
+    }
+    return h;
+}
+
+static struct stored_event* event_map_find(const struct event_map* map, const char* key) {
+    if (map->cap == 0) {
+        return NULL;
+    }
+    for (size_t i = hash_string(key) & (map->cap - 1);; i = (i + 1) & (map->cap - 1)) {
+        if (map->slots[i].key == NULL) {
+            return NULL;
+        }
+        if (strcmp(map->slots[i].key, key) == 0) {
+            return map->slots[i].event;
+        }
+    }
+}
+
+static void event_map_put(struct event_map* map, const char* key, struct stored_event* event) {
+    if ((map->count + 1) * 4 > map->cap * 3) {
+        struct event_map grown = { NULL, map->cap ? map->cap * 2 : 1024, 0 };
+        grown.slots = calloc(grown.cap, sizeof(*grown.slots));
+        if (!grown.slots) {
+            fprintf(stderr, "エラー: メモリ割り当てに失敗しました\n");
+            exit(1);
+        }
+        for (size_t i = 0; i < map->cap; i++) {
+            if (map->slots[i].key) {
+                event_map_put(&grown, map->slots[i].key, map->slots[i].event);
+            }
+        }
+        free(map->slots);
+        *map = grown;
+    }
+    size_t i = hash_string(key) & (map->cap - 1);
+    while (map->slots[i].key != NULL && strcmp(map->slots[i].key, key) != 0) {
+        i = (i + 1) & (map->cap - 1);
+    }
+    if (map->slots[i].key == NULL) {
+        map->count++;
+    }
+    map->slots[i].key = key;
+    map->slots[i].event = event;
+}
+
+/**
+ * カレンダーを取得する関数（存在しない場合は作成する）
+ */
+static struct mock_calendar* calendar_get(const char* id) {
+    for (struct mock_calendar* cal = g_calendars; cal; cal = cal->next) {
+        if (strcmp(cal->id, id) == 0) {
+            return cal;
+        }
+    }
+    struct mock_calendar* cal = calloc(1, sizeof(*cal));
+    if (!cal || !(cal->id = strdup(id))) {
+        fprintf(stderr, "エラー: メモリ割り当てに失敗しました\n");
+        exit(1);
+    }
+    cal->next = g_calendars;
+    g_calendars = cal;
+    return cal;
+}
+
+/**
+ * RFC 3339 の日時（または日付）を UNIX時間に変換する関数
+ * 日付だけの場合はその日の0時（UTC）、オフセットのない日時はUTCとして扱う
+ *
+ * @return 変換できない場合は fallback
+ */
+static long long mock_parse_time(const char* text, long long fallback) {
+    int y, mo, d, h = 0, mi = 0, sec = 0, n = 0;
+    if (sscanf(text, "%d-%d-%dT%d:%d:%d%n", &y, &mo, &d, &h, &mi, &sec, &n) != 6) {
+        h = mi = sec = 0;
+        if (sscanf(text, "%d-%d-%d%n", &y, &mo, &d, &n) != 3) {
+            return fallback;
+        }
+    }
+    struct tm tm = {0};
+    tm.tm_year = y - 1900;
+    tm.tm_mon = mo - 1;
+    tm.tm_mday = d;
+    tm.tm_hour = h;
+    tm.tm_min = mi;
+    tm.tm_sec = sec;
+    long long t = (long long)timegm(&tm);
+    const char* zone = text + n;
+    while (*zone == '.' || isdigit((unsigned char)*zone)) {
+        zone++;
+    }
+    int oh, om;
+    if ((*zone == '+' || *zone == '-') && sscanf(zone + 1, "%d:%d", &oh, &om) == 2) {
+        t -= (*zone == '+' ? 1 : -1) * (oh * 3600LL + om * 60LL);
+    }
+    return t;
+}
+
+/**
+ * イベントの start / end（dateTime または date）を UNIX時間に変換する関数
+ */
+static long long mock_event_time(struct json_object* resource, const char* key, long long fallback) {
+    struct json_object* when;
+    struct json_object* value;
+    if (!json_object_object_get_ex(resource, key, &when)) {
+        return fallback;
+    }
+    if (json_object_object_get_ex(when, "dateTime", &value) ||
+        json_object_object_get_ex(when, "date", &value)) {
+        return mock_parse_time(json_object_get_string(value), fallback);
+    }
+    return fallback;
+}
+
+/**
+ * 保存しているリソースから開始・終了時刻を計算し直す関数
+ */
+static void stored_event_set_times(struct stored_event* event) {
+    event->start_time = mock_event_time(event->resource, "start", 0);
+    event->end_time = mock_event_time(event->resource, "end", event->start_time);
+}
+
+/**
+ * イベントをカレンダーに追加する関数
+ */
+static struct stored_event* calendar_add(struct mock_calendar* cal, const char* id, const char* ical_uid,
+                                         struct json_object* resource) {
+    struct stored_event* event = calloc(1, sizeof(*event));
+    if (!event || !(event->id = strdup(id)) || !(event->ical_uid = strdup(ical_uid))) {
+        fprintf(stderr, "エラー: メモリ割り当てに失敗しました\n");
+        exit(1);
+    }
+    event->resource = resource;
+    stored_event_set_times(event);
+    if (cal->count == cal->cap) {
+        cal->cap = cal->cap ? cal->cap * 2 : 1024;
+        cal->events = realloc(cal->events, cal->cap * sizeof(*cal->events));
+        if (!cal->events) {
+            fprintf(stderr, "エラー: メモリ割り当てに失敗しました\n");
+            exit(1);
+        }
+    }
+    cal->events[cal->count++] = event;
+    event_map_put(&cal->by_id, event->id, event);
+    event_map_put(&cal->by_uid, event->ical_uid, event);
+    return event;
+}
+
+/**
+ * URLエンコードされた文字列をデコードする関数
+ */
+static void url_decode(const char* src, size_t len, char* dest, size_t dest_size) {
+    size_t out = 0;
+    for (size_t i = 0; i < len && out + 1 < dest_size; i++) {
+        if (src[i] == '%' && i + 2 < len && isxdigit((unsigned char)src[i + 1]) && isxdigit((unsigned char)src[i + 2])) {
+            char hex[3] = { src[i + 1], src[i + 2], '\0' };
+            dest[out++] = (char)strtol(hex, NULL, 16);
+            i += 2;
+        } else {
+            dest[out++] = (src[i] == '+') ? ' ' : src[i];
+        }
+    }
+    dest[out] = '\0';
+}
+
+/**
+ * クエリ文字列またはフォームから値を取り出す関数
+ *
+ * @return 見つかった場合は1、見つからない場合は0
+ */
+static int form_value(const char* form, size_t form_len, const char* name, char* out, size_t out_size) {
+    size_t name_len = strlen(name);
+    const char* p = form;
+    const char* end = form + form_len;
+    while (p < end) {
+        const char* amp = memchr(p, '&', end - p);
+        const char* field_end = amp ? amp : end;
+        if ((size_t)(field_end - p) > name_len && strncmp(p, name, name_len) == 0 && p[name_len] == '=') {
+            url_decode(p + name_len + 1, field_end - p - name_len - 1, out, out_size);
+            return 1;
+        }
+        p = field_end + 1;
+    }
+    return 0;
+}
+
+/**
+ * 1件のAPI呼び出しの結果
+ */
+struct api_reply {
+    int status;
+    long retry_after;               // Retry-After ヘッダーの秒数（付けない場合は0）
+    const char* content_type;
+    struct buffer body;
+};
+
+static const char* status_text(int status) {
+    switch (status) {
+    case 100: return "Continue";
+    case 200: return "OK";
+    case 204: return "No Content";
+    case 400: return "Bad Request";
+    case 401: return "Unauthorized";
+    case 403: return "Forbidden";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 409: return "Conflict";
+    case 410: return "Gone";
+    case 411: return "Length Required";
+    case 413: return "Payload Too Large";
+    case 429: return "Too Many Requests";
+    case 500: return "Internal Server Error";
+    case 502: return "Bad Gateway";
+    case 503: return "Service Unavailable";
+    default: return "Unknown";
+    }
+}
+
+/**
+ * Google API 形式のエラーレスポンスを作成する関数
+ */
+static void reply_error(struct api_reply* reply, int status, const char* reason, const char* message) {
+    reply->status = status;
+    reply->retry_after = 0;
+    reply->content_type = "application/json; charset=UTF-8";
+    reply->body.len = 0;
+    buffer_appendf(&reply->body,
+                   "{\"error\":{\"errors\":[{\"domain\":\"global\",\"reason\":\"%s\",\"message\":\"%s\"}],"
+                   "\"code\":%d,\"message\":\"%s\"}}",
+                   reason, message, status, message);
+}
+
+static void reply_json(struct api_reply* reply, int status, struct json_object* obj) {
+    size_t len;
+    const char* json = json_object_to_json_string_length(obj, JSON_C_TO_STRING_PLAIN, &len);
+    reply->status = status;
+    reply->content_type = "application/json; charset=UTF-8";
+    reply->body.len = 0;
+    buffer_append(&reply->body, json, len);
+}
+
+/**
+ * 設定された割合でエラーを注入する関数
+ *
+ * @return エラーを注入した場合は1
+ */
+static int inject_fault(struct api_reply* reply) {
+    double x = random_unit();
+    if (x < g_options.rate_limit_rate) {
+        g_stats.injected_rate_limits++;
+        reply_error(reply, g_options.rate_limit_status, "rateLimitExceeded", "Rate Limit Exceeded");
+        reply->retry_after = g_options.retry_after;
+        return 1;
+    }
+    if (x < g_options.rate_limit_rate + g_options.error_rate) {
+        g_stats.injected_errors++;
+        reply_error(reply, g_options.error_status, "backendError", "Backend Error");
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * 新しいイベントIDを作る関数（Googleと同じく base32hex の小文字と数字だけを使う）
+ */
+static void new_event_id(char* out, size_t out_size) {
+    snprintf(out, out_size, "mock%08lx", ++g_next_event_id);
+}
+
+/**
+ * イベントリソースにサーバー側の項目を設定する関数
+ */
+static const char* json_string_member(struct json_object* obj, const char* key) {
+    struct json_object* value;
+    if (json_object_object_get_ex(obj, key, &value) && json_object_is_type(value, json_type_string)) {
+        return json_object_get_string(value);
+    }
+    return NULL;
+}
+
+/**
+ * タイムゾーンを切り替える関数（サーバーは1スレッドなので環境変数の TZ を書き換えてよい）
+ */
+static void use_time_zone(const char* zone) {
+    setenv("TZ", zone, 1);
+    tzset();
+}
+
+/**
+ * start / end の日時を API と同じように書き直す関数
+ * dateTime はカレンダーのタイムゾーンのオフセット付きにし、timeZone がなければカレンダーのものを補う。
+ * オフセットのない dateTime は、イベントの timeZone（なければカレンダーのもの）の壁時計として解釈する。
+ * 日付（date）はそのままにする。
+ */
+static void decorate_time(struct json_object* when) {
+    struct json_object* value;
+    if (!json_object_is_type(when, json_type_object) || !json_object_object_get_ex(when, "dateTime", &value) ||
+        !json_object_is_type(value, json_type_string)) {
+        return;
+    }
+    const char* text = json_object_get_string(value);
+    const char* event_zone = json_string_member(when, "timeZone");
+    long long t = mock_parse_time(text, LLONG_MIN);
+    if (t == LLONG_MIN) {
+        return;
+    }
+    const char* suffix = strlen(text) > 19 ? text + 19 : "";
+    while (*suffix == '.' || isdigit((unsigned char)*suffix)) {
+        suffix++;
+    }
+    if (*suffix == '\0') {
+        // mock_parse_time は UTC とみなしたので、壁時計の時刻として変換し直す
+        time_t wall = (time_t)t;
+        struct tm tm;
+        gmtime_r(&wall, &tm);
+        tm.tm_isdst = -1;
+        use_time_zone(event_zone ? event_zone : g_options.decorate);
+        t = (long long)mktime(&tm);
+    }
+
+    time_t instant = (time_t)t;
+    struct tm tm;
+    char buf[40];
+    use_time_zone(g_options.decorate);
+    localtime_r(&instant, &tm);
+    size_t len = strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", &tm);
+    long offset = tm.tm_gmtoff;
+    snprintf(buf + len, sizeof(buf) - len, "%c%02ld:%02ld", offset < 0 ? '-' : '+',
+             labs(offset) / 3600, labs(offset) / 60 % 60);
+    json_object_object_add(when, "dateTime", json_object_new_string(buf));
+    if (event_zone == NULL) {
+        json_object_object_add(when, "timeZone", json_object_new_string(g_options.decorate));
+    }
+}
+
+/**
+ * API が補う項目をイベントに加える関数（--decorate を指定した場合だけ）
+ */
+static void decorate_event(struct json_object* resource) {
+    struct json_object* when;
+    if (g_options.decorate == NULL) {
+        return;
+    }
+    if (!json_object_object_get_ex(resource, "reminders", NULL)) {
+        struct json_object* reminders = json_object_new_object();
+        json_object_object_add(reminders, "useDefault", json_object_new_boolean(1));
+        json_object_object_add(resource, "reminders", reminders);
+    }
+    if (!json_object_object_get_ex(resource, "eventType", NULL)) {
+        json_object_object_add(resource, "eventType", json_object_new_string("default"));
+    }
+    if (!json_object_object_get_ex(resource, "sequence", NULL)) {
+        json_object_object_add(resource, "sequence", json_object_new_int(0));
+    }
+    if (json_object_object_get_ex(resource, "start", &when)) {
+        decorate_time(when);
+    }
+    if (json_object_object_get_ex(resource, "end", &when)) {
+        decorate_time(when);
+    }
+}
+
+static void stamp_event(struct json_object* resource, const char* id, const char* ical_uid) {
+    char etag[32];
+    char updated[32];
+    time_t now = time(NULL);
+    struct tm tm;
+    gmtime_r(&now, &tm);
+    strftime(updated, sizeof(updated), "%Y-%m-%dT%H:%M:%S.000Z", &tm);
+    snprintf(etag, sizeof(etag), "\"%llu\"", ++g_change_seq);
+
+    json_object_object_add(resource, "kind", json_object_new_string("calendar#event"));
+    json_object_object_add(resource, "etag", json_object_new_string(etag));
+    json_object_object_add(resource, "id", json_object_new_string(id));
+    json_object_object_add(resource, "iCalUID", json_object_new_string(ical_uid));
+    json_object_object_add(resource, "updated", json_object_new_string(updated));
+    if (!json_object_object_get_ex(resource, "status", NULL)) {
+        json_object_object_add(resource, "status", json_object_new_string("confirmed"));
+    }
+    decorate_event(resource);
+}
+
+/**
+ * events.import / events.insert を処理する関数
+ *
+ * @param import import の場合は1（iCalUID が同じイベントを上書きする）
+ */
+static void handle_create(struct api_reply* reply, const char* calendar_id, const char* body, size_t body_len, int import) {
+    struct json_tokener* tok = json_tokener_new();
+    struct json_object* resource = tok ? json_tokener_parse_ex(tok, body, (int)body_len) : NULL;
+    int complete = tok && json_tokener_get_error(tok) == json_tokener_success;
+    json_tokener_free(tok);
+    if (!complete || !json_object_is_type(resource, json_type_object)) {
+        json_object_put(resource);
+        reply_error(reply, 400, "parseError", "Parse Error");
+        return;
+    }
+    if (!json_object_object_get_ex(resource, "start", NULL) || !json_object_object_get_ex(resource, "end", NULL)) {
+        json_object_put(resource);
+        reply_error(reply, 400, "required", "Missing end time.");
+        return;
+    }
+
+    char generated_id[32];
+    char generated_uid[64];
+    const char* ical_uid = json_string_member(resource, "iCalUID");
+    const char* id = json_string_member(resource, "id");
+    if (import && ical_uid == NULL) {
+        json_object_put(resource);
+        reply_error(reply, 400, "required", "Missing iCalUID.");
+        return;
+    }
+
+    struct mock_calendar* cal = g_options.store ? calendar_get(calendar_id) : NULL;
+    struct stored_event* existing = NULL;
+    if (cal && import) {
+        existing = event_map_find(&cal->by_uid, ical_uid);
+    } else if (cal && id) {
+        existing = event_map_find(&cal->by_id, id);
+        if (existing) {
+            json_object_put(resource);
+            reply_error(reply, 409, "duplicate", "The requested identifier already exists.");
+            return;
+        }
+    }
+
+    if (existing) {
+        id = existing->id;
+    } else if (id == NULL) {
+        new_event_id(generated_id, sizeof(generated_id));
+        id = generated_id;
+    }
+    if (ical_uid == NULL) {
+        snprintf(generated_uid, sizeof(generated_uid), "%s@google.com", id);
+        ical_uid = generated_uid;
+    }
+
+    // json_object_object_add で元の文字列が解放されるため、先に複製しておく
+    char* id_copy = strdup(id);
+    char* uid_copy = strdup(ical_uid);
+    stamp_event(resource, id_copy, uid_copy);
+    reply_json(reply, 200, resource);
+
+    if (cal == NULL) {
+        json_object_put(resource);
+    } else if (existing) {
+        json_object_put(existing->resource);
+        existing->resource = resource;
+        stored_event_set_times(existing);
+        existing->deleted = 0;
+        existing->updated_seq = g_change_seq;
+    } else {
+        calendar_add(cal, id_copy, uid_copy, resource)->updated_seq = g_change_seq;
+    }
+    free(id_copy);
+    free(uid_copy);
+}
+
+/**
+ * events.list を処理する関数
+ */
+static void handle_list(struct api_reply* reply, const char* calendar_id, const char* query, size_t query_len) {
+    char value[64];
+    size_t max_results = DEFAULT_PAGE_SIZE;
+    size_t start = 0;
+    if (form_value(query, query_len, "maxResults", value, sizeof(value))) {
+        max_results = strtoul(value, NULL, 10);
+        if (max_results == 0 || max_results > MAX_PAGE_SIZE) {
+            max_results = MAX_PAGE_SIZE;
+        }
+    }
+    if (form_value(query, query_len, "pageToken", value, sizeof(value))) {
+        start = strtoul(value, NULL, 10);
+    }
+    int show_deleted = form_value(query, query_len, "showDeleted", value, sizeof(value)) && strcmp(value, "true") == 0;
+
+    // 同期トークン（起動ごとの値-通し番号）以降に変更されたイベントだけを返す。削除されたイベントも含める
+    int incremental = form_value(query, query_len, "syncToken", value, sizeof(value));
+    unsigned long long since = 0;
+    if (incremental) {
+        char* end;
+        unsigned long epoch = strtoul(value, &end, 16);
+        if (epoch != g_sync_epoch || *end != '-') {
+            reply_error(reply, 410, "fullSyncRequired", "Sync token is no longer valid, a full sync is required.");
+            return;
+        }
+        since = strtoull(end + 1, NULL, 10);
+        show_deleted = 1;
+    }
+
+    // timeMin は終了時刻、timeMax は開始時刻の境界（どちらも含まない）
+    long long time_min = LLONG_MIN;
+    long long time_max = LLONG_MAX;
+    if (form_value(query, query_len, "timeMin", value, sizeof(value))) {
+        time_min = mock_parse_time(value, LLONG_MIN);
+    }
+    if (form_value(query, query_len, "timeMax", value, sizeof(value))) {
+        time_max = mock_parse_time(value, LLONG_MAX);
+    }
+
+    struct mock_calendar* cal = g_options.store ? calendar_get(calendar_id) : NULL;
+    size_t count = cal ? cal->count : 0;
+    reply->status = 200;
+    reply->content_type = "application/json; charset=UTF-8";
+    reply->body.len = 0;
+    struct json_object* summary = json_object_new_string(calendar_id);
+    buffer_appendf(&reply->body, "{\"kind\":\"calendar#events\",\"summary\":%s,\"items\":[",
+                   json_object_to_json_string(summary));
+    json_object_put(summary);
+
+    size_t i = start;
+    size_t listed = 0;
+    for (; i < count && listed < max_results; i++) {
+        const struct stored_event* event = cal->events[i];
+        if ((event->deleted && !show_deleted) || event->updated_seq <= since ||
+            event->end_time <= time_min || event->start_time >= time_max) {
+            continue;
+        }
+        size_t len;
+        const char* json = json_object_to_json_string_length(event->resource, JSON_C_TO_STRING_PLAIN, &len);
+        if (listed++ > 0) {
+            buffer_append(&reply->body, ",", 1);
+        }
+        buffer_append(&reply->body, json, len);
+    }
+    buffer_append(&reply->body, "]", 1);
+    if (i < count) {
+        buffer_appendf(&reply->body, ",\"nextPageToken\":\"%zu\"", i);
+    } else {
+        buffer_appendf(&reply->body, ",\"nextSyncToken\":\"%lx-%llu\"", g_sync_epoch, g_change_seq);
+    }
+    buffer_append(&reply->body, "}", 1);
+}
+
+/**
+ * events.get / events.patch / events.delete を処理する関数
+ */
+static void handle_event(struct api_reply* reply, const char* method, const char* calendar_id, const char* event_id,
+                         const char* body, size_t body_len) {
+    struct mock_calendar* cal = g_options.store ? calendar_get(calendar_id) : NULL;
+    struct stored_event* event = cal ? event_map_find(&cal->by_id, event_id) : NULL;
+    if (event == NULL) {
+        reply_error(reply, 404, "notFound", "Not Found");
+        return;
+    }
+
+    if (strcmp(method, "GET") == 0) {
+        reply_json(reply, 200, event->resource);
+    } else if (strcmp(method, "DELETE") == 0) {
+        if (event->deleted) {
+            reply_error(reply, 410, "deleted", "Resource has been deleted");
+            return;
+        }
+        event->deleted = 1;
+        json_object_object_add(event->resource, "status", json_object_new_string("cancelled"));
+        stamp_event(event->resource, event->id, event->ical_uid);
+        event->updated_seq = g_change_seq;
+        reply->status = 204;
+        reply->content_type = NULL;
+        reply->body.len = 0;
+    } else if (strcmp(method, "PATCH") == 0) {
+        struct json_object* patch = json_tokener_parse(body_len ? body : "null");
+        if (!json_object_is_type(patch, json_type_object)) {
+            json_object_put(patch);
+            reply_error(reply, 400, "parseError", "Parse Error");
+            return;
+        }
+        json_object_object_foreach(patch, key, value) {
+            if (strcmp(key, "id") != 0 && strcmp(key, "iCalUID") != 0) {
+                json_object_object_add(event->resource, key, json_object_get(value));
+            }
+        }
+        json_object_put(patch);
+        stored_event_set_times(event);
+        event->deleted = 0;
+        stamp_event(event->resource, event->id, event->ical_uid);
+        event->updated_seq = g_change_seq;
+        reply_json(reply, 200, event->resource);
+    } else {
+        reply_error(reply, 405, "methodNotAllowed", "Method Not Allowed");
+    }
+}
+
+/**
+ * Calendar API の1件の呼び出しを処理する関数（バッチ内の各リクエストにも使う）
+ *
+ * @param authorization Authorization ヘッダーの値（ない場合はNULL）
+ */
+static void handle_api(struct api_reply* reply, const char* method, const char* target, size_t target_len,
+                       const char* authorization, const char* body, size_t body_len) {
+    g_stats.api_calls++;
+    reply->retry_after = 0;
+
+    if (authorization == NULL || strncmp(authorization, "Bearer ", 7) != 0 || authorization[7] == '\0') {
+        reply_error(reply, 401, "authError", "Invalid Credentials");
+        return;
+    }
+    if (inject_fault(reply)) {
+        return;
+    }
+
+    const char* query = memchr(target, '?', target_len);
+    size_t path_len = query ? (size_t)(query - target) : target_len;
+    size_t query_len = query ? target_len - path_len - 1 : 0;
+    query = query ? query + 1 : "";
+
+    // パスを .../calendars/{calendarId}/events[/{eventId} | /import] に分解する
+    const char* cal = memmem(target, path_len, "/calendars/", 11);
+    if (cal == NULL) {
+        reply_error(reply, 404, "notFound", "Not Found");
+        return;
+    }
+    cal += 11;
+    const char* path_end = target + path_len;
+    const char* slash = memchr(cal, '/', path_end - cal);
+    if (slash == NULL || (size_t)(path_end - slash) < 7 || strncmp(slash, "/events", 7) != 0) {
+        reply_error(reply, 404, "notFound", "Not Found");
+        return;
+    }
+    char calendar_id[512];
+    char event_id[1024];
+    url_decode(cal, slash - cal, calendar_id, sizeof(calendar_id));
+    const char* rest = slash + 7;
+    size_t rest_len = path_end - rest;
+
+    if (rest_len == 0 && strcmp(method, "POST") == 0) {
+        handle_create(reply, calendar_id, body, body_len, 0);
+    } else if (rest_len == 0 && strcmp(method, "GET") == 0) {
+        handle_list(reply, calendar_id, query, query_len);
+    } else if (rest_len == 7 && strncmp(rest, "/import", 7) == 0) {
+        if (strcmp(method, "POST") == 0) {
+            handle_create(reply, calendar_id, body, body_len, 1);
+        } else {
+            reply_error(reply, 405, "methodNotAllowed", "Method Not Allowed");
+        }
+    } else if (rest_len > 1 && rest[0] == '/' && memchr(rest + 1, '/', rest_len - 1) == NULL) {
+        url_decode(rest + 1, rest_len - 1, event_id, sizeof(event_id));
+        handle_event(reply, method, calendar_id, event_id, body, body_len);
+    } else {
+        reply_error(reply, 404, "notFound", "Not Found");
+    }
+}
+
+/**
+ * トークンエンドポイントを処理する関数
+ */
+static void handle_token(struct api_reply* reply, const char* body, size_t body_len) {
+    char grant_type[64];
+    char client_id[256];
+    g_stats.tokens++;
+
+    if (!form_value(body, body_len, "client_id", client_id, sizeof(client_id)) || client_id[0] == '\0') {
+        reply->status = 401;
+        reply->content_type = "application/json";
+        reply->body.len = 0;
+        buffer_appendf(&reply->body, "{\"error\":\"invalid_client\",\"error_description\":\"The OAuth client was not found.\"}");
+        return;
+    }
+    if (!form_value(body, body_len, "grant_type", grant_type, sizeof(grant_type)) ||
+        (strcmp(grant_type, "authorization_code") != 0 && strcmp(grant_type, "refresh_token") != 0)) {
+        reply->status = 400;
+        reply->content_type = "application/json";
+        reply->body.len = 0;
+        buffer_appendf(&reply->body, "{\"error\":\"unsupported_grant_type\",\"error_description\":\"Invalid grant_type\"}");
+        return;
+    }
+
+    reply->status = 200;
+    reply->content_type = "application/json; charset=utf-8";
+    reply->body.len = 0;
+    buffer_appendf(&reply->body, "{\"access_token\":\"mock-access-%lu\",\"expires_in\":%ld,", ++g_next_token, g_options.token_ttl);
+    if (strcmp(grant_type, "authorization_code") == 0) {
+        buffer_appendf(&reply->body, "\"refresh_token\":\"mock-refresh-%lu\",", g_next_token);
+    }
+    buffer_appendf(&reply->body, "\"scope\":\"https://www.googleapis.com/auth/calendar.events\",\"token_type\":\"Bearer\"}");
+}
+
+/**
+ * HTTPリクエストのヘッダーから値を取り出す関数
+ *
+ * @return 値の先頭（見つからない場合はNULL）。*len に値の長さを設定する
+ */
+static const char* header_value(const char* headers, size_t headers_len, const char* name, size_t* len) {
+    size_t name_len = strlen(name);
+    const char* p = headers;
+    const char* end = headers + headers_len;
+    while (p < end) {
+        const char* eol = memchr(p, '\n', end - p);
+        const char* line_end = eol ? eol : end;
+        if ((size_t)(line_end - p) > name_len && strncasecmp(p, name, name_len) == 0 && p[name_len] == ':') {
+            const char* v = p + name_len + 1;
+            while (v < line_end && (*v == ' ' || *v == '\t')) {
+                v++;
+            }
+            const char* v_end = line_end;
+            while (v_end > v && (v_end[-1] == '\r' || v_end[-1] == ' ')) {
+                v_end--;
+            }
+            *len = v_end - v;
+            return v;
+        }
+        p = line_end + 1;
+    }
+    return NULL;
+}
+
+/**
+ * 埋め込まれたHTTPレスポンスを1パート分書き出す関数
+ */
+static void batch_append_part(struct buffer* out, const char* boundary, const char* content_id, size_t content_id_len,
+                              const struct api_reply* reply) {
+    buffer_appendf(out, "--%s\r\nContent-Type: application/http\r\n", boundary);
+    if (content_id) {
+        // Content-ID: <item-N> には Content-ID: <response-item-N> で応える
+        const char* id = content_id;
+        size_t id_len = content_id_len;
+        if (id_len >= 2 && id[0] == '<' && id[id_len - 1] == '>') {
+            id++;
+            id_len -= 2;
+        }
+        buffer_appendf(out, "Content-ID: <response-%.*s>\r\n", (int)id_len, id);
+    }
+    buffer_appendf(out, "\r\nHTTP/1.1 %d %s\r\n", reply->status, status_text(reply->status));
+    if (reply->content_type) {
+        buffer_appendf(out, "Content-Type: %s\r\n", reply->content_type);
+    }
+    if (reply->retry_after > 0) {
+        buffer_appendf(out, "Retry-After: %ld\r\n", reply->retry_after);
+    }
+    buffer_appendf(out, "Content-Length: %zu\r\n\r\n", reply->body.len);
+    buffer_append(out, reply->body.data ? reply->body.data : "", reply->body.len);
+    buffer_append(out, "\r\n", 2);
+}
+
+/**
+ * バッチリクエストを処理する関数
+ */
+static void handle_batch(struct api_reply* reply, const char* content_type, size_t content_type_len,
+                         const char* authorization, const char* body, size_t body_len) {
+    g_stats.batches++;
+    const char* b = content_type ? memmem(content_type, content_type_len, "boundary=", 9) : NULL;
+    if (b == NULL) {
+        reply_error(reply, 400, "badRequest", "Missing multipart boundary");
+        return;
+    }
+    b += 9;
+    const char* b_end = content_type + content_type_len;
+    if (b < b_end && *b == '"') {
+        b++;
+    }
+    char delimiter[256];
+    size_t boundary_len = 0;
+    while (b + boundary_len < b_end && !strchr("\";, \t", b[boundary_len])) {
+        boundary_len++;
+    }
+    if (boundary_len == 0 || boundary_len + 3 > sizeof(delimiter)) {
+        reply_error(reply, 400, "badRequest", "Invalid multipart boundary");
+        return;
+    }
+    int delimiter_len = snprintf(delimiter, sizeof(delimiter), "--%.*s", (int)boundary_len, b);
+
+    struct buffer out = {0};
+    struct api_reply part_reply = {0};
+    const char* response_boundary = "batch_mock_response";
+    const char* end = body + body_len;
+    const char* p = memmem(body, body_len, delimiter, delimiter_len);
+    int parts = 0;
+    while (p != NULL) {
+        p += delimiter_len;
+        if (end - p >= 2 && p[0] == '-' && p[1] == '-') {
+            break;
+        }
+        const char* part_end = memmem(p, end - p, delimiter, delimiter_len);
+        if (part_end == NULL) {
+            part_end = end;
+        }
+        if (++parts > MAX_BATCH_PARTS) {
+            free(out.data);
+            free(part_reply.body.data);
+            reply_error(reply, 400, "badRequest", "Too many requests in batch");
+            return;
+        }
+
+        // パートのヘッダー、埋め込まれたリクエストの行・ヘッダー・本文の順に並ぶ
+        const char* part_headers = memmem(p, part_end - p, "\r\n\r\n", 4);
+        const char* inner = part_headers ? part_headers + 4 : part_end;
+        size_t content_id_len = 0;
+        const char* content_id = part_headers ? header_value(p, part_headers - p, "Content-ID", &content_id_len) : NULL;
+
+        const char* inner_headers_end = memmem(inner, part_end - inner, "\r\n\r\n", 4);
+        const char* inner_body = inner_headers_end ? inner_headers_end + 4 : part_end;
+        const char* inner_body_end = part_end;
+        while (inner_body_end > inner_body && (inner_body_end[-1] == '\r' || inner_body_end[-1] == '\n')) {
+            inner_body_end--;
+        }
+        const char* request_line_end = memchr(inner, '\r', part_end - inner);
+        const char* sp = request_line_end ? memchr(inner, ' ', request_line_end - inner) : NULL;
+        if (sp == NULL || sp - inner >= 16) {
+            reply_error(&part_reply, 400, "badRequest", "Invalid embedded request");
+        } else {
+            char method[16];
+            memcpy(method, inner, sp - inner);
+            method[sp - inner] = '\0';
+            const char* target = sp + 1;
+            const char* target_end = memchr(target, ' ', request_line_end - target);
+            if (target_end == NULL) {
+                target_end = request_line_end;
+            }
+            handle_api(&part_reply, method, target, target_end - target, authorization,
+                       inner_body, inner_body_end - inner_body);
+        }
+        if (part_reply.status >= 200 && part_reply.status < 300) {
+            g_stats.status_2xx++;
+        } else if (part_reply.status < 500) {
+            g_stats.status_4xx++;
+        } else {
+            g_stats.status_5xx++;
+        }
+        batch_append_part(&out, response_boundary, content_id, content_id_len, &part_reply);
+        p = part_end < end ? part_end : NULL;
+    }
+    buffer_appendf(&out, "--%s--\r\n", response_boundary);
+    free(part_reply.body.data);
+
+    free(reply->body.data);
+    reply->body = out;
+    reply->status = 200;
+    reply->retry_after = 0;
+    reply->content_type = "multipart/mixed; boundary=batch_mock_response";
+}
+
+/**
+ * 遅延させて送るレスポンス
+ */
+struct delayed_reply {
+    long long due_ms;
+    int fd;
+    unsigned long serial;           // 接続を識別する番号（遅延中に接続が入れ替わった場合に捨てる）
+    uint32_t stream_id;             // HTTP/2 のストリーム（HTTP/1.1 の場合は0）
+    struct buffer head;             // HTTP/2 のヘッダーブロック（HTTP/1.1 では data にレスポンス全体を入れる）
+    struct buffer data;
+};
+
+/**
+ * 遅延レスポンスの二分ヒープ（due_ms が最小のものが先頭）
+ */
+static struct {
+    struct delayed_reply* items;
+    size_t count;
+    size_t cap;
+} g_timers;
+
+static void timer_swap(size_t a, size_t b) {
+    struct delayed_reply tmp = g_timers.items[a];
+    g_timers.items[a] = g_timers.items[b];
+    g_timers.items[b] = tmp;
+}
+
+static void timer_push(const struct delayed_reply* item) {
+    if (g_timers.count == g_timers.cap) {
+        g_timers.cap = g_timers.cap ? g_timers.cap * 2 : 256;
+        g_timers.items = realloc(g_timers.items, g_timers.cap * sizeof(*g_timers.items));
+        if (!g_timers.items) {
+            fprintf(stderr, "エラー: メモリ割り当てに失敗しました\n");
+            exit(1);
+        }
+    }
+    size_t i = g_timers.count++;
+    g_timers.items[i] = *item;
+    while (i > 0 && g_timers.items[(i - 1) / 2].due_ms > g_timers.items[i].due_ms) {
+        timer_swap(i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static struct delayed_reply timer_pop(void) {
+    struct delayed_reply top = g_timers.items[0];
+    g_timers.items[0] = g_timers.items[--g_timers.count];
+    size_t i = 0;
+    for (;;) {
+        size_t smallest = i;
+        size_t l = 2 * i + 1, r = 2 * i + 2;
+        if (l < g_timers.count && g_timers.items[l].due_ms < g_timers.items[smallest].due_ms) {
+            smallest = l;
+        }
+        if (r < g_timers.count && g_timers.items[r].due_ms < g_timers.items[smallest].due_ms) {
+            smallest = r;
+        }
+        if (smallest == i) {
+            break;
+        }
+        timer_swap(i, smallest);
+        i = smallest;
+    }
+    return top;
+}
+
+struct h2_connection;
+
+/**
+ * クライアントとの接続
+ * HTTP/1.1 のパイプラインでは応答の順序を守る必要があるため、
+ * 応答を遅延させている間は次のリクエストを処理しない（HTTP/2 ではストリームごとに独立して応答する）
+ */
+struct connection {
+    int fd;
+    unsigned long serial;
+    struct buffer in;
+    struct buffer out;
+    size_t out_sent;
+    int waiting;                    // 遅延中のレスポンスの数（HTTP/1.1 では0か1）
+    int close_after;                // 送信し終えたら閉じるか
+    int sent_continue;              // 現在のリクエストに 100 Continue を送ったか
+    int writable_armed;             // EPOLLOUT を監視しているか
+    struct h2_connection* h2;       // HTTP/2 の接続状態（HTTP/1.1 の場合はNULL）
+};
+
+static struct connection** g_connections;
+static size_t g_connection_cap;
+static unsigned long g_connection_serial;
+static int g_epoll_fd;
+static long g_inflight;
+
+static void h2_connection_free(struct h2_connection* h2);
+
+static void connection_close(struct connection* conn) {
+    epoll_ctl(g_epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    g_connections[conn->fd] = NULL;
+    g_inflight -= conn->waiting;
+    if (conn->h2) {
+        h2_connection_free(conn->h2);
+    }
+    free(conn->in.data);
+    free(conn->out.data);
+    free(conn);
+}
+
+/**
+ * 送信バッファの内容を書き出す関数
+ *
+ * @return 接続を閉じた場合は-1、それ以外は0
+ */
+static int connection_flush(struct connection* conn) {
+    while (conn->out_sent < conn->out.len) {
+        ssize_t n = send(conn->fd, conn->out.data + conn->out_sent, conn->out.len - conn->out_sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            connection_close(conn);
+            return -1;
+        }
+        conn->out_sent += n;
+    }
+    if (conn->out_sent == conn->out.len) {
+        conn->out.len = 0;
+        conn->out_sent = 0;
+        if (conn->close_after && !conn->waiting) {
+            connection_close(conn);
+            return -1;
+        }
+    }
+
+    int want_write = conn->out.len > 0;
+    if (want_write != conn->writable_armed) {
+        struct epoll_event ev = { .events = EPOLLIN | EPOLLRDHUP | (want_write ? EPOLLOUT : 0), .data.fd = conn->fd };
+        epoll_ctl(g_epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev);
+        conn->writable_armed = want_write;
+    }
+    return 0;
+}
+
+/**
+ * レスポンス全体（ステータス行・ヘッダー・本文）を作成する関数
+ */
+static void build_response(struct buffer* out, const struct api_reply* reply, int close_after) {
+    buffer_appendf(out, "HTTP/1.1 %d %s\r\n", reply->status, status_text(reply->status));
+    if (reply->content_type) {
+        buffer_appendf(out, "Content-Type: %s\r\n", reply->content_type);
+    }
+    if (reply->retry_after > 0) {
+        buffer_appendf(out, "Retry-After: %ld\r\n", reply->retry_after);
+    }
+    if (close_after) {
+        buffer_appendf(out, "Connection: close\r\n");
+    }
+    buffer_appendf(out, "Content-Length: %zu\r\n\r\n", reply->body.len);
+    buffer_append(out, reply->body.data ? reply->body.data : "", reply->body.len);
+}
+
+static void count_status(int status) {
+    if (status >= 200 && status < 300) {
+        g_stats.status_2xx++;
+    } else if (status < 500) {
+        g_stats.status_4xx++;
+    } else {
+        g_stats.status_5xx++;
+    }
+}
+
+/**
+ * 応答の遅延時間を決める関数
+ */
+static long reply_delay_ms(void) {
+    long delay = g_options.latency_ms;
+    if (g_options.jitter_ms > 0) {
+        delay += (long)(random_unit() * g_options.jitter_ms);
+    }
+    if (g_options.slow_rate > 0 && random_unit() < g_options.slow_rate) {
+        delay += g_options.slow_ms;
+    }
+    return delay;
+}
+
+/**
+ * 1件のHTTPリクエストを処理する関数（HTTP/1.1 と HTTP/2 で共通）
+ *
+ * @param authorization Authorization ヘッダーの値（ない場合はNULL）
+ * @return APIの呼び出しだった場合は1（応答を遅延させる対象）、それ以外は0
+ */
+static int handle_request(struct api_reply* reply, const char* method, const char* target, size_t target_len,
+                          const char* authorization, const char* content_type, size_t content_type_len,
+                          const char* body, size_t body_len) {
+    g_stats.requests++;
+    reply->retry_after = 0;
+    int is_api = 0;
+    if (target_len >= 6 && strncmp(target, "/token", 6) == 0 && strcmp(method, "POST") == 0) {
+        handle_token(reply, body, body_len);
+    } else if (strcmp(method, "GET") == 0 && target_len >= 5 &&
+               (memmem(target, target_len, "/auth?", 6) || strncmp(target + target_len - 5, "/auth", 5) == 0)) {
+        reply->status = 200;
+        reply->content_type = "text/plain; charset=utf-8";
+        reply->body.len = 0;
+        buffer_appendf(&reply->body, "模擬サーバーの認証コード: mock-auth-code\n");
+    } else if (g_options.max_inflight > 0 && g_inflight >= g_options.max_inflight) {
+        g_stats.inflight_rejects++;
+        reply_error(reply, g_options.rate_limit_status, "rateLimitExceeded", "Rate Limit Exceeded");
+        reply->retry_after = g_options.retry_after;
+        count_status(reply->status);
+    } else if (target_len >= 7 && strncmp(target, "/batch/", 7) == 0 && strcmp(method, "POST") == 0) {
+        handle_batch(reply, content_type, content_type_len, authorization, body, body_len);
+        is_api = 1;
+    } else {
+        handle_api(reply, method, target, target_len, authorization, body, body_len);
+        count_status(reply->status);
+        is_api = 1;
+    }
+    return is_api;
+}
+
+/**
+ * HPACK の静的テーブル（RFC 7541 付録A、インデックス1〜61）
+ */
+static const char* const hpack_static_table[61][2] = {
+    {":authority", ""}, {":method", "GET"}, {":method", "POST"}, {":path", "/"}, {":path", "/index.html"},
+    {":scheme", "http"}, {":scheme", "https"}, {":status", "200"}, {":status", "204"}, {":status", "206"},
+    {":status", "304"}, {":status", "400"}, {":status", "404"}, {":status", "500"}, {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"}, {"accept-language", ""}, {"accept-ranges", ""}, {"accept", ""},
+    {"access-control-allow-origin", ""}, {"age", ""}, {"allow", ""}, {"authorization", ""}, {"cache-control", ""},
+    {"content-disposition", ""}, {"content-encoding", ""}, {"content-language", ""}, {"content-length", ""},
+    {"content-location", ""}, {"content-range", ""}, {"content-type", ""}, {"cookie", ""}, {"date", ""},
+    {"etag", ""}, {"expect", ""}, {"expires", ""}, {"from", ""}, {"host", ""}, {"if-match", ""},
+    {"if-modified-since", ""}, {"if-none-match", ""}, {"if-range", ""}, {"if-unmodified-since", ""},
+    {"last-modified", ""}, {"link", ""}, {"location", ""}, {"max-forwards", ""}, {"proxy-authenticate", ""},
+    {"proxy-authorization", ""}, {"range", ""}, {"referer", ""}, {"refresh", ""}, {"retry-after", ""},
+    {"server", ""}, {"set-cookie", ""}, {"strict-transport-security", ""}, {"transfer-encoding", ""},
+    {"user-agent", ""}, {"vary", ""}, {"via", ""}, {"www-authenticate", ""},
+};
+
+#define HPACK_STATUS 8
+#define HPACK_CONTENT_LENGTH 28
+#define HPACK_CONTENT_TYPE 31
+#define HPACK_RETRY_AFTER 53
+
+/**
+ * HPACK のハフマン符号の各記号の符号長（RFC 7541 付録B）
+ * 正準ハフマン符号なので、符号そのものは長さから復元できる（記号256の EOS は30ビットのすべて1）
+ */
+static const unsigned char hpack_huffman_bits[256] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+    6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+};
+
+/**
+ * 正準ハフマン符号の復号表（符号長ごとの最初の符号と記号の並び）
+ */
+static struct {
+    int ready;
+    unsigned first[31];
+    unsigned count[31];
+    unsigned offset[31];
+    unsigned short symbols[257];    // (符号長, 記号) の順に並べた記号
+} g_huffman;
+
+static void huffman_init(void) {
+    unsigned n = 0;
+    for (unsigned len = 1; len <= 30; len++) {
+        g_huffman.offset[len] = n;
+        for (unsigned sym = 0; sym <= 256; sym++) {
+            if ((sym < 256 ? hpack_huffman_bits[sym] : 30) == len) {
+                g_huffman.symbols[n++] = (unsigned short)sym;
+            }
+        }
+        g_huffman.count[len] = n - g_huffman.offset[len];
+    }
+    unsigned code = 0;
+    for (unsigned len = 1; len <= 30; len++) {
+        g_huffman.first[len] = code;
+        code = (code + g_huffman.count[len]) << 1;
+    }
+    g_huffman.ready = 1;
+}
+
+/**
+ * ハフマン符号化された文字列を復号する関数
+ *
+ * @return 成功時は0、不正な符号の場合は-1
+ */
+static int huffman_decode(const unsigned char* src, size_t len, struct buffer* out) {
+    if (!g_huffman.ready) {
+        huffman_init();
+    }
+    unsigned code = 0;
+    unsigned bits = 0;
+    for (size_t i = 0; i < len; i++) {
+        for (int b = 7; b >= 0; b--) {
+            code = (code << 1) | ((src[i] >> b) & 1);
+            if (++bits > 30) {
+                return -1;
+            }
+            if (code >= g_huffman.first[bits] && code - g_huffman.first[bits] < g_huffman.count[bits]) {
+                unsigned sym = g_huffman.symbols[g_huffman.offset[bits] + code - g_huffman.first[bits]];
+                if (sym == 256) {
+                    return -1;  // EOS は文字列の中に現れてはいけない
+                }
+                char c = (char)sym;
+                buffer_append(out, &c, 1);
+                code = 0;
+                bits = 0;
+            }
+        }
+    }
+    // 残りは EOS の先頭（すべて1）で、7ビット以下の詰め物でなければならない
+    return (bits <= 7 && code == (1u << bits) - 1) ? 0 : -1;
+}
+
+/**
+ * HPACK の整数（先頭バイトの下位 prefix_bits ビットから始まる可変長）を読む関数
+ */
+static int hpack_read_int(const unsigned char** p, const unsigned char* end, int prefix_bits, size_t* value) {
+    if (*p >= end) {
+        return -1;
+    }
+    size_t max = (1u << prefix_bits) - 1;
+    size_t v = *(*p)++ & max;
+    if (v == max) {
+        int shift = 0;
+        unsigned char c;
+        do {
+            if (*p >= end || shift > 28) {
+                return -1;
+            }
+            c = *(*p)++;
+            v += (size_t)(c & 0x7f) << shift;
+            shift += 7;
+        } while (c & 0x80);
+    }
+    *value = v;
+    return 0;
+}
+
+static int hpack_read_string(const unsigned char** p, const unsigned char* end, struct buffer* out) {
+    if (*p >= end) {
+        return -1;
+    }
+    int huffman = **p & 0x80;
+    size_t len;
+    if (hpack_read_int(p, end, 7, &len) != 0 || len > (size_t)(end - *p)) {
+        return -1;
+    }
+    out->len = 0;
+    buffer_reserve(out, len + 1);
+    if (huffman) {
+        if (huffman_decode(*p, len, out) != 0) {
+            return -1;
+        }
+    } else {
+        buffer_append(out, (const char*)*p, len);
+    }
+    out->data[out->len] = '\0';
+    *p += len;
+    return 0;
+}
+
+static void hpack_write_int(struct buffer* out, unsigned char first, int prefix_bits, size_t value) {
+    size_t max = (1u << prefix_bits) - 1;
+    char c;
+    if (value < max) {
+        c = (char)(first | value);
+        buffer_append(out, &c, 1);
+        return;
+    }
+    c = (char)(first | max);
+    buffer_append(out, &c, 1);
+    for (value -= max; value >= 128; value >>= 7) {
+        c = (char)(0x80 | (value & 0x7f));
+        buffer_append(out, &c, 1);
+    }
+    c = (char)value;
+    buffer_append(out, &c, 1);
+}
+
+/**
+ * 名前を静的テーブルの索引で表し、値をそのまま書くヘッダーを追加する関数（動的テーブルには登録しない）
+ */
+static void hpack_write_header(struct buffer* out, size_t name_index, const char* value) {
+    size_t len = strlen(value);
+    hpack_write_int(out, 0x00, 4, name_index);
+    hpack_write_int(out, 0x00, 7, len);
+    buffer_append(out, value, len);
+}
+
+/**
+ * HPACK の動的テーブル（entries[count - 1] が最新でインデックス62にあたる）
+ */
+struct hpack_entry {
+    char* name;
+    char* value;
+    size_t name_len;
+    size_t value_len;
+};
+
+struct hpack_table {
+    struct hpack_entry* entries;
+    size_t count;
+    size_t cap;
+    size_t size;                    // RFC 7541 4.1 の大きさ（名前 + 値 + 32 の合計）
+    size_t max_size;
+};
+
+static void hpack_evict(struct hpack_table* table, size_t limit) {
+    size_t drop = 0;
+    while (table->size > limit && drop < table->count) {
+        struct hpack_entry* e = &table->entries[drop++];
+        table->size -= e->name_len + e->value_len + 32;
+        free(e->name);
+        free(e->value);
+    }
+    memmove(table->entries, table->entries + drop, (table->count - drop) * sizeof(*table->entries));
+    table->count -= drop;
+}
+
+static void hpack_add(struct hpack_table* table, const char* name, size_t name_len, const char* value, size_t value_len) {
+    size_t size = name_len + value_len + 32;
+    if (size > table->max_size) {
+        hpack_evict(table, 0);
+        return;
+    }
+    hpack_evict(table, table->max_size - size);
+    if (table->count == table->cap) {
+        table->cap = table->cap ? table->cap * 2 : 32;
+        table->entries = realloc(table->entries, table->cap * sizeof(*table->entries));
+    }
+    struct hpack_entry* e = &table->entries[table->count];
+    e->name = malloc(name_len + 1);
+    e->value = malloc(value_len + 1);
+    if (!table->entries || !e->name || !e->value) {
+        fprintf(stderr, "エラー: メモリ割り当てに失敗しました\n");
+        exit(1);
+    }
+    memcpy(e->name, name, name_len);
+    e->name[name_len] = '\0';
+    memcpy(e->value, value, value_len);
+    e->value[value_len] = '\0';
+    e->name_len = name_len;
+    e->value_len = value_len;
+    table->count++;
+    table->size += size;
+}
+
+static int hpack_lookup(const struct hpack_table* table, size_t index, const char** name, size_t* name_len,
+                        const char** value, size_t* value_len) {
+    if (index >= 1 && index <= 61) {
+        *name = hpack_static_table[index - 1][0];
+        *value = hpack_static_table[index - 1][1];
+        *name_len = strlen(*name);
+        *value_len = strlen(*value);
+        return 0;
+    }
+    if (index < 62 || index - 62 >= table->count) {
+        return -1;
+    }
+    const struct hpack_entry* e = &table->entries[table->count - 1 - (index - 62)];
+    *name = e->name;
+    *name_len = e->name_len;
+    *value = e->value;
+    *value_len = e->value_len;
+    return 0;
+}
+
+/**
+ * HTTP/2 のストリーム（1件のリクエストと応答）
+ */
+struct h2_stream {
+    uint32_t id;
+    char method[16];
+    char authorization[4096];
+    char content_type[256];
+    struct buffer target;
+    struct buffer body;
+    int dispatched;                 // リクエストを受け取り終えて処理したか
+    int responding;                 // 応答のヘッダーを送ったか
+    long send_window;               // このストリームで送れる残りのバイト数
+    long received;                  // まだ WINDOW_UPDATE で補充していないこのストリームの受信量
+    struct buffer pending;          // 送信ウィンドウが足りず送れていない応答本文
+    size_t pending_sent;
+    struct h2_stream* next;
+};
+
+/**
+ * HTTP/2 の接続状態
+ */
+struct h2_connection {
+    struct hpack_table table;
+    struct h2_stream* streams;
+    size_t stream_count;
+    uint32_t last_stream;           // 最後に開かれたストリーム
+    int expect_preface;             // Upgrade の後でクライアントの接続プリフェースを待っているか
+    long send_window;               // 接続全体で送れる残りのバイト数
+    long initial_window;            // クライアントの SETTINGS_INITIAL_WINDOW_SIZE
+    size_t max_frame;               // クライアントの SETTINGS_MAX_FRAME_SIZE
+    long received;                  // まだ WINDOW_UPDATE で補充していない受信量
+    uint32_t header_stream;         // CONTINUATION を待っているストリーム（0はなし）
+    int header_end_stream;          // 待っているヘッダーブロックが END_STREAM 付きか
+    struct buffer header_block;
+    struct buffer name;             // ヘッダーの復号に使う作業領域
+    struct buffer value;
+};
+
+static void h2_stream_free(struct h2_stream* stream) {
+    free(stream->target.data);
+    free(stream->body.data);
+    free(stream->pending.data);
+    free(stream);
+}
+
+static void h2_connection_free(struct h2_connection* h2) {
+    while (h2->streams) {
+        struct h2_stream* next = h2->streams->next;
+        h2_stream_free(h2->streams);
+        h2->streams = next;
+    }
+    hpack_evict(&h2->table, 0);
+    free(h2->table.entries);
+    free(h2->header_block.data);
+    free(h2->name.data);
+    free(h2->value.data);
+    free(h2);
+}
+
+static struct h2_stream* h2_stream_find(struct h2_connection* h2, uint32_t id) {
+    for (struct h2_stream* s = h2->streams; s; s = s->next) {
+        if (s->id == id) {
+            return s;
+        }
+    }
+    return NULL;
+}
+
+static void h2_stream_remove(struct h2_connection* h2, struct h2_stream* stream) {
+    for (struct h2_stream** link = &h2->streams; *link; link = &(*link)->next) {
+        if (*link == stream) {
+            *link = stream->next;
+            h2->stream_count--;
+            h2_stream_free(stream);
+            return;
+        }
+    }
+}
+
+static void h2_frame(struct buffer* out, int type, int flags, uint32_t stream_id, const void* payload, size_t len) {
+    unsigned char head[H2_FRAME_HEADER_SIZE] = {
+        (unsigned char)(len >> 16), (unsigned char)(len >> 8), (unsigned char)len, (unsigned char)type,
+        (unsigned char)flags, (unsigned char)((stream_id >> 24) & 0x7f), (unsigned char)(stream_id >> 16),
+        (unsigned char)(stream_id >> 8), (unsigned char)stream_id,
+    };
+    buffer_append(out, (const char*)head, sizeof(head));
+    if (len > 0) {
+        buffer_append(out, payload, len);
+    }
+}
+
+static void h2_window_update(struct buffer* out, uint32_t stream_id, unsigned long increment) {
+    unsigned char payload[4] = { (unsigned char)((increment >> 24) & 0x7f), (unsigned char)(increment >> 16),
+                                 (unsigned char)(increment >> 8), (unsigned char)increment };
+    h2_frame(out, H2_WINDOW_UPDATE, 0, stream_id, payload, sizeof(payload));
+    g_stats.h2_window_updates_sent++;
+}
+
+/**
+ * 接続の最初にサーバーの SETTINGS を送り、HTTP/2 の状態を用意する関数
+ */
+static void h2_start(struct connection* conn) {
+    struct h2_connection* h2 = calloc(1, sizeof(*h2));
+    if (!h2) {
+        fprintf(stderr, "エラー: メモリ割り当てに失敗しました\n");
+        exit(1);
+    }
+    h2->table.max_size = HPACK_TABLE_SIZE;
+    h2->send_window = H2_DEFAULT_WINDOW;
+    h2->initial_window = H2_DEFAULT_WINDOW;
+    h2->max_frame = H2_MAX_FRAME_SIZE;
+    conn->h2 = h2;
+    g_stats.h2_connections++;
+
+    // MAX_CONCURRENT_STREAMS と INITIAL_WINDOW_SIZE（既定ではリクエスト本文をウィンドウ待ちなしで受け取る）
+    long window = g_options.h2_window;
+    unsigned char settings[12] = {
+        0, 3, 0, 0, (unsigned char)(H2_MAX_STREAMS >> 8), (unsigned char)H2_MAX_STREAMS,
+        0, 4, (unsigned char)(window >> 24), (unsigned char)(window >> 16),
+        (unsigned char)(window >> 8), (unsigned char)window,
+    };
+    h2_frame(&conn->out, H2_SETTINGS, 0, 0, settings, sizeof(settings));
+    if (window > H2_DEFAULT_WINDOW) {
+        h2_window_update(&conn->out, 0, (unsigned long)(window - H2_DEFAULT_WINDOW));
+    }
+}
+
+/**
+ * 復号した1つのヘッダーをストリームに記録する関数（使うものだけを取り出す）
+ */
+static void h2_stream_header(struct h2_stream* stream, const char* name, size_t name_len, const char* value,
+                             size_t value_len) {
+    if (name_len == 7 && memcmp(name, ":method", 7) == 0 && value_len < sizeof(stream->method)) {
+        memcpy(stream->method, value, value_len);
+        stream->method[value_len] = '\0';
+    } else if (name_len == 5 && memcmp(name, ":path", 5) == 0) {
+        stream->target.len = 0;
+        buffer_append(&stream->target, value, value_len);
+    } else if (name_len == 13 && memcmp(name, "authorization", 13) == 0 && value_len < sizeof(stream->authorization)) {
+        memcpy(stream->authorization, value, value_len);
+        stream->authorization[value_len] = '\0';
+    } else if (name_len == 12 && memcmp(name, "content-type", 12) == 0 && value_len < sizeof(stream->content_type)) {
+        memcpy(stream->content_type, value, value_len);
+        stream->content_type[value_len] = '\0';
+    }
+}
+
+/**
+ * ヘッダーブロックを HPACK で復号する関数
+ *
+ * @return 成功時は0、圧縮の誤り（COMPRESSION_ERROR）の場合は-1
+ */
+static int h2_decode_headers(struct h2_connection* h2, struct h2_stream* stream) {
+    const unsigned char* p = (const unsigned char*)h2->header_block.data;
+    const unsigned char* end = p + h2->header_block.len;
+    while (p < end) {
+        size_t index;
+        const char* name;
+        const char* value;
+        size_t name_len, value_len;
+        if (*p & 0x80) {
+            // 索引付きのヘッダー
+            if (hpack_read_int(&p, end, 7, &index) != 0 ||
+                hpack_lookup(&h2->table, index, &name, &name_len, &value, &value_len) != 0) {
+                return -1;
+            }
+            h2_stream_header(stream, name, name_len, value, value_len);
+            continue;
+        }
+        if ((*p & 0xe0) == 0x20) {
+            // 動的テーブルの大きさの変更
+            if (hpack_read_int(&p, end, 5, &index) != 0 || index > HPACK_TABLE_SIZE) {
+                return -1;
+            }
+            h2->table.max_size = index;
+            hpack_evict(&h2->table, index);
+            continue;
+        }
+        // リテラル（0x40 は動的テーブルに登録する、0x00 / 0x10 は登録しない）
+        int indexing = (*p & 0xc0) == 0x40;
+        if (hpack_read_int(&p, end, indexing ? 6 : 4, &index) != 0) {
+            return -1;
+        }
+        if (index == 0) {
+            if (hpack_read_string(&p, end, &h2->name) != 0) {
+                return -1;
+            }
+        } else {
+            if (hpack_lookup(&h2->table, index, &name, &name_len, &value, &value_len) != 0) {
+                return -1;
+            }
+            h2->name.len = 0;
+            buffer_append(&h2->name, name, name_len);
+        }
+        if (hpack_read_string(&p, end, &h2->value) != 0) {
+            return -1;
+        }
+        h2_stream_header(stream, h2->name.data, h2->name.len, h2->value.data, h2->value.len);
+        if (indexing) {
+            hpack_add(&h2->table, h2->name.data, h2->name.len, h2->value.data, h2->value.len);
+        }
+    }
+    return 0;
+}
+
+/**
+ * 応答のヘッダーブロックを作成する関数
+ */
+static void h2_build_headers(struct buffer* out, const struct api_reply* reply) {
+    char number[32];
+    snprintf(number, sizeof(number), "%d", reply->status);
+    hpack_write_header(out, HPACK_STATUS, number);
+    if (reply->content_type) {
+        hpack_write_header(out, HPACK_CONTENT_TYPE, reply->content_type);
+    }
+    if (reply->retry_after > 0) {
+        snprintf(number, sizeof(number), "%ld", reply->retry_after);
+        hpack_write_header(out, HPACK_RETRY_AFTER, number);
+    }
+    snprintf(number, sizeof(number), "%zu", reply->body.len);
+    hpack_write_header(out, HPACK_CONTENT_LENGTH, number);
+}
+
+/**
+ * 送信ウィンドウの範囲で、各ストリームの送れていない応答本文を DATA フレームにする関数
+ * 送り終えたストリームは閉じる
+ */
+static void h2_pump(struct connection* conn) {
+    struct h2_connection* h2 = conn->h2;
+    struct h2_stream** link = &h2->streams;
+    while (*link) {
+        struct h2_stream* s = *link;
+        while (s->responding && s->pending_sent < s->pending.len && h2->send_window > 0 && s->send_window > 0) {
+            size_t n = s->pending.len - s->pending_sent;
+            n = n < (size_t)h2->send_window ? n : (size_t)h2->send_window;
+            n = n < (size_t)s->send_window ? n : (size_t)s->send_window;
+            n = n < h2->max_frame ? n : h2->max_frame;
+            int last = (s->pending_sent + n == s->pending.len);
+            h2_frame(&conn->out, H2_DATA, last ? H2_FLAG_END_STREAM : 0, s->id, s->pending.data + s->pending_sent, n);
+            s->pending_sent += n;
+            h2->send_window -= (long)n;
+            s->send_window -= (long)n;
+        }
+        if (s->responding && s->pending_sent < s->pending.len) {
+            g_stats.h2_window_waits++;
+        }
+        if (s->responding && s->pending_sent == s->pending.len) {
+            *link = s->next;
+            h2->stream_count--;
+            h2_stream_free(s);
+            continue;
+        }
+        link = &s->next;
+    }
+}
+
+/**
+ * ストリームに応答する関数（ヘッダーはすぐに送り、本文は h2_pump() がウィンドウに合わせて送る）
+ * RST_STREAM で取り消されたストリームへの応答は捨てる
+ */
+static void h2_respond(struct connection* conn, uint32_t stream_id, const struct buffer* head, const char* body,
+                       size_t body_len) {
+    struct h2_stream* stream = h2_stream_find(conn->h2, stream_id);
+    if (stream == NULL) {
+        return;
+    }
+    h2_frame(&conn->out, H2_HEADERS, H2_FLAG_END_HEADERS | (body_len == 0 ? H2_FLAG_END_STREAM : 0), stream_id,
+             head->data, head->len);
+    if (body_len == 0) {
+        h2_stream_remove(conn->h2, stream);
+        return;
+    }
+    stream->pending.len = 0;
+    buffer_append(&stream->pending, body, body_len);
+    stream->pending_sent = 0;
+    stream->responding = 1;
+}
+
+/**
+ * 応答をすぐに送るか、遅延させるためにタイマーに登録する関数
+ */
+static void h2_schedule_reply(struct connection* conn, uint32_t stream_id, const struct api_reply* reply, int is_api) {
+    struct buffer head = {0};
+    h2_build_headers(&head, reply);
+    long delay = is_api ? reply_delay_ms() : 0;
+    if (delay > 0) {
+        struct delayed_reply delayed = { monotonic_ms() + delay, conn->fd, conn->serial, stream_id, head, {0} };
+        buffer_append(&delayed.data, reply->body.data ? reply->body.data : "", reply->body.len);
+        timer_push(&delayed);
+        conn->waiting++;
+        g_inflight++;
+    } else {
+        h2_respond(conn, stream_id, &head, reply->body.data, reply->body.len);
+        free(head.data);
+    }
+}
+
+/**
+ * 受け取り終えたリクエストを処理し、応答するか遅延させる関数
+ */
+static void h2_dispatch(struct connection* conn, struct h2_stream* stream) {
+    static struct api_reply reply;
+
+    stream->dispatched = 1;
+    const char* target = stream->target.data ? stream->target.data : "/";
+    int is_api = handle_request(&reply, stream->method, target, strlen(target),
+                                stream->authorization[0] ? stream->authorization : NULL,
+                                stream->content_type[0] ? stream->content_type : NULL, strlen(stream->content_type),
+                                stream->body.data ? stream->body.data : "", stream->body.len);
+    free(stream->body.data);
+    stream->body = (struct buffer){0};
+    h2_schedule_reply(conn, stream->id, &reply, is_api);
+}
+
+/**
+ * ヘッダーブロックが揃ったときに呼ばれる関数
+ */
+static int h2_headers_done(struct connection* conn) {
+    struct h2_connection* h2 = conn->h2;
+    struct h2_stream* stream = h2_stream_find(h2, h2->header_stream);
+    h2->header_stream = 0;
+    if (stream == NULL || h2_decode_headers(h2, stream) != 0) {
+        return -1;
+    }
+    if (h2->header_end_stream && !stream->dispatched) {
+        h2_dispatch(conn, stream);
+    }
+    return 0;
+}
+
+/**
+ * PADDED フラグの付いたフレームから詰め物を取り除く関数
+ */
+static int h2_strip_padding(int flags, const unsigned char** payload, size_t* len) {
+    if (!(flags & H2_FLAG_PADDED)) {
+        return 0;
+    }
+    if (*len < 1 || (*payload)[0] >= *len) {
+        return -1;
+    }
+    *len -= 1 + (*payload)[0];
+    (*payload)++;
+    return 0;
+}
+
+/**
+ * クライアントの SETTINGS（フレームの本体か HTTP2-Settings ヘッダーの値）を反映する関数
+ */
+static int h2_apply_settings(struct h2_connection* h2, const unsigned char* p, size_t len) {
+    if (len % 6 != 0) {
+        return -1;
+    }
+    for (size_t i = 0; i < len; i += 6) {
+        unsigned identifier = ((unsigned)p[i] << 8) | p[i + 1];
+        unsigned long value = ((unsigned long)p[i + 2] << 24) | ((unsigned long)p[i + 3] << 16) |
+                              ((unsigned long)p[i + 4] << 8) | p[i + 5];
+        if (identifier == 4) {
+            // INITIAL_WINDOW_SIZE の変更は開いているストリームのウィンドウにも反映する
+            if (value > 0x7fffffffUL) {
+                return -1;
+            }
+            for (struct h2_stream* s = h2->streams; s; s = s->next) {
+                s->send_window += (long)value - h2->initial_window;
+            }
+            h2->initial_window = (long)value;
+        } else if (identifier == 5) {
+            if (value < H2_MAX_FRAME_SIZE || value > 0xffffffUL) {
+                return -1;
+            }
+            h2->max_frame = value;
+        }
+    }
+    return 0;
+}
+
+/**
+ * 1つのフレームを処理する関数
+ *
+ * @return 成功時は0、接続を閉じるべきプロトコル違反の場合は-1
+ */
+static int h2_frame_received(struct connection* conn, int type, int flags, uint32_t id, const unsigned char* p,
+                             size_t len) {
+    struct h2_connection* h2 = conn->h2;
+    if (h2->header_stream != 0 && (type != H2_CONTINUATION || id != h2->header_stream)) {
+        return -1;
+    }
+    struct h2_stream* stream = id ? h2_stream_find(h2, id) : NULL;
+
+    switch (type) {
+    case H2_DATA:
+        // 受け取った分（パディングを含む）だけ、半分を使われたところで受信ウィンドウを補充する
+        h2->received += (long)len;
+        if (h2->received >= g_options.h2_window / 2) {
+            h2_window_update(&conn->out, 0, (unsigned long)h2->received);
+            h2->received = 0;
+        }
+        if (stream != NULL && !(flags & H2_FLAG_END_STREAM)) {
+            stream->received += (long)len;
+            if (stream->received >= g_options.h2_window / 2) {
+                h2_window_update(&conn->out, id, (unsigned long)stream->received);
+                stream->received = 0;
+            }
+        }
+        if (h2_strip_padding(flags, &p, &len) != 0) {
+            return -1;
+        }
+        if (stream == NULL || stream->dispatched) {
+            return 0;
+        }
+        if (stream->body.len + len > MAX_REQUEST_SIZE) {
+            return -1;
+        }
+        buffer_append(&stream->body, (const char*)p, len);
+        if (flags & H2_FLAG_END_STREAM) {
+            h2_dispatch(conn, stream);
+        }
+        return 0;
+
+    case H2_HEADERS:
+        if (h2_strip_padding(flags, &p, &len) != 0) {
+            return -1;
+        }
+        if (flags & H2_FLAG_PRIORITY) {
+            if (len < 5) {
+                return -1;
+            }
+            p += 5;
+            len -= 5;
+        }
+        if (stream == NULL) {
+            if ((id & 1) == 0 || id <= h2->last_stream || h2->stream_count >= H2_MAX_STREAMS) {
+                return -1;
+            }
+            stream = calloc(1, sizeof(*stream));
+            if (!stream) {
+                fprintf(stderr, "エラー: メモリ割り当てに失敗しました\n");
+                exit(1);
+            }
+            stream->id = id;
+            stream->send_window = h2->initial_window;
+            stream->next = h2->streams;
+            h2->streams = stream;
+            h2->stream_count++;
+            h2->last_stream = id;
+        }
+        h2->header_stream = id;
+        h2->header_end_stream = flags & H2_FLAG_END_STREAM;
+        h2->header_block.len = 0;
+        buffer_append(&h2->header_block, (const char*)p, len);
+        if (!(flags & H2_FLAG_END_HEADERS)) {
+            g_stats.h2_continuations++;
+        }
+        return (flags & H2_FLAG_END_HEADERS) ? h2_headers_done(conn) : 0;
+
+    case H2_CONTINUATION:
+        if (h2->header_stream == 0 || h2->header_block.len + len > H2_MAX_HEADER_BLOCK) {
+            return -1;
+        }
+        buffer_append(&h2->header_block, (const char*)p, len);
+        return (flags & H2_FLAG_END_HEADERS) ? h2_headers_done(conn) : 0;
+
+    case H2_RST_STREAM:
+        if (stream != NULL) {
+            h2_stream_remove(h2, stream);
+        }
+        return 0;
+
+    case H2_SETTINGS:
+        if (id != 0) {
+            return -1;
+        }
+        if (flags & H2_FLAG_ACK) {
+            return 0;
+        }
+        if (h2_apply_settings(h2, p, len) != 0) {
+            return -1;
+        }
+        h2_frame(&conn->out, H2_SETTINGS, H2_FLAG_ACK, 0, NULL, 0);
+        return 0;
+
+    case H2_PING:
+        if (len != 8) {
+            return -1;
+        }
+        if (!(flags & H2_FLAG_ACK)) {
+            h2_frame(&conn->out, H2_PING, H2_FLAG_ACK, 0, p, len);
+        }
+        return 0;
+
+    case H2_GOAWAY:
+        conn->close_after = 1;
+        return 0;
+
+    case H2_WINDOW_UPDATE: {
+        if (len != 4) {
+            return -1;
+        }
+        long increment = (long)((((unsigned long)p[0] & 0x7f) << 24) | ((unsigned long)p[1] << 16) |
+                                ((unsigned long)p[2] << 8) | p[3]);
+        if (increment == 0) {
+            return -1;
+        }
+        g_stats.h2_window_updates_received++;
+        if (id == 0) {
+            h2->send_window += increment;
+        } else if (stream != NULL) {
+            stream->send_window += increment;
+        }
+        return 0;
+    }
+
+    default:
+        return 0;   // PRIORITY と未知のフレームは無視する
+    }
+}
+
+/**
+ * 受信バッファ内の HTTP/2 フレームを処理する関数
+ *
+ * @return 接続を閉じた場合は-1、それ以外は0
+ */
+static int h2_process(struct connection* conn) {
+    if (conn->h2->expect_preface && conn->in.len >= H2_PREFACE_LEN) {
+        if (memcmp(conn->in.data, H2_PREFACE, H2_PREFACE_LEN) != 0) {
+            connection_close(conn);
+            return -1;
+        }
+        buffer_consume(&conn->in, H2_PREFACE_LEN);
+        conn->h2->expect_preface = 0;
+    }
+    size_t pos = 0;
+    while (!conn->h2->expect_preface && !conn->close_after && conn->in.len - pos >= H2_FRAME_HEADER_SIZE) {
+        const unsigned char* f = (const unsigned char*)conn->in.data + pos;
+        size_t len = ((size_t)f[0] << 16) | ((size_t)f[1] << 8) | f[2];
+        uint32_t id = ((uint32_t)(f[5] & 0x7f) << 24) | ((uint32_t)f[6] << 16) | ((uint32_t)f[7] << 8) | f[8];
+        if (len > H2_MAX_FRAME_SIZE) {
+            connection_close(conn);
+            return -1;
+        }
+        if (conn->in.len - pos < H2_FRAME_HEADER_SIZE + len) {
+            break;
+        }
+        if (h2_frame_received(conn, f[3], f[4], id, f + H2_FRAME_HEADER_SIZE, len) != 0) {
+            connection_close(conn);
+            return -1;
+        }
+        pos += H2_FRAME_HEADER_SIZE + len;
+    }
+    buffer_consume(&conn->in, pos);
+    h2_pump(conn);
+    return connection_flush(conn);
+}
+
+/**
+ * HTTP2-Settings ヘッダーの値（パディングなしの base64url）を復号する関数
+ */
+static int base64url_decode(const char* src, size_t len, unsigned char* out, size_t out_size, size_t* out_len) {
+    unsigned long bits = 0;
+    int nbits = 0;
+    size_t n = 0;
+    for (size_t i = 0; i < len && src[i] != '='; i++) {
+        const char* digits = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+        const char* d = src[i] ? strchr(digits, src[i]) : NULL;
+        if (d == NULL) {
+            return -1;
+        }
+        bits = ((bits << 6) | (unsigned long)(d - digits)) & 0xffffff;
+        nbits += 6;
+        if (nbits >= 8) {
+            nbits -= 8;
+            if (n == out_size) {
+                return -1;
+            }
+            out[n++] = (unsigned char)(bits >> nbits);
+        }
+    }
+    *out_len = n;
+    return 0;
+}
+
+/**
+ * Upgrade: h2c のリクエストに 101 を返して HTTP/2 に切り替える関数
+ * 切り替えのきっかけになったリクエストへの応答はストリーム1で返す（RFC 7540 3.2）
+ */
+static void h2_upgrade(struct connection* conn, const unsigned char* settings, size_t settings_len,
+                       const struct api_reply* reply, int is_api) {
+    buffer_appendf(&conn->out, "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n");
+    h2_start(conn);
+    struct h2_connection* h2 = conn->h2;
+    h2->expect_preface = 1;
+    h2_apply_settings(h2, settings, settings_len);
+
+    struct h2_stream* stream = calloc(1, sizeof(*stream));
+    if (!stream) {
+        fprintf(stderr, "エラー: メモリ割り当てに失敗しました\n");
+        exit(1);
+    }
+    stream->id = 1;
+    stream->dispatched = 1;
+    stream->send_window = h2->initial_window;
+    h2->streams = stream;
+    h2->stream_count = 1;
+    h2->last_stream = 1;
+    h2_schedule_reply(conn, 1, reply, is_api);
+}
+
+/**
+ * 受信バッファ内のリクエストを順に処理する関数
+ *
+ * @return 接続を閉じた場合は-1、それ以外は0
+ */
+static int connection_process(struct connection* conn) {
+    static struct api_reply reply;
+
+    // HTTP/2 の接続は事前知識で送られる接続プリフェースで始まる
+    if (conn->h2 == NULL && conn->in.len > 0 &&
+        memcmp(conn->in.data, H2_PREFACE, conn->in.len < H2_PREFACE_LEN ? conn->in.len : H2_PREFACE_LEN) == 0) {
+        if (conn->in.len < H2_PREFACE_LEN) {
+            return 0;
+        }
+        buffer_consume(&conn->in, H2_PREFACE_LEN);
+        h2_start(conn);
+    }
+    if (conn->h2) {
+        return h2_process(conn);
+    }
+
+    while (!conn->waiting && !conn->close_after) {
+        char* head_end = memmem(conn->in.data ? conn->in.data : "", conn->in.len, "\r\n\r\n", 4);
+        if (head_end == NULL) {
+            if (conn->in.len > MAX_REQUEST_SIZE) {
+                connection_close(conn);
+                return -1;
+            }
+            break;
+        }
+        size_t head_len = head_end + 4 - conn->in.data;
+
+        // リクエスト行: METHOD TARGET HTTP/1.x
+        char method[16];
+        const char* line_end = memchr(conn->in.data, '\r', head_len);
+        const char* sp1 = memchr(conn->in.data, ' ', line_end - conn->in.data);
+        const char* sp2 = sp1 ? memchr(sp1 + 1, ' ', line_end - sp1 - 1) : NULL;
+        if (sp2 == NULL || sp1 - conn->in.data >= (long)sizeof(method)) {
+            connection_close(conn);
+            return -1;
+        }
+        memcpy(method, conn->in.data, sp1 - conn->in.data);
+        method[sp1 - conn->in.data] = '\0';
+        const char* target = sp1 + 1;
+        size_t target_len = sp2 - target;
+        const char* headers = line_end + 2;
+        size_t headers_len = head_end + 2 - headers;
+
+        size_t value_len = 0;
+        const char* value = header_value(headers, headers_len, "Transfer-Encoding", &value_len);
+        if (value != NULL) {
+            reply_error(&reply, 411, "badRequest", "Chunked request bodies are not supported");
+            build_response(&conn->out, &reply, 1);
+            conn->close_after = 1;
+            break;
+        }
+        value = header_value(headers, headers_len, "Content-Length", &value_len);
+        size_t content_length = value ? strtoul(value, NULL, 10) : 0;
+        if (content_length > MAX_REQUEST_SIZE) {
+            reply_error(&reply, 413, "badRequest", "Request too large");
+            build_response(&conn->out, &reply, 1);
+            conn->close_after = 1;
+            break;
+        }
+        if (conn->in.len < head_len + content_length) {
+            // 本文の送信を待っているクライアントには 100 Continue を返す
+            value = header_value(headers, headers_len, "Expect", &value_len);
+            if (value && !conn->sent_continue && value_len == 12 && strncasecmp(value, "100-continue", 12) == 0) {
+                buffer_appendf(&conn->out, "HTTP/1.1 100 Continue\r\n\r\n");
+                conn->sent_continue = 1;
+            }
+            break;
+        }
+        conn->sent_continue = 0;
+
+        value = header_value(headers, headers_len, "Connection", &value_len);
+        int close_after = (value && value_len == 5 && strncasecmp(value, "close", 5) == 0);
+        char authorization[4096] = "";
+        value = header_value(headers, headers_len, "Authorization", &value_len);
+        if (value && value_len < sizeof(authorization)) {
+            memcpy(authorization, value, value_len);
+            authorization[value_len] = '\0';
+        }
+        size_t content_type_len = 0;
+        const char* content_type = header_value(headers, headers_len, "Content-Type", &content_type_len);
+        const char* body = conn->in.data + head_len;
+
+        // Upgrade: h2c の場合は、このリクエストに応答してから HTTP/2 に切り替える
+        unsigned char h2_settings[256];
+        size_t h2_settings_len = 0;
+        int upgrade = 0;
+        value = header_value(headers, headers_len, "Upgrade", &value_len);
+        if (value && value_len == 3 && strncasecmp(value, "h2c", 3) == 0) {
+            value = header_value(headers, headers_len, "HTTP2-Settings", &value_len);
+            upgrade = value && base64url_decode(value, value_len, h2_settings, sizeof(h2_settings), &h2_settings_len) == 0 &&
+                      h2_settings_len % 6 == 0;
+        }
+
+        int is_api = handle_request(&reply, method, target, target_len, authorization[0] ? authorization : NULL,
+                                    content_type, content_type_len, body, content_length);
+        buffer_consume(&conn->in, head_len + content_length);
+        if (upgrade) {
+            h2_upgrade(conn, h2_settings, h2_settings_len, &reply, is_api);
+            return h2_process(conn);
+        }
+
+        long delay = is_api ? reply_delay_ms() : 0;
+        if (delay > 0) {
+            struct delayed_reply delayed = { monotonic_ms() + delay, conn->fd, conn->serial, 0, {0}, {0} };
+            build_response(&delayed.data, &reply, close_after);
+            timer_push(&delayed);
+            conn->waiting++;
+            g_inflight++;
+        } else {
+            build_response(&conn->out, &reply, close_after);
+        }
+        conn->close_after = close_after;
+    }
+    return connection_flush(conn);
+}
+
+/**
+ * 期限の来た遅延レスポンスを送信する関数
+ */
+static void timers_fire(void) {
+    long long now = monotonic_ms();
+    while (g_timers.count > 0 && g_timers.items[0].due_ms <= now) {
+        struct delayed_reply item = timer_pop();
+        struct connection* conn = (size_t)item.fd < g_connection_cap ? g_connections[item.fd] : NULL;
+        if (conn != NULL && conn->serial == item.serial) {
+            if (conn->h2) {
+                h2_respond(conn, item.stream_id, &item.head, item.data.data, item.data.len);
+            } else {
+                buffer_append(&conn->out, item.data.data, item.data.len);
+            }
+            conn->waiting--;
+            g_inflight--;
+            connection_process(conn);
+        }
+        free(item.head.data);
+        free(item.data.data);
+    }
+}
+
+static void connection_read(struct connection* conn) {
+    for (;;) {
+        buffer_reserve(&conn->in, conn->in.len + READ_CHUNK + 1);
+        ssize_t n = recv(conn->fd, conn->in.data + conn->in.len, READ_CHUNK, 0);
+        if (n > 0) {
+            conn->in.len += n;
+            conn->in.data[conn->in.len] = '\0';
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+            connection_close(conn);
+            return;
+        }
+        break;
+    }
+    connection_process(conn);
+}
+
+static void accept_connections(int listen_fd) {
+    for (;;) {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            return;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if ((size_t)fd >= g_connection_cap) {
+            size_t cap = g_connection_cap ? g_connection_cap : 1024;
+            while (cap <= (size_t)fd) {
+                cap *= 2;
+            }
+            g_connections = realloc(g_connections, cap * sizeof(*g_connections));
+            if (!g_connections) {
+                fprintf(stderr, "エラー: メモリ割り当てに失敗しました\n");
+                exit(1);
+            }
+            memset(g_connections + g_connection_cap, 0, (cap - g_connection_cap) * sizeof(*g_connections));
+            g_connection_cap = cap;
+        }
+        struct connection* conn = calloc(1, sizeof(*conn));
+        if (!conn) {
+            close(fd);
+            continue;
+        }
+        conn->fd = fd;
+        conn->serial = ++g_connection_serial;
+        g_connections[fd] = conn;
+        struct epoll_event ev = { .events = EPOLLIN | EPOLLRDHUP, .data.fd = fd };
+        epoll_ctl(g_epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+        g_stats.connections++;
+    }
+}
+
+static void on_signal(int sig) {
+    (void)sig;
+    g_stop = 1;
+}
+
+static void print_stats(void) {
+    size_t events = 0;
+    for (struct mock_calendar* cal = g_calendars; cal; cal = cal->next) {
+        events += cal->count;
+    }
+    fprintf(stderr,
+            "mock_server: 接続 %lu（HTTP/2 %lu）/ HTTPリクエスト %lu（バッチ %lu）/ API呼び出し %lu / トークン発行 %lu\n"
+            "mock_server: 2xx %lu / 4xx %lu / 5xx %lu（注入: レート制限 %lu、5xx %lu、同時実行数超過 %lu）/ 保存イベント %zu\n"
+            "mock_server: HTTP/2 WINDOW_UPDATE 送信 %lu / 受信 %lu / 送信ウィンドウ待ち %lu / CONTINUATION %lu\n",
+            g_stats.connections, g_stats.h2_connections, g_stats.requests, g_stats.batches, g_stats.api_calls, g_stats.tokens,
+            g_stats.status_2xx, g_stats.status_4xx, g_stats.status_5xx,
+            g_stats.injected_rate_limits, g_stats.injected_errors, g_stats.inflight_rejects, events,
+            g_stats.h2_window_updates_sent, g_stats.h2_window_updates_received, g_stats.h2_window_waits,
+            g_stats.h2_continuations);
+}
+
+static void print_usage(const char* prog) {
+    printf("使用方法: %s [オプション]\n"
+           "  --bind ADDR            待ち受けるアドレス（既定: 127.0.0.1）\n"
+           "  --port N               待ち受けるポート（0は空いているポート、既定: %d）\n"
+           "  --latency-ms MS        APIリクエストの応答を遅らせる時間（既定: 0）\n"
+           "  --jitter-ms MS         遅延に加える 0..MS の一様乱数\n"
+           "  --slow-rate P          さらに --slow-ms だけ遅らせるリクエストの割合（0..1）\n"
+           "  --slow-ms MS           遅いリクエストに加える時間\n"
+           "  --error-rate P         5xx を返すリクエストの割合（0..1）\n"
+           "  --error-status N       返す5xxのステータス（既定: 503）\n"
+           "  --rate-limit-rate P    レート制限エラーを返すリクエストの割合（0..1）\n"
+           "  --rate-limit-status N  レート制限エラーのステータス（429 または 403、既定: 429）\n"
+           "  --retry-after SEC      レート制限エラーの Retry-After（0で付けない、既定: 1）\n"
+           "  --max-inflight N       応答待ちのリクエストがN件を超えたらレート制限エラーを返す\n"
+           "  --token-ttl SEC        発行するアクセストークンの expires_in（既定: 3600）\n"
+           "  --no-store             イベントを保存しない（大量のインポートでメモリを使わない）\n"
+           "  --decorate ZONE        APIと同じように reminders などを補い、日時をカレンダーのタイムゾーン ZONE\n"
+           "                         （例: Asia/Tokyo）のオフセットで書き直す\n"
+           "  --h2-window BYTES      HTTP/2 でクライアントに許す送信量（65535..2147483647、既定: %ld）\n"
+           "                         小さくすると受信側のフロー制御（WINDOW_UPDATE の送信）を確かめられる\n"
+           "  --seed N               エラー注入と遅延に使う乱数の種\n",
+           prog, DEFAULT_PORT, (long)H2_RECEIVE_WINDOW);
+}
+
+int main(int argc, char* argv[]) {
+    static struct option long_options[] = {
+        {"bind", required_argument, 0, 'B'},
+        {"port", required_argument, 0, 'p'},
+        {"latency-ms", required_argument, 0, 'l'},
+        {"jitter-ms", required_argument, 0, 'j'},
+        {"slow-rate", required_argument, 0, 'S'},
+        {"slow-ms", required_argument, 0, 'T'},
+        {"error-rate", required_argument, 0, 'e'},
+        {"error-status", required_argument, 0, 'E'},
+        {"rate-limit-rate", required_argument, 0, 'r'},
+        {"rate-limit-status", required_argument, 0, 'R'},
+        {"retry-after", required_argument, 0, 'a'},
+        {"max-inflight", required_argument, 0, 'm'},
+        {"token-ttl", required_argument, 0, 't'},
+        {"no-store", no_argument, 0, 'n'},
+        {"decorate", required_argument, 0, 'D'},
+        {"h2-window", required_argument, 0, 'W'},
+        {"seed", required_argument, 0, 's'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "B:p:l:j:S:T:e:E:r:R:a:m:t:nD:W:s:h", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'B': g_options.bind_address = optarg; break;
+        case 'p': g_options.port = atoi(optarg); break;
+        case 'l': g_options.latency_ms = atol(optarg); break;
+        case 'j': g_options.jitter_ms = atol(optarg); break;
+        case 'S': g_options.slow_rate = atof(optarg); break;
+        case 'T': g_options.slow_ms = atol(optarg); break;
+        case 'e': g_options.error_rate = atof(optarg); break;
+        case 'E': g_options.error_status = atoi(optarg); break;
+        case 'r': g_options.rate_limit_rate = atof(optarg); break;
+        case 'R': g_options.rate_limit_status = atoi(optarg); break;
+        case 'a': g_options.retry_after = atol(optarg); break;
+        case 'm': g_options.max_inflight = atol(optarg); break;
+        case 't': g_options.token_ttl = atol(optarg); break;
+        case 'n': g_options.store = 0; break;
+        case 'D': g_options.decorate = optarg; break;
+        case 'W': g_options.h2_window = atol(optarg); break;
+        case 's': g_options.seed = strtoull(optarg, NULL, 10); break;
+        case 'h': print_usage(argv[0]); return 0;
+        default: print_usage(argv[0]); return 1;
+        }
+    }
+    if (g_options.error_status < 500 || g_options.error_status > 599 ||
+        (g_options.rate_limit_status != 429 && g_options.rate_limit_status != 403) ||
+        g_options.error_rate < 0 || g_options.rate_limit_rate < 0 || g_options.error_rate + g_options.rate_limit_rate > 1) {
+        fprintf(stderr, "エラー: エラー注入の設定が不正です\n");
+        return 1;
+    }
+    if (g_options.h2_window < H2_DEFAULT_WINDOW || g_options.h2_window > 0x7fffffffL) {
+        fprintf(stderr, "エラー: --h2-window は 65535 から 2147483647 の範囲で指定してください\n");
+        return 1;
+    }
+    g_random_state = g_options.seed ? g_options.seed : 1;
+    g_sync_epoch = ((unsigned long)time(NULL) << 16) ^ (unsigned long)getpid();
+
+    int listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(g_options.port) };
+    int one = 1;
+    if (listen_fd < 0 || inet_pton(AF_INET, g_options.bind_address, &addr.sin_addr) != 1 ||
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0 ||
+        bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listen_fd, 1024) != 0) {
+        fprintf(stderr, "エラー: %s:%d で待ち受けできません: %s\n", g_options.bind_address, g_options.port, strerror(errno));
+        return 1;
+    }
+    socklen_t addr_len = sizeof(addr);
+    getsockname(listen_fd, (struct sockaddr*)&addr, &addr_len);
+
+    g_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event listen_ev = { .events = EPOLLIN, .data.fd = listen_fd };
+    epoll_ctl(g_epoll_fd, EPOLL_CTL_ADD, listen_fd, &listen_ev);
+
+    struct sigaction sa = {0};
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    // ベンチマークのスクリプトはこの行からポート番号を読み取る
+    printf("mock_server: http://%s:%d で待ち受けています\n", g_options.bind_address, ntohs(addr.sin_port));
+    fflush(stdout);
+
+    struct epoll_event events[MAX_EVENTS];
+    while (!g_stop) {
+        int timeout = -1;
+        if (g_timers.count > 0) {
+            long long wait = g_timers.items[0].due_ms - monotonic_ms();
+            timeout = wait > 0 ? (int)wait : 0;
+        }
+        int n = epoll_wait(g_epoll_fd, events, MAX_EVENTS, timeout);
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if (fd == listen_fd) {
+                accept_connections(listen_fd);
+                continue;
+            }
+            struct connection* conn = g_connections[fd];
+            if (conn == NULL) {
+                continue;
+            }
+            if (events[i].events & EPOLLOUT) {
+                if (connection_flush(conn) != 0) {
+                    continue;
+                }
+            }
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                connection_read(conn);
+            }
+        }
+        timers_fire();
+    }
+
+    print_stats();
+    return 0;
+}
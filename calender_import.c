@@ -1,792 +1,10082 @@
-/**
- * Google Calendar イベントインポートツール
- * 
- * このプログラムは、OAuth 2.0認証を使用してGoogle Calendar APIにアクセスし、
- * ユーザーが指定したイベントをカレンダーにインポートします。
- * 
- * セキュリティ対策:
- * - 機密情報の安全な取り扱い
- * - 入力値の検証
- * - メモリの安全な管理
- * - エラー処理の強化
- * 
- * 注意: このコードを実際に使用する前に、セキュリティ専門家によるレビューを受けることをお勧めします。
- */
-
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include "curl/curl.h"
-#include "json-c/json.h"
-#include <time.h>
-#include <locale.h>
-#include <ctype.h>
-#include <unistd.h>
-
-#define CONFIG_FILE "config.json"
-#define TOKEN_FILE "token.json"
-#define BUFFER_SIZE 4096
-#define MAX_INPUT_LENGTH 256
-#define AUTH_URL "https://accounts.google.com/o/oauth2/v2/auth"
-#define TOKEN_URL "https://oauth2.googleapis.com/token"
-#define SCOPE "https://www.googleapis.com/auth/calendar.events"
-
-// セキュリティ強化: バッファオーバーフロー対策のための安全な文字列操作マクロ
-#define SAFE_STRCPY(dest, src, dest_size) \
-    do { \
-        strncpy(dest, src, (dest_size) - 1); \
-        (dest)[(dest_size) - 1] = '\0'; \
-    } while(0)
-
-/**
- * メモリ構造体
- * CURLによって取得されたデータを格納するための構造体
- */
-struct MemoryStruct {
-    char *memory;  // 動的に割り当てられたメモリへのポインタ
-    size_t size;   // 現在のメモリサイズ
-};
-
-/**
- * メモリコールバック関数
- * CURLがデータを受信するたびに呼び出される関数
- * 
- * @param contents 受信したデータ
- * @param size 各データ要素のサイズ
- * @param nmemb データ要素の数
- * @param userp ユーザーポインタ（MemoryStruct構造体へのポインタ）
- * @return 処理されたバイト数
- */
-static size_t WriteMemoryCallback(void *contents, size_t size, size_t nmemb, void *userp) {
-    size_t realsize = size * nmemb;
-    struct MemoryStruct *mem = (struct MemoryStruct *)userp;
-
-    char *ptr = realloc(mem->memory, mem->size + realsize + 1);
-    if(!ptr) {
-        fprintf(stderr, "エラー: メモリ不足（reallocがNULLを返しました）\n");
-        return 0;
-    }
-
-    mem->memory = ptr;
-    memcpy(&(mem->memory[mem->size]), contents, realsize);
-    mem->size += realsize;
-    mem->memory[mem->size] = 0;
-
-    return realsize;
-}
-
-/**
- * ファイルの内容を読み取る関数
- * 
- * @param filename 読み取るファイルの名前
- * @return ファイルの内容を含む動的に割り当てられた文字列、失敗時はNULL
- */
-char* read_file(const char* filename) {
-    FILE* file = fopen(filename, "r");
-    if (file == NULL) {
-        fprintf(stderr, "エラー: ファイル %s を開けません\n", filename);
-        return NULL;
-    }
-
-    fseek(file, 0, SEEK_END);
-    long file_size = ftell(file);
-    fseek(file, 0, SEEK_SET);
-
-    char* content = malloc(file_size + 1);
-    if (content == NULL) {
-        fprintf(stderr, "エラー: メモリ割り当てに失敗しました\n");
-        fclose(file);
-        return NULL;
-    }
-
-    size_t read_size = fread(content, 1, file_size, file);
-    if (read_size != file_size) {
-        fprintf(stderr, "エラー: ファイル全体の読み取りに失敗しました\n");
-        free(content);
-        fclose(file);
-        return NULL;
-    }
-
-    content[file_size] = '\0';
-    fclose(file);
-    return content;
-}
-
-/**
- * 設定ファイルから特定の値を取得する関数
- * 
- * @param key 取得したい設定のキー
- * @return 設定値を含む動的に割り当てられた文字列、失敗時はNULL
- */
-char* get_config_value(const char* key) {
-    char* config_content = read_file(CONFIG_FILE);
-    if (config_content == NULL) {
-        return NULL;
-    }
-
-    struct json_object *parsed_json;
-    struct json_object *value;
-
-    parsed_json = json_tokener_parse(config_content);
-    if (!parsed_json) {
-        fprintf(stderr, "エラー: 設定ファイルの解析に失敗しました\n");
-        free(config_content);
-        return NULL;
-    }
-
-    if (json_object_object_get_ex(parsed_json, key, &value)) {
-        char* result = strdup(json_object_get_string(value));
-        json_object_put(parsed_json);
-        free(config_content);
-        return result;
-    } else {
-        fprintf(stderr, "エラー: キー '%s' が設定に見つかりません\n", key);
-        json_object_put(parsed_json);
-        free(config_content);
-        return NULL;
-    }
-}
-
-/**
- * 文字列をURL安全にエンコードする関数
- * 
- * @param input エンコードする文字列
- * @return エンコードされた文字列、失敗時はNULL
- */
-char* url_encode(const char* input) {
-    CURL *curl = curl_easy_init();
-    if(curl) {
-        char* output = curl_easy_escape(curl, input, 0);
-        curl_easy_cleanup(curl);
-        return output;
-    }
-    return NULL;
-}
-
-// ... [前のパートから続く]
-
-/**
- * OAuth 2.0認証用のURLを生成する関数
- * 
- * @return 生成された認証URL、失敗時はNULL
- */
-char* generate_auth_url() {
-    char* client_id = get_config_value("client_id");
-    char* redirect_uri = get_config_value("redirect_uri");
-    
-    if (!client_id || !redirect_uri) {
-        fprintf(stderr, "エラー: client_idまたはredirect_uriの取得に失敗しました\n");
-        free(client_id);
-        free(redirect_uri);
-        return NULL;
-    }
-
-    char* encoded_redirect_uri = url_encode(redirect_uri);
-    char* encoded_scope = url_encode(SCOPE);
-    
-    if (!encoded_redirect_uri || !encoded_scope) {
-        fprintf(stderr, "エラー: URLエンコードに失敗しました\n");
-        free(client_id);
-        free(redirect_uri);
-        free(encoded_redirect_uri);
-        free(encoded_scope);
-        return NULL;
-    }
-
-    char* url = malloc(BUFFER_SIZE);
-    if (!url) {
-        fprintf(stderr, "エラー: メモリ割り当てに失敗しました\n");
-        free(client_id);
-        free(redirect_uri);
-        free(encoded_redirect_uri);
-        free(encoded_scope);
-        return NULL;
-    }
-
-    // セキュリティ強化: バッファオーバーフロー対策としてsnprintfを使用
-    int written = snprintf(url, BUFFER_SIZE, "%s?client_id=%s&redirect_uri=%s&response_type=code&scope=%s",
-             AUTH_URL, client_id, encoded_redirect_uri, encoded_scope);
-
-    if (written < 0 || written >= BUFFER_SIZE) {
-        fprintf(stderr, "エラー: 認証URLの生成に失敗しました\n");
-        free(url);
-        url = NULL;
-    }
-    
-    free(client_id);
-    free(redirect_uri);
-    curl_free(encoded_redirect_uri);
-    curl_free(encoded_scope);
-    
-    return url;
-}
-
-/**
- * 認証コードをアクセストークンと交換する関数
- * 
- * @param code 認証コード
- * @return トークンレスポンスを含む文字列、失敗時はNULL
- */
-char* exchange_code_for_token(const char* code) {
-    CURL *curl;
-    CURLcode res;
-    struct MemoryStruct chunk;
-    chunk.memory = malloc(1);
-    chunk.size = 0;
-
-    curl_global_init(CURL_GLOBAL_ALL);
-    curl = curl_easy_init();
-
-    if(curl) {
-        char* client_id = get_config_value("client_id");
-        char* client_secret = get_config_value("client_secret");
-        char* redirect_uri = get_config_value("redirect_uri");
-
-        if (!client_id || !client_secret || !redirect_uri) {
-            fprintf(stderr, "エラー: 必要な設定値の取得に失敗しました\n");
-            free(client_id);
-            free(client_secret);
-            free(redirect_uri);
-            curl_easy_cleanup(curl);
-            curl_global_cleanup();
-            free(chunk.memory);
-            return NULL;
-        }
-
-        char* post_fields = malloc(BUFFER_SIZE);
-        if (!post_fields) {
-            fprintf(stderr, "エラー: メモリ割り当てに失敗しました\n");
-            free(client_id);
-            free(client_secret);
-            free(redirect_uri);
-            curl_easy_cleanup(curl);
-            curl_global_cleanup();
-            free(chunk.memory);
-            return NULL;
-        }
-
-        // セキュリティ強化: バッファオーバーフロー対策としてsnprintfを使用
-        int written = snprintf(post_fields, BUFFER_SIZE,
-                 "code=%s&client_id=%s&client_secret=%s&redirect_uri=%s&grant_type=authorization_code",
-                 code, client_id, client_secret, redirect_uri);
-
-        if (written < 0 || written >= BUFFER_SIZE) {
-            fprintf(stderr, "エラー: POSTフィールドの生成に失敗しました\n");
-            free(client_id);
-            free(client_secret);
-            free(redirect_uri);
-            free(post_fields);
-            curl_easy_cleanup(curl);
-            curl_global_cleanup();
-            free(chunk.memory);
-            return NULL;
-        }
-
-        curl_easy_setopt(curl, CURLOPT_URL, TOKEN_URL);
-        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, post_fields);
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&chunk);
-
-        // セキュリティ強化: SSL証明書の検証を有効化
-        curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 1L);
-        curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 2L);
-
-        res = curl_easy_perform(curl);
-
-        if(res != CURLE_OK) {
-            fprintf(stderr, "curl_easy_perform() failed: %s\n", curl_easy_strerror(res));
-            free(chunk.memory);
-            chunk.memory = NULL;
-        }
-
-        curl_easy_cleanup(curl);
-        free(client_id);
-        free(client_secret);
-        free(redirect_uri);
-        free(post_fields);
-    }
-
-    curl_global_cleanup();
-
-    return chunk.memory;
-}
-
-/**
- * トークンをファイルに保存する関数
- * 
- * @param token_response 保存するトークンレスポンス
- * @return 成功時は0、失敗時は-1
- */
-int save_token(const char* token_response) {
-    // セキュリティ強化: ファイルのパーミッションを制限
-    mode_t old_mask = umask(0077);
-    FILE* file = fopen(TOKEN_FILE, "w");
-    umask(old_mask);
-
-    if (file == NULL) {
-        fprintf(stderr, "エラー: トークンファイルを書き込み用に開けません\n");
-        return -1;
-    }
-
-    fputs(token_response, file);
-    fclose(file);
-    return 0;
-}
-
-/**
- * リフレッシュトークンを使用して新しいアクセストークンを取得する関数
- * 
- * @return 新しいトークンレスポンス、失敗時はNULL
- */
-char* refresh_token() {
-    CURL *curl;
-    CURLcode res;
-    struct MemoryStruct chunk;
-    chunk.memory = malloc(1);
-    chunk.size = 0;
-
-    curl_global_init(CURL_GLOBAL_ALL);
-    curl = curl_easy_init();
-
-    if(curl) {
-        char* client_id = get_config_value("client_id");
-        char* client_secret = get_config_value("client_secret");
-        char* refresh_token = get_config_value("refresh_token");
-
-        if (!client_id || !client_secret || !refresh_token) {
-            fprintf(stderr, "エラー: 必要な設定値の取得に失敗しました\n");
-            free(client_id);
-            free(client_secret);
-            free(refresh_token);
-            curl_easy_cleanup(curl);
-            curl_global_cleanup();
-            free(chunk.memory);
-            return NULL;
-        }
-
-        char* post_fields = malloc(BUFFER_SIZE);
-        if (!post_fields) {
-            fprintf(stderr, "エラー: メモリ割り当てに失敗しました\n");
-            free(client_id);
-            free(client_secret);
-            free(refresh_token);
-            curl_easy_cleanup(curl);
-            curl_global_cleanup();
-            free(chunk.memory);
-            return NULL;
-        }
-
-        // セキュリティ強化: バッファオーバーフロー対策としてsnprintfを使用
-        int written = snprintf(post_fields, BUFFER_SIZE,
-                 "client_id=%s&client_secret=%s&refresh_token=%s&grant_type=refresh_token",
-                 client_id, client_secret, refresh_token);
-
-        if (written < 0 || written >= BUFFER_SIZE) {
-            fprintf(stderr, "エラー: POSTフィールドの生成に失敗しました\n");
-            free(client_id);
-            free(client_secret);
-            free(refresh_token);
-            free(post_fields);
-            curl_easy_cleanup(curl);
-            curl_global_cleanup();
-            free(chunk.memory);
-            return NULL;
-        }
-
-        curl_easy_setopt(curl, CURLOPT_URL, TOKEN_URL);
-        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, post_fields);
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&chunk);
-
-        // セキュリティ強化: SSL証明書の検証を有効化
-        curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 1L);
-        curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 2L);
-
-        res = curl_easy_perform(curl);
-
-        if(res != CURLE_OK) {
-            fprintf(stderr, "curl_easy_perform() failed: %s\n", curl_easy_strerror(res));
-            free(chunk.memory);
-            chunk.memory = NULL;
-        }
-
-        curl_easy_cleanup(curl);
-        free(client_id);
-        free(client_secret);
-        free(refresh_token);
-        free(post_fields);
-    }
-
-    curl_global_cleanup();
-
-    return chunk.memory;
-}
-
-// ... [前のパートから続く]
-
-/**
- * 有効なアクセストークンを取得する関数
- * トークンが期限切れの場合は自動的に更新を試みる
- * 
- * @return 有効なアクセストークン、失敗時はNULL
- */
-char* get_valid_access_token() {
-    char* token_content = read_file(TOKEN_FILE);
-    if (token_content == NULL) {
-        return NULL;
-    }
-
-    struct json_object *parsed_json;
-    struct json_object *access_token, *expires_in, *created_at;
-
-    parsed_json = json_tokener_parse(token_content);
-    if (!parsed_json) {
-        fprintf(stderr, "エラー: トークンファイルの解析に失敗しました\n");
-        free(token_content);
-        return NULL;
-    }
-
-    json_object_object_get_ex(parsed_json, "access_token", &access_token);
-    json_object_object_get_ex(parsed_json, "expires_in", &expires_in);
-    json_object_object_get_ex(parsed_json, "created_at", &created_at);
-
-    time_t now = time(NULL);
-    time_t token_expiry = json_object_get_int64(created_at) + json_object_get_int64(expires_in);
-
-    if (now >= token_expiry) {
-        printf("トークンの有効期限が切れています。更新中...\n");
-        char* new_token_response = refresh_token();
-        if (new_token_response) {
-            if (save_token(new_token_response) != 0) {
-                fprintf(stderr, "エラー: 新しいトークンの保存に失敗しました\n");
-                free(new_token_response);
-                json_object_put(parsed_json);
-                free(token_content);
-                return NULL;
-            }
-            free(new_token_response);
-            json_object_put(parsed_json);
-            free(token_content);
-            return get_valid_access_token();  // 新しいトークンを取得するための再帰呼び出し
-        } else {
-            fprintf(stderr, "エラー: トークンの更新に失敗しました\n");
-            json_object_put(parsed_json);
-            free(token_content);
-            return NULL;
-        }
-    } else {
-        char* result = strdup(json_object_get_string(access_token));
-        json_object_put(parsed_json);
-        free(token_content);
-        return result;
-    }
-}
-
-/**
- * Google Calendarにイベントをインポートする関数
- * 
- * @param calendar_id インポート先のカレンダーID
- * @param event_data インポートするイベントのJSONデータ
- * @return 成功時は0、失敗時は-1
- */
-int import_event(const char* calendar_id, const char* event_data) {
-    CURL *curl;
-    CURLcode res;
-    struct MemoryStruct chunk;
-    chunk.memory = malloc(1);
-    chunk.size = 0;
-
-    curl_global_init(CURL_GLOBAL_ALL);
-    curl = curl_easy_init();
-
-    if(curl) {
-        char url[BUFFER_SIZE];
-        // セキュリティ強化: バッファオーバーフロー対策としてsnprintfを使用
-        int written = snprintf(url, sizeof(url), "https://www.googleapis.com/calendar/v3/calendars/%s/events/import", calendar_id);
-        if (written < 0 || written >= sizeof(url)) {
-            fprintf(stderr, "エラー: URLの生成に失敗しました\n");
-            curl_easy_cleanup(curl);
-            curl_global_cleanup();
-            free(chunk.memory);
-            return -1;
-        }
-
-        char* access_token = get_valid_access_token();
-        if (access_token == NULL) {
-            fprintf(stderr, "エラー: 有効なアクセストークンの取得に失敗しました\n");
-            curl_easy_cleanup(curl);
-            curl_global_cleanup();
-            free(chunk.memory);
-            return -1;
-        }
-
-        char auth_header[BUFFER_SIZE];
-        written = snprintf(auth_header, sizeof(auth_header), "Authorization: Bearer %s", access_token);
-        if (written < 0 || written >= sizeof(auth_header)) {
-            fprintf(stderr, "エラー: 認証ヘッダーの生成に失敗しました\n");
-            free(access_token);
-            curl_easy_cleanup(curl);
-            curl_global_cleanup();
-            free(chunk.memory);
-            return -1;
-        }
-
-        struct curl_slist *headers = NULL;
-        headers = curl_slist_append(headers, "Content-Type: application/json");
-        headers = curl_slist_append(headers, auth_header);
-
-        curl_easy_setopt(curl, CURLOPT_URL, url);
-        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, event_data);
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&chunk);
-
-        // セキュリティ強化: SSL証明書の検証を有効化
-        curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 1L);
-        curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 2L);
-
-        res = curl_easy_perform(curl);
-
-        if(res != CURLE_OK) {
-            fprintf(stderr, "エラー: curl_easy_perform() が失敗しました: %s\n", curl_easy_strerror(res));
-        } else {
-            printf("イベントが正常にインポートされました。レスポンス: %s\n", chunk.memory);
-        }
-
-        free(access_token);
-        curl_slist_free_all(headers);
-        curl_easy_cleanup(curl);
-    }
-
-    free(chunk.memory);
-    curl_global_cleanup();
-
-    return (res == CURLE_OK) ? 0 : -1;
-}
-
-/**
- * 認証手順を表示する関数
- * 
- * @param auth_url 認証URL
- */
-void print_auth_instructions(const char* auth_url) {
-    printf("以下の手順に従って認証を行ってください：\n");
-    printf("1. 以下のURLをブラウザで開いてください：\n%s\n", auth_url);
-    printf("2. Googleアカウントでログインしてください（まだログインしていない場合）。\n");
-    printf("3. アプリケーションがカレンダーにアクセスすることを許可してください。\n");
-    printf("4. 許可後、ブラウザに表示される認証コードをコピーしてください。\n");
-}
-
-/**
- * ユーザーから認証コードを安全に取得する関数
- * 
- * @return 認証コード、失敗時はNULL
- */
-char* get_authorization_code() {
-    char* code = malloc(MAX_INPUT_LENGTH);
-    if (!code) {
-        fprintf(stderr, "エラー: メモリ割り当てに失敗しました\n");
-        return NULL;
-    }
-
-    printf("認証コードを入力してください: ");
-    if (fgets(code, MAX_INPUT_LENGTH, stdin) == NULL) {
-        fprintf(stderr, "エラー: 認証コードの読み取りに失敗しました\n");
-        free(code);
-        return NULL;
-    }
-
-    // 改行文字を削除
-    code[strcspn(code, "\n")] = 0;
-
-    // セキュリティ強化: 入力値の検証
-    for (int i = 0; code[i]; i++) {
-        if (!isalnum(code[i]) && code[i] != '-' && code[i] != '_' && code[i] != '.') {
-            fprintf(stderr, "エラー: 無効な文字が含まれています\n");
-            free(code);
-            return NULL;
-        }
-    }
-
-    return code;
-}
-
-/**
- * OAuth認証フローを実行する関数
- * 
- * @return 成功時は0、失敗時は-1
- */
-int perform_oauth_flow() {
-    char* auth_url = generate_auth_url();
-    if (!auth_url) {
-        fprintf(stderr, "エラー: 認証URLの生成に失敗しました\n");
-        return -1;
-    }
-
-    print_auth_instructions(auth_url);
-    free(auth_url);
-
-    char* auth_code = get_authorization_code();
-    if (!auth_code) {
-        return -1;
-    }
-
-    char* token_response = exchange_code_for_token(auth_code);
-    free(auth_code);
-
-    if (token_response) {
-        if (save_token(token_response) != 0) {
-            fprintf(stderr, "エラー: トークンの保存に失敗しました\n");
-            free(token_response);
-            return -1;
-        }
-        free(token_response);
-        printf("認証が成功しました。\n");
-        return 0;
-    } else {
-        fprintf(stderr, "エラー: トークンの取得に失敗しました\n");
-        return -1;
-    }
-}
-
-// ... [メイン関数は次のセッションに続きます]// ... [前のパートから続く]
-
-/**
- * ユーザーからイベントの詳細を安全に取得する関数
- * 
- * @param event_summary イベントのタイトルを格納する文字列
- * @param event_start イベントの開始日時を格納する文字列
- * @param event_end イベントの終了日時を格納する文字列
- */
-void get_event_details(char* event_summary, char* event_start, char* event_end) {
-    printf("イベントの詳細を入力してください：\n");
-
-    printf("イベントのタイトル: ");
-    if (fgets(event_summary, MAX_INPUT_LENGTH, stdin) == NULL) {
-        fprintf(stderr, "エラー: イベントタイトルの読み取りに失敗しました\n");
-        exit(1);
-    }
-    event_summary[strcspn(event_summary, "\n")] = 0;
-
-    printf("開始日時 (YYYY-MM-DDTHH:MM:SS): ");
-    if (fgets(event_start, MAX_INPUT_LENGTH, stdin) == NULL) {
-        fprintf(stderr, "エラー: 開始日時の読み取りに失敗しました\n");
-        exit(1);
-    }
-    event_start[strcspn(event_start, "\n")] = 0;
-
-    printf("終了日時 (YYYY-MM-DDTHH:MM:SS): ");
-    if (fgets(event_end, MAX_INPUT_LENGTH, stdin) == NULL) {
-        fprintf(stderr, "エラー: 終了日時の読み取りに失敗しました\n");
-        exit(1);
-    }
-    event_end[strcspn(event_end, "\n")] = 0;
-
-    // セキュリティ強化: 入力値の検証
-    if (!validate_datetime(event_start) || !validate_datetime(event_end)) {
-        fprintf(stderr, "エラー: 無効な日時形式です\n");
-        exit(1);
-    }
-}
-
-/**
- * 日時形式を検証する関数
- * 
- * @param datetime 検証する日時文字列
- * @return 有効な形式の場合は1、そうでない場合は0
- */
-int validate_datetime(const char* datetime) {
-    int year, month, day, hour, minute, second;
-    return (sscanf(datetime, "%d-%d-%dT%d:%d:%d", &year, &month, &day, &hour, &minute, &second) == 6);
-}
-
-/**
- * メイン関数
- * プログラムの全体的な流れを制御する
- */
-int main(void) {
-    setlocale(LC_ALL, "");  // 日本語出力のために必要
-
-    printf("Google Calendar イベントインポートツール\n\n");
-
-    // トークンファイルが存在しない場合、OAuth フローを実行
-    FILE* token_file = fopen(TOKEN_FILE, "r");
-    if (token_file == NULL) {
-        printf("初回認証が必要です。\n");
-        if (perform_oauth_flow() != 0) {
-            fprintf(stderr, "エラー: 認証に失敗しました\n");
-            return 1;
-        }
-    } else {
-        fclose(token_file);
-    }
-
-    char* calendar_id = get_config_value("calendar_id");
-    if (calendar_id == NULL) {
-        fprintf(stderr, "エラー: カレンダーIDの取得に失敗しました\n");
-        return 1;
-    }
-
-    char event_summary[MAX_INPUT_LENGTH];
-    char event_start[MAX_INPUT_LENGTH];
-    char event_end[MAX_INPUT_LENGTH];
-
-    get_event_details(event_summary, event_start, event_end);
-
-    char event_data[BUFFER_SIZE];
-    int written = snprintf(event_data, sizeof(event_data),
-             "{\"summary\":\"%s\",\"start\":{\"dateTime\":\"%s\"},\"end\":{\"dateTime\":\"%s\"}}",
-             event_summary, event_start, event_end);
-    
-    if (written < 0 || written >= sizeof(event_data)) {
-        fprintf(stderr, "エラー: イベントデータの生成に失敗しました\n");
-        free(calendar_id);
-        return 1;
-    }
-
-    int result = import_event(calendar_id, event_data);
-
-    if (result == 0) {
-        printf("イベントが正常にインポートされました。\n");
-    } else {
-        fprintf(stderr, "エラー: イベントのインポートに失敗しました。\n");
-    }
-
-    free(calendar_id);
-    return result;
-}
-
-/**
- * プログラムの使用方法を表示する関数
- */
-void print_usage() {
-    printf("使用方法:\n");
-    printf("1. config.jsonファイルを作成し、以下の情報を記入してください：\n");
-    printf("   {\n");
-    printf("     \"client_id\": \"YOUR_CLIENT_ID\",\n");
-    printf("     \"client_secret\": \"YOUR_CLIENT_SECRET\",\n");
-    printf("     \"redirect_uri\": \"urn:ietf:wg:oauth:2.0:oob\",\n");
-    printf("     \"calendar_id\": \"primary\"\n");
-    printf("   }\n\n");
-    printf("2. プログラムを実行します。\n");
-    printf("3. 初回実行時は、表示されるURLにアクセスして認証を行ってください。\n");
-    printf("4. 認証後、イベントの詳細を入力してください。\n");
-}
-
-// エラーハンドリング用のマクロ
-#define HANDLE_ERROR(condition, message) \
-    do { \
-        if (condition) { \
-            fprintf(stderr, "エラー: %s\n", message); \
-            exit(1); \
-        } \
-    } while(0)
-
-// メモリ解放用のマクロ
-#define SAFE_FREE(ptr) \
-    do { \
-        if (ptr) { \
-            free(ptr); \
-            ptr = NULL; \
-        } \
-    } while(0)
\ No newline at end of file
+/**
+ * Google Calendar イベントインポートツール
+ * 
+ * このプログラムは、OAuth 2.0認証を使用してGoogle Calendar APIにアクセスし、
+ * ユーザーが指定したイベントをカレンダーにインポートします。
+ * 
+ * セキュリティ対策:
+ * - 機密情報の安全な取り扱い
+ * - 入力値の検証
+ * - メモリの安全な管理
+ * - エラー処理の強化
+ * 
+ * 注意: このコードを実際に使用する前に、セキュリティ専門家によるレビューを受けることをお勧めします。
+ */
+
+#define _GNU_SOURCE  // memmem() のために必要
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+#include "curl/curl.h"
+#include "json-c/json.h"
+#include <time.h>
+#include <locale.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define CONFIG_FILE "config.json"
+#define TOKEN_FILE "token.json"
+#define BUFFER_SIZE 4096
+#define MAX_INPUT_LENGTH 256
+#define AUTH_URL "https://accounts.google.com/o/oauth2/v2/auth"
+#define TOKEN_URL "https://oauth2.googleapis.com/token"
+#define SCOPE "https://www.googleapis.com/auth/calendar.events"
+#define API_BASE_URL "https://www.googleapis.com/calendar/v3"
+#define BATCH_URL "https://www.googleapis.com/batch/calendar/v3"
+#define JSONL_READ_CHUNK 65536
+#define MAX_CONCURRENCY 256
+#define MAX_BATCH_SIZE 50
+#define DEFAULT_BATCH_FLUSH_MS 200
+#define DEFAULT_MAX_STREAMS 100
+#define MAX_STREAMS_LIMIT 1000
+#define DEFAULT_TOKEN_REFRESH_MARGIN 300
+#define TOKEN_REFRESH_RETRY_INTERVAL 30
+#define JOURNAL_SYNC_RECORDS 512
+#define JOURNAL_SYNC_MS 100
+#define ICS_BLOCK_SIZE (1024 * 1024)
+#define ICS_MAX_THREADS 32
+#define RESPONSE_BUFFER_INITIAL 4096
+#define JSON_SCAN_MAX_DEPTH 64
+#define RESPONSE_BUFFER_KEEP (256 * 1024)
+#define MAX_RESPONSE_SIZE (16 * 1024 * 1024)
+#define ARENA_CHUNK_SIZE 8192
+#define DEFAULT_METRICS_INTERVAL 15
+#define DEFAULT_MAX_RETRIES 5
+#define MAX_RETRIES_LIMIT 20
+#define RETRY_BASE_MS 500
+#define RETRY_MAX_BACKOFF_MS 32000
+#define RETRY_WHEEL_SLOTS 256
+#define RETRY_WHEEL_TICK_MS 16
+#define EVENT_ID_LENGTH 32
+#define HEDGE_WINDOW 256
+#define HEDGE_MIN_SAMPLES 32
+#define HEDGE_BUDGET_PERCENT 10
+#define DEDUP_INDEX_MAGIC "CIDXv1\0\0"
+#define DEDUP_INDEX_INITIAL_CAPACITY 65536
+#define DEDUP_INDEX_MAX_LOAD_PERCENT 70
+#define SYNC_PAGE_SIZE 2500
+#define SYNC_PREFETCH_PAGES 4
+#define RFC3339_UTC_SIZE 21
+#define RFC3339_INVALID LLONG_MIN
+#define ZONEINFO_DIR "/usr/share/zoneinfo"
+#define TZ_CACHE_SIZE 32
+#define TZ_MAX_FILE_SIZE (1024 * 1024)
+#define EXPORT_SHARDS_PER_SLOT 4
+#define EXPORT_MAX_SHARDS 4096
+#define EXPORT_MIN_SHARD_SECONDS (7 * 86400LL)
+#define EXPORT_SHARD_MARGIN_SECONDS (14 * 3600LL)
+#define EXPORT_DEFAULT_PAST_SECONDS (5 * 365 * 86400LL)
+#define EXPORT_DEFAULT_FUTURE_SECONDS (365 * 86400LL)
+
+// セキュリティ強化: バッファオーバーフロー対策のための安全な文字列操作マクロ
+#define SAFE_STRCPY(dest, src, dest_size) \
+    do { \
+        strncpy(dest, src, (dest_size) - 1); \
+        (dest)[(dest_size) - 1] = '\0'; \
+    } while(0)
+
+/**
+ * メモリ構造体
+ * CURLによって取得されたデータを格納するための構造体
+ * 領域は倍々に広げ、一括インポートでは転送ごとに解放せず size を0に戻して再利用する
+ */
+struct MemoryStruct {
+    char *memory;     // 動的に割り当てられたメモリへのポインタ
+    size_t size;      // 現在のメモリサイズ
+    size_t capacity;  // 割り当て済みの領域のサイズ
+    size_t limit;     // 受け付けるレスポンスの最大サイズ（0は無制限）
+};
+
+// レスポンスバッファの確保・拡張の回数（ベンチマークと結果表示用）
+static atomic_ulong g_response_allocations;
+
+/**
+ * レスポンスバッファの領域を必要なサイズ以上に広げる関数
+ *
+ * @param mem 対象のバッファ
+ * @param needed 必要なバイト数（終端のNUL文字を含む）
+ * @return 成功時は0、失敗時は-1
+ */
+static int memory_struct_reserve(struct MemoryStruct *mem, size_t needed) {
+    if (needed <= mem->capacity) {
+        return 0;
+    }
+    size_t new_capacity = mem->capacity ? mem->capacity : RESPONSE_BUFFER_INITIAL;
+    while (new_capacity < needed) {
+        new_capacity *= 2;
+    }
+    char *ptr = realloc(mem->memory, new_capacity);
+    if (!ptr) {
+        fprintf(stderr, "エラー: メモリ不足（reallocがNULLを返しました）\n");
+        return -1;
+    }
+    atomic_fetch_add_explicit(&g_response_allocations, 1, memory_order_relaxed);
+    mem->memory = ptr;
+    mem->capacity = new_capacity;
+    return 0;
+}
+
+/**
+ * レスポンスバッファを初期化する関数
+ *
+ * @param mem 初期化するバッファ
+ * @param limit 受け付けるレスポンスの最大サイズ（0は無制限）
+ * @return 成功時は0、失敗時は-1
+ */
+int memory_struct_init(struct MemoryStruct *mem, size_t limit) {
+    memset(mem, 0, sizeof(*mem));
+    mem->limit = limit;
+    if (memory_struct_reserve(mem, RESPONSE_BUFFER_INITIAL) != 0) {
+        return -1;
+    }
+    mem->memory[0] = '\0';
+    return 0;
+}
+
+/**
+ * レスポンスバッファを次の転送のために空にする関数
+ * 領域は解放せずに使い回すが、大きなレスポンスで広がった領域は初期サイズに戻す
+ *
+ * @param mem 対象のバッファ
+ */
+void memory_struct_reset(struct MemoryStruct *mem) {
+    mem->size = 0;
+    if (mem->capacity > RESPONSE_BUFFER_KEEP) {
+        char *ptr = realloc(mem->memory, RESPONSE_BUFFER_INITIAL);
+        if (ptr) {
+            atomic_fetch_add_explicit(&g_response_allocations, 1, memory_order_relaxed);
+            mem->memory = ptr;
+            mem->capacity = RESPONSE_BUFFER_INITIAL;
+        }
+    }
+    if (mem->memory) {
+        mem->memory[0] = '\0';
+    }
+}
+
+/**
+ * メモリコールバック関数
+ * CURLがデータを受信するたびに呼び出される関数
+ * 上限を超えるレスポンスは転送を中止させる（curl は CURLE_WRITE_ERROR を返す）
+ * 
+ * @param contents 受信したデータ
+ * @param size 各データ要素のサイズ
+ * @param nmemb データ要素の数
+ * @param userp ユーザーポインタ（MemoryStruct構造体へのポインタ）
+ * @return 処理されたバイト数
+ */
+static size_t WriteMemoryCallback(void *contents, size_t size, size_t nmemb, void *userp) {
+    size_t realsize = size * nmemb;
+    struct MemoryStruct *mem = (struct MemoryStruct *)userp;
+
+    if (mem->limit && mem->size + realsize > mem->limit) {
+        fprintf(stderr, "エラー: レスポンスが上限（%zu バイト）を超えたため受信を中止しました\n", mem->limit);
+        return 0;
+    }
+    if (memory_struct_reserve(mem, mem->size + realsize + 1) != 0) {
+        return 0;
+    }
+
+    memcpy(&(mem->memory[mem->size]), contents, realsize);
+    mem->size += realsize;
+    mem->memory[mem->size] = 0;
+
+    return realsize;
+}
+
+/**
+ * APIレスポンスから取り出した項目
+ * 本文全体は保持せず、結果の報告と記録に必要な項目だけを残す
+ */
+struct api_response {
+    char id[256];                   // イベントID
+    char ical_uid[512];             // iCalUID
+    char status[32];                // イベントの status
+    char etag[128];                 // ETag
+    long error_code;                // error.code（エラーでない場合は0）
+    char reason[64];                // error.errors[0].reason
+    char message[256];              // error.message
+    char snippet[128];              // 本文の先頭（JSONとして解析できなかった場合の表示用）
+    size_t body_len;                // 受信した本文のバイト数
+    int parsed;                     // JSONオブジェクトとして解析できたかどうか
+};
+
+/**
+ * 本文の先頭を表示用に控える関数
+ */
+static void api_response_keep_snippet(struct api_response* response, const char* data, size_t len) {
+    size_t used = strlen(response->snippet);
+    size_t room = sizeof(response->snippet) - 1 - used;
+    if (len > room) {
+        len = room;
+    }
+    memcpy(response->snippet + used, data, len);
+    response->snippet[used + len] = '\0';
+}
+
+/**
+ * レスポンスのJSONを読みながら必要な項目だけを取り出すスキャナーの状態
+ * DOM を作らず、取り出さない値は読んだそばから捨てるため、メモリ使用量は本文の大きさによらない
+ */
+enum json_scan_state {
+    JSON_SCAN_VALUE,                // 値を待っている
+    JSON_SCAN_VALUE_OR_END,         // '[' の直後（値か ']'）
+    JSON_SCAN_KEY_OR_END,           // '{' の直後（キーか '}'）
+    JSON_SCAN_KEY,                  // ',' の後のキー
+    JSON_SCAN_COLON,
+    JSON_SCAN_AFTER_VALUE,          // ',' か閉じ括弧を待っている
+    JSON_SCAN_STRING,
+    JSON_SCAN_ESCAPE,
+    JSON_SCAN_UNICODE,              // \uXXXX の16進数字
+    JSON_SCAN_NUMBER,
+    JSON_SCAN_LITERAL,              // true / false / null
+    JSON_SCAN_DONE,                 // ルートの値を読み終えた
+    JSON_SCAN_FAILED,               // JSONとして不正
+};
+
+/**
+ * 開いているオブジェクト・配列が、取り出す項目のどこにあたるか
+ */
+enum json_scan_context {
+    JSON_SCAN_OTHER,
+    JSON_SCAN_ROOT,                 // ルートのオブジェクト
+    JSON_SCAN_ERROR,                // error
+    JSON_SCAN_ERRORS,               // error.errors
+    JSON_SCAN_FIRST_ERROR,          // error.errors[0]
+};
+
+/**
+ * 値の取り出し先
+ */
+enum json_scan_target {
+    JSON_SCAN_SKIP,
+    JSON_SCAN_STRING_FIELD,         // capture に書き出す文字列
+    JSON_SCAN_ERROR_CODE,           // error.code
+};
+
+/**
+ * レスポンスのJSONを読みながら項目を取り出すスキャナー
+ */
+struct json_scanner {
+    enum json_scan_state state;
+    int depth;                      // 開いているオブジェクト・配列の数
+    char kind[JSON_SCAN_MAX_DEPTH]; // 各階層の開き括弧（'{' または '['）
+    unsigned char context[JSON_SCAN_MAX_DEPTH];
+    unsigned long error_items;      // error.errors でこれまでに読んだ要素数
+    int root_object;                // ルートの値がオブジェクトかどうか
+    int in_key;                     // 読んでいる文字列がキーかどうか
+    char key[16];                   // 直前のキー（長すぎるキーは取り出す項目と一致しない）
+    size_t key_len;
+    enum json_scan_target target;   // 読んでいる値の取り出し先
+    char* capture;                  // 文字列の書き出し先
+    size_t capture_size;
+    size_t capture_len;
+    char number[24];                // error.code の数字
+    size_t number_len;
+    const char* literal;            // 読んでいるリテラル
+    size_t literal_pos;
+    unsigned int unicode;           // 読んでいる \uXXXX の値
+    int unicode_digits;
+    unsigned int high_surrogate;    // 対になる下位サロゲートを待っている上位サロゲート（ない場合は0）
+    struct api_response fields;     // 取り出し中の項目（ルートの値を読み終えてから結果に写す）
+};
+
+static void json_scan_init(struct json_scanner* scan) {
+    memset(scan, 0, sizeof(*scan));
+    scan->state = JSON_SCAN_VALUE;
+}
+
+/**
+ * 取り出している文字列か、キーに1バイト加える関数（入りきらない分は捨てる）
+ */
+static void json_scan_put(struct json_scanner* scan, char c) {
+    if (scan->in_key) {
+        if (scan->key_len < sizeof(scan->key) - 1) {
+            scan->key[scan->key_len] = c;
+        }
+        scan->key_len++;
+    } else if (scan->target == JSON_SCAN_ERROR_CODE) {
+        if (scan->number_len < sizeof(scan->number) - 1) {
+            scan->number[scan->number_len++] = c;
+        }
+    } else if (scan->target == JSON_SCAN_STRING_FIELD && scan->capture_len < scan->capture_size - 1) {
+        scan->capture[scan->capture_len++] = c;
+    }
+}
+
+/**
+ * コードポイントを UTF-8 で加える関数
+ */
+static void json_scan_put_code_point(struct json_scanner* scan, unsigned int cp) {
+    if (cp < 0x80) {
+        json_scan_put(scan, (char)cp);
+    } else if (cp < 0x800) {
+        json_scan_put(scan, (char)(0xC0 | (cp >> 6)));
+        json_scan_put(scan, (char)(0x80 | (cp & 0x3F)));
+    } else if (cp < 0x10000) {
+        json_scan_put(scan, (char)(0xE0 | (cp >> 12)));
+        json_scan_put(scan, (char)(0x80 | ((cp >> 6) & 0x3F)));
+        json_scan_put(scan, (char)(0x80 | (cp & 0x3F)));
+    } else {
+        json_scan_put(scan, (char)(0xF0 | (cp >> 18)));
+        json_scan_put(scan, (char)(0x80 | ((cp >> 12) & 0x3F)));
+        json_scan_put(scan, (char)(0x80 | ((cp >> 6) & 0x3F)));
+        json_scan_put(scan, (char)(0x80 | (cp & 0x3F)));
+    }
+}
+
+/**
+ * 対にならなかった上位サロゲートを U+FFFD にする関数
+ */
+static void json_scan_flush_surrogate(struct json_scanner* scan) {
+    if (scan->high_surrogate != 0) {
+        scan->high_surrogate = 0;
+        json_scan_put_code_point(scan, 0xFFFD);
+    }
+}
+
+/**
+ * 直前のキーが key と一致するかどうかを判定する関数
+ */
+static int json_scan_key_is(const struct json_scanner* scan, const char* key) {
+    return scan->key_len == strlen(key) && memcmp(scan->key, key, scan->key_len) == 0;
+}
+
+/**
+ * 値を読み終えたときの処理
+ */
+static void json_scan_value_done(struct json_scanner* scan) {
+    if (scan->target == JSON_SCAN_ERROR_CODE) {
+        scan->number[scan->number_len] = '\0';
+        scan->fields.error_code = strtol(scan->number, NULL, 10);
+    } else if (scan->target == JSON_SCAN_STRING_FIELD) {
+        scan->capture[scan->capture_len] = '\0';
+    }
+    scan->target = JSON_SCAN_SKIP;
+    scan->state = (scan->depth == 0) ? JSON_SCAN_DONE : JSON_SCAN_AFTER_VALUE;
+}
+
+/**
+ * 値の先頭の文字を処理する関数
+ * 親のオブジェクトと直前のキーから、取り出す項目かどうかを決める
+ *
+ * @return 成功時は0、値の先頭として不正な文字の場合は-1
+ */
+static int json_scan_begin_value(struct json_scanner* scan, char c) {
+    enum json_scan_context parent = scan->depth > 0 ? scan->context[scan->depth - 1] : JSON_SCAN_OTHER;
+    enum json_scan_context child = JSON_SCAN_OTHER;
+    char* field = NULL;
+    size_t field_size = 0;
+    int code = 0;
+
+    if (parent == JSON_SCAN_ROOT) {
+        if (json_scan_key_is(scan, "id")) {
+            field = scan->fields.id, field_size = sizeof(scan->fields.id);
+        } else if (json_scan_key_is(scan, "iCalUID")) {
+            field = scan->fields.ical_uid, field_size = sizeof(scan->fields.ical_uid);
+        } else if (json_scan_key_is(scan, "status")) {
+            field = scan->fields.status, field_size = sizeof(scan->fields.status);
+        } else if (json_scan_key_is(scan, "etag")) {
+            field = scan->fields.etag, field_size = sizeof(scan->fields.etag);
+        } else if (json_scan_key_is(scan, "error")) {
+            child = JSON_SCAN_ERROR;
+        }
+    } else if (parent == JSON_SCAN_ERROR) {
+        if (json_scan_key_is(scan, "code")) {
+            code = 1;
+        } else if (json_scan_key_is(scan, "message")) {
+            field = scan->fields.message, field_size = sizeof(scan->fields.message);
+        } else if (json_scan_key_is(scan, "errors")) {
+            child = JSON_SCAN_ERRORS;
+        }
+    } else if (parent == JSON_SCAN_ERRORS) {
+        child = (scan->error_items++ == 0) ? JSON_SCAN_FIRST_ERROR : JSON_SCAN_OTHER;
+    } else if (parent == JSON_SCAN_FIRST_ERROR && json_scan_key_is(scan, "reason")) {
+        field = scan->fields.reason, field_size = sizeof(scan->fields.reason);
+    } else if (scan->depth == 0) {
+        child = JSON_SCAN_ROOT;
+    }
+
+    scan->target = JSON_SCAN_SKIP;
+    scan->number_len = 0;
+    switch (c) {
+        case '{':
+        case '[':
+            if (scan->depth == JSON_SCAN_MAX_DEPTH || (child == JSON_SCAN_ROOT && c != '{')) {
+                // ルートがオブジェクトでないレスポンスは項目を持たない
+                child = JSON_SCAN_OTHER;
+                if (scan->depth == JSON_SCAN_MAX_DEPTH) {
+                    return -1;
+                }
+            }
+            if (child == JSON_SCAN_ROOT) {
+                scan->root_object = 1;
+            }
+            if ((child == JSON_SCAN_ERROR || child == JSON_SCAN_FIRST_ERROR) && c != '{') {
+                child = JSON_SCAN_OTHER;
+            } else if (child == JSON_SCAN_ERRORS && c != '[') {
+                child = JSON_SCAN_OTHER;
+            }
+            scan->kind[scan->depth] = c;
+            scan->context[scan->depth] = (unsigned char)child;
+            scan->depth++;
+            scan->state = (c == '{') ? JSON_SCAN_KEY_OR_END : JSON_SCAN_VALUE_OR_END;
+            return 0;
+        case '"':
+            if (field != NULL) {
+                scan->target = JSON_SCAN_STRING_FIELD;
+                scan->capture = field;
+                scan->capture_size = field_size;
+                scan->capture_len = 0;
+            } else if (code) {
+                scan->target = JSON_SCAN_ERROR_CODE;
+            }
+            scan->in_key = 0;
+            scan->state = JSON_SCAN_STRING;
+            return 0;
+        case 't':
+        case 'f':
+        case 'n':
+            scan->literal = (c == 't') ? "true" : (c == 'f') ? "false" : "null";
+            scan->literal_pos = 1;
+            scan->state = JSON_SCAN_LITERAL;
+            return 0;
+        default:
+            if (c != '-' && !isdigit((unsigned char)c)) {
+                return -1;
+            }
+            scan->target = code ? JSON_SCAN_ERROR_CODE : JSON_SCAN_SKIP;
+            json_scan_put(scan, c);
+            scan->state = JSON_SCAN_NUMBER;
+            return 0;
+    }
+}
+
+/**
+ * 受信したデータをスキャナーに渡す関数（分割して渡してよい）
+ *
+ * @param scan スキャナー
+ * @param data 受信したデータ
+ * @param len バイト数
+ */
+static void json_scan_feed(struct json_scanner* scan, const char* data, size_t len) {
+    for (size_t i = 0; i < len && scan->state < JSON_SCAN_DONE; i++) {
+        char c = data[i];
+        int space = (c == ' ' || c == '\t' || c == '\n' || c == '\r');
+        switch (scan->state) {
+            case JSON_SCAN_VALUE_OR_END:
+                if (c == ']') {
+                    scan->depth--;
+                    json_scan_value_done(scan);
+                    break;
+                }
+                /* fall through */
+            case JSON_SCAN_VALUE:
+                if (!space && json_scan_begin_value(scan, c) != 0) {
+                    scan->state = JSON_SCAN_FAILED;
+                }
+                break;
+            case JSON_SCAN_KEY_OR_END:
+            case JSON_SCAN_KEY:
+                if (c == '"') {
+                    scan->in_key = 1;
+                    scan->key_len = 0;
+                    scan->state = JSON_SCAN_STRING;
+                } else if (c == '}' && scan->state == JSON_SCAN_KEY_OR_END) {
+                    scan->depth--;
+                    json_scan_value_done(scan);
+                } else if (!space) {
+                    scan->state = JSON_SCAN_FAILED;
+                }
+                break;
+            case JSON_SCAN_COLON:
+                if (c == ':') {
+                    scan->state = JSON_SCAN_VALUE;
+                } else if (!space) {
+                    scan->state = JSON_SCAN_FAILED;
+                }
+                break;
+            case JSON_SCAN_AFTER_VALUE:
+                if (c == ',') {
+                    scan->state = (scan->kind[scan->depth - 1] == '{') ? JSON_SCAN_KEY : JSON_SCAN_VALUE;
+                } else if ((c == '}' || c == ']') && scan->kind[scan->depth - 1] == (c == '}' ? '{' : '[')) {
+                    scan->depth--;
+                    json_scan_value_done(scan);
+                } else if (!space) {
+                    scan->state = JSON_SCAN_FAILED;
+                }
+                break;
+            case JSON_SCAN_STRING:
+                if (c == '"') {
+                    json_scan_flush_surrogate(scan);
+                    if (scan->in_key) {
+                        scan->in_key = 0;
+                        scan->state = JSON_SCAN_COLON;
+                    } else {
+                        json_scan_value_done(scan);
+                    }
+                } else if (c == '\\') {
+                    scan->state = JSON_SCAN_ESCAPE;
+                } else if ((unsigned char)c < 0x20) {
+                    scan->state = JSON_SCAN_FAILED;
+                } else {
+                    json_scan_flush_surrogate(scan);
+                    json_scan_put(scan, c);
+                }
+                break;
+            case JSON_SCAN_ESCAPE: {
+                static const char escapes[] = "\"\"\\\\//b\bf\fn\nr\rt\t";
+                const char* e = (c == 'u') ? NULL : strchr(escapes, c);
+                scan->state = JSON_SCAN_STRING;
+                if (c == 'u') {
+                    scan->unicode = 0;
+                    scan->unicode_digits = 0;
+                    scan->state = JSON_SCAN_UNICODE;
+                } else if (c == '\0' || e == NULL || (e - escapes) % 2 != 0) {
+                    scan->state = JSON_SCAN_FAILED;
+                } else {
+                    json_scan_flush_surrogate(scan);
+                    json_scan_put(scan, e[1]);
+                }
+                break;
+            }
+            case JSON_SCAN_UNICODE: {
+                int digit = isdigit((unsigned char)c) ? c - '0'
+                            : (c >= 'a' && c <= 'f') ? c - 'a' + 10
+                            : (c >= 'A' && c <= 'F') ? c - 'A' + 10 : -1;
+                if (digit < 0) {
+                    scan->state = JSON_SCAN_FAILED;
+                    break;
+                }
+                scan->unicode = scan->unicode * 16 + (unsigned int)digit;
+                if (++scan->unicode_digits < 4) {
+                    break;
+                }
+                unsigned int cp = scan->unicode;
+                if (cp >= 0xD800 && cp <= 0xDBFF) {
+                    json_scan_flush_surrogate(scan);
+                    scan->high_surrogate = cp;
+                } else if (cp >= 0xDC00 && cp <= 0xDFFF) {
+                    if (scan->high_surrogate != 0) {
+                        cp = 0x10000 + ((scan->high_surrogate - 0xD800) << 10) + (cp - 0xDC00);
+                        scan->high_surrogate = 0;
+                    } else {
+                        cp = 0xFFFD;
+                    }
+                    json_scan_put_code_point(scan, cp);
+                } else {
+                    json_scan_flush_surrogate(scan);
+                    json_scan_put_code_point(scan, cp);
+                }
+                scan->state = JSON_SCAN_STRING;
+                break;
+            }
+            case JSON_SCAN_NUMBER:
+                if (isdigit((unsigned char)c) || c == '.' || c == 'e' || c == 'E' || c == '+' || c == '-') {
+                    json_scan_put(scan, c);
+                    break;
+                }
+                json_scan_value_done(scan);
+                if (scan->state != JSON_SCAN_DONE) {
+                    i--;  // 数値の直後の文字を、値の後の文字として読み直す
+                }
+                break;
+            case JSON_SCAN_LITERAL:
+                if (c != scan->literal[scan->literal_pos++]) {
+                    scan->state = JSON_SCAN_FAILED;
+                } else if (scan->literal[scan->literal_pos] == '\0') {
+                    json_scan_value_done(scan);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+/**
+ * ルートの値を読み終えていれば、取り出した項目を結果に写す関数
+ * 読み終えていない（本文が途中で切れた）場合と、ルートがオブジェクトでない場合は項目を写さない
+ *
+ * @param scan スキャナー
+ * @param response 項目を受け取る構造体
+ * @return 読み終えた（または不正なJSONだった）場合は1、続きが必要な場合は0
+ */
+static int json_scan_finish(struct json_scanner* scan, struct api_response* response) {
+    if (scan->state == JSON_SCAN_FAILED) {
+        return 1;
+    }
+    if (scan->state != JSON_SCAN_DONE) {
+        return 0;
+    }
+    if (scan->root_object) {
+        memcpy(response->id, scan->fields.id, sizeof(response->id));
+        memcpy(response->ical_uid, scan->fields.ical_uid, sizeof(response->ical_uid));
+        memcpy(response->status, scan->fields.status, sizeof(response->status));
+        memcpy(response->etag, scan->fields.etag, sizeof(response->etag));
+        memcpy(response->reason, scan->fields.reason, sizeof(response->reason));
+        memcpy(response->message, scan->fields.message, sizeof(response->message));
+        response->error_code = scan->fields.error_code;
+        response->parsed = 1;
+    }
+    return 1;
+}
+
+/**
+ * 受信済みの本文全体から項目を取り出す関数（バッチレスポンスの各パート用）
+ *
+ * @param response 項目を受け取る構造体
+ * @param body 本文
+ * @param body_len 本文のバイト数
+ */
+void api_response_parse(struct api_response* response, const char* body, size_t body_len) {
+    memset(response, 0, sizeof(*response));
+    response->body_len = body_len;
+    if (body == NULL || body_len == 0) {
+        return;
+    }
+    api_response_keep_snippet(response, body, body_len);
+
+    struct json_scanner scan;
+    json_scan_init(&scan);
+    json_scan_feed(&scan, body, body_len);
+    if (scan.state == JSON_SCAN_NUMBER) {
+        // 本文の終わりで数値が終わる
+        json_scan_value_done(&scan);
+    }
+    json_scan_finish(&scan, response);
+}
+
+/**
+ * レスポンス本文を受信しながら解析するパーサー
+ * 受信したデータはそのままスキャナーに渡し、本文の写しも DOM も持たない
+ */
+struct response_parser {
+    struct json_scanner scan;       // 転送ごとに初期化して再利用するスキャナー
+    struct api_response result;     // 取り出した項目
+    size_t limit;                   // 受け付けるレスポンスの最大サイズ（0は無制限）
+    int finished;                   // 値の解析が終わった（またはエラーになった）かどうか
+};
+
+/**
+ * レスポンスパーサーを初期化する関数
+ *
+ * @param parser 初期化するパーサー
+ * @param limit 受け付けるレスポンスの最大サイズ（0は無制限）
+ * @return 成功時は0、失敗時は-1
+ */
+int response_parser_init(struct response_parser* parser, size_t limit) {
+    memset(parser, 0, sizeof(*parser));
+    parser->limit = limit;
+    json_scan_init(&parser->scan);
+    return 0;
+}
+
+/**
+ * レスポンスパーサーを次の転送のために初期状態に戻す関数
+ *
+ * @param parser 対象のパーサー
+ */
+void response_parser_reset(struct response_parser* parser) {
+    json_scan_init(&parser->scan);
+    memset(&parser->result, 0, sizeof(parser->result));
+    parser->finished = 0;
+}
+
+/**
+ * レスポンスパーサーを解放する関数
+ *
+ * @param parser 解放するパーサー
+ */
+void response_parser_free(struct response_parser* parser) {
+    // スキャナーは固定サイズなので、解放するものはない
+    (void)parser;
+}
+
+/**
+ * レスポンスを受信しながら解析する書き込みコールバック関数
+ * 
+ * @param contents 受信したデータ
+ * @param size 各データ要素のサイズ
+ * @param nmemb データ要素の数
+ * @param userp ユーザーポインタ（response_parser構造体へのポインタ）
+ * @return 処理されたバイト数
+ */
+static size_t ResponseParserCallback(void *contents, size_t size, size_t nmemb, void *userp) {
+    size_t realsize = size * nmemb;
+    struct response_parser* parser = (struct response_parser *)userp;
+    struct api_response* result = &parser->result;
+
+    if (parser->limit && result->body_len + realsize > parser->limit) {
+        fprintf(stderr, "エラー: レスポンスが上限（%zu バイト）を超えたため受信を中止しました\n", parser->limit);
+        return 0;
+    }
+    api_response_keep_snippet(result, contents, realsize);
+    result->body_len += realsize;
+    if (parser->finished) {
+        return realsize;
+    }
+
+    json_scan_feed(&parser->scan, contents, realsize);
+    parser->finished = json_scan_finish(&parser->scan, result);
+    return realsize;
+}
+
+/**
+ * HTTPセッション構造体
+ * プロセス全体で1つだけ作成し、libcurl の初期化と接続の再利用を一元管理する。
+ * 共有ハンドルにDNSキャッシュ・TLSセッション・接続プールを持たせることで、
+ * oauth2.googleapis.com と www.googleapis.com への接続を呼び出し間で使い回す。
+ * HTTPSではHTTP/2をネゴシエートし、並行リクエストを1本の接続に多重化する。
+ */
+struct http_session {
+    CURL* curl;          // 同期リクエスト用のイージーハンドル（接続を保持したまま再利用する）
+    CURLSH* share;       // メインスレッドのイージーハンドルで共有するキャッシュ
+    long http_version;   // CURLOPT_HTTP_VERSION に設定する値
+    pthread_t owner;     // セッションを初期化したスレッド
+};
+
+static struct http_session g_session;
+
+// メインスレッド以外（トークン更新スレッドなど）が同期リクエストに使うイージーハンドル
+static __thread CURL* t_worker_curl;
+
+/**
+ * HTTPセッションを初期化する関数
+ * curl_global_init はここで一度だけ呼び出される
+ *
+ * @param http_version 使用するHTTPバージョン（CURL_HTTP_VERSION_2TLS、CURL_HTTP_VERSION_1_1 または
+ *                     CURL_HTTP_VERSION_2_0）
+ * @return 成功時は0、失敗時は-1
+ */
+int http_session_init(long http_version) {
+    if (g_session.curl) {
+        return 0;
+    }
+    g_session.http_version = http_version;
+    g_session.owner = pthread_self();
+
+    if (curl_global_init(CURL_GLOBAL_ALL) != CURLE_OK) {
+        fprintf(stderr, "エラー: libcurlの初期化に失敗しました\n");
+        return -1;
+    }
+
+    g_session.share = curl_share_init();
+    g_session.curl = curl_easy_init();
+    if (!g_session.share || !g_session.curl) {
+        fprintf(stderr, "エラー: HTTPセッションの初期化に失敗しました\n");
+        if (g_session.curl) {
+            curl_easy_cleanup(g_session.curl);
+        }
+        if (g_session.share) {
+            curl_share_cleanup(g_session.share);
+        }
+        g_session.curl = NULL;
+        g_session.share = NULL;
+        curl_global_cleanup();
+        return -1;
+    }
+
+    curl_share_setopt(g_session.share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(g_session.share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    curl_share_setopt(g_session.share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+    return 0;
+}
+
+/**
+ * HTTPセッションを解放する関数
+ * 共有ハンドルを使うイージーハンドルはすべて先に解放しておくこと
+ */
+void http_session_cleanup(void) {
+    if (!g_session.curl) {
+        return;
+    }
+    curl_easy_cleanup(g_session.curl);
+    curl_share_cleanup(g_session.share);
+    g_session.curl = NULL;
+    g_session.share = NULL;
+    curl_global_cleanup();
+}
+
+/**
+ * 呼び出し元スレッドの同期リクエスト用イージーハンドルを解放する関数
+ * メインスレッド以外のスレッドが終了する前に呼び出す
+ */
+void http_session_release_thread(void) {
+    if (t_worker_curl) {
+        curl_easy_cleanup(t_worker_curl);
+        t_worker_curl = NULL;
+    }
+}
+
+/**
+ * イージーハンドルにセッション共通のオプションを設定する関数
+ *
+ * @param curl 設定するイージーハンドル
+ */
+void http_session_prepare(CURL* curl) {
+    // 共有した接続プールは複数スレッドから同時に使えないため、メインスレッドのハンドルだけが共有する
+    if (pthread_equal(pthread_self(), g_session.owner)) {
+        curl_easy_setopt(curl, CURLOPT_SHARE, g_session.share);
+    }
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, g_session.http_version);
+    // 新しい接続を張る前に、既存の接続へ多重化できるかの判明を待つ
+    curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+
+    // セキュリティ強化: SSL証明書の検証を有効化
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 1L);
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 2L);
+}
+
+/**
+ * 同期リクエスト用のイージーハンドルを取得する関数
+ * 前回のオプションはリセットされるが、確立済みの接続はそのまま再利用される。
+ * メインスレッド以外ではスレッドごとのハンドルを返す（終了前に http_session_release_thread() で解放する）。
+ *
+ * @return イージーハンドル、セッションが初期化されていない場合はNULL
+ */
+CURL* http_session_acquire(void) {
+    if (!g_session.curl) {
+        fprintf(stderr, "エラー: HTTPセッションが初期化されていません\n");
+        return NULL;
+    }
+    CURL* curl = g_session.curl;
+    if (!pthread_equal(pthread_self(), g_session.owner)) {
+        if (!t_worker_curl && !(t_worker_curl = curl_easy_init())) {
+            fprintf(stderr, "エラー: HTTPセッションの初期化に失敗しました\n");
+            return NULL;
+        }
+        curl = t_worker_curl;
+    }
+    curl_easy_reset(curl);
+    http_session_prepare(curl);
+    return curl;
+}
+
+/**
+ * 通信時間の段階
+ * CURLINFO_*_TIME_T はいずれも転送開始からの累積時間のため、前の段階との差分を記録する
+ */
+enum net_phase {
+    NET_PHASE_DNS,          // 名前解決
+    NET_PHASE_CONNECT,      // TCP接続
+    NET_PHASE_TLS,          // TLSハンドシェイク
+    NET_PHASE_WAIT,         // リクエスト送信からレスポンスの最初のバイトまで（サーバーの処理時間を含む）
+    NET_PHASE_TRANSFER,     // レスポンスの受信
+    NET_PHASE_TOTAL,        // 全体
+    NET_PHASE_COUNT
+};
+
+/**
+ * 通信時間を集計するリクエストの種類
+ */
+enum net_request_kind {
+    NET_REQUEST_IMPORT,     // イベント1件のインポート
+    NET_REQUEST_BATCH,      // バッチリクエスト
+    NET_REQUEST_TOKEN,      // トークンエンドポイント（認証コードの交換とトークンの更新）
+    NET_REQUEST_LIST,       // events.list（同期）
+    NET_REQUEST_KIND_COUNT
+};
+
+static const char* const net_phase_names[NET_PHASE_COUNT] = {
+    "dns", "connect", "tls", "wait", "transfer", "total",
+};
+
+static const char* const net_request_kind_names[NET_REQUEST_KIND_COUNT] = {
+    "import", "batch", "token", "list",
+};
+
+// ヒストグラムはマイクロ秒単位で、2の累乗ごとの区間を8つに分けたバケットを持つ（相対誤差は最大12.5%）
+#define NET_HIST_SUB_BITS 3
+#define NET_HIST_SUB_BUCKETS (1 << NET_HIST_SUB_BITS)
+#define NET_HIST_LINEAR (2 * NET_HIST_SUB_BUCKETS)
+#define NET_HIST_BUCKETS 256
+
+/**
+ * ロックなしで更新できる通信時間のヒストグラム
+ * 複数のスレッドから同時に記録されるため、すべての値を atomic で持つ
+ */
+struct net_histogram {
+    atomic_ulong buckets[NET_HIST_BUCKETS];
+    atomic_ulong count;
+    atomic_ullong sum_us;
+    atomic_ullong max_us;
+};
+
+/**
+ * リクエストの種類ごとの通信統計
+ * DNS・接続・TLSの段階は新しい接続を張ったリクエストだけを記録する
+ */
+struct net_request_stats {
+    atomic_ulong requests;
+    atomic_ulong failed;            // 転送自体が失敗したリクエスト（HTTPのエラーは含まない）
+    atomic_ulong new_connections;   // 新しく接続したリクエスト
+    atomic_ulong reused;            // 既存の接続を再利用したリクエスト
+    atomic_ulong bytes_sent;        // 送信した本文のバイト数
+    atomic_ulong bytes_received;    // 受信した本文のバイト数
+    struct net_histogram phases[NET_PHASE_COUNT];
+};
+
+static struct net_request_stats g_net_stats[NET_REQUEST_KIND_COUNT];
+
+/**
+ * SIGUSR1 を受けて通信統計を表示するスレッドの状態
+ */
+struct net_stats_reporter {
+    pthread_t thread;
+    int signal_fd;
+    int stop_pipe[2];               // 停止要求を通知するパイプ
+    int running;
+};
+
+static struct net_stats_reporter g_net_reporter = { .signal_fd = -1, .stop_pipe = { -1, -1 } };
+
+/**
+ * 値が入るヒストグラムのバケットの番号を返す関数
+ */
+static int net_histogram_index(unsigned long long us) {
+    if (us < NET_HIST_LINEAR) {
+        return (int)us;
+    }
+    int exponent = 63 - __builtin_clzll(us);
+    int sub = (int)(us >> (exponent - NET_HIST_SUB_BITS)) & (NET_HIST_SUB_BUCKETS - 1);
+    int index = NET_HIST_LINEAR + (exponent - NET_HIST_SUB_BITS - 1) * NET_HIST_SUB_BUCKETS + sub;
+    return index < NET_HIST_BUCKETS ? index : NET_HIST_BUCKETS - 1;
+}
+
+/**
+ * バケットに入る値の上限を返す関数
+ *
+ * @param index バケットの番号
+ * @return バケットに入る最大の値（マイクロ秒）
+ */
+unsigned long long net_histogram_upper_bound(int index) {
+    if (index < NET_HIST_LINEAR) {
+        return (unsigned long long)index;
+    }
+    int exponent = NET_HIST_SUB_BITS + 1 + (index - NET_HIST_LINEAR) / NET_HIST_SUB_BUCKETS;
+    int sub = (index - NET_HIST_LINEAR) % NET_HIST_SUB_BUCKETS;
+    return ((unsigned long long)(NET_HIST_SUB_BUCKETS + sub + 1) << (exponent - NET_HIST_SUB_BITS)) - 1;
+}
+
+/**
+ * ヒストグラムに値を1つ記録する関数
+ */
+static void net_histogram_record(struct net_histogram* hist, long long us) {
+    unsigned long long value = us > 0 ? (unsigned long long)us : 0;
+    atomic_fetch_add_explicit(&hist->buckets[net_histogram_index(value)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&hist->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&hist->sum_us, value, memory_order_relaxed);
+    unsigned long long max = atomic_load_explicit(&hist->max_us, memory_order_relaxed);
+    while (value > max &&
+           !atomic_compare_exchange_weak_explicit(&hist->max_us, &max, value,
+                                                  memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+/**
+ * ヒストグラムからパーセンタイルの近似値を求める関数
+ * 該当するバケットの上限を返すため、実際の値より最大12.5%大きくなることがある
+ *
+ * @param hist ヒストグラム
+ * @param percentile 求めるパーセンタイル（0〜100）
+ * @return パーセンタイルの近似値（マイクロ秒）、記録がない場合は0
+ */
+unsigned long long net_histogram_percentile(const struct net_histogram* hist, double percentile) {
+    unsigned long total = 0;
+    unsigned long counts[NET_HIST_BUCKETS];
+    for (int i = 0; i < NET_HIST_BUCKETS; i++) {
+        counts[i] = atomic_load_explicit(&hist->buckets[i], memory_order_relaxed);
+        total += counts[i];
+    }
+    if (total == 0) {
+        return 0;
+    }
+
+    unsigned long long max = atomic_load_explicit(&hist->max_us, memory_order_relaxed);
+    unsigned long rank = (unsigned long)(percentile / 100.0 * total + 0.999999);
+    unsigned long seen = 0;
+    for (int i = 0; i < NET_HIST_BUCKETS; i++) {
+        seen += counts[i];
+        if (seen >= rank && counts[i] > 0) {
+            unsigned long long bound = net_histogram_upper_bound(i);
+            return bound < max ? bound : max;
+        }
+    }
+    return max;
+}
+
+/**
+ * 完了した転送の通信時間を記録する関数
+ * 転送が失敗した場合も、そこまでに終わった段階の時間は記録する
+ *
+ * @param kind リクエストの種類
+ * @param curl 転送が完了したイージーハンドル
+ * @param result 転送の結果
+ */
+void net_stats_record(enum net_request_kind kind, CURL* curl, CURLcode result) {
+    struct net_request_stats* stats = &g_net_stats[kind];
+    curl_off_t namelookup = 0, connect = 0, appconnect = 0, starttransfer = 0, total = 0;
+    curl_off_t uploaded = 0, downloaded = 0;
+    long connects = 0;
+    curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME_T, &namelookup);
+    curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME_T, &connect);
+    curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME_T, &appconnect);
+    curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &starttransfer);
+    curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &total);
+    curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &connects);
+    curl_easy_getinfo(curl, CURLINFO_SIZE_UPLOAD_T, &uploaded);
+    curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &downloaded);
+
+    atomic_fetch_add_explicit(&stats->requests, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stats->bytes_sent, (unsigned long)uploaded, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stats->bytes_received, (unsigned long)downloaded, memory_order_relaxed);
+    if (result != CURLE_OK) {
+        atomic_fetch_add_explicit(&stats->failed, 1, memory_order_relaxed);
+    }
+    if (connects > 0) {
+        atomic_fetch_add_explicit(&stats->new_connections, 1, memory_order_relaxed);
+        net_histogram_record(&stats->phases[NET_PHASE_DNS], namelookup);
+        if (connect > 0) {
+            net_histogram_record(&stats->phases[NET_PHASE_CONNECT], connect - namelookup);
+        }
+        if (appconnect > 0) {
+            net_histogram_record(&stats->phases[NET_PHASE_TLS], appconnect - connect);
+        }
+    } else {
+        atomic_fetch_add_explicit(&stats->reused, 1, memory_order_relaxed);
+    }
+    // 再利用した接続では接続までの時間はほぼ0になるため、最初のバイトまでの時間は前の段階の終わりから数える
+    if (starttransfer > 0) {
+        curl_off_t ready = appconnect > 0 ? appconnect : connect;
+        net_histogram_record(&stats->phases[NET_PHASE_WAIT], starttransfer - ready);
+        net_histogram_record(&stats->phases[NET_PHASE_TRANSFER], total - starttransfer);
+    }
+    net_histogram_record(&stats->phases[NET_PHASE_TOTAL], total);
+}
+
+/**
+ * 通信時間の内訳を表示する関数
+ * 記録のないリクエストの種類は表示しない
+ *
+ * @param out 出力先
+ */
+void net_stats_report(FILE* out) {
+    int printed = 0;
+    for (int kind = 0; kind < NET_REQUEST_KIND_COUNT; kind++) {
+        const struct net_request_stats* stats = &g_net_stats[kind];
+        unsigned long requests = atomic_load(&stats->requests);
+        if (requests == 0) {
+            continue;
+        }
+        if (!printed) {
+            fprintf(out, "\n通信時間の内訳（マイクロ秒、パーセンタイルはヒストグラムからの近似値）\n");
+            printed = 1;
+        }
+        fprintf(out, "[%s] リクエスト %lu（転送失敗 %lu）/ 新規接続 %lu / 接続の再利用 %lu\n",
+                net_request_kind_names[kind], requests, atomic_load(&stats->failed),
+                atomic_load(&stats->new_connections), atomic_load(&stats->reused));
+        fprintf(out, "  %-9s %10s %10s %10s %10s %10s %10s\n", "phase", "count", "avg", "p50", "p95", "p99", "max");
+        for (int phase = 0; phase < NET_PHASE_COUNT; phase++) {
+            const struct net_histogram* hist = &stats->phases[phase];
+            unsigned long count = atomic_load(&hist->count);
+            if (count == 0) {
+                continue;
+            }
+            fprintf(out, "  %-9s %10lu %10llu %10llu %10llu %10llu %10llu\n", net_phase_names[phase], count,
+                    atomic_load(&hist->sum_us) / count,
+                    net_histogram_percentile(hist, 50), net_histogram_percentile(hist, 95),
+                    net_histogram_percentile(hist, 99), atomic_load(&hist->max_us));
+        }
+    }
+    fflush(out);
+}
+
+/**
+ * SIGUSR1 を受けるたびに通信時間の内訳を標準エラー出力に表示するスレッド
+ */
+static void* net_stats_reporter_main(void* arg) {
+    (void)arg;
+    for (;;) {
+        struct pollfd fds[2] = {
+            { g_net_reporter.signal_fd, POLLIN, 0 },
+            { g_net_reporter.stop_pipe[0], POLLIN, 0 },
+        };
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (fds[1].revents) {
+            break;
+        }
+
+        struct signalfd_siginfo info;
+        if (read(g_net_reporter.signal_fd, &info, sizeof(info)) == (ssize_t)sizeof(info)) {
+            net_stats_report(stderr);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * SIGUSR1 による通信統計の表示を開始する関数
+ * シグナルはスレッドの作成時に引き継がれるマスクで受け取るため、他のスレッドを作成する前に呼び出すこと
+ *
+ * @return 成功時は0、失敗時は-1
+ */
+int net_stats_start(void) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR1);
+    if (pthread_sigmask(SIG_BLOCK, &mask, NULL) != 0) {
+        fprintf(stderr, "エラー: SIGUSR1 のマスクに失敗しました\n");
+        return -1;
+    }
+
+    g_net_reporter.signal_fd = signalfd(-1, &mask, SFD_CLOEXEC);
+    if (g_net_reporter.signal_fd < 0 || pipe(g_net_reporter.stop_pipe) != 0) {
+        fprintf(stderr, "エラー: 通信統計の表示を開始できません: %s\n", strerror(errno));
+        return -1;
+    }
+    if (pthread_create(&g_net_reporter.thread, NULL, net_stats_reporter_main, NULL) != 0) {
+        fprintf(stderr, "エラー: 通信統計表示スレッドの起動に失敗しました\n");
+        return -1;
+    }
+    g_net_reporter.running = 1;
+    return 0;
+}
+
+/**
+ * 通信統計の表示を停止し、最終的な内訳を標準エラー出力に表示する関数
+ */
+void net_stats_shutdown(void) {
+    if (g_net_reporter.running) {
+        ssize_t ignored = write(g_net_reporter.stop_pipe[1], "x", 1);
+        (void)ignored;
+        pthread_join(g_net_reporter.thread, NULL);
+        g_net_reporter.running = 0;
+    }
+    if (g_net_reporter.signal_fd >= 0) {
+        close(g_net_reporter.signal_fd);
+        g_net_reporter.signal_fd = -1;
+    }
+    for (int i = 0; i < 2; i++) {
+        if (g_net_reporter.stop_pipe[i] >= 0) {
+            close(g_net_reporter.stop_pipe[i]);
+            g_net_reporter.stop_pipe[i] = -1;
+        }
+    }
+    net_stats_report(stderr);
+}
+
+/**
+ * イベントが失敗した理由（メトリクスのラベル）
+ */
+enum import_failure_reason {
+    IMPORT_FAILURE_TRANSPORT,       // 転送エラー（送信前のトークン取得やメモリ割り当ての失敗を含む）
+    IMPORT_FAILURE_RATE_LIMITED,    // レート制限
+    IMPORT_FAILURE_CLIENT,          // 4xx（レート制限を除く）
+    IMPORT_FAILURE_SERVER,          // 5xx（レート制限を除く）
+    IMPORT_FAILURE_HTTP_OTHER,      // その他のHTTPステータス
+    IMPORT_FAILURE_INVALID_INPUT,   // 入力の行を解析・変換できない
+    IMPORT_FAILURE_DEADLINE,        // 締め切り（--deadline）までに送信できなかった
+    IMPORT_FAILURE_REASON_COUNT
+};
+
+static const char* const import_failure_reason_names[IMPORT_FAILURE_REASON_COUNT] = {
+    "transport", "rate_limited", "client_error", "server_error", "http_other", "invalid_input", "deadline",
+};
+
+/**
+ * 一括インポートのメトリクス
+ * インポート中に更新する値はすべて atomic で持ち、ロックを取らずに加算する
+ */
+struct import_metrics {
+    atomic_ulong events_attempted;  // 入力から読み取ったイベント（不正な行を含む）
+    atomic_ulong events_succeeded;
+    atomic_ulong events_skipped;    // 前回と内容が同じため送信しなかったイベント
+    atomic_ulong events_failed[IMPORT_FAILURE_REASON_COUNT];
+    atomic_ulong retries;           // 再送したイベント
+    atomic_ulong duplicates;        // 409（同じIDのイベントが登録済み）を成功として扱ったイベント
+    atomic_ulong hedges_sent;       // 遅いリクエストを複製して送った回数
+    atomic_ulong hedges_won;        // 複製した方が先に応答した回数
+    atomic_ulong token_refreshes;
+    atomic_ulong token_refresh_failures;
+    atomic_long in_flight;          // 送信中のHTTPリクエスト
+};
+
+static struct import_metrics g_metrics;
+
+/**
+ * 失敗したイベントを理由ごとに数える関数
+ *
+ * @param reason 失敗の理由
+ */
+static void metrics_count_failure(enum import_failure_reason reason) {
+    atomic_fetch_add_explicit(&g_metrics.events_failed[reason], 1, memory_order_relaxed);
+}
+
+/**
+ * ファイルの内容を読み取る関数
+ * 
+ * @param filename 読み取るファイルの名前
+ * @return ファイルの内容を含む動的に割り当てられた文字列、失敗時はNULL
+ */
+char* read_file(const char* filename) {
+    FILE* file = fopen(filename, "r");
+    if (file == NULL) {
+        fprintf(stderr, "エラー: ファイル %s を開けません\n", filename);
+        return NULL;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long file_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char* content = malloc(file_size + 1);
+    if (content == NULL) {
+        fprintf(stderr, "エラー: メモリ割り当てに失敗しました\n");
+        fclose(file);
+        return NULL;
+    }
+
+    size_t read_size = fread(content, 1, file_size, file);
+    if (read_size != file_size) {
+        fprintf(stderr, "エラー: ファイル全体の読み取りに失敗しました\n");
+        free(content);
+        fclose(file);
+        return NULL;
+    }
+
+    content[file_size] = '\0';
+    fclose(file);
+    return content;
+}
+
+/**
+ * 一括インポートの調整用パラメータ構造体
+ * 値が負の場合は「未指定」を表す（コマンドラインによる上書き用）
+ */
+struct import_tuning {
+    int concurrency;                // 同時に処理するリクエストの上限
+    int batch_size;                 // 1回のバッチリクエストにまとめるイベント数の上限
+    long batch_flush_ms;            // 未送信のイベントを溜めておく最大時間（ミリ秒）
+    long http_version;              // CURLOPT_HTTP_VERSION に設定する値
+    int max_streams;                // HTTP/2の1接続あたりの同時ストリーム数の上限
+    long token_refresh_margin;      // アクセストークンを有効期限の何秒前に更新するか
+    int adaptive;                   // レート制限に応じて同時実行数を自動調整するか（1/0）
+    int max_retries;                // 一時的なエラーで失敗したイベントを再送する最大回数
+    int event_ids;                  // iCalUID から決めたIDをイベントに付けるか（1/0）
+    int hedge;                      // 遅いリクエストを複製して送るか（1/0）
+};
+
+/**
+ * 設定構造体
+ * config.json を起動時に一度だけ解析して作成し、作成後は変更しない。
+ * ホットリロード時は新しい構造体を作成してポインタごと差し替える。
+ * 読み取り側は config_acquire() で参照を得て config_release() で返し、
+ * 差し替えられた古い設定は最後の参照が返された時点で解放する。
+ */
+struct app_config {
+    char* client_id;
+    char* client_secret;
+    char* redirect_uri;
+    char* refresh_token;
+    char* calendar_id;
+    char* auth_url;                 // OAuth 2.0 認証エンドポイント
+    char* token_url;                // トークンエンドポイント
+    char* api_base_url;             // Calendar API のベースURL
+    char* batch_url;                // バッチエンドポイント
+    struct import_tuning tuning;
+    int refs;                       // 参照数（現在の設定であることによる1を含む。g_config_lock で保護する）
+};
+
+// 現在の設定と、その参照数を保護するロック
+static pthread_mutex_t g_config_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct app_config* g_config;
+
+// コマンドラインで指定された値（config.json の値より優先する）
+static struct import_tuning g_tuning_overrides = { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 };
+
+/**
+ * 設定構造体を解放する関数
+ *
+ * @param config 解放する設定
+ */
+void config_free(struct app_config* config) {
+    if (!config) {
+        return;
+    }
+    free(config->client_id);
+    free(config->client_secret);
+    free(config->redirect_uri);
+    free(config->refresh_token);
+    free(config->calendar_id);
+    free(config->auth_url);
+    free(config->token_url);
+    free(config->api_base_url);
+    free(config->batch_url);
+    free(config);
+}
+
+/**
+ * 設定から文字列値を取り出す関数
+ *
+ * @param root 設定のJSONオブジェクト
+ * @param key キー
+ * @param fallback キーがない場合の既定値（NULL可）
+ * @param out 値を受け取るポインタ（呼び出し側で free する）
+ * @return 成功時は0、失敗時は-1
+ */
+static int config_get_string(struct json_object* root, const char* key, const char* fallback, char** out) {
+    struct json_object* value;
+    const char* str = fallback;
+    if (json_object_object_get_ex(root, key, &value) && !json_object_is_type(value, json_type_null)) {
+        str = json_object_get_string(value);
+    }
+    *out = str ? strdup(str) : NULL;
+    if (str && !*out) {
+        fprintf(stderr, "エラー: メモリ割り当てに失敗しました\n");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * 設定から整数値を取り出す関数
+ * キーがない場合は out を変更しない
+ *
+ * @param root 設定のJSONオブジェクト
+ * @param key キー
+ * @param out 値を受け取るポインタ
+ * @return 成功時は0、値が整数でない場合は-1
+ */
+static int config_get_long(struct json_object* root, const char* key, long* out) {
+    struct json_object* value;
+    if (!json_object_object_get_ex(root, key, &value)) {
+        return 0;
+    }
+    if (!json_object_is_type(value, json_type_int)) {
+        fprintf(stderr, "エラー: 設定 '%s' には整数を指定してください\n", key);
+        return -1;
+    }
+    *out = (long)json_object_get_int64(value);
+    return 0;
+}
+
+/**
+ * HTTPバージョンの指定文字列を CURLOPT_HTTP_VERSION の値に変換する関数
+ *
+ * @param str "2"、"1.1" または "h2c"（平文の http:// でも Upgrade: h2c で HTTP/2 に切り替える。
+ *            bench/mock_server などのテスト用。libcurl 7.88 では事前知識による h2c の接続を
+ *            再利用できないため、CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE は使わない）
+ * @return 対応する値、不正な場合は-1
+ */
+long parse_http_version(const char* str) {
+    if (strcmp(str, "2") == 0) {
+        return CURL_HTTP_VERSION_2TLS;
+    }
+    if (strcmp(str, "h2c") == 0) {
+        return CURL_HTTP_VERSION_2_0;
+    }
+    if (strcmp(str, "1.1") == 0) {
+        return CURL_HTTP_VERSION_1_1;
+    }
+    return -1;
+}
+
+/**
+ * 調整用パラメータの範囲を検証する関数
+ *
+ * @param tuning 検証するパラメータ
+ * @return 有効な場合は0、そうでない場合は-1
+ */
+static int config_validate_tuning(const struct import_tuning* tuning) {
+    if (tuning->concurrency < 1 || tuning->concurrency > MAX_CONCURRENCY) {
+        fprintf(stderr, "エラー: concurrency（--concurrency）は 1 から %d の範囲で指定してください\n", MAX_CONCURRENCY);
+        return -1;
+    }
+    if (tuning->batch_size < 1 || tuning->batch_size > MAX_BATCH_SIZE) {
+        fprintf(stderr, "エラー: batch_size（--batch-size）は 1 から %d の範囲で指定してください\n", MAX_BATCH_SIZE);
+        return -1;
+    }
+    if (tuning->batch_flush_ms < 0) {
+        fprintf(stderr, "エラー: batch_flush_ms（--batch-flush-ms）には0以上の値を指定してください\n");
+        return -1;
+    }
+    if (tuning->http_version < 0) {
+        fprintf(stderr, "エラー: http_version（--http-version）には 1.1、2 または h2c を指定してください\n");
+        return -1;
+    }
+    if (tuning->max_streams < 1 || tuning->max_streams > MAX_STREAMS_LIMIT) {
+        fprintf(stderr, "エラー: max_streams（--max-streams）は 1 から %d の範囲で指定してください\n", MAX_STREAMS_LIMIT);
+        return -1;
+    }
+    if (tuning->token_refresh_margin < 0) {
+        fprintf(stderr, "エラー: token_refresh_margin（--token-refresh-margin）には0以上の値を指定してください\n");
+        return -1;
+    }
+    if (tuning->max_retries < 0 || tuning->max_retries > MAX_RETRIES_LIMIT) {
+        fprintf(stderr, "エラー: max_retries（--max-retries）は 0 から %d の範囲で指定してください\n", MAX_RETRIES_LIMIT);
+        return -1;
+    }
+    if (tuning->hedge && !tuning->event_ids) {
+        // IDがないと複製したリクエストが別のイベントとして登録されてしまう
+        fprintf(stderr, "エラー: hedge_requests（--hedge）は deterministic_ids を無効にした状態では使用できません\n");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * 設定ファイルを読み込んで設定構造体を作成する関数
+ * 既定値、設定ファイルの値、コマンドラインの値の順に適用する
+ *
+ * @param path 設定ファイルのパス
+ * @return 作成した設定、失敗時はNULL
+ */
+struct app_config* config_load(const char* path) {
+    char* config_content = read_file(path);
+    if (config_content == NULL) {
+        return NULL;
+    }
+
+    struct json_object* parsed_json = json_tokener_parse(config_content);
+    free(config_content);
+    if (!parsed_json || !json_object_is_type(parsed_json, json_type_object)) {
+        fprintf(stderr, "エラー: 設定ファイルの解析に失敗しました\n");
+        json_object_put(parsed_json);
+        return NULL;
+    }
+
+    struct app_config* config = calloc(1, sizeof(struct app_config));
+    if (!config) {
+        fprintf(stderr, "エラー: メモリ割り当てに失敗しました\n");
+        json_object_put(parsed_json);
+        return NULL;
+    }
+
+    long concurrency = 1;
+    long batch_size = 1;
+    long batch_flush_ms = DEFAULT_BATCH_FLUSH_MS;
+    long max_streams = DEFAULT_MAX_STREAMS;
+    long token_refresh_margin = DEFAULT_TOKEN_REFRESH_MARGIN;
+    long max_retries = DEFAULT_MAX_RETRIES;
+    char* http_version = NULL;
+    struct json_object* adaptive;
+    struct json_object* event_ids;
+    struct json_object* hedge;
+
+    int status = 0;
+    status |= config_get_string(parsed_json, "client_id", NULL, &config->client_id);
+    status |= config_get_string(parsed_json, "client_secret", NULL, &config->client_secret);
+    status |= config_get_string(parsed_json, "redirect_uri", NULL, &config->redirect_uri);
+    status |= config_get_string(parsed_json, "refresh_token", NULL, &config->refresh_token);
+    status |= config_get_string(parsed_json, "calendar_id", NULL, &config->calendar_id);
+    status |= config_get_string(parsed_json, "auth_url", AUTH_URL, &config->auth_url);
+    status |= config_get_string(parsed_json, "token_url", TOKEN_URL, &config->token_url);
+    status |= config_get_string(parsed_json, "api_base_url", API_BASE_URL, &config->api_base_url);
+    status |= config_get_string(parsed_json, "batch_url", BATCH_URL, &config->batch_url);
+    status |= config_get_string(parsed_json, "http_version", "2", &http_version);
+    status |= config_get_long(parsed_json, "concurrency", &concurrency);
+    status |= config_get_long(parsed_json, "batch_size", &batch_size);
+    status |= config_get_long(parsed_json, "batch_flush_ms", &batch_flush_ms);
+    status |= config_get_long(parsed_json, "max_streams", &max_streams);
+    status |= config_get_long(parsed_json, "token_refresh_margin", &token_refresh_margin);
+    status |= config_get_long(parsed_json, "max_retries", &max_retries);
+    config->tuning.adaptive = json_object_object_get_ex(parsed_json, "adaptive_concurrency", &adaptive)
+                              ? json_object_get_boolean(adaptive) : 1;
+    config->tuning.event_ids = json_object_object_get_ex(parsed_json, "deterministic_ids", &event_ids)
+                               ? json_object_get_boolean(event_ids) : 1;
+    config->tuning.hedge = json_object_object_get_ex(parsed_json, "hedge_requests", &hedge)
+                           ? json_object_get_boolean(hedge) : 0;
+    json_object_put(parsed_json);
+
+    config->tuning.concurrency = (int)concurrency;
+    config->tuning.batch_size = (int)batch_size;
+    config->tuning.batch_flush_ms = batch_flush_ms;
+    config->tuning.http_version = http_version ? parse_http_version(http_version) : -1;
+    config->tuning.max_streams = (int)max_streams;
+    config->tuning.token_refresh_margin = token_refresh_margin;
+    config->tuning.max_retries = (int)max_retries;
+    free(http_version);
+
+    const struct import_tuning* cli = &g_tuning_overrides;
+    if (cli->concurrency >= 0) config->tuning.concurrency = cli->concurrency;
+    if (cli->batch_size >= 0) config->tuning.batch_size = cli->batch_size;
+    if (cli->batch_flush_ms >= 0) config->tuning.batch_flush_ms = cli->batch_flush_ms;
+    if (cli->http_version >= 0) config->tuning.http_version = cli->http_version;
+    if (cli->max_streams >= 0) config->tuning.max_streams = cli->max_streams;
+    if (cli->token_refresh_margin >= 0) config->tuning.token_refresh_margin = cli->token_refresh_margin;
+    if (cli->adaptive >= 0) config->tuning.adaptive = cli->adaptive;
+    if (cli->max_retries >= 0) config->tuning.max_retries = cli->max_retries;
+    if (cli->event_ids >= 0) config->tuning.event_ids = cli->event_ids;
+    if (cli->hedge >= 0) config->tuning.hedge = cli->hedge;
+
+    // 認証とインポート先に必要なキー（refresh_token はトークンの更新時に確認する）
+    const struct {
+        const char* key;
+        const char* value;
+    } required[] = {
+        { "client_id", config->client_id },
+        { "client_secret", config->client_secret },
+        { "redirect_uri", config->redirect_uri },
+        { "calendar_id", config->calendar_id },
+    };
+    for (size_t i = 0; i < sizeof(required) / sizeof(required[0]); i++) {
+        if (required[i].value == NULL || required[i].value[0] == '\0') {
+            fprintf(stderr, "エラー: キー '%s' が設定に見つかりません\n", required[i].key);
+            status = -1;
+        }
+    }
+
+    if (status != 0 || config_validate_tuning(&config->tuning) != 0) {
+        config_free(config);
+        return NULL;
+    }
+    return config;
+}
+
+/**
+ * 現在の設定の参照を得る関数
+ * 返された設定は config_release() を呼ぶまで、再読み込みで差し替えられても解放されない
+ *
+ * @return 現在の設定
+ */
+const struct app_config* config_acquire(void) {
+    pthread_mutex_lock(&g_config_lock);
+    struct app_config* config = g_config;
+    config->refs++;
+    pthread_mutex_unlock(&g_config_lock);
+    return config;
+}
+
+/**
+ * config_acquire() で得た設定の参照を返す関数
+ * 差し替え済みの設定は、最後の参照が返された時点で解放する
+ *
+ * @param config 参照を返す設定
+ */
+void config_release(const struct app_config* config) {
+    struct app_config* owned = (struct app_config*)config;
+    pthread_mutex_lock(&g_config_lock);
+    int unused = (--owned->refs == 0);
+    pthread_mutex_unlock(&g_config_lock);
+    if (unused) {
+        config_free(owned);
+    }
+}
+
+/**
+ * 現在の設定の token_refresh_margin を取得する関数
+ * トークンの更新スレッドは再読み込みのたびに新しい値で待ち時間を計算し直す
+ *
+ * @return アクセストークンを有効期限の何秒前に更新するか
+ */
+static long config_token_refresh_margin(void) {
+    const struct app_config* config = config_acquire();
+    long margin = config->tuning.token_refresh_margin;
+    config_release(config);
+    return margin;
+}
+
+/**
+ * 新しい設定に差し替える関数
+ * 古い設定は、参照中のスレッドがすべて config_release() を呼んだ時点で解放される
+ *
+ * @param config 新しい設定
+ */
+static void config_publish(struct app_config* config) {
+    config->refs = 1;
+    pthread_mutex_lock(&g_config_lock);
+    struct app_config* old = g_config;
+    g_config = config;
+    pthread_mutex_unlock(&g_config_lock);
+    if (old) {
+        config_release(old);
+    }
+}
+
+// トークンキャッシュの更新スレッドを起こす（後方で定義）
+static void token_cache_wake(void);
+
+/**
+ * 設定ファイルの変更を監視するスレッドの状態
+ */
+struct config_watcher {
+    pthread_t thread;
+    int inotify_fd;
+    int stop_pipe[2];               // 停止要求を通知するパイプ
+    int running;
+};
+
+static struct config_watcher g_config_watcher = { .inotify_fd = -1, .stop_pipe = { -1, -1 } };
+
+/**
+ * 設定ファイルが書き換えられたら読み込み直して差し替えるスレッド
+ * エディタによる置き換え（rename）にも対応するため、ディレクトリを監視する
+ */
+static void* config_watcher_main(void* arg) {
+    (void)arg;
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    for (;;) {
+        struct pollfd fds[2] = {
+            { g_config_watcher.inotify_fd, POLLIN, 0 },
+            { g_config_watcher.stop_pipe[0], POLLIN, 0 },
+        };
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (fds[1].revents) {
+            break;
+        }
+
+        ssize_t len = read(g_config_watcher.inotify_fd, buf, sizeof(buf));
+        if (len <= 0) {
+            continue;
+        }
+
+        int changed = 0;
+        for (char* p = buf; p < buf + len; ) {
+            struct inotify_event* ev = (struct inotify_event*)p;
+            if (ev->len > 0 && strcmp(ev->name, CONFIG_FILE) == 0) {
+                changed = 1;
+            }
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+        if (!changed) {
+            continue;
+        }
+
+        struct app_config* config = config_load(CONFIG_FILE);
+        if (config == NULL) {
+            fprintf(stderr, "エラー: 設定ファイルの再読み込みに失敗しました。現在の設定を使い続けます\n");
+            continue;
+        }
+        const struct app_config* old = config_acquire();
+        int margin_changed = (old->tuning.token_refresh_margin != config->tuning.token_refresh_margin);
+        config_release(old);
+        config_publish(config);
+        if (margin_changed) {
+            // 更新スレッドは古い値で計算した時刻まで待っているため、起こして待ち時間を計算し直させる
+            token_cache_wake();
+        }
+        printf("設定ファイルを再読み込みしました。\n");
+    }
+    return NULL;
+}
+
+/**
+ * 設定ファイルの監視を開始する関数
+ *
+ * @return 成功時は0、失敗時は-1
+ */
+int config_watch_start(void) {
+    g_config_watcher.inotify_fd = inotify_init1(IN_CLOEXEC);
+    if (g_config_watcher.inotify_fd < 0 ||
+        inotify_add_watch(g_config_watcher.inotify_fd, ".", IN_CLOSE_WRITE | IN_MOVED_TO) < 0 ||
+        pipe(g_config_watcher.stop_pipe) != 0) {
+        fprintf(stderr, "エラー: 設定ファイルの監視を開始できません: %s\n", strerror(errno));
+        return -1;
+    }
+    if (pthread_create(&g_config_watcher.thread, NULL, config_watcher_main, NULL) != 0) {
+        fprintf(stderr, "エラー: 設定ファイル監視スレッドの起動に失敗しました\n");
+        return -1;
+    }
+    g_config_watcher.running = 1;
+    return 0;
+}
+
+/**
+ * 設定を読み込む関数
+ * プログラム開始時に一度だけ呼び出す
+ *
+ * @return 成功時は0、失敗時は-1
+ */
+int config_init(void) {
+    struct app_config* config = config_load(CONFIG_FILE);
+    if (config == NULL) {
+        return -1;
+    }
+    config_publish(config);
+    return 0;
+}
+
+/**
+ * 設定の監視を停止し、現在の設定を解放する関数
+ * config_acquire() で参照中の設定は、config_release() の時点で解放される
+ */
+void config_shutdown(void) {
+    if (g_config_watcher.running) {
+        ssize_t ignored = write(g_config_watcher.stop_pipe[1], "x", 1);
+        (void)ignored;
+        pthread_join(g_config_watcher.thread, NULL);
+        g_config_watcher.running = 0;
+    }
+    if (g_config_watcher.inotify_fd >= 0) {
+        close(g_config_watcher.inotify_fd);
+    }
+    for (int i = 0; i < 2; i++) {
+        if (g_config_watcher.stop_pipe[i] >= 0) {
+            close(g_config_watcher.stop_pipe[i]);
+        }
+    }
+
+    pthread_mutex_lock(&g_config_lock);
+    struct app_config* config = g_config;
+    g_config = NULL;
+    pthread_mutex_unlock(&g_config_lock);
+    if (config) {
+        config_release(config);
+    }
+}
+
+/**
+ * アリーナのチャンク
+ * アリーナはチャンクを単方向リストでつなぎ、リセット後も解放せずに先頭から使い直す
+ */
+struct arena_chunk {
+    struct arena_chunk* next;
+    size_t size;                    // data のバイト数
+    char data[];
+};
+
+/**
+ * リクエスト単位のアリーナ（バンプアロケーター）
+ * 1回のリクエスト（またはバッチ）の間だけ使う文字列・ヘッダーリストをここから割り当て、
+ * 完了後に arena_reset() でまとめて捨てる。個々の領域を free する必要はない。
+ * チャンクは次のリクエストで使い回すため、定常状態では malloc が発生しない。
+ */
+struct arena {
+    struct arena_chunk* head;       // 最初のチャンク
+    struct arena_chunk* current;    // 割り当て中のチャンク
+    size_t used;                    // current の使用済みバイト数
+};
+
+// アリーナのチャンクを確保した回数（結果表示用）
+static atomic_ulong g_arena_chunk_allocations;
+
+/**
+ * アリーナから領域を割り当てる関数
+ * 現在のチャンクに収まらない場合は、リセット前に使っていたチャンクか新しいチャンクに移る
+ *
+ * @param arena 対象のアリーナ
+ * @param size 割り当てるバイト数
+ * @return 割り当てた領域（ポインタ境界に揃える）、失敗時はNULL
+ */
+void* arena_alloc(struct arena* arena, size_t size) {
+    size = (size + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+    if (arena->current && size <= arena->current->size - arena->used) {
+        void* ptr = arena->current->data + arena->used;
+        arena->used += size;
+        return ptr;
+    }
+
+    struct arena_chunk* chunk = arena->current ? arena->current->next : arena->head;
+    if (chunk == NULL || chunk->size < size) {
+        size_t chunk_size = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+        struct arena_chunk* fresh = malloc(sizeof(struct arena_chunk) + chunk_size);
+        if (!fresh) {
+            fprintf(stderr, "エラー: メモリ割り当てに失敗しました\n");
+            return NULL;
+        }
+        atomic_fetch_add_explicit(&g_arena_chunk_allocations, 1, memory_order_relaxed);
+        fresh->size = chunk_size;
+        // 小さすぎて使えなかったチャンクはリストに残し、次のリセット後に使う
+        if (arena->current) {
+            fresh->next = arena->current->next;
+            arena->current->next = fresh;
+        } else {
+            fresh->next = arena->head;
+            arena->head = fresh;
+        }
+        chunk = fresh;
+    }
+
+    arena->current = chunk;
+    arena->used = size;
+    return chunk->data;
+}
+
+/**
+ * アリーナをリセットする関数
+ * 割り当てた領域をすべて無効にする。チャンクは解放しない（O(1)）。
+ *
+ * @param arena 対象のアリーナ
+ */
+void arena_reset(struct arena* arena) {
+    arena->current = arena->head;
+    arena->used = 0;
+}
+
+/**
+ * アリーナのチャンクをすべて解放する関数
+ *
+ * @param arena 対象のアリーナ
+ */
+void arena_free(struct arena* arena) {
+    struct arena_chunk* chunk = arena->head;
+    while (chunk) {
+        struct arena_chunk* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    memset(arena, 0, sizeof(*arena));
+}
+
+/**
+ * 文字列をアリーナに複製する関数
+ *
+ * @param arena 対象のアリーナ
+ * @param str 複製する文字列
+ * @return 複製した文字列、失敗時はNULL
+ */
+char* arena_strdup(struct arena* arena, const char* str) {
+    size_t len = strlen(str);
+    char* copy = arena_alloc(arena, len + 1);
+    if (copy) {
+        memcpy(copy, str, len + 1);
+    }
+    return copy;
+}
+
+/**
+ * 書式付き文字列をアリーナに作成する関数
+ * 現在のチャンクの空き領域に直接書き込み、収まらなかった場合だけ必要なサイズを割り当て直す
+ *
+ * @param arena 対象のアリーナ
+ * @param fmt 書式文字列
+ * @return 作成した文字列、失敗時はNULL
+ */
+char* arena_printf(struct arena* arena, const char* fmt, ...) {
+    size_t avail = arena->current ? arena->current->size - arena->used : 0;
+    char* dest = arena->current ? arena->current->data + arena->used : NULL;
+
+    va_list args;
+    va_start(args, fmt);
+    int written = vsnprintf(dest, avail, fmt, args);
+    va_end(args);
+    if (written < 0) {
+        return NULL;
+    }
+    if ((size_t)written < avail) {
+        return arena_alloc(arena, written + 1);  // 書き込んだ位置がそのまま返る
+    }
+
+    dest = arena_alloc(arena, written + 1);
+    if (!dest) {
+        return NULL;
+    }
+    va_start(args, fmt);
+    vsnprintf(dest, written + 1, fmt, args);
+    va_end(args);
+    return dest;
+}
+
+/**
+ * 文字列をパーセントエンコードしてアリーナに作成する関数
+ * RFC 3986 の非予約文字（英数字と -._~）以外をすべて %XX に変換する
+ *
+ * @param arena 対象のアリーナ
+ * @param input エンコードする文字列
+ * @return エンコードされた文字列、失敗時はNULL
+ */
+char* arena_url_encode(struct arena* arena, const char* input) {
+    static const char hex[] = "0123456789ABCDEF";
+    size_t len = 0;
+    for (const unsigned char* p = (const unsigned char*)input; *p; p++) {
+        len += (isalnum(*p) || strchr("-._~", *p)) ? 1 : 3;
+    }
+
+    char* encoded = arena_alloc(arena, len + 1);
+    if (!encoded) {
+        return NULL;
+    }
+    char* out = encoded;
+    for (const unsigned char* p = (const unsigned char*)input; *p; p++) {
+        if (isalnum(*p) || strchr("-._~", *p)) {
+            *out++ = (char)*p;
+        } else {
+            *out++ = '%';
+            *out++ = hex[*p >> 4];
+            *out++ = hex[*p & 0x0F];
+        }
+    }
+    *out = '\0';
+    return encoded;
+}
+
+/**
+ * curl のヘッダーリストにアリーナ上の要素を追加する関数
+ * 要素も文字列もアリーナに置くため、curl_slist_free_all() で解放してはならない。
+ * curl は CURLOPT_HTTPHEADER のリストを読むだけなので、転送が終わるまでリセットしなければよい。
+ *
+ * @param arena 対象のアリーナ
+ * @param list 追加先のリスト（空の場合はNULL）
+ * @param header 追加するヘッダー（アリーナ上または静的な文字列）
+ * @return 追加後のリストの先頭、失敗時はNULL
+ */
+struct curl_slist* arena_slist_append(struct arena* arena, struct curl_slist* list, const char* header) {
+    struct curl_slist* node = arena_alloc(arena, sizeof(struct curl_slist));
+    if (!node) {
+        return NULL;
+    }
+    node->data = (char*)header;
+    node->next = NULL;
+    if (list == NULL) {
+        return node;
+    }
+    struct curl_slist* tail = list;
+    while (tail->next) {
+        tail = tail->next;
+    }
+    tail->next = node;
+    return list;
+}
+
+// ... [前のパートから続く]
+
+/**
+ * OAuth 2.0認証用のURLを生成する関数
+ * 
+ * @return 生成された認証URL、失敗時はNULL
+ */
+char* generate_auth_url() {
+    const struct app_config* config = config_acquire();
+    const char* client_id = config->client_id;
+    const char* redirect_uri = config->redirect_uri;
+    
+    if (!client_id || !redirect_uri) {
+        fprintf(stderr, "エラー: client_idまたはredirect_uriの取得に失敗しました\n");
+        config_release(config);
+        return NULL;
+    }
+
+    struct arena arena = {0};
+    char* url = NULL;
+    char* encoded_client_id = arena_url_encode(&arena, client_id);
+    char* encoded_redirect_uri = arena_url_encode(&arena, redirect_uri);
+    char* encoded_scope = arena_url_encode(&arena, SCOPE);
+    if (!encoded_client_id || !encoded_redirect_uri || !encoded_scope) {
+        fprintf(stderr, "エラー: URLエンコードに失敗しました\n");
+    } else {
+        const char* built = arena_printf(&arena, "%s?client_id=%s&redirect_uri=%s&response_type=code&scope=%s",
+                                         config->auth_url, encoded_client_id, encoded_redirect_uri, encoded_scope);
+        url = built ? strdup(built) : NULL;
+        if (!url) {
+            fprintf(stderr, "エラー: 認証URLの生成に失敗しました\n");
+        }
+    }
+
+    arena_free(&arena);
+    config_release(config);
+    return url;
+}
+
+/**
+ * トークンエンドポイントにフォームをPOSTする関数
+ * POSTフィールドはアリーナ上に作成するため、エラー時も呼び出し側でアリーナを解放するだけでよい
+ *
+ * @param config トークンエンドポイントを取り出す設定
+ * @param post_fields 送信するフォーム（application/x-www-form-urlencoded）
+ * @return レスポンスの本文、失敗時はNULL
+ */
+static char* post_token_request(const struct app_config* config, const char* post_fields) {
+    CURL* curl = http_session_acquire();
+    if (!curl) {
+        return NULL;
+    }
+
+    struct MemoryStruct chunk;
+    if (memory_struct_init(&chunk, MAX_RESPONSE_SIZE) != 0) {
+        return NULL;
+    }
+
+    curl_easy_setopt(curl, CURLOPT_URL, config->token_url);
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, post_fields);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&chunk);
+
+    CURLcode res = curl_easy_perform(curl);
+    net_stats_record(NET_REQUEST_TOKEN, curl, res);
+    if(res != CURLE_OK) {
+        fprintf(stderr, "curl_easy_perform() failed: %s\n", curl_easy_strerror(res));
+        free(chunk.memory);
+        return NULL;
+    }
+    return chunk.memory;
+}
+
+/**
+ * 認証コードをアクセストークンと交換する関数
+ * 
+ * @param code 認証コード
+ * @return トークンレスポンスを含む文字列、失敗時はNULL
+ */
+char* exchange_code_for_token(const char* code) {
+    const struct app_config* config = config_acquire();
+    const char* client_id = config->client_id;
+    const char* client_secret = config->client_secret;
+    const char* redirect_uri = config->redirect_uri;
+
+    if (!client_id || !client_secret || !redirect_uri) {
+        fprintf(stderr, "エラー: 必要な設定値の取得に失敗しました\n");
+        config_release(config);
+        return NULL;
+    }
+
+    // フォームの値はすべてエンコードする（認証コードやシークレットに '/' や '+' が含まれることがある）
+    struct arena arena = {0};
+    char* response = NULL;
+    const char* encoded_code = arena_url_encode(&arena, code);
+    const char* encoded_client_id = arena_url_encode(&arena, client_id);
+    const char* encoded_secret = arena_url_encode(&arena, client_secret);
+    const char* encoded_redirect_uri = arena_url_encode(&arena, redirect_uri);
+    const char* post_fields = NULL;
+    if (encoded_code && encoded_client_id && encoded_secret && encoded_redirect_uri) {
+        post_fields = arena_printf(&arena,
+                                   "code=%s&client_id=%s&client_secret=%s&redirect_uri=%s&grant_type=authorization_code",
+                                   encoded_code, encoded_client_id, encoded_secret, encoded_redirect_uri);
+    }
+
+    if (post_fields == NULL) {
+        fprintf(stderr, "エラー: POSTフィールドの生成に失敗しました\n");
+    } else {
+        response = post_token_request(config, post_fields);
+    }
+
+    arena_free(&arena);
+    config_release(config);
+    return response;
+}
+
+/**
+ * トークンをファイルに保存する関数
+ * 
+ * @param token_response 保存するトークンレスポンス
+ * @return 成功時は0、失敗時は-1
+ */
+int save_token(const char* token_response) {
+    // トークンエンドポイントのレスポンスには発行時刻が含まれないため、有効期限の計算用に記録する
+    struct json_object* parsed_json = json_tokener_parse(token_response);
+    if (!parsed_json || !json_object_is_type(parsed_json, json_type_object)) {
+        fprintf(stderr, "エラー: トークンレスポンスの解析に失敗しました\n");
+        json_object_put(parsed_json);
+        return -1;
+    }
+    if (!json_object_object_get_ex(parsed_json, "created_at", NULL)) {
+        json_object_object_add(parsed_json, "created_at", json_object_new_int64((int64_t)time(NULL)));
+    }
+
+    // 書き込み中に中断してもリフレッシュトークンを失わないよう、一時ファイルに書いてから置き換える
+    // セキュリティ強化: ファイルのパーミッションを制限
+    const char* tmp_path = TOKEN_FILE ".tmp";
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        fprintf(stderr, "エラー: トークンファイルを書き込み用に開けません: %s\n", strerror(errno));
+        json_object_put(parsed_json);
+        return -1;
+    }
+
+    size_t len;
+    const char* json = json_object_to_json_string_length(parsed_json, JSON_C_TO_STRING_PLAIN, &len);
+    int ok = (write(fd, json, len) == (ssize_t)len && fsync(fd) == 0);
+    close(fd);
+    json_object_put(parsed_json);
+    if (!ok || rename(tmp_path, TOKEN_FILE) != 0) {
+        fprintf(stderr, "エラー: トークンファイル %s を保存できません: %s\n", TOKEN_FILE, strerror(errno));
+        unlink(tmp_path);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * リフレッシュトークンを使用して新しいアクセストークンを取得する関数
+ * 
+ * @return 新しいトークンレスポンス、失敗時はNULL
+ */
+char* refresh_token() {
+    const struct app_config* config = config_acquire();
+    const char* client_id = config->client_id;
+    const char* client_secret = config->client_secret;
+    const char* refresh_token = config->refresh_token;
+
+    if (!client_id || !client_secret || !refresh_token) {
+        fprintf(stderr, "エラー: 必要な設定値の取得に失敗しました\n");
+        config_release(config);
+        return NULL;
+    }
+
+    struct arena arena = {0};
+    char* response = NULL;
+    const char* encoded_client_id = arena_url_encode(&arena, client_id);
+    const char* encoded_secret = arena_url_encode(&arena, client_secret);
+    const char* encoded_refresh_token = arena_url_encode(&arena, refresh_token);
+    const char* post_fields = NULL;
+    if (encoded_client_id && encoded_secret && encoded_refresh_token) {
+        post_fields = arena_printf(&arena, "client_id=%s&client_secret=%s&refresh_token=%s&grant_type=refresh_token",
+                                   encoded_client_id, encoded_secret, encoded_refresh_token);
+    }
+
+    if (post_fields == NULL) {
+        fprintf(stderr, "エラー: POSTフィールドの生成に失敗しました\n");
+    } else {
+        response = post_token_request(config, post_fields);
+    }
+
+    arena_free(&arena);
+    config_release(config);
+    return response;
+}
+
+// ... [前のパートから続く]
+
+/**
+ * アクセストークンキャッシュ構造体
+ * token.json は起動時に一度だけ読み込み、以降はメモリ上のトークンを使う。
+ * 有効期限の token_refresh_margin 秒前になると更新スレッドが先回りして更新するため、
+ * インポート処理が期限切れで失敗したり、更新を待たされたりすることはない。
+ * 更新は同時に1つだけ実行され（single-flight）、他の呼び出し元はその完了を待つ。
+ */
+struct token_cache {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;            // 更新の完了・停止要求を通知する
+    char* access_token;             // 現在のアクセストークン
+    time_t expires_at;              // アクセストークンの有効期限
+    time_t retry_at;                // 更新に失敗した後、次に更新を試みる時刻
+    unsigned long generation;       // トークンが更新されるたびに増える
+    int loaded;                     // token.json を読み込み済みか
+    int refreshing;                 // 更新処理が実行中か
+    int stop;                       // 更新スレッドへの停止要求
+    int thread_running;             // 更新スレッドが動作中か
+    pthread_t thread;
+};
+
+static struct token_cache g_tokens = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+/**
+ * トークンJSONからアクセストークンと有効期限を取り出す関数
+ *
+ * @param token_json token.json の内容
+ * @param issued_fallback created_at が記録されていない場合に発行時刻とみなす時刻
+ * @param access_token アクセストークンを受け取るポインタ（呼び出し側で free する）
+ * @param expires_at 有効期限を受け取るポインタ
+ * @return 成功時は0、失敗時は-1
+ */
+static int parse_token_json(const char* token_json, time_t issued_fallback, char** access_token, time_t* expires_at) {
+    struct json_object *parsed_json;
+    struct json_object *token, *expires_in, *created_at;
+
+    parsed_json = json_tokener_parse(token_json);
+    if (!parsed_json) {
+        fprintf(stderr, "エラー: トークンファイルの解析に失敗しました\n");
+        return -1;
+    }
+
+    if (!json_object_object_get_ex(parsed_json, "access_token", &token) ||
+        !json_object_object_get_ex(parsed_json, "expires_in", &expires_in)) {
+        fprintf(stderr, "エラー: トークンファイルに access_token または expires_in がありません\n");
+        json_object_put(parsed_json);
+        return -1;
+    }
+
+    time_t issued = issued_fallback;
+    if (json_object_object_get_ex(parsed_json, "created_at", &created_at)) {
+        issued = (time_t)json_object_get_int64(created_at);
+    }
+
+    *access_token = strdup(json_object_get_string(token));
+    *expires_at = issued + (time_t)json_object_get_int64(expires_in);
+    json_object_put(parsed_json);
+    return *access_token ? 0 : -1;
+}
+
+/**
+ * トークンを更新してキャッシュに反映する関数
+ * g_tokens.lock を保持した状態で呼び出す。通信中はロックを解放する。
+ *
+ * @return 成功時は0、失敗時は-1
+ */
+static int token_cache_refresh_locked(void) {
+    g_tokens.refreshing = 1;
+    pthread_mutex_unlock(&g_tokens.lock);
+
+    char* new_access_token = NULL;
+    time_t new_expires_at = 0;
+    int result = -1;
+
+    char* new_token_response = refresh_token();
+    if (new_token_response == NULL) {
+        fprintf(stderr, "エラー: トークンの更新に失敗しました\n");
+    } else if (save_token(new_token_response) != 0) {
+        fprintf(stderr, "エラー: 新しいトークンの保存に失敗しました\n");
+    } else {
+        char* saved = read_file(TOKEN_FILE);
+        if (saved != NULL && parse_token_json(saved, time(NULL), &new_access_token, &new_expires_at) == 0) {
+            result = 0;
+        }
+        free(saved);
+    }
+    free(new_token_response);
+
+    pthread_mutex_lock(&g_tokens.lock);
+    if (result == 0) {
+        atomic_fetch_add_explicit(&g_metrics.token_refreshes, 1, memory_order_relaxed);
+        free(g_tokens.access_token);
+        g_tokens.access_token = new_access_token;
+        g_tokens.expires_at = new_expires_at;
+        g_tokens.retry_at = 0;
+        g_tokens.generation++;
+    } else {
+        atomic_fetch_add_explicit(&g_metrics.token_refresh_failures, 1, memory_order_relaxed);
+        g_tokens.retry_at = time(NULL) + TOKEN_REFRESH_RETRY_INTERVAL;
+    }
+    g_tokens.refreshing = 0;
+    pthread_cond_broadcast(&g_tokens.cond);
+    return result;
+}
+
+/**
+ * 有効期限が近づいたトークンを先回りして更新するスレッド
+ */
+static void* token_refresher_main(void* arg) {
+    (void)arg;
+
+    pthread_mutex_lock(&g_tokens.lock);
+    while (!g_tokens.stop) {
+        time_t wake = g_tokens.expires_at - config_token_refresh_margin();
+        if (g_tokens.retry_at > wake) {
+            wake = g_tokens.retry_at;
+        }
+
+        if (time(NULL) < wake) {
+            struct timespec deadline = { wake, 0 };
+            pthread_cond_timedwait(&g_tokens.cond, &g_tokens.lock, &deadline);
+            continue;
+        }
+        if (g_tokens.refreshing) {
+            pthread_cond_wait(&g_tokens.cond, &g_tokens.lock);
+            continue;
+        }
+        if (token_cache_refresh_locked() == 0) {
+            printf("アクセストークンを更新しました。\n");
+        }
+    }
+    pthread_mutex_unlock(&g_tokens.lock);
+
+    http_session_release_thread();
+    return NULL;
+}
+
+/**
+ * トークンキャッシュを初期化する関数
+ *
+ * @param background 更新スレッドを起動するかどうか（一括インポートなど長時間の処理向け）
+ * @return 成功時は0、失敗時は-1
+ */
+int token_cache_init(int background) {
+    pthread_mutex_lock(&g_tokens.lock);
+
+    if (!g_tokens.loaded) {
+        // 発行時刻が記録されていない古い token.json は、ファイルの更新時刻を発行時刻とみなす
+        struct stat st;
+        time_t issued_fallback = (stat(TOKEN_FILE, &st) == 0) ? st.st_mtime : 0;
+        char* token_content = read_file(TOKEN_FILE);
+        if (token_content == NULL ||
+            parse_token_json(token_content, issued_fallback, &g_tokens.access_token, &g_tokens.expires_at) != 0) {
+            free(token_content);
+            pthread_mutex_unlock(&g_tokens.lock);
+            return -1;
+        }
+        free(token_content);
+        g_tokens.loaded = 1;
+    }
+
+    if (background && !g_tokens.thread_running) {
+        g_tokens.stop = 0;
+        if (pthread_create(&g_tokens.thread, NULL, token_refresher_main, NULL) != 0) {
+            fprintf(stderr, "エラー: トークン更新スレッドの起動に失敗しました\n");
+            pthread_mutex_unlock(&g_tokens.lock);
+            return -1;
+        }
+        g_tokens.thread_running = 1;
+    }
+
+    pthread_mutex_unlock(&g_tokens.lock);
+    return 0;
+}
+
+/**
+ * 更新スレッドを起こし、更新する時刻を現在の設定で計算し直させる関数
+ * 設定の再読み込みで token_refresh_margin が変わったときに呼び出す
+ */
+static void token_cache_wake(void) {
+    pthread_mutex_lock(&g_tokens.lock);
+    pthread_cond_broadcast(&g_tokens.cond);
+    pthread_mutex_unlock(&g_tokens.lock);
+}
+
+/**
+ * トークンキャッシュを解放し、更新スレッドを停止する関数
+ */
+void token_cache_shutdown(void) {
+    pthread_mutex_lock(&g_tokens.lock);
+    int running = g_tokens.thread_running;
+    g_tokens.stop = 1;
+    pthread_cond_broadcast(&g_tokens.cond);
+    pthread_mutex_unlock(&g_tokens.lock);
+
+    if (running) {
+        pthread_join(g_tokens.thread, NULL);
+    }
+
+    pthread_mutex_lock(&g_tokens.lock);
+    free(g_tokens.access_token);
+    g_tokens.access_token = NULL;
+    g_tokens.loaded = 0;
+    g_tokens.thread_running = 0;
+    pthread_mutex_unlock(&g_tokens.lock);
+}
+
+/**
+ * キャッシュ上のアクセストークンが使える状態になるまで待つ関数
+ * 期限切れが近い場合は更新する。更新スレッドが動作中であれば、
+ * 期限切れになるまではそちらに任せて待たずに戻る。
+ * g_tokens.lock を保持した状態で呼び出す。
+ *
+ * @return 有効なトークンがある場合は0、失敗時は-1
+ */
+static int token_cache_wait_valid_locked(void) {
+    for (;;) {
+        time_t now = time(NULL);
+        int expired = (now >= g_tokens.expires_at);
+        int expiring = (now >= g_tokens.expires_at - config_token_refresh_margin());
+
+        if (!expiring || (!expired && (g_tokens.thread_running || g_tokens.refreshing || now < g_tokens.retry_at))) {
+            return 0;
+        }
+        if (g_tokens.refreshing) {
+            // 他の呼び出し元が実行中の更新の完了を待つ
+            pthread_cond_wait(&g_tokens.cond, &g_tokens.lock);
+            continue;
+        }
+        if (expired && now < g_tokens.retry_at) {
+            fprintf(stderr, "エラー: アクセストークンの有効期限が切れており、更新にも失敗しています\n");
+            return -1;
+        }
+
+        printf(expired ? "トークンの有効期限が切れています。更新中...\n" : "トークンの有効期限が近づいています。更新中...\n");
+        if (token_cache_refresh_locked() != 0 && expired) {
+            return -1;
+        }
+    }
+}
+
+/**
+ * 有効なアクセストークンを取得する関数
+ * キャッシュ上のトークンを返し、期限切れが近い場合は更新する。
+ *
+ * @param arena トークンの複製先のアリーナ（NULLの場合は malloc で複製する）
+ * @param generation 複製したトークンの世代を受け取るポインタ（不要な場合はNULL）
+ * @return 有効なアクセストークン（arena がNULLの場合は呼び出し側で free する）、失敗時はNULL
+ */
+char* get_valid_access_token_in(struct arena* arena, unsigned long* generation) {
+    if (!g_tokens.loaded && token_cache_init(0) != 0) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&g_tokens.lock);
+    char* result = NULL;
+    if (token_cache_wait_valid_locked() == 0) {
+        result = arena ? arena_strdup(arena, g_tokens.access_token) : strdup(g_tokens.access_token);
+        if (generation) {
+            *generation = g_tokens.generation;
+        }
+    }
+    pthread_mutex_unlock(&g_tokens.lock);
+    return result;
+}
+
+/**
+ * 有効なアクセストークンを取得する関数
+ *
+ * @return 有効なアクセストークン（呼び出し側で free する）、失敗時はNULL
+ */
+char* get_valid_access_token() {
+    return get_valid_access_token_in(NULL, NULL);
+}
+
+/**
+ * 有効なアクセストークンの世代を取得する関数
+ * トークンは複製しない。手元のトークンを使い続けてよいかの確認に使う。
+ *
+ * @param generation 世代を受け取るポインタ
+ * @return 成功時は0、有効なトークンがない場合は-1
+ */
+int get_valid_access_token_generation(unsigned long* generation) {
+    if (!g_tokens.loaded && token_cache_init(0) != 0) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&g_tokens.lock);
+    int result = token_cache_wait_valid_locked();
+    *generation = g_tokens.generation;
+    pthread_mutex_unlock(&g_tokens.lock);
+    return result;
+}
+
+/**
+ * カレンダーごとのリクエストテンプレート
+ * インポート先のURLとバッチ内のパスは、calendar_id をパーセントエンコードして一度だけ作成する。
+ * イベントごとに作るのは本文だけにする。
+ */
+struct request_template {
+    struct arena arena;             // URL と固定のヘッダーの格納先
+    const char* url;                // インポートエンドポイントのURL
+    const char* list_url;           // events.list のURL
+    const char* batch_path;         // バッチ内の各リクエストのパス
+    const char* batch_content_type; // バッチリクエストの Content-Type ヘッダー（バッチを使わない場合はNULL）
+};
+
+/**
+ * URLからパス部分（ホスト名より後ろ）を取り出す関数
+ *
+ * @param url 対象のURL
+ * @return パス部分の先頭、パスがない場合は空文字列
+ */
+static const char* url_path(const char* url) {
+    const char* p = strstr(url, "://");
+    p = p ? p + 3 : url;
+    const char* slash = strchr(p, '/');
+    return slash ? slash : "";
+}
+
+/**
+ * リクエストテンプレートを作成する関数
+ *
+ * @param tmpl 作成するテンプレート
+ * @param config 使用する設定
+ * @param calendar_id インポート先のカレンダーID（エンコード前）
+ * @param boundary バッチリクエストの区切り文字列（バッチを使わない場合はNULL）
+ * @return 成功時は0、失敗時は-1
+ */
+int request_template_init(struct request_template* tmpl, const struct app_config* config,
+                          const char* calendar_id, const char* boundary) {
+    memset(tmpl, 0, sizeof(*tmpl));
+    const char* encoded_id = arena_url_encode(&tmpl->arena, calendar_id);
+    if (encoded_id) {
+        tmpl->url = arena_printf(&tmpl->arena, "%s/calendars/%s/events/import", config->api_base_url, encoded_id);
+        tmpl->list_url = arena_printf(&tmpl->arena, "%s/calendars/%s/events", config->api_base_url, encoded_id);
+        tmpl->batch_path = arena_printf(&tmpl->arena, "%s/calendars/%s/events/import",
+                                        url_path(config->api_base_url), encoded_id);
+    }
+    if (boundary) {
+        tmpl->batch_content_type = arena_printf(&tmpl->arena, "Content-Type: multipart/mixed; boundary=%s", boundary);
+    }
+    if (!tmpl->url || !tmpl->list_url || !tmpl->batch_path || (boundary && !tmpl->batch_content_type)) {
+        fprintf(stderr, "エラー: URLの生成に失敗しました\n");
+        arena_free(&tmpl->arena);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * リクエストテンプレートを解放する関数
+ *
+ * @param tmpl 解放するテンプレート
+ */
+void request_template_free(struct request_template* tmpl) {
+    arena_free(&tmpl->arena);
+}
+
+/**
+ * アクセストークンを含むヘッダーリスト
+ * トークンが更新されたとき（世代が変わったとき）だけ作り直す。
+ * curl は転送中もリストを参照するため、転送中のハンドルが使っているリストを作り直してはならない。
+ */
+struct request_headers {
+    struct arena arena;             // ヘッダー文字列とリストの格納先（作り直すときにリセットする）
+    struct curl_slist* single;      // 単独のインポート用（application/json）
+    struct curl_slist* batch;       // バッチリクエスト用（multipart/mixed、テンプレートにない場合はNULL）
+    unsigned long generation;       // リストに含まれるトークンの世代
+};
+
+/**
+ * ヘッダーリストを最新のアクセストークンに合わせる関数
+ * トークンが前回から変わっていなければ何もしない
+ *
+ * @param headers 対象のヘッダーリスト
+ * @param tmpl リクエストテンプレート
+ * @return 成功時は0、失敗時は-1
+ */
+int request_headers_update(struct request_headers* headers, const struct request_template* tmpl) {
+    unsigned long generation;
+    if (get_valid_access_token_generation(&generation) != 0) {
+        return -1;
+    }
+    if (headers->single && generation == headers->generation) {
+        return 0;
+    }
+
+    arena_reset(&headers->arena);
+    headers->single = NULL;
+    headers->batch = NULL;
+    const char* access_token = get_valid_access_token_in(&headers->arena, &headers->generation);
+    const char* auth_header = access_token ? arena_printf(&headers->arena, "Authorization: Bearer %s", access_token) : NULL;
+    if (!auth_header) {
+        return -1;
+    }
+
+    struct curl_slist* single = arena_slist_append(&headers->arena, NULL, "Content-Type: application/json");
+    single = single ? arena_slist_append(&headers->arena, single, auth_header) : NULL;
+    struct curl_slist* batch = NULL;
+    if (tmpl->batch_content_type) {
+        batch = arena_slist_append(&headers->arena, NULL, tmpl->batch_content_type);
+        batch = batch ? arena_slist_append(&headers->arena, batch, auth_header) : NULL;
+    }
+    if (!single || (tmpl->batch_content_type && !batch)) {
+        return -1;
+    }
+    headers->single = single;
+    headers->batch = batch;
+    return 0;
+}
+
+/**
+ * 応答がレート制限によるものかを判定する関数
+ *
+ * @param http_status HTTPステータスコード
+ * @param reason Google API のエラー理由
+ * @return レート制限の場合は1、そうでない場合は0
+ */
+static int is_rate_limited(long http_status, const char* reason) {
+    if (http_status == 429) {
+        return 1;
+    }
+    return http_status == 403 &&
+           (strcmp(reason, "rateLimitExceeded") == 0 || strcmp(reason, "userRateLimitExceeded") == 0);
+}
+
+/**
+ * 転送エラーが一時的なもので、再送すれば成功し得るかを判定する関数
+ * 接続・送受信の失敗やタイムアウトは再送し、URLや証明書の誤りなど設定の問題は再送しない
+ *
+ * @param result 転送の結果
+ * @return 再送する場合は1、しない場合は0
+ */
+static int is_retryable_transfer_error(CURLcode result) {
+    switch (result) {
+        case CURLE_COULDNT_RESOLVE_HOST:
+        case CURLE_COULDNT_CONNECT:
+        case CURLE_OPERATION_TIMEDOUT:
+        case CURLE_SEND_ERROR:
+        case CURLE_RECV_ERROR:
+        case CURLE_GOT_NOTHING:
+        case CURLE_PARTIAL_FILE:
+        case CURLE_HTTP2:
+        case CURLE_HTTP2_STREAM:
+        case CURLE_SSL_CONNECT_ERROR:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * HTTPレスポンスが一時的なエラーで、再送すれば成功し得るかを判定する関数
+ * レート制限、408、5xx（501 を除く）と、理由が backendError のエラーを再送する。
+ * 1日あたりの上限（dailyLimitExceeded など）は待っても解消しないため再送しない。
+ *
+ * @param http_status HTTPステータスコード
+ * @param reason Google API のエラー理由（error.errors[0].reason）
+ * @return 再送する場合は1、しない場合は0
+ */
+static int is_retryable_response(long http_status, const char* reason) {
+    if (is_rate_limited(http_status, reason) || strcmp(reason, "backendError") == 0) {
+        return 1;
+    }
+    return http_status == 408 || (http_status >= 500 && http_status < 600 && http_status != 501);
+}
+
+// 再送ごとの待ち時間に使う乱数の状態（スレッドごとに持つ）
+static __thread unsigned long long t_retry_random;
+
+/**
+ * 再送までの待ち時間を求める関数
+ * 待ち時間の上限を試行ごとに倍にし（RETRY_MAX_BACKOFF_MS まで）、上限の半分から上限までの間で
+ * ランダムに選ぶ。多数のイベントが同時に失敗しても再送の時刻が揃わないようにするため。
+ * Retry-After が指定されている場合は、それより早くは再送しない。
+ *
+ * @param attempt 何回目の再送か（1から）
+ * @param retry_after_sec Retry-After ヘッダーの秒数（ない場合は負の値）
+ * @return 再送までの待ち時間（ミリ秒）
+ */
+long retry_backoff_ms(int attempt, long retry_after_sec) {
+    long cap = RETRY_BASE_MS;
+    for (int i = 1; i < attempt && cap < RETRY_MAX_BACKOFF_MS; i++) {
+        cap *= 2;
+    }
+    if (cap > RETRY_MAX_BACKOFF_MS) {
+        cap = RETRY_MAX_BACKOFF_MS;
+    }
+
+    if (t_retry_random == 0) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        t_retry_random = (((unsigned long long)ts.tv_nsec << 20) ^ (unsigned long long)getpid() ^ (unsigned long long)ts.tv_sec) | 1;
+    }
+    t_retry_random ^= t_retry_random >> 12;
+    t_retry_random ^= t_retry_random << 25;
+    t_retry_random ^= t_retry_random >> 27;
+    unsigned long long r = (t_retry_random * 2685821657736338717ULL) >> 33;
+
+    long delay = cap / 2 + (long)(r % (unsigned long long)(cap / 2 + 1));
+    if (retry_after_sec > 0 && delay < retry_after_sec * 1000) {
+        delay = retry_after_sec * 1000;
+    }
+    return delay;
+}
+
+/**
+ * Google Calendarにイベントをインポートする関数
+ * 一時的なエラー（転送エラー、レート制限、5xx など）の場合は、バックオフしながら max_retries 回まで再送する
+ * 
+ * @param calendar_id インポート先のカレンダーID
+ * @param event_data インポートするイベントのJSONデータ
+ * @return 成功時は0、失敗時は-1
+ */
+int import_event(const char* calendar_id, const char* event_data) {
+    CURL *curl;
+    int result = -1;
+    struct response_parser parser;
+    if (response_parser_init(&parser, MAX_RESPONSE_SIZE) != 0) {
+        return -1;
+    }
+
+    struct request_template tmpl;
+    const struct app_config* config = config_acquire();
+    int max_retries = config->tuning.max_retries;
+    int status = request_template_init(&tmpl, config, calendar_id, NULL);
+    config_release(config);
+    if (status != 0) {
+        response_parser_free(&parser);
+        return -1;
+    }
+    struct request_headers headers = {0};
+
+    curl = http_session_acquire();
+
+    for (int attempt = 0; curl != NULL; attempt++) {
+        if (request_headers_update(&headers, &tmpl) != 0) {
+            fprintf(stderr, "エラー: 有効なアクセストークンの取得に失敗しました\n");
+            break;
+        }
+        response_parser_reset(&parser);
+        curl_easy_setopt(curl, CURLOPT_URL, tmpl.url);
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers.single);
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, event_data);
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, ResponseParserCallback);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&parser);
+
+        CURLcode res = curl_easy_perform(curl);
+        net_stats_record(NET_REQUEST_IMPORT, curl, res);
+        long http_status = 0;
+        curl_off_t retry_after = -1;
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_status);
+        curl_easy_getinfo(curl, CURLINFO_RETRY_AFTER, &retry_after);
+        // 共有ハンドルに解放済みのリストを残さない
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, NULL);
+
+        const struct api_response* response = &parser.result;
+        int retryable;
+        if(res != CURLE_OK) {
+            fprintf(stderr, "エラー: curl_easy_perform() が失敗しました: %s\n", curl_easy_strerror(res));
+            retryable = is_retryable_transfer_error(res);
+        } else if (http_status >= 200 && http_status < 300) {
+            if (response->id[0]) {
+                printf("イベントが正常にインポートされました。ID: %s（status: %s）\n", response->id, response->status);
+            } else {
+                printf("レスポンス: %s\n", response->message[0] ? response->message : response->snippet);
+            }
+            result = 0;
+            break;
+        } else {
+            fprintf(stderr, "エラー: インポートに失敗しました (HTTP %ld%s%s): %s\n", http_status,
+                    response->reason[0] ? " " : "", response->reason,
+                    response->message[0] ? response->message : response->snippet);
+            retryable = is_retryable_response(http_status, response->reason);
+        }
+
+        if (!retryable || attempt >= max_retries) {
+            break;
+        }
+        long delay = retry_backoff_ms(attempt + 1, (long)retry_after);
+        printf("%.1f 秒後に再送します（%d/%d 回目）\n", delay / 1000.0, attempt + 1, max_retries);
+        struct timespec wait = { delay / 1000, (delay % 1000) * 1000000L };
+        while (nanosleep(&wait, &wait) != 0 && errno == EINTR) {
+        }
+    }
+
+    arena_free(&headers.arena);
+    request_template_free(&tmpl);
+    response_parser_free(&parser);
+
+    return result;
+}
+
+/**
+ * 認証手順を表示する関数
+ * 
+ * @param auth_url 認証URL
+ */
+void print_auth_instructions(const char* auth_url) {
+    printf("以下の手順に従って認証を行ってください：\n");
+    printf("1. 以下のURLをブラウザで開いてください：\n%s\n", auth_url);
+    printf("2. Googleアカウントでログインしてください（まだログインしていない場合）。\n");
+    printf("3. アプリケーションがカレンダーにアクセスすることを許可してください。\n");
+    printf("4. 許可後、ブラウザに表示される認証コードをコピーしてください。\n");
+}
+
+/**
+ * ユーザーから認証コードを安全に取得する関数
+ * 
+ * @return 認証コード、失敗時はNULL
+ */
+char* get_authorization_code() {
+    char* code = malloc(MAX_INPUT_LENGTH);
+    if (!code) {
+        fprintf(stderr, "エラー: メモリ割り当てに失敗しました\n");
+        return NULL;
+    }
+
+    printf("認証コードを入力してください: ");
+    if (fgets(code, MAX_INPUT_LENGTH, stdin) == NULL) {
+        fprintf(stderr, "エラー: 認証コードの読み取りに失敗しました\n");
+        free(code);
+        return NULL;
+    }
+
+    // 改行文字を削除
+    code[strcspn(code, "\n")] = 0;
+
+    // セキュリティ強化: 入力値の検証
+    for (int i = 0; code[i]; i++) {
+        if (!isalnum(code[i]) && code[i] != '-' && code[i] != '_' && code[i] != '.') {
+            fprintf(stderr, "エラー: 無効な文字が含まれています\n");
+            free(code);
+            return NULL;
+        }
+    }
+
+    return code;
+}
+
+/**
+ * OAuth認証フローを実行する関数
+ * 
+ * @return 成功時は0、失敗時は-1
+ */
+int perform_oauth_flow() {
+    char* auth_url = generate_auth_url();
+    if (!auth_url) {
+        fprintf(stderr, "エラー: 認証URLの生成に失敗しました\n");
+        return -1;
+    }
+
+    print_auth_instructions(auth_url);
+    free(auth_url);
+
+    char* auth_code = get_authorization_code();
+    if (!auth_code) {
+        return -1;
+    }
+
+    char* token_response = exchange_code_for_token(auth_code);
+    free(auth_code);
+
+    if (token_response) {
+        if (save_token(token_response) != 0) {
+            fprintf(stderr, "エラー: トークンの保存に失敗しました\n");
+            free(token_response);
+            return -1;
+        }
+        free(token_response);
+        printf("認証が成功しました。\n");
+        return 0;
+    } else {
+        fprintf(stderr, "エラー: トークンの取得に失敗しました\n");
+        return -1;
+    }
+}
+
+// ... [メイン関数は次のセッションに続きます]// ... [前のパートから続く]
+
+/**
+ * RFC 3339 / ISO 8601 の日時を解析した結果
+ */
+struct rfc3339_time {
+    int year;
+    int month;
+    int day;
+    int hour;
+    int minute;
+    int second;                     // 0〜60（60はうるう秒）
+    long nanosecond;                // 小数秒（ナノ秒、10桁目以降は切り捨て）
+    int offset_minutes;             // UTC からのオフセット（分、オフセットがない場合は0）
+    int has_time;                   // 時刻があるか（日付だけの場合は0）
+    int has_offset;                 // オフセット（Z または ±hh:mm）があるか
+};
+
+// 数字の値に1を足したもの（数字でない文字は0）
+static const unsigned char rfc3339_digit[256] = {
+    ['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5, ['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+};
+
+/**
+ * 日付と時刻の各項目の位置・桁数・範囲と、直後の区切り文字
+ * "YYYY-MM-DDTHH:MM:SS" の形を表の順に確認する
+ */
+static const struct rfc3339_field {
+    unsigned char offset;           // 文字列内の位置
+    unsigned char width;            // 桁数
+    unsigned short min;
+    unsigned short max;
+    char separator;                 // 直後の区切り文字（最後の項目は '\0'）
+} rfc3339_fields[] = {
+    { 0, 4, 0, 9999, '-' },
+    { 5, 2, 1, 12, '-' },
+    { 8, 2, 1, 31, 'T' },
+    { 11, 2, 0, 23, ':' },
+    { 14, 2, 0, 59, ':' },
+    { 17, 2, 0, 60, '\0' },
+};
+
+#define RFC3339_DATE_FIELDS 3
+#define RFC3339_FIELD_COUNT (sizeof(rfc3339_fields) / sizeof(rfc3339_fields[0]))
+
+static const unsigned char rfc3339_days_in_month[12] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+static const unsigned short rfc3339_days_before_month[12] = { 0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334 };
+
+static int rfc3339_leap_year(int year) {
+    return (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+}
+
+/**
+ * 数字の並びを数値に変換する関数
+ *
+ * @return 数値、数字でない文字を含む場合は-1
+ */
+static int rfc3339_number(const char* p, int width) {
+    int value = 0;
+    int valid = 1;
+    for (int i = 0; i < width; i++) {
+        unsigned char d = rfc3339_digit[(unsigned char)p[i]];
+        valid &= (d != 0);
+        value = value * 10 + d - 1;
+    }
+    return valid ? value : -1;
+}
+
+/**
+ * 日時の小数秒とオフセット（時刻より後ろの部分）を解析する関数
+ *
+ * @param p 秒の直後
+ * @param end 文字列の終わり
+ * @param out 解析結果
+ * @return 成功時は0、失敗時は-1
+ */
+static int rfc3339_parse_suffix(const char* p, const char* end, struct rfc3339_time* out) {
+    if (p < end && *p == '.') {
+        const char* digits = ++p;
+        long scale = 100000000L;
+        for (; p < end && rfc3339_digit[(unsigned char)*p]; p++) {
+            out->nanosecond += (rfc3339_digit[(unsigned char)*p] - 1) * scale;
+            scale /= 10;
+        }
+        if (p == digits) {
+            return -1;
+        }
+    }
+    if (p == end) {
+        return 0;
+    }
+    if ((*p == 'Z' || *p == 'z') && p + 1 == end) {
+        out->has_offset = 1;
+        return 0;
+    }
+    if ((*p != '+' && *p != '-') || end - p != 6 || p[3] != ':') {
+        return -1;
+    }
+    int hours = rfc3339_number(p + 1, 2);
+    int minutes = rfc3339_number(p + 4, 2);
+    if (hours < 0 || hours > 23 || minutes < 0 || minutes > 59) {
+        return -1;
+    }
+    out->offset_minutes = (*p == '-' ? -1 : 1) * (hours * 60 + minutes);
+    out->has_offset = 1;
+    return 0;
+}
+
+/**
+ * 日付の範囲（月ごとの日数）を確認する関数
+ */
+static int rfc3339_check_day(const struct rfc3339_time* t) {
+    int days = rfc3339_days_in_month[t->month - 1] + (t->month == 2 && rfc3339_leap_year(t->year));
+    return t->day <= days ? 0 : -1;
+}
+
+/**
+ * RFC 3339 / ISO 8601 の日時（または日付）を解析する関数
+ *
+ * "YYYY-MM-DD"、または "YYYY-MM-DDTHH:MM:SS" に小数秒とオフセット（Z または ±hh:mm）を続けた形を受け付け、
+ * すべての項目の範囲（月ごとの日数とうるう年を含む）を確認する。日付と時刻の区切りは T のほか t と空白も認める。
+ * オフセットのない日時（ISO 8601 のローカル時刻）も受け付け、has_offset を0にする。
+ *
+ * @param text 解析する文字列
+ * @param len text の長さ
+ * @param out 解析結果を受け取る構造体
+ * @return 成功時は0、失敗時は-1
+ */
+int rfc3339_parse_fields(const char* text, size_t len, struct rfc3339_time* out) {
+    int values[RFC3339_FIELD_COUNT] = {0};
+    size_t fields = (len == 10) ? RFC3339_DATE_FIELDS : RFC3339_FIELD_COUNT;
+    if (len != 10 && len < 19) {
+        return -1;
+    }
+    for (size_t i = 0; i < fields; i++) {
+        const struct rfc3339_field* field = &rfc3339_fields[i];
+        int value = rfc3339_number(text + field->offset, field->width);
+        if (value < field->min || value > field->max) {
+            return -1;
+        }
+        char sep = text[field->offset + field->width];
+        if (i + 1 < fields && sep != field->separator && !(field->separator == 'T' && (sep == 't' || sep == ' '))) {
+            return -1;
+        }
+        values[i] = value;
+    }
+
+    memset(out, 0, sizeof(*out));
+    out->year = values[0];
+    out->month = values[1];
+    out->day = values[2];
+    out->hour = values[3];
+    out->minute = values[4];
+    out->second = values[5];
+    out->has_time = (fields == RFC3339_FIELD_COUNT);
+    if (rfc3339_check_day(out) != 0) {
+        return -1;
+    }
+    return out->has_time ? rfc3339_parse_suffix(text + 19, text + len, out) : 0;
+}
+
+/**
+ * 解析した日時を UNIX時間（秒）に変換する関数
+ * オフセットのない日時と日付は UTC とみなす。小数秒は切り捨てる。
+ */
+long long rfc3339_to_epoch(const struct rfc3339_time* t) {
+    // 西暦0年（うるう年）の1月1日から数えた日数
+    long long year = t->year;
+    long long days = year * 365 + (year + 3) / 4 - (year + 99) / 100 + (year + 399) / 400 +
+                     rfc3339_days_before_month[t->month - 1] + (t->month > 2 && rfc3339_leap_year(t->year)) +
+                     t->day - 1 - 719528;  // 1970-01-01 までの日数
+    return days * 86400 + t->hour * 3600 + t->minute * 60 + t->second - t->offset_minutes * 60LL;
+}
+
+/**
+ * 解析した日時を UNIX時間に変換できるか判定する関数
+ * オフセットのない日時（ローカル時刻）はどの時刻を指すか決まらないため変換しない。
+ * rfc3339_parse() と rfc3339_parse_batch() はこの規則で結果をそろえる。
+ */
+static int rfc3339_is_instant(const struct rfc3339_time* t) {
+    return !t->has_time || t->has_offset;
+}
+
+/**
+ * RFC 3339 の日時（または日付）を UNIX時間に変換する関数
+ * 日時にはオフセットが必要で、日付だけの場合はその日の0時（UTC）とする
+ *
+ * @param text 変換する文字列
+ * @param out 変換した時刻（秒）を受け取るポインタ
+ * @return 成功時は0、失敗時は-1
+ */
+int rfc3339_parse(const char* text, long long* out) {
+    struct rfc3339_time t;
+    if (rfc3339_parse_fields(text, strlen(text), &t) != 0 || !rfc3339_is_instant(&t)) {
+        return -1;
+    }
+    *out = rfc3339_to_epoch(&t);
+    return 0;
+}
+
+/**
+ * UNIX時間を UTC の RFC 3339 形式（YYYY-MM-DDTHH:MM:SSZ）にする関数
+ * 異なるオフセットで書かれた日時も、解析してからこの形式にすれば比較や並べ替えに使える
+ *
+ * @param t UNIX時間（秒、西暦0〜9999年）
+ * @param out 書き出し先（RFC3339_UTC_SIZE バイト以上）
+ */
+void rfc3339_format_utc(long long t, char* out) {
+    long long days = t / 86400;
+    long long secs = t % 86400;
+    if (secs < 0) {
+        secs += 86400;
+        days--;
+    }
+    // 3月1日を年の始まりとして、400年周期の中の位置から年月日を求める
+    days += 719468;
+    long long era = (days >= 0 ? days : days - 146096) / 146097;
+    long long doe = days - era * 146097;
+    long long yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    long long doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    long long mp = (5 * doy + 2) / 153;
+    int day = (int)(doy - (153 * mp + 2) / 5 + 1);
+    int month = (int)(mp < 10 ? mp + 3 : mp - 9);
+    int year = (int)(yoe + era * 400 + (month <= 2));
+    snprintf(out, RFC3339_UTC_SIZE, "%04d-%02d-%02dT%02d:%02d:%02dZ", year, month, day,
+             (int)(secs / 3600), (int)(secs / 60 % 60), (int)(secs % 60));
+}
+
+#ifdef __SSE2__
+/**
+ * 日時の先頭16バイト（"YYYY-MM-DDTHH:MM"）を SSE2 でまとめて検証・変換する関数
+ * 数字と区切り文字の位置を1回の比較で確認し、隣り合う桁を _mm_madd_epi16 で数値にまとめる。
+ * 形が合わない場合（区切りが T 以外など）は-1を返し、呼び出し側で1文字ずつ解析する。
+ */
+static int rfc3339_parse_prefix_sse2(const char* text, int values[5]) {
+    const __m128i digits = _mm_sub_epi8(_mm_loadu_si128((const __m128i*)text), _mm_set1_epi8('0'));
+    const __m128i expected = _mm_setr_epi8(0, 0, 0, 0, '-' - '0', 0, 0, '-' - '0', 0, 0, 'T' - '0', 0, 0, ':' - '0', 0, 0);
+    const __m128i separators = _mm_setr_epi8(0, 0, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0);
+    __m128i is_digit = _mm_cmpeq_epi8(_mm_min_epu8(digits, _mm_set1_epi8(9)), digits);
+    __m128i is_separator = _mm_cmpeq_epi8(digits, expected);
+    __m128i ok = _mm_or_si128(_mm_andnot_si128(separators, is_digit), _mm_and_si128(separators, is_separator));
+    if (_mm_movemask_epi8(ok) != 0xFFFF) {
+        return -1;
+    }
+
+    // 区切り文字の重みを0にして、(0,1)(2,3)... の桁の組ごとに 10*上位 + 下位 を求める
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i weights_lo = _mm_setr_epi16(10, 1, 10, 1, 0, 10, 1, 0);
+    const __m128i weights_hi = _mm_setr_epi16(10, 1, 0, 10, 1, 0, 10, 1);
+    int pairs[8];
+    _mm_storeu_si128((__m128i*)pairs, _mm_madd_epi16(_mm_unpacklo_epi8(digits, zero), weights_lo));
+    _mm_storeu_si128((__m128i*)(pairs + 4), _mm_madd_epi16(_mm_unpackhi_epi8(digits, zero), weights_hi));
+    values[0] = pairs[0] * 100 + pairs[1];
+    values[1] = pairs[2] + pairs[3];
+    values[2] = pairs[4];
+    values[3] = pairs[5] + pairs[6];
+    values[4] = pairs[7];
+    return 0;
+}
+#endif
+
+/**
+ * 多数の日時をまとめて検証し、UNIX時間に変換する関数
+ * 大量の入力を検証する場合に使う。日時の先頭は SSE2 でまとめて処理し、
+ * 秒より後ろ（小数秒とオフセット）と日付だけの値は rfc3339_parse_fields() と同じ規則で解析する。
+ * 結果は1件ずつ rfc3339_parse() を呼んだ場合と同じで、オフセットのない日時は無効、
+ * 日付だけの値はその日の0時（UTC）とする。
+ *
+ * @param texts 日時の文字列の配列
+ * @param lengths 各文字列の長さ（NULLの場合は strlen() で求める）
+ * @param count 文字列の数
+ * @param epochs 変換した時刻（秒）を受け取る配列（無効な日時は RFC3339_INVALID）
+ * @return 有効な日時の数
+ */
+size_t rfc3339_parse_batch(const char* const* texts, const size_t* lengths, size_t count, long long* epochs) {
+    size_t valid = 0;
+    for (size_t i = 0; i < count; i++) {
+        const char* text = texts[i];
+        size_t len = lengths ? lengths[i] : strlen(text);
+        struct rfc3339_time t;
+        epochs[i] = RFC3339_INVALID;
+#ifdef __SSE2__
+        int values[5];
+        if (len >= 19 && rfc3339_parse_prefix_sse2(text, values) == 0) {
+            memset(&t, 0, sizeof(t));
+            t.year = values[0];
+            t.month = values[1];
+            t.day = values[2];
+            t.hour = values[3];
+            t.minute = values[4];
+            t.second = rfc3339_number(text + 17, 2);
+            t.has_time = 1;
+            if (t.month < 1 || t.month > 12 || t.day < 1 || t.hour > 23 || t.minute > 59 || text[16] != ':' ||
+                t.second < 0 || t.second > 60 || rfc3339_check_day(&t) != 0 ||
+                rfc3339_parse_suffix(text + 19, text + len, &t) != 0 || !t.has_offset) {
+                continue;
+            }
+            epochs[i] = rfc3339_to_epoch(&t);
+            valid++;
+            continue;
+        }
+#endif
+        if (rfc3339_parse_fields(text, len, &t) == 0 && rfc3339_is_instant(&t)) {
+            epochs[i] = rfc3339_to_epoch(&t);
+            valid++;
+        }
+    }
+    return valid;
+}
+
+/**
+ * 日時形式を検証する関数
+ * RFC 3339 / ISO 8601 の日時（オフセットは省略できる）で、すべての項目が範囲内であることを確認する
+ *
+ * @param datetime 検証する日時文字列
+ * @return 有効な形式の場合は1、そうでない場合は0
+ */
+int validate_datetime(const char* datetime) {
+    struct rfc3339_time t;
+    return rfc3339_parse_fields(datetime, strlen(datetime), &t) == 0 && t.has_time;
+}
+
+/**
+ * POSIX の TZ 文字列の切り替え日（Mm.w.d、Jn、n のいずれか）と時刻
+ */
+struct tz_rule_date {
+    char kind;                      // 'M'（月・週・曜日）、'J'（2月29日を数えない通日）、'D'（0から数える通日）
+    int month;
+    int week;                       // 1〜5（5は最終週）
+    int day;                        // M の場合は曜日（0は日曜日）、J/D の場合は通日
+    long time;                      // 切り替える現地時刻（0時からの秒、負や24時以降もあり得る）
+};
+
+/**
+ * POSIX の TZ 文字列（例: EST5EDT,M3.2.0,M11.1.0）で表した、最後の変化より後の規則
+ */
+struct tz_rule {
+    int std_offset;                 // 標準時の UTC からのオフセット（秒、東が正）
+    int dst_offset;                 // 夏時間の UTC からのオフセット（秒）
+    int has_dst;                    // 夏時間があるかどうか
+    struct tz_rule_date start;      // 夏時間の開始（標準時の現地時刻）
+    struct tz_rule_date end;        // 夏時間の終了（夏時間の現地時刻）
+};
+
+/**
+ * タイムゾーンの UTC からのオフセットの変化（tzdata の TZif ファイルから読み込む）
+ */
+struct tz_zone {
+    char name[64];
+    long long* transitions;         // オフセットが変わる時刻（UNIX時間、昇順）
+    int* offsets;                   // transitions[i] 以降のオフセット（秒）
+    size_t count;
+    int initial_offset;             // 最初の変化より前のオフセット（秒）
+    struct tz_rule rule;            // 最後の変化より後の規則（TZif バージョン2以降の末尾の TZ 文字列）
+    int has_rule;
+    int loaded;                     // 読み込めたかどうか（見つからない名前も記録して読み直さない）
+};
+
+/**
+ * 読み込んだタイムゾーンのキャッシュ（プロセスの終了まで保持する）
+ */
+static struct {
+    pthread_mutex_t lock;
+    struct tz_zone zones[TZ_CACHE_SIZE];
+    size_t count;
+} g_tz_cache = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static long long tz_read_be(const unsigned char* p, size_t width) {
+    unsigned long long value = 0;
+    for (size_t i = 0; i < width; i++) {
+        value = (value << 8) | p[i];
+    }
+    // 符号付きの値として読む
+    return width == 4 ? (long long)(int32_t)value : (long long)value;
+}
+
+/**
+ * TZ 文字列の時刻（[+-]hh[:mm[:ss]]）を読む関数
+ *
+ * @param p 読み始める位置
+ * @param out 秒数を受け取るポインタ
+ * @return 読み終えた位置、形式が不正な場合はNULL
+ */
+static const char* tz_parse_time(const char* p, long* out) {
+    int sign = 1;
+    if (*p == '+' || *p == '-') {
+        sign = (*p++ == '-') ? -1 : 1;
+    }
+    long value = 0;
+    for (int part = 0; part < 3; part++) {
+        if (!isdigit((unsigned char)*p)) {
+            return NULL;
+        }
+        long n = 0;
+        while (isdigit((unsigned char)*p) && n < 1000) {
+            n = n * 10 + (*p++ - '0');
+        }
+        value += n * (part == 0 ? 3600 : part == 1 ? 60 : 1);
+        if (*p != ':') {
+            break;
+        }
+        p++;
+    }
+    *out = sign * value;
+    return p;
+}
+
+/**
+ * TZ 文字列のタイムゾーン名（英字3文字以上、または <...>）を読み飛ばす関数
+ */
+static const char* tz_skip_name(const char* p) {
+    const char* start = p;
+    if (*p == '<') {
+        const char* close = strchr(p, '>');
+        return (close != NULL && close - p >= 4) ? close + 1 : NULL;
+    }
+    while (isalpha((unsigned char)*p)) {
+        p++;
+    }
+    return (p - start >= 3) ? p : NULL;
+}
+
+/**
+ * TZ 文字列の切り替え日と時刻（Mm.w.d[/time]、Jn[/time]、n[/time]）を読む関数
+ */
+static const char* tz_parse_rule_date(const char* p, struct tz_rule_date* date) {
+    char* end;
+    date->time = 2 * 3600;
+    if (*p == 'M') {
+        date->kind = 'M';
+        date->month = (int)strtol(p + 1, &end, 10);
+        if (*end != '.') {
+            return NULL;
+        }
+        date->week = (int)strtol(end + 1, &end, 10);
+        if (*end != '.') {
+            return NULL;
+        }
+        date->day = (int)strtol(end + 1, &end, 10);
+        if (date->month < 1 || date->month > 12 || date->week < 1 || date->week > 5 ||
+            date->day < 0 || date->day > 6) {
+            return NULL;
+        }
+    } else {
+        date->kind = (*p == 'J') ? 'J' : 'D';
+        if (*p == 'J') {
+            p++;
+        }
+        if (!isdigit((unsigned char)*p)) {
+            return NULL;
+        }
+        date->day = (int)strtol(p, &end, 10);
+        if (date->day > 365 || (date->kind == 'J' && date->day < 1)) {
+            return NULL;
+        }
+    }
+    p = end;
+    if (*p == '/') {
+        p = tz_parse_time(p + 1, &date->time);
+    }
+    return p;
+}
+
+/**
+ * POSIX の TZ 文字列を解析する関数（例: JST-9、EST5EDT,M3.2.0,M11.1.0、<+0330>-3:30）
+ * TZ 文字列のオフセットは西が正なので、符号を反転して記録する
+ *
+ * @param text TZ 文字列
+ * @param rule 解析結果を受け取るポインタ
+ * @return 成功時は0、形式が不正な場合は-1
+ */
+static int tz_parse_rule(const char* text, struct tz_rule* rule) {
+    long offset;
+    memset(rule, 0, sizeof(*rule));
+    const char* p = tz_skip_name(text);
+    if (p == NULL || (p = tz_parse_time(p, &offset)) == NULL) {
+        return -1;
+    }
+    rule->std_offset = (int)-offset;
+    if (*p == '\0') {
+        return 0;
+    }
+
+    if ((p = tz_skip_name(p)) == NULL) {
+        return -1;
+    }
+    rule->has_dst = 1;
+    rule->dst_offset = rule->std_offset + 3600;
+    if (*p != ',' && *p != '\0') {
+        if ((p = tz_parse_time(p, &offset)) == NULL) {
+            return -1;
+        }
+        rule->dst_offset = (int)-offset;
+    }
+    if (*p == '\0') {
+        // 規則のない夏時間は POSIX の既定（米国の規則）とする
+        rule->start = (struct tz_rule_date){ 'M', 3, 2, 0, 2 * 3600 };
+        rule->end = (struct tz_rule_date){ 'M', 11, 1, 0, 2 * 3600 };
+        return 0;
+    }
+    if (*p != ',' || (p = tz_parse_rule_date(p + 1, &rule->start)) == NULL ||
+        *p != ',' || (p = tz_parse_rule_date(p + 1, &rule->end)) == NULL) {
+        return -1;
+    }
+    return *p == '\0' ? 0 : -1;
+}
+
+/**
+ * 年月日から 1970-01-01 を0とする通日を求める関数
+ */
+static long long tz_days_from_civil(int year, int month, int day) {
+    struct rfc3339_time t = { .year = year, .month = month, .day = day };
+    return rfc3339_to_epoch(&t) / 86400;
+}
+
+/**
+ * 切り替え日の0時（現地時刻、UTC とみなした UNIX時間）を求める関数
+ */
+static long long tz_rule_day(const struct tz_rule_date* date, int year) {
+    if (date->kind == 'J') {
+        // 2月29日は数えないため、うるう年の3月1日以降は1日ずらす
+        int day = date->day - 1 + (rfc3339_leap_year(year) && date->day >= 60);
+        return (tz_days_from_civil(year, 1, 1) + day) * 86400;
+    }
+    if (date->kind == 'D') {
+        return (tz_days_from_civil(year, 1, 1) + date->day) * 86400;
+    }
+    long long first = tz_days_from_civil(year, date->month, 1);
+    int weekday = (int)(((first + 4) % 7 + 7) % 7);  // 1970-01-01 は木曜日
+    int day = 1 + (date->day - weekday + 7) % 7 + (date->week - 1) * 7;
+    int days_in_month = rfc3339_days_in_month[date->month - 1] + (date->month == 2 && rfc3339_leap_year(year));
+    while (day > days_in_month) {
+        day -= 7;
+    }
+    return (first + day - 1) * 86400;
+}
+
+/**
+ * 規則から時刻 t（UTC）のオフセットを求める関数
+ */
+static int tz_rule_offset(const struct tz_rule* rule, long long t) {
+    if (!rule->has_dst) {
+        return rule->std_offset;
+    }
+    char buf[RFC3339_UTC_SIZE];
+    rfc3339_format_utc(t + rule->std_offset, buf);
+    int year = atoi(buf);
+    long long start = tz_rule_day(&rule->start, year) + rule->start.time - rule->std_offset;
+    long long end = tz_rule_day(&rule->end, year) + rule->end.time - rule->dst_offset;
+    int in_dst = (start < end) ? (t >= start && t < end) : !(t >= end && t < start);
+    return in_dst ? rule->dst_offset : rule->std_offset;
+}
+
+/**
+ * TZif ファイル（RFC 8536）からオフセットの変化を読み込む関数
+ * バージョン2以降のファイルは64ビットの時刻を持つ後半のデータと、末尾の TZ 文字列を使う。
+ * 最後の変化より後のオフセットは TZ 文字列の規則で求める（zic の既定の slim 形式では、
+ * 規則で表せる変化はファイルに記録されない。fat 形式でも記録は2037年まで）
+ *
+ * @param zone 読み込み先（name は設定済み）
+ * @return 成功時は0、ファイルがないか形式が不正な場合は-1
+ */
+static int tz_zone_load(struct tz_zone* zone) {
+    const char* name = zone->name;
+    if (name[0] == '\0' || name[0] == '/' || strstr(name, "..") != NULL) {
+        return -1;
+    }
+    // libc と同じく TZDIR でタイムゾーンのディレクトリを差し替えられる
+    const char* dir = getenv("TZDIR");
+    char path[PATH_MAX];
+    if (snprintf(path, sizeof(path), "%s/%s", (dir && dir[0]) ? dir : ZONEINFO_DIR, name) >= (int)sizeof(path)) {
+        return -1;
+    }
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    unsigned char* data = NULL;
+    size_t size = 0;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size >= 44 && st.st_size <= TZ_MAX_FILE_SIZE) {
+        size = (size_t)st.st_size;
+        data = malloc(size);
+        if (data != NULL && read(fd, data, size) != (ssize_t)size) {
+            free(data);
+            data = NULL;
+        }
+    }
+    close(fd);
+    if (data == NULL) {
+        return -1;
+    }
+
+    int status = -1;
+    const unsigned char* header = data;
+    size_t width = 4;
+    if (memcmp(header, "TZif", 4) != 0) {
+        goto done;
+    }
+    if (header[4] >= '2') {
+        // バージョン1のデータを読み飛ばし、64ビットのヘッダーに移る
+        size_t skip = 44 + tz_read_be(header + 32, 4) * 5 + tz_read_be(header + 36, 4) * 6 +
+                      tz_read_be(header + 40, 4) + tz_read_be(header + 28, 4) * 8 +
+                      tz_read_be(header + 24, 4) + tz_read_be(header + 20, 4);
+        if (skip + 44 > size || memcmp(data + skip, "TZif", 4) != 0) {
+            goto done;
+        }
+        header = data + skip;
+        width = 8;
+    }
+    size_t time_count = (size_t)tz_read_be(header + 32, 4);
+    size_t type_count = (size_t)tz_read_be(header + 36, 4);
+    const unsigned char* times = header + 44;
+    const unsigned char* indices = times + time_count * width;
+    const unsigned char* types = indices + time_count;
+    if (type_count == 0 || type_count > 256 || time_count > size ||
+        types + type_count * 6 > data + size) {
+        goto done;
+    }
+    if (width == 8) {
+        // データの後ろの "\nTZ文字列\n"
+        const unsigned char* footer = types + type_count * 6 + tz_read_be(header + 40, 4) +
+                                      tz_read_be(header + 28, 4) * 12 + tz_read_be(header + 24, 4) +
+                                      tz_read_be(header + 20, 4);
+        if (footer < data + size && *footer == '\n') {
+            const unsigned char* close = memchr(footer + 1, '\n', (size_t)(data + size - footer - 1));
+            char text[128];
+            size_t len = close ? (size_t)(close - footer - 1) : 0;
+            if (len > 0 && len < sizeof(text)) {
+                memcpy(text, footer + 1, len);
+                text[len] = '\0';
+                zone->has_rule = (tz_parse_rule(text, &zone->rule) == 0);
+            }
+        }
+    }
+
+    zone->transitions = malloc((time_count ? time_count : 1) * sizeof(long long));
+    zone->offsets = malloc((time_count ? time_count : 1) * sizeof(int));
+    if (zone->transitions == NULL || zone->offsets == NULL) {
+        free(zone->transitions);
+        free(zone->offsets);
+        zone->transitions = NULL;
+        zone->offsets = NULL;
+        goto done;
+    }
+    for (size_t i = 0; i < time_count; i++) {
+        size_t type = indices[i] < type_count ? indices[i] : 0;
+        zone->transitions[i] = tz_read_be(times + i * width, width);
+        zone->offsets[i] = (int)tz_read_be(types + type * 6, 4);
+    }
+    zone->count = time_count;
+    zone->initial_offset = (int)tz_read_be(types, 4);
+    status = 0;
+
+done:
+    free(data);
+    return status;
+}
+
+/**
+ * キャッシュからタイムゾーンを探し、なければ読み込んでキャッシュに加える関数（g_tz_cache.lock を保持して呼ぶ）
+ *
+ * @param name IANA のタイムゾーン名
+ * @return キャッシュのタイムゾーン（loaded が0なら見つからなかった名前）、キャッシュが一杯の場合はNULL
+ */
+static struct tz_zone* tz_cache_find(const char* name) {
+    for (size_t i = 0; i < g_tz_cache.count; i++) {
+        if (strcmp(g_tz_cache.zones[i].name, name) == 0) {
+            return &g_tz_cache.zones[i];
+        }
+    }
+    if (g_tz_cache.count == TZ_CACHE_SIZE) {
+        return NULL;
+    }
+    struct tz_zone* zone = &g_tz_cache.zones[g_tz_cache.count++];
+    SAFE_STRCPY(zone->name, name, sizeof(zone->name));
+    zone->loaded = (tz_zone_load(zone) == 0);
+    return zone;
+}
+
+/**
+ * 時刻 t におけるタイムゾーンのオフセット（秒）を求める関数
+ */
+static int tz_zone_offset(const struct tz_zone* zone, long long t) {
+    if (zone->has_rule && (zone->count == 0 || t >= zone->transitions[zone->count - 1])) {
+        return tz_rule_offset(&zone->rule, t);
+    }
+    if (zone->count == 0 || t < zone->transitions[0]) {
+        return zone->initial_offset;
+    }
+    size_t lo = 0, hi = zone->count;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (zone->transitions[mid] <= t) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return zone->offsets[lo];
+}
+
+/**
+ * タイムゾーンの壁時計の時刻を UNIX時間に変換する関数
+ * 夏時間の切り替えで存在しない時刻や2回ある時刻は、どちらかのオフセットで解釈する
+ *
+ * @param name IANA のタイムゾーン名（例: Asia/Tokyo）
+ * @param wall 壁時計の時刻を UTC とみなした UNIX時間
+ * @param out 変換した時刻を受け取るポインタ
+ * @return 成功時は0、タイムゾーンが見つからない場合は-1
+ */
+int tz_wall_to_epoch(const char* name, long long wall, long long* out) {
+    if (strlen(name) >= sizeof(g_tz_cache.zones[0].name)) {
+        return -1;
+    }
+    pthread_mutex_lock(&g_tz_cache.lock);
+    struct tz_zone* zone = tz_cache_find(name);
+    int status = -1;
+    if (zone != NULL && zone->loaded) {
+        int offset = tz_zone_offset(zone, wall);
+        long long t = wall - offset;
+        int actual = tz_zone_offset(zone, t);
+        if (actual != offset && tz_zone_offset(zone, wall - actual) == actual) {
+            t = wall - actual;
+        }
+        *out = t;
+        status = 0;
+    }
+    pthread_mutex_unlock(&g_tz_cache.lock);
+    return status;
+}
+
+/**
+ * tzdata にタイムゾーンがあるかどうかを調べる関数
+ *
+ * @param name IANA のタイムゾーン名（例: America/New_York）
+ * @return ある場合は1、ない場合は0、tzdata がインストールされておらず調べられない場合は-1
+ */
+int tz_zone_exists(const char* name) {
+    if (strlen(name) >= sizeof(g_tz_cache.zones[0].name)) {
+        return 0;
+    }
+    pthread_mutex_lock(&g_tz_cache.lock);
+    struct tz_zone* zone = tz_cache_find(name);
+    int found;
+    if (zone != NULL) {
+        found = zone->loaded;
+    } else {
+        // キャッシュが一杯なら、読み込んだものはすぐに捨てる
+        struct tz_zone scratch = {0};
+        SAFE_STRCPY(scratch.name, name, sizeof(scratch.name));
+        found = (tz_zone_load(&scratch) == 0);
+        free(scratch.transitions);
+        free(scratch.offsets);
+    }
+    pthread_mutex_unlock(&g_tz_cache.lock);
+    if (!found) {
+        const char* dir = getenv("TZDIR");
+        struct stat st;
+        if (stat((dir && dir[0]) ? dir : ZONEINFO_DIR, &st) != 0 || !S_ISDIR(st.st_mode)) {
+            return -1;
+        }
+    }
+    return found;
+}
+
+/**
+ * 入力された日時を API に送る UTC の形式（YYYY-MM-DDTHH:MM:SSZ）に書き直す関数
+ * オフセットのない日時は、このコンピューターのタイムゾーンの時刻とみなす。小数秒は切り捨てる。
+ *
+ * @param t 解析した日時
+ * @param out 書き出し先（RFC3339_UTC_SIZE バイト以上）
+ * @return 成功時は0、時刻に変換できない場合は-1
+ */
+static int datetime_normalize(const struct rfc3339_time* t, char* out) {
+    long long epoch = rfc3339_to_epoch(t);
+    if (!t->has_offset) {
+        struct tm tm = {0};
+        tm.tm_year = t->year - 1900;
+        tm.tm_mon = t->month - 1;
+        tm.tm_mday = t->day;
+        tm.tm_hour = t->hour;
+        tm.tm_min = t->minute;
+        tm.tm_sec = t->second;
+        tm.tm_isdst = -1;
+        time_t local = mktime(&tm);
+        if (local == (time_t)-1) {
+            return -1;
+        }
+        epoch = (long long)local;
+    }
+    rfc3339_format_utc(epoch, out);
+    return 0;
+}
+
+/**
+ * ユーザーからイベントの詳細を安全に取得する関数
+ * 
+ * @param event_summary イベントのタイトルを格納する文字列
+ * @param event_start イベントの開始日時を格納する文字列
+ * @param event_end イベントの終了日時を格納する文字列
+ */
+void get_event_details(char* event_summary, char* event_start, char* event_end) {
+    printf("イベントの詳細を入力してください：\n");
+
+    printf("イベントのタイトル: ");
+    if (fgets(event_summary, MAX_INPUT_LENGTH, stdin) == NULL) {
+        fprintf(stderr, "エラー: イベントタイトルの読み取りに失敗しました\n");
+        exit(1);
+    }
+    event_summary[strcspn(event_summary, "\n")] = 0;
+
+    printf("日時はこのコンピューターのタイムゾーンで入力してください（末尾に Z や +09:00 を付けるとそのオフセットで解釈します）\n");
+    printf("開始日時 (YYYY-MM-DDTHH:MM:SS): ");
+    if (fgets(event_start, MAX_INPUT_LENGTH, stdin) == NULL) {
+        fprintf(stderr, "エラー: 開始日時の読み取りに失敗しました\n");
+        exit(1);
+    }
+    event_start[strcspn(event_start, "\n")] = 0;
+
+    printf("終了日時 (YYYY-MM-DDTHH:MM:SS): ");
+    if (fgets(event_end, MAX_INPUT_LENGTH, stdin) == NULL) {
+        fprintf(stderr, "エラー: 終了日時の読み取りに失敗しました\n");
+        exit(1);
+    }
+    event_end[strcspn(event_end, "\n")] = 0;
+
+    // セキュリティ強化: 入力値の検証
+    if (!validate_datetime(event_start) || !validate_datetime(event_end)) {
+        fprintf(stderr, "エラー: 無効な日時形式です\n");
+        exit(1);
+    }
+    struct rfc3339_time start, end;
+    rfc3339_parse_fields(event_start, strlen(event_start), &start);
+    rfc3339_parse_fields(event_end, strlen(event_end), &end);
+    if (start.has_offset != end.has_offset) {
+        // 一方だけをローカル時刻として解釈すると、前後関係を取り違えるおそれがある
+        fprintf(stderr, "エラー: 開始日時と終了日時は、どちらもオフセット付きか、どちらもオフセットなしで入力してください\n");
+        exit(1);
+    }
+
+    // 区切りの空白や小文字の t、小数秒なども受け付けるため、API に送る前に1つの形式に揃える
+    char start_utc[RFC3339_UTC_SIZE];
+    char end_utc[RFC3339_UTC_SIZE];
+    if (datetime_normalize(&start, start_utc) != 0 || datetime_normalize(&end, end_utc) != 0) {
+        fprintf(stderr, "エラー: 無効な日時形式です\n");
+        exit(1);
+    }
+    if (strcmp(end_utc, start_utc) < 0) {
+        fprintf(stderr, "エラー: 終了日時が開始日時より前です\n");
+        exit(1);
+    }
+    SAFE_STRCPY(event_start, start_utc, MAX_INPUT_LENGTH);
+    SAFE_STRCPY(event_end, end_utc, MAX_INPUT_LENGTH);
+}
+
+/**
+ * プログラムの使用方法を表示する関数
+ */
+void print_usage() {
+    printf("使用方法:\n");
+    printf("1. config.jsonファイルを作成し、以下の情報を記入してください：\n");
+    printf("   {\n");
+    printf("     \"client_id\": \"YOUR_CLIENT_ID\",\n");
+    printf("     \"client_secret\": \"YOUR_CLIENT_SECRET\",\n");
+    printf("     \"redirect_uri\": \"urn:ietf:wg:oauth:2.0:oob\",\n");
+    printf("     \"calendar_id\": \"primary\"\n");
+    printf("   }\n\n");
+    printf("2. プログラムを実行します。\n");
+    printf("3. 初回実行時は、表示されるURLにアクセスして認証を行ってください。\n");
+    printf("4. 認証後、イベントの詳細を入力してください。\n\n");
+    printf("config.json には以下のキーも指定できます（コマンドラインの同名オプションが優先されます）：\n");
+    printf("   auth_url, token_url, api_base_url, batch_url,\n");
+    printf("   concurrency, batch_size, batch_flush_ms, http_version, max_streams, token_refresh_margin,\n");
+    printf("   adaptive_concurrency, max_retries, deterministic_ids, hedge_requests\n\n");
+    printf("オプション:\n");
+    printf("  --input FILE     JSONL形式（1行に1イベント）のファイルから一括インポートします（-は標準入力）\n");
+    printf("                   拡張子が .ics の場合は iCalendar (RFC 5545) の VEVENT をイベントに変換します\n");
+    printf("  --concurrency N  一括インポート時に同時に処理するリクエスト数の上限（既定: 1）\n");
+    printf("  --fixed-concurrency  レート制限に応じた同時実行数の自動調整を行わず、常に上限まで送信します\n");
+    printf("  --batch-size N   N件（最大%d件）のイベントを1回のバッチリクエストにまとめます（既定: 1）\n", MAX_BATCH_SIZE);
+    printf("  --batch-flush-ms T  バッチが満たない場合に送信を待つ最大時間（ミリ秒、既定: %d）\n", DEFAULT_BATCH_FLUSH_MS);
+    printf("  --http-version V HTTPSで使用するHTTPバージョン（2 または 1.1、既定: 2）\n");
+    printf("                   h2c は http:// の接続にも HTTP/2 を使います（模擬サーバーでの測定用）\n");
+    printf("  --max-streams N  HTTP/2の1接続あたりの同時ストリーム数の上限（既定: %d）\n", DEFAULT_MAX_STREAMS);
+    printf("  --token-refresh-margin SEC  アクセストークンを有効期限の何秒前に更新するか（既定: %d）\n", DEFAULT_TOKEN_REFRESH_MARGIN);
+    printf("  --max-retries N  一時的なエラー（転送エラー、レート制限、5xx）で失敗したイベントを再送する\n");
+    printf("                   最大回数（既定: %d）。再送の間隔は指数的に広げ、Retry-After に従います\n", DEFAULT_MAX_RETRIES);
+    printf("  --no-event-ids   iCalUID とカレンダーIDから決まるイベントIDを付けずに送信します\n");
+    printf("                   （既定では付けるため、再送で同じイベントが二重に作られることはありません）\n");
+    printf("  --hedge          直近の p95 を超えても応答のないリクエストを複製して送り、先に届いた応答を使います\n");
+    printf("                   （複製は送信したリクエストの %d%% まで）\n", HEDGE_BUDGET_PERCENT);
+    printf("  --deadline SEC   起動から SEC 秒で新しい送信をやめ、送信中のリクエストも打ち切ります\n");
+    printf("  --journal FILE   一括インポートの結果を FILE に追記で記録します（再開に使用）\n");
+    printf("  --resume         ジャーナルをもとに、成功済みのイベントを飛ばして前回の続きから再開します\n");
+    printf("                   （--journal を省略した場合は 入力ファイル名.journal を使用）\n");
+    printf("  --dedup-index FILE  インポートに成功したイベントの iCalUID と本文のハッシュを FILE に記録し、\n");
+    printf("                   次回以降は前回から変更のないイベントを送信せずに読み飛ばします\n");
+    printf("                   （カレンダー側で削除したイベントを送り直す場合は FILE を削除してください）\n");
+    printf("  --sync FILE      インポートの前に events.list でカレンダーの変更を取得して FILE に記録し、\n");
+    printf("                   カレンダーと内容の異なるイベントだけを送信します。初回はすべてのイベントを取得し、\n");
+    printf("                   以降は FILE.token に保存した同期トークンで差分だけを取得します\n");
+    printf("  --export FILE    カレンダーのイベントを JSONL 形式で FILE に書き出します（-は標準出力）\n");
+    printf("                   時間範囲を区間に分け、区間ごとのページを --concurrency 件まで並行に取得します\n");
+    printf("  --time-min T     T より後に終わるイベントを書き出します（RFC 3339 の日時または日付）\n");
+    printf("  --time-max T     T より前に始まるイベントを書き出します\n");
+    printf("  --shards N       時間範囲の分割数（既定: --concurrency の %d 倍、最大 %d）\n", EXPORT_SHARDS_PER_SLOT,
+           EXPORT_MAX_SHARDS);
+    printf("  --sorted         イベントを開始時刻の順に並べて書き出します（届いた区間を一時ファイルに溜めます）\n");
+    printf("  --watch-config   config.json の変更を監視し、実行中に設定を再読み込みします\n");
+    printf("  --metrics-file FILE  メトリクスを Prometheus のテキスト形式で FILE に定期的に書き出します\n");
+    printf("                   （node_exporter の textfile collector 向け）\n");
+    printf("  --metrics-port N 127.0.0.1:N の /metrics でメトリクスを公開します\n");
+    printf("  --metrics-interval SEC  --metrics-file を書き出す間隔（秒、既定: %d）\n", DEFAULT_METRICS_INTERVAL);
+    printf("  --help           この使用方法を表示します\n\n");
+    printf("実行中に SIGUSR1 を送ると、DNS・接続・TLS・応答待ち・受信の段階ごとの通信時間を標準エラー出力に表示します\n");
+    printf("（終了時にも表示します）。\n");
+}
+
+/**
+ * JSONLストリームリーダー構造体
+ * ファイル全体を読み込まず、固定サイズのチャンクを json_tokener に逐次渡して
+ * 1イベントずつ取り出すための状態を保持する
+ */
+struct jsonl_reader {
+    int fd;                       // 入力ファイルディスクリプタ
+    int saved_flags;              // 非ブロッキング化する前のファイル状態フラグ（-1は未変更）
+    const char* path;             // エラーメッセージ用のパス
+    json_tokener* tok;            // 再利用するトークナイザ
+    char buf[JSONL_READ_CHUNK];   // 読み込みチャンク
+    size_t len;                   // チャンク内の有効バイト数
+    size_t pos;                   // チャンク内の現在位置
+    int in_value;                 // トークナイザに値の途中まで渡しているか
+    int skipping;                 // 解析エラー後、次の改行まで読み飛ばし中か
+    unsigned long line;           // 現在位置の行番号（1始まり）
+    unsigned long value_line;     // 直近に取り出した値の開始行
+    unsigned long long base_offset;  // チャンク先頭の入力上のバイトオフセット
+    unsigned long long value_offset; // 直近に取り出した値の開始バイトオフセット
+};
+
+/**
+ * JSONLリーダーを閉じる関数
+ *
+ * @param reader 閉じるリーダー
+ */
+void jsonl_reader_close(struct jsonl_reader* reader) {
+    if (reader->tok) {
+        json_tokener_free(reader->tok);
+    }
+    if (reader->saved_flags >= 0) {
+        fcntl(reader->fd, F_SETFL, reader->saved_flags);
+    }
+    if (reader->fd > STDIN_FILENO) {
+        close(reader->fd);
+    }
+    reader->tok = NULL;
+    reader->fd = -1;
+}
+
+/**
+ * JSONLリーダーを初期化する関数
+ *
+ * @param reader 初期化するリーダー
+ * @param path 入力ファイルのパス（"-" は標準入力）
+ * @return 成功時は0、失敗時は-1
+ */
+int jsonl_reader_open(struct jsonl_reader* reader, const char* path) {
+    memset(reader, 0, sizeof(*reader));
+    reader->path = path;
+    reader->line = 1;
+    reader->saved_flags = -1;
+
+    if (strcmp(path, "-") == 0) {
+        reader->fd = STDIN_FILENO;
+    } else {
+        reader->fd = open(path, O_RDONLY);
+        if (reader->fd < 0) {
+            fprintf(stderr, "エラー: 入力ファイル %s を開けません\n", path);
+            return -1;
+        }
+    }
+
+    // パイプなどから読む場合は、データを待つ間も転送を進められるよう非ブロッキングにする
+    struct stat st;
+    if (fstat(reader->fd, &st) == 0 && !S_ISREG(st.st_mode)) {
+        int flags = fcntl(reader->fd, F_GETFL);
+        if (flags >= 0 && fcntl(reader->fd, F_SETFL, flags | O_NONBLOCK) == 0) {
+            reader->saved_flags = flags;
+        }
+    }
+
+    reader->tok = json_tokener_new();
+    if (reader->tok == NULL) {
+        fprintf(stderr, "エラー: メモリ割り当てに失敗しました\n");
+        jsonl_reader_close(reader);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * チャンク内の現在位置を進め、通過した改行を行番号に反映する
+ */
+static void jsonl_reader_advance(struct jsonl_reader* reader, size_t n) {
+    const char* p = reader->buf + reader->pos;
+    const char* end = p + n;
+    while ((p = memchr(p, '\n', end - p)) != NULL) {
+        reader->line++;
+        p++;
+    }
+    reader->pos += n;
+}
+
+/**
+ * 未処理のデータがなければ次のチャンクを読み込む
+ *
+ * @return データがある場合は1、EOFの場合は0、読み取りエラーの場合は-1、
+ *         非ブロッキング入力でデータがまだ届いていない場合は2
+ */
+static int jsonl_reader_fill(struct jsonl_reader* reader) {
+    if (reader->pos < reader->len) {
+        return 1;
+    }
+    reader->base_offset += reader->len;
+    reader->pos = 0;
+    reader->len = 0;
+
+    for (;;) {
+        ssize_t n = read(reader->fd, reader->buf, sizeof(reader->buf));
+        if (n > 0) {
+            reader->len = (size_t)n;
+            return 1;
+        }
+        if (n == 0) {
+            return 0;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 2;
+        }
+        return -1;
+    }
+}
+
+/**
+ * 次のイベントオブジェクトを取り出す関数
+ * 解析できない行はエラーとして報告し、次の行から読み取りを再開する
+ *
+ * @param reader JSONLリーダー
+ * @param out 取り出したJSONオブジェクト（呼び出し側で json_object_put する）
+ * @return 取り出せた場合は1、EOFの場合は0、その行が不正な場合は-1、読み取りエラーの場合は-2、
+ *         非ブロッキング入力でデータがまだ届いていない場合は2
+ */
+int jsonl_reader_next(struct jsonl_reader* reader, struct json_object** out) {
+    *out = NULL;
+
+    for (;;) {
+        int filled = jsonl_reader_fill(reader);
+        if (filled == 2) {
+            return 2;
+        }
+        if (filled < 0) {
+            fprintf(stderr, "エラー: 入力ファイル %s の読み取りに失敗しました: %s\n", reader->path, strerror(errno));
+            return -2;
+        }
+        if (filled == 0) {
+            if (reader->in_value) {
+                fprintf(stderr, "エラー: %s:%lu 行目のJSONが途中で終わっています\n",
+                        reader->path, reader->value_line);
+                reader->in_value = 0;
+                json_tokener_reset(reader->tok);
+                return -1;
+            }
+            return 0;
+        }
+
+        if (reader->skipping) {
+            const char* nl = memchr(reader->buf + reader->pos, '\n', reader->len - reader->pos);
+            if (nl == NULL) {
+                reader->pos = reader->len;
+                continue;
+            }
+            jsonl_reader_advance(reader, (size_t)(nl - (reader->buf + reader->pos)) + 1);
+            reader->skipping = 0;
+            continue;
+        }
+
+        if (!reader->in_value) {
+            while (reader->pos < reader->len && isspace((unsigned char)reader->buf[reader->pos])) {
+                jsonl_reader_advance(reader, 1);
+            }
+            if (reader->pos == reader->len) {
+                continue;
+            }
+            reader->in_value = 1;
+            reader->value_line = reader->line;
+            reader->value_offset = reader->base_offset + reader->pos;
+        }
+
+        size_t avail = reader->len - reader->pos;
+        struct json_object* obj = json_tokener_parse_ex(reader->tok, reader->buf + reader->pos, (int)avail);
+        enum json_tokener_error jerr = json_tokener_get_error(reader->tok);
+
+        if (jerr == json_tokener_continue) {
+            jsonl_reader_advance(reader, avail);
+            continue;
+        }
+
+        jsonl_reader_advance(reader, json_tokener_get_parse_end(reader->tok));
+        json_tokener_reset(reader->tok);
+        reader->in_value = 0;
+
+        if (jerr != json_tokener_success) {
+            fprintf(stderr, "エラー: %s:%lu 行目のJSONを解析できません: %s\n",
+                    reader->path, reader->value_line, json_tokener_error_desc(jerr));
+            reader->skipping = 1;
+            return -1;
+        }
+
+        if (!json_object_is_type(obj, json_type_object)) {
+            fprintf(stderr, "エラー: %s:%lu 行目がJSONオブジェクトではありません\n",
+                    reader->path, reader->value_line);
+            json_object_put(obj);
+            return -1;
+        }
+
+        *out = obj;
+        return 1;
+    }
+}
+
+/**
+ * 空白を読み飛ばし、次の値の先頭まで読み進める関数
+ * 解析エラーの後で読み飛ばし中の場合は、先にその行の終わりまで進める
+ *
+ * @param reader JSONLリーダー
+ * @return 値の先頭に進んだ場合は1、EOFの場合は0、読み取りエラーの場合は-1、
+ *         非ブロッキング入力でデータがまだ届いていない場合は2
+ */
+int jsonl_reader_skip_space(struct jsonl_reader* reader) {
+    if (reader->in_value) {
+        return 1;
+    }
+    for (;;) {
+        int filled = jsonl_reader_fill(reader);
+        if (filled != 1) {
+            return filled;
+        }
+        if (reader->skipping) {
+            const char* nl = memchr(reader->buf + reader->pos, '\n', reader->len - reader->pos);
+            if (nl == NULL) {
+                reader->pos = reader->len;
+                continue;
+            }
+            jsonl_reader_advance(reader, (size_t)(nl - (reader->buf + reader->pos)) + 1);
+            reader->skipping = 0;
+        }
+        while (reader->pos < reader->len && isspace((unsigned char)reader->buf[reader->pos])) {
+            jsonl_reader_advance(reader, 1);
+        }
+        if (reader->pos < reader->len) {
+            return 1;
+        }
+    }
+}
+
+/**
+ * 入力上の指定した位置から読み取りを再開する関数
+ * 位置が読み込み済みのチャンク内にあればそのチャンクを使い、そうでなければシークする
+ *
+ * @param reader JSONLリーダー
+ * @param offset 再開するバイトオフセット
+ * @param line その位置の行番号
+ * @return 成功時は0、失敗時は-1
+ */
+int jsonl_reader_seek(struct jsonl_reader* reader, unsigned long long offset, unsigned long line) {
+    if (reader->in_value) {
+        json_tokener_reset(reader->tok);
+        reader->in_value = 0;
+    }
+    reader->skipping = 0;
+    reader->line = line;
+
+    if (offset >= reader->base_offset && offset <= reader->base_offset + reader->len) {
+        reader->pos = (size_t)(offset - reader->base_offset);
+        return 0;
+    }
+    if (lseek(reader->fd, (off_t)offset, SEEK_SET) == (off_t)-1) {
+        fprintf(stderr, "エラー: 入力ファイル %s をシークできません: %s\n", reader->path, strerror(errno));
+        return -1;
+    }
+    reader->base_offset = offset;
+    reader->pos = 0;
+    reader->len = 0;
+    return 0;
+}
+
+/**
+ * 現在時刻をミリ秒単位で取得する関数（単調増加クロック）
+ *
+ * @return 任意の起点からの経過ミリ秒
+ */
+static long long monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * 可変長文字列バッファ構造体
+ * 領域は解放せずに len を0に戻して再利用する
+ */
+struct string_buffer {
+    char* data;
+    size_t len;
+    size_t cap;
+};
+
+/**
+ * 文字列バッファにデータを追加する関数
+ *
+ * @param buf 追加先のバッファ
+ * @param data 追加するデータ
+ * @param len 追加するバイト数
+ * @return 成功時は0、失敗時は-1
+ */
+int string_buffer_append(struct string_buffer* buf, const char* data, size_t len) {
+    if (buf->len + len + 1 > buf->cap) {
+        size_t new_cap = buf->cap ? buf->cap : 256;
+        while (new_cap < buf->len + len + 1) {
+            new_cap *= 2;
+        }
+        char* ptr = realloc(buf->data, new_cap);
+        if (!ptr) {
+            fprintf(stderr, "エラー: メモリ割り当てに失敗しました\n");
+            return -1;
+        }
+        buf->data = ptr;
+        buf->cap = new_cap;
+    }
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+    buf->data[buf->len] = '\0';
+    return 0;
+}
+
+/**
+ * 書式化した文字列を文字列バッファに追加する関数
+ *
+ * @param buf 追加先のバッファ
+ * @param fmt printf形式の書式
+ * @return 成功時は0、失敗時は-1
+ */
+int string_buffer_appendf(struct string_buffer* buf, const char* fmt, ...) {
+    char tmp[BUFFER_SIZE];
+    va_list ap;
+    va_start(ap, fmt);
+    int written = vsnprintf(tmp, sizeof(tmp), fmt, ap);
+    va_end(ap);
+    if (written < 0 || written >= (int)sizeof(tmp)) {
+        fprintf(stderr, "エラー: 文字列の生成に失敗しました\n");
+        return -1;
+    }
+    return string_buffer_append(buf, tmp, (size_t)written);
+}
+
+/**
+ * JSONライター
+ * 値を文字列バッファに直接書き出す。オブジェクトを組み立てないため、書き出し中の割り当ては
+ * バッファの拡張だけで、バッファを使い回せば定常状態では割り当ては発生しない。
+ */
+struct json_writer {
+    struct string_buffer* out;      // 書き出し先（呼び出し側が所有し、使い回す）
+    unsigned int depth;             // 現在の入れ子の深さ
+    unsigned long long has_items;   // ビットn: 深さnのコンテナに要素を書いたかどうか
+    int after_key;                  // キーを書いた直後かどうか
+    int error;                      // 書き出しに失敗したかどうか
+};
+
+/**
+ * JSONライターを初期化する関数（出力先のバッファは空にする）
+ *
+ * @param writer 初期化するライター
+ * @param out 書き出し先のバッファ
+ */
+void json_writer_init(struct json_writer* writer, struct string_buffer* out) {
+    memset(writer, 0, sizeof(*writer));
+    writer->out = out;
+    out->len = 0;
+}
+
+/**
+ * 加工せずに書き出す関数
+ */
+static void json_writer_raw(struct json_writer* writer, const char* data, size_t len) {
+    if (!writer->error && string_buffer_append(writer->out, data, len) != 0) {
+        writer->error = 1;
+    }
+}
+
+/**
+ * 値の前に必要な区切り（","）を書き出す関数
+ */
+static void json_writer_separator(struct json_writer* writer) {
+    if (writer->after_key) {
+        writer->after_key = 0;
+        return;
+    }
+    if (writer->depth > 0) {
+        unsigned long long bit = 1ULL << writer->depth;
+        if (writer->has_items & bit) {
+            json_writer_raw(writer, ",", 1);
+        }
+        writer->has_items |= bit;
+    }
+}
+
+/**
+ * 文字列の先頭からエスケープが不要なバイト数を数える関数
+ * SSE2 が使える場合は16バイトずつまとめて判定する（0x80以上のバイトは UTF-8 としてそのまま出力する）
+ *
+ * @param s 文字列
+ * @param len バイト数
+ * @return 最初にエスケープが必要な位置（なければ len）
+ */
+static size_t json_plain_prefix(const char* s, size_t len) {
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i control_max = _mm_set1_epi8(0x1F);
+    for (; i + 16 <= len; i += 16) {
+        __m128i c = _mm_loadu_si128((const __m128i*)(s + i));
+        __m128i special = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(c, quote), _mm_cmpeq_epi8(c, backslash)),
+                                       _mm_cmpeq_epi8(_mm_max_epu8(c, control_max), control_max));
+        int mask = _mm_movemask_epi8(special);
+        if (mask != 0) {
+            return i + (size_t)__builtin_ctz((unsigned)mask);
+        }
+    }
+#endif
+    for (; i < len; i++) {
+        unsigned char c = (unsigned char)s[i];
+        if (c < 0x20 || c == '"' || c == '\\') {
+            break;
+        }
+    }
+    return i;
+}
+
+/**
+ * 文字列をエスケープして引用符付きで書き出す関数
+ */
+static void json_writer_escaped(struct json_writer* writer, const char* s, size_t len) {
+    static const char hex[] = "0123456789abcdef";
+    json_writer_raw(writer, "\"", 1);
+    while (len > 0) {
+        size_t plain = json_plain_prefix(s, len);
+        json_writer_raw(writer, s, plain);
+        if (plain == len) {
+            break;
+        }
+
+        unsigned char c = (unsigned char)s[plain];
+        char escaped[6] = { '\\', 0, 0, 0, 0, 0 };
+        size_t escaped_len = 2;
+        switch (c) {
+            case '"':  escaped[1] = '"'; break;
+            case '\\': escaped[1] = '\\'; break;
+            case '\b': escaped[1] = 'b'; break;
+            case '\f': escaped[1] = 'f'; break;
+            case '\n': escaped[1] = 'n'; break;
+            case '\r': escaped[1] = 'r'; break;
+            case '\t': escaped[1] = 't'; break;
+            default:
+                memcpy(escaped + 1, "u00", 3);
+                escaped[4] = hex[c >> 4];
+                escaped[5] = hex[c & 0xF];
+                escaped_len = 6;
+                break;
+        }
+        json_writer_raw(writer, escaped, escaped_len);
+        s += plain + 1;
+        len -= plain + 1;
+    }
+    json_writer_raw(writer, "\"", 1);
+}
+
+/**
+ * オブジェクトの開始・終了、配列の開始・終了を書き出す関数
+ */
+void json_writer_begin_object(struct json_writer* writer) {
+    json_writer_separator(writer);
+    json_writer_raw(writer, "{", 1);
+    writer->depth++;
+    writer->has_items &= ~(1ULL << writer->depth);
+}
+
+void json_writer_end_object(struct json_writer* writer) {
+    writer->depth--;
+    json_writer_raw(writer, "}", 1);
+}
+
+void json_writer_begin_array(struct json_writer* writer) {
+    json_writer_separator(writer);
+    json_writer_raw(writer, "[", 1);
+    writer->depth++;
+    writer->has_items &= ~(1ULL << writer->depth);
+}
+
+void json_writer_end_array(struct json_writer* writer) {
+    writer->depth--;
+    json_writer_raw(writer, "]", 1);
+}
+
+/**
+ * オブジェクトのキーを書き出す関数（続けて値を書き出す）
+ *
+ * @param writer ライター
+ * @param key キー
+ */
+void json_writer_key(struct json_writer* writer, const char* key) {
+    json_writer_separator(writer);
+    json_writer_escaped(writer, key, strlen(key));
+    json_writer_raw(writer, ":", 1);
+    writer->after_key = 1;
+}
+
+/**
+ * 文字列の値を書き出す関数
+ *
+ * @param writer ライター
+ * @param value 値（NULLの場合は null）
+ */
+void json_writer_string(struct json_writer* writer, const char* value) {
+    json_writer_separator(writer);
+    if (value == NULL) {
+        json_writer_raw(writer, "null", 4);
+    } else {
+        json_writer_escaped(writer, value, strlen(value));
+    }
+}
+
+/**
+ * 整数の値を書き出す関数
+ */
+void json_writer_int(struct json_writer* writer, long long value) {
+    char buf[24];
+    int len = snprintf(buf, sizeof(buf), "%lld", value);
+    json_writer_separator(writer);
+    json_writer_raw(writer, buf, (size_t)len);
+}
+
+/**
+ * 真偽値を書き出す関数
+ */
+void json_writer_bool(struct json_writer* writer, int value) {
+    json_writer_separator(writer);
+    json_writer_raw(writer, value ? "true" : "false", value ? 4 : 5);
+}
+
+/**
+ * 値がある場合だけ「キー: 文字列」を書き出す関数
+ */
+static void json_writer_member(struct json_writer* writer, const char* key, const char* value) {
+    if (value != NULL) {
+        json_writer_key(writer, key);
+        json_writer_string(writer, value);
+    }
+}
+
+/**
+ * イベントの開始・終了日時
+ * 終日イベントは date、それ以外は date_time（と必要なら time_zone）を指定する
+ */
+struct event_time {
+    const char* date;
+    const char* date_time;
+    const char* time_zone;
+};
+
+/**
+ * イベントの参加者
+ */
+struct event_attendee {
+    const char* email;
+    const char* display_name;
+    int optional;
+};
+
+/**
+ * イベントのリマインダー（method は "email" または "popup"）
+ */
+struct event_reminder {
+    const char* method;
+    int minutes;
+};
+
+/**
+ * 拡張プロパティのキーと値
+ */
+struct event_property {
+    const char* key;
+    const char* value;
+};
+
+/**
+ * Google Calendar API のイベントの項目
+ * NULLまたは件数0の項目は書き出さない
+ */
+struct event_fields {
+    const char* ical_uid;
+    const char* summary;
+    const char* description;
+    const char* location;
+    const char* status;
+    const char* transparency;
+    struct event_time start;
+    struct event_time end;
+    const char* const* recurrence;
+    size_t recurrence_count;
+    const struct event_attendee* attendees;
+    size_t attendee_count;
+    int reminders_use_default;      // 1/0 で useDefault を書き出す（負の値は reminders を書き出さない）
+    const struct event_reminder* reminders;
+    size_t reminder_count;
+    const struct event_property* private_properties;
+    size_t private_count;
+    const struct event_property* shared_properties;
+    size_t shared_count;
+    int sequence;                   // 負の値は書き出さない
+};
+
+/**
+ * 日時オブジェクトを書き出す関数
+ */
+static void json_write_event_time(struct json_writer* writer, const char* key, const struct event_time* when) {
+    if (when->date == NULL && when->date_time == NULL) {
+        return;
+    }
+    json_writer_key(writer, key);
+    json_writer_begin_object(writer);
+    json_writer_member(writer, "date", when->date);
+    json_writer_member(writer, "dateTime", when->date_time);
+    json_writer_member(writer, "timeZone", when->time_zone);
+    json_writer_end_object(writer);
+}
+
+/**
+ * 拡張プロパティを1組書き出す関数
+ */
+static void json_write_properties(struct json_writer* writer, const char* key,
+                                  const struct event_property* properties, size_t count) {
+    if (count == 0) {
+        return;
+    }
+    json_writer_key(writer, key);
+    json_writer_begin_object(writer);
+    for (size_t i = 0; i < count; i++) {
+        json_writer_member(writer, properties[i].key, properties[i].value);
+    }
+    json_writer_end_object(writer);
+}
+
+/**
+ * イベントをJSONとして書き出す関数
+ *
+ * @param out 書き出し先のバッファ（先頭から書き直す）
+ * @param event イベントの項目
+ * @return 成功時は0、失敗時は-1
+ */
+int json_write_event(struct string_buffer* out, const struct event_fields* event) {
+    struct json_writer writer;
+    json_writer_init(&writer, out);
+
+    json_writer_begin_object(&writer);
+    json_writer_member(&writer, "iCalUID", event->ical_uid);
+    json_writer_member(&writer, "summary", event->summary);
+    json_writer_member(&writer, "description", event->description);
+    json_writer_member(&writer, "location", event->location);
+    json_writer_member(&writer, "status", event->status);
+    json_writer_member(&writer, "transparency", event->transparency);
+    json_write_event_time(&writer, "start", &event->start);
+    json_write_event_time(&writer, "end", &event->end);
+
+    if (event->recurrence_count > 0) {
+        json_writer_key(&writer, "recurrence");
+        json_writer_begin_array(&writer);
+        for (size_t i = 0; i < event->recurrence_count; i++) {
+            json_writer_string(&writer, event->recurrence[i]);
+        }
+        json_writer_end_array(&writer);
+    }
+
+    if (event->attendee_count > 0) {
+        json_writer_key(&writer, "attendees");
+        json_writer_begin_array(&writer);
+        for (size_t i = 0; i < event->attendee_count; i++) {
+            const struct event_attendee* attendee = &event->attendees[i];
+            json_writer_begin_object(&writer);
+            json_writer_member(&writer, "email", attendee->email);
+            json_writer_member(&writer, "displayName", attendee->display_name);
+            if (attendee->optional) {
+                json_writer_key(&writer, "optional");
+                json_writer_bool(&writer, 1);
+            }
+            json_writer_end_object(&writer);
+        }
+        json_writer_end_array(&writer);
+    }
+
+    if (event->reminders_use_default >= 0) {
+        json_writer_key(&writer, "reminders");
+        json_writer_begin_object(&writer);
+        json_writer_key(&writer, "useDefault");
+        json_writer_bool(&writer, event->reminders_use_default);
+        if (event->reminder_count > 0) {
+            json_writer_key(&writer, "overrides");
+            json_writer_begin_array(&writer);
+            for (size_t i = 0; i < event->reminder_count; i++) {
+                json_writer_begin_object(&writer);
+                json_writer_member(&writer, "method", event->reminders[i].method);
+                json_writer_key(&writer, "minutes");
+                json_writer_int(&writer, event->reminders[i].minutes);
+                json_writer_end_object(&writer);
+            }
+            json_writer_end_array(&writer);
+        }
+        json_writer_end_object(&writer);
+    }
+
+    if (event->private_count > 0 || event->shared_count > 0) {
+        json_writer_key(&writer, "extendedProperties");
+        json_writer_begin_object(&writer);
+        json_write_properties(&writer, "private", event->private_properties, event->private_count);
+        json_write_properties(&writer, "shared", event->shared_properties, event->shared_count);
+        json_writer_end_object(&writer);
+    }
+
+    if (event->sequence >= 0) {
+        json_writer_key(&writer, "sequence");
+        json_writer_int(&writer, event->sequence);
+    }
+    json_writer_end_object(&writer);
+
+    if (writer.error) {
+        fprintf(stderr, "エラー: イベントデータの生成に失敗しました\n");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * json-c のオブジェクトをそのまま書き出す関数
+ * 文字列のエスケープは json_writer_escaped() で行い、json-c の文字列化（オブジェクトごとの printbuf）は
+ * 小数にしか使わない
+ */
+static void json_writer_value(struct json_writer* writer, struct json_object* value) {
+    switch (json_object_get_type(value)) {
+        case json_type_object:
+            if (writer->depth + 1 >= 64) {
+                writer->error = 1;
+                return;
+            }
+            json_writer_begin_object(writer);
+            json_object_object_foreach(value, key, member) {
+                json_writer_key(writer, key);
+                json_writer_value(writer, member);
+            }
+            json_writer_end_object(writer);
+            break;
+        case json_type_array: {
+            if (writer->depth + 1 >= 64) {
+                writer->error = 1;
+                return;
+            }
+            size_t count = json_object_array_length(value);
+            json_writer_begin_array(writer);
+            for (size_t i = 0; i < count; i++) {
+                json_writer_value(writer, json_object_array_get_idx(value, i));
+            }
+            json_writer_end_array(writer);
+            break;
+        }
+        case json_type_string:
+            json_writer_separator(writer);
+            json_writer_escaped(writer, json_object_get_string(value), (size_t)json_object_get_string_len(value));
+            break;
+        case json_type_int:
+            json_writer_int(writer, json_object_get_int64(value));
+            break;
+        case json_type_boolean:
+            json_writer_bool(writer, json_object_get_boolean(value));
+            break;
+        case json_type_double: {
+            // 読み込んだ小数は json-c が元の表記のまま書き出す
+            const char* text = json_object_to_json_string_ext(value, JSON_C_TO_STRING_PLAIN);
+            json_writer_separator(writer);
+            json_writer_raw(writer, text, strlen(text));
+            break;
+        }
+        default:
+            json_writer_separator(writer);
+            json_writer_raw(writer, "null", 4);
+            break;
+    }
+}
+
+/**
+ * json-c のオブジェクトをJSONとしてバッファの末尾に書き足す関数
+ * 一括インポートのリクエスト本文とエクスポートの各行を、使い回すバッファに直接書き出すのに使う
+ *
+ * @param out 書き足す先のバッファ
+ * @param value 書き出すオブジェクト
+ * @return 成功時は0、失敗時は-1
+ */
+int json_write_value(struct string_buffer* out, struct json_object* value) {
+    struct json_writer writer = { .out = out };
+    json_writer_value(&writer, value);
+    return writer.error ? -1 : 0;
+}
+
+/**
+ * iCalendar の VEVENT 1件を変換した結果
+ */
+struct ics_event {
+    struct json_object* event;      // 変換したイベント（変換できなかった場合はNULL）
+    const char* error;              // 変換できなかった理由
+    char* error_detail;             // 変換できなかった理由の詳細（TZID などを含む、malloc したもの、ない場合はNULL）
+    size_t offset;                  // BEGIN:VEVENT のバイトオフセット
+    size_t end;                     // END:VEVENT の行の直後のバイトオフセット
+    unsigned long line;             // ブロック先頭からの BEGIN:VEVENT の行の位置（0始まり）
+    unsigned long end_line;         // ブロック先頭からの END:VEVENT の次の行の位置
+};
+
+/**
+ * ファイルを一定サイズで区切ったブロック
+ * BEGIN:VEVENT の行がブロック内で始まるイベントを、そのブロックの担当として変換する
+ */
+struct ics_block {
+    size_t index;                   // ブロック番号
+    int done;                       // 変換が終わったかどうか
+    struct ics_event* events;
+    size_t count;
+    size_t cap;
+    unsigned long newlines;         // ブロック内の改行の数（行番号の計算用）
+};
+
+/**
+ * iCalendar ファイルのリーダー
+ * ファイルを mmap し、ワーカースレッドがブロック単位で並列に VEVENT を変換する。
+ * 取り出し側はブロックを先頭から順に受け取るため、イベントはファイル上の順序で取り出される。
+ * 変換済みで未取り出しのブロックは ring 個までに制限し、メモリ使用量を抑える。
+ */
+struct ics_reader {
+    const char* path;
+    int fd;
+    const char* data;               // mmap した内容
+    size_t size;
+    char* default_tz;               // X-WR-TIMEZONE（TZIDのない日時に使う、ない場合はNULL）
+    size_t block_count;
+    struct ics_block* blocks;       // ring 個のブロックを使い回す
+    size_t ring;
+    pthread_t* threads;
+    int thread_count;
+    pthread_mutex_t mutex;
+    pthread_cond_t block_done;      // ブロックの変換が終わったときに通知する
+    pthread_cond_t space;           // 取り出し側がブロックを使い終えたときに通知する
+    size_t next_block;              // 次にワーカーが担当するブロック
+    size_t current;                 // 取り出し中のブロック
+    size_t event_pos;               // 取り出し中のブロック内の位置
+    int stop;
+    unsigned long line_base;        // 取り出し中のブロックの先頭の行番号
+    size_t next_offset;             // 未取り出しのイベントの開始位置の下限（ウォーターマーク用）
+    unsigned long next_line;
+};
+
+/**
+ * 範囲内の改行の数を数える関数
+ */
+static unsigned long ics_count_newlines(const char* p, size_t n) {
+    unsigned long count = 0;
+    for (size_t i = 0; i < n; i++) {
+        count += (p[i] == '\n');
+    }
+    return count;
+}
+
+/**
+ * 行頭にある指定した文字列を探す関数
+ *
+ * @param data ファイルの先頭
+ * @param from 探索の開始位置
+ * @param size ファイルのサイズ
+ * @param needle 探す文字列（例: "BEGIN:VEVENT"）
+ * @return 見つかった位置、ない場合は size
+ */
+static size_t ics_find_line(const char* data, size_t from, size_t size, const char* needle) {
+    size_t needle_len = strlen(needle);
+    while (from < size) {
+        const char* hit = memmem(data + from, size - from, needle, needle_len);
+        if (hit == NULL) {
+            return size;
+        }
+        size_t pos = (size_t)(hit - data);
+        if (pos == 0 || data[pos - 1] == '\n') {
+            return pos;
+        }
+        from = pos + 1;
+    }
+    return size;
+}
+
+/**
+ * 折り返された行（CRLFの直後が空白またはタブ）を連結し、論理行を1つ取り出す関数
+ *
+ * @param p 現在位置（次の論理行の先頭に進める）
+ * @param end 範囲の終端
+ * @param out 論理行を受け取るバッファ（CRLFは含まない）
+ * @return 取り出せた場合は0、失敗時は-1
+ */
+static int ics_unfold_line(const char** p, const char* end, struct string_buffer* out) {
+    out->len = 0;
+    const char* s = *p;
+    for (;;) {
+        const char* nl = memchr(s, '\n', end - s);
+        const char* line_end = nl ? nl : end;
+        const char* content_end = (line_end > s && line_end[-1] == '\r') ? line_end - 1 : line_end;
+        if (string_buffer_append(out, s, (size_t)(content_end - s)) != 0) {
+            return -1;
+        }
+        s = nl ? nl + 1 : end;
+        if (s >= end || (*s != ' ' && *s != '\t')) {
+            break;
+        }
+        s++;  // 継続行の先頭の空白1文字は折り返しの一部
+    }
+    *p = s;
+    return 0;
+}
+
+/**
+ * TEXT 型の値のエスケープ（\n \, \; \\）を戻す関数
+ *
+ * @param value 値
+ * @param len 値のバイト数
+ * @param out 結果を受け取るバッファ
+ * @return 成功時は0、失敗時は-1
+ */
+static int ics_unescape_text(const char* value, size_t len, struct string_buffer* out) {
+    out->len = 0;
+    size_t start = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (value[i] != '\\' || i + 1 == len) {
+            continue;
+        }
+        char c = value[i + 1];
+        char decoded = (c == 'n' || c == 'N') ? '\n' : c;
+        if (string_buffer_append(out, value + start, i - start) != 0 ||
+            string_buffer_append(out, &decoded, 1) != 0) {
+            return -1;
+        }
+        i++;
+        start = i + 1;
+    }
+    if (string_buffer_append(out, value + start, len - start) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * プロパティのパラメータから指定した名前の値を取り出す関数
+ *
+ * @param params ";" から始まるパラメータ部分
+ * @param params_len パラメータ部分のバイト数
+ * @param name パラメータ名（例: "TZID"）
+ * @param out 値を受け取るバッファ
+ * @param out_size バッファのサイズ
+ * @return 見つかった場合は1、ない場合は0
+ */
+static int ics_param(const char* params, size_t params_len, const char* name, char* out, size_t out_size) {
+    size_t name_len = strlen(name);
+    const char* p = params;
+    const char* end = params + params_len;
+    while (p < end) {
+        p++;  // ';'
+        const char* eq = memchr(p, '=', end - p);
+        if (eq == NULL) {
+            return 0;
+        }
+        const char* value = eq + 1;
+        const char* value_end = value;
+        int quoted = (value < end && *value == '"');
+        if (quoted) {
+            value++;
+            value_end = memchr(value, '"', end - value);
+            if (value_end == NULL) {
+                value_end = end;
+            }
+        } else {
+            while (value_end < end && *value_end != ';') {
+                value_end++;
+            }
+        }
+        if ((size_t)(eq - p) == name_len && strncasecmp(p, name, name_len) == 0) {
+            size_t len = (size_t)(value_end - value);
+            if (len >= out_size) {
+                len = out_size - 1;
+            }
+            memcpy(out, value, len);
+            out[len] = '\0';
+            return 1;
+        }
+        p = value_end + (quoted && value_end < end ? 1 : 0);
+    }
+    return 0;
+}
+
+/**
+ * Windows のタイムゾーン名と IANA のタイムゾーン名の対応（CLDR windowsZones.xml の地域 001）
+ * Outlook や Exchange が書き出す iCalendar は TZID に Windows の名前を使う
+ */
+static const struct {
+    const char* windows;
+    const char* iana;
+} ICS_WINDOWS_ZONES[] = {
+    {"Dateline Standard Time", "Etc/GMT+12"}, {"UTC-11", "Etc/GMT+11"}, {"Aleutian Standard Time", "America/Adak"},
+    {"Hawaiian Standard Time", "Pacific/Honolulu"}, {"Marquesas Standard Time", "Pacific/Marquesas"},
+    {"Alaskan Standard Time", "America/Anchorage"}, {"UTC-09", "Etc/GMT+9"},
+    {"Pacific Standard Time (Mexico)", "America/Tijuana"}, {"UTC-08", "Etc/GMT+8"},
+    {"Pacific Standard Time", "America/Los_Angeles"}, {"US Mountain Standard Time", "America/Phoenix"},
+    {"Mountain Standard Time (Mexico)", "America/Mazatlan"}, {"Mountain Standard Time", "America/Denver"},
+    {"Yukon Standard Time", "America/Whitehorse"}, {"Central America Standard Time", "America/Guatemala"},
+    {"Central Standard Time", "America/Chicago"}, {"Easter Island Standard Time", "Pacific/Easter"},
+    {"Central Standard Time (Mexico)", "America/Mexico_City"}, {"Canada Central Standard Time", "America/Regina"},
+    {"SA Pacific Standard Time", "America/Bogota"}, {"Eastern Standard Time (Mexico)", "America/Cancun"},
+    {"Eastern Standard Time", "America/New_York"}, {"Haiti Standard Time", "America/Port-au-Prince"},
+    {"Cuba Standard Time", "America/Havana"}, {"US Eastern Standard Time", "America/Indiana/Indianapolis"},
+    {"Turks And Caicos Standard Time", "America/Grand_Turk"}, {"Paraguay Standard Time", "America/Asuncion"},
+    {"Atlantic Standard Time", "America/Halifax"}, {"Venezuela Standard Time", "America/Caracas"},
+    {"Central Brazilian Standard Time", "America/Cuiaba"}, {"SA Western Standard Time", "America/La_Paz"},
+    {"Pacific SA Standard Time", "America/Santiago"}, {"Newfoundland Standard Time", "America/St_Johns"},
+    {"Tocantins Standard Time", "America/Araguaina"}, {"E. South America Standard Time", "America/Sao_Paulo"},
+    {"SA Eastern Standard Time", "America/Cayenne"}, {"Argentina Standard Time", "America/Argentina/Buenos_Aires"},
+    {"Greenland Standard Time", "America/Nuuk"}, {"Montevideo Standard Time", "America/Montevideo"},
+    {"Magallanes Standard Time", "America/Punta_Arenas"}, {"Saint Pierre Standard Time", "America/Miquelon"},
+    {"Bahia Standard Time", "America/Bahia"}, {"UTC-02", "Etc/GMT+2"}, {"Mid-Atlantic Standard Time", "Etc/GMT+2"},
+    {"Azores Standard Time", "Atlantic/Azores"}, {"Cape Verde Standard Time", "Atlantic/Cape_Verde"},
+    {"UTC", "Etc/UTC"}, {"GMT Standard Time", "Europe/London"}, {"Greenwich Standard Time", "Atlantic/Reykjavik"},
+    {"Sao Tome Standard Time", "Africa/Sao_Tome"}, {"Morocco Standard Time", "Africa/Casablanca"},
+    {"W. Europe Standard Time", "Europe/Berlin"}, {"Central Europe Standard Time", "Europe/Budapest"},
+    {"Romance Standard Time", "Europe/Paris"}, {"Central European Standard Time", "Europe/Warsaw"},
+    {"W. Central Africa Standard Time", "Africa/Lagos"}, {"Jordan Standard Time", "Asia/Amman"},
+    {"GTB Standard Time", "Europe/Bucharest"}, {"Middle East Standard Time", "Asia/Beirut"},
+    {"Egypt Standard Time", "Africa/Cairo"}, {"E. Europe Standard Time", "Europe/Chisinau"},
+    {"Syria Standard Time", "Asia/Damascus"}, {"West Bank Standard Time", "Asia/Hebron"},
+    {"South Africa Standard Time", "Africa/Johannesburg"}, {"FLE Standard Time", "Europe/Kiev"},
+    {"Israel Standard Time", "Asia/Jerusalem"}, {"South Sudan Standard Time", "Africa/Juba"},
+    {"Kaliningrad Standard Time", "Europe/Kaliningrad"}, {"Sudan Standard Time", "Africa/Khartoum"},
+    {"Libya Standard Time", "Africa/Tripoli"}, {"Namibia Standard Time", "Africa/Windhoek"},
+    {"Arabic Standard Time", "Asia/Baghdad"}, {"Turkey Standard Time", "Europe/Istanbul"},
+    {"Arab Standard Time", "Asia/Riyadh"}, {"Belarus Standard Time", "Europe/Minsk"},
+    {"Russian Standard Time", "Europe/Moscow"}, {"E. Africa Standard Time", "Africa/Nairobi"},
+    {"Volgograd Standard Time", "Europe/Volgograd"}, {"Iran Standard Time", "Asia/Tehran"},
+    {"Arabian Standard Time", "Asia/Dubai"}, {"Astrakhan Standard Time", "Europe/Astrakhan"},
+    {"Azerbaijan Standard Time", "Asia/Baku"}, {"Russia Time Zone 3", "Europe/Samara"},
+    {"Mauritius Standard Time", "Indian/Mauritius"}, {"Saratov Standard Time", "Europe/Saratov"},
+    {"Georgian Standard Time", "Asia/Tbilisi"}, {"Caucasus Standard Time", "Asia/Yerevan"},
+    {"Afghanistan Standard Time", "Asia/Kabul"}, {"West Asia Standard Time", "Asia/Tashkent"},
+    {"Ekaterinburg Standard Time", "Asia/Yekaterinburg"}, {"Pakistan Standard Time", "Asia/Karachi"},
+    {"Qyzylorda Standard Time", "Asia/Qyzylorda"}, {"India Standard Time", "Asia/Kolkata"},
+    {"Sri Lanka Standard Time", "Asia/Colombo"}, {"Nepal Standard Time", "Asia/Kathmandu"},
+    {"Central Asia Standard Time", "Asia/Almaty"}, {"Bangladesh Standard Time", "Asia/Dhaka"},
+    {"Omsk Standard Time", "Asia/Omsk"}, {"Myanmar Standard Time", "Asia/Yangon"},
+    {"SE Asia Standard Time", "Asia/Bangkok"}, {"Altai Standard Time", "Asia/Barnaul"},
+    {"W. Mongolia Standard Time", "Asia/Hovd"}, {"North Asia Standard Time", "Asia/Krasnoyarsk"},
+    {"N. Central Asia Standard Time", "Asia/Novosibirsk"}, {"Tomsk Standard Time", "Asia/Tomsk"},
+    {"China Standard Time", "Asia/Shanghai"}, {"North Asia East Standard Time", "Asia/Irkutsk"},
+    {"Singapore Standard Time", "Asia/Singapore"}, {"W. Australia Standard Time", "Australia/Perth"},
+    {"Taipei Standard Time", "Asia/Taipei"}, {"Ulaanbaatar Standard Time", "Asia/Ulaanbaatar"},
+    {"Aus Central W. Standard Time", "Australia/Eucla"}, {"Transbaikal Standard Time", "Asia/Chita"},
+    {"Tokyo Standard Time", "Asia/Tokyo"}, {"North Korea Standard Time", "Asia/Pyongyang"},
+    {"Korea Standard Time", "Asia/Seoul"}, {"Yakutsk Standard Time", "Asia/Yakutsk"},
+    {"Cen. Australia Standard Time", "Australia/Adelaide"}, {"AUS Central Standard Time", "Australia/Darwin"},
+    {"E. Australia Standard Time", "Australia/Brisbane"}, {"AUS Eastern Standard Time", "Australia/Sydney"},
+    {"West Pacific Standard Time", "Pacific/Port_Moresby"}, {"Tasmania Standard Time", "Australia/Hobart"},
+    {"Vladivostok Standard Time", "Asia/Vladivostok"}, {"Lord Howe Standard Time", "Australia/Lord_Howe"},
+    {"Bougainville Standard Time", "Pacific/Bougainville"}, {"Russia Time Zone 10", "Asia/Srednekolymsk"},
+    {"Magadan Standard Time", "Asia/Magadan"}, {"Norfolk Standard Time", "Pacific/Norfolk"},
+    {"Sakhalin Standard Time", "Asia/Sakhalin"}, {"Central Pacific Standard Time", "Pacific/Guadalcanal"},
+    {"Russia Time Zone 11", "Asia/Kamchatka"}, {"New Zealand Standard Time", "Pacific/Auckland"},
+    {"UTC+12", "Etc/GMT-12"}, {"Fiji Standard Time", "Pacific/Fiji"},
+    {"Chatham Islands Standard Time", "Pacific/Chatham"}, {"UTC+13", "Etc/GMT-13"},
+    {"Tonga Standard Time", "Pacific/Tongatapu"}, {"Samoa Standard Time", "Pacific/Apia"},
+    {"Line Islands Standard Time", "Pacific/Kiritimati"},
+};
+
+/**
+ * TZID を API に渡せる IANA のタイムゾーン名にする関数
+ * Windows の名前は対応する IANA の名前に置き換え、それ以外は tzdata にある名前だけを受け付ける
+ * （VTIMEZONE で独自に定義したタイムゾーンは API が解釈できないため受け付けない）。
+ * tzdata がインストールされていない場合は、IANA の名前かどうかを確かめずにそのまま使う。
+ *
+ * @param tzid TZID
+ * @return IANA のタイムゾーン名、対応する名前がない場合はNULL
+ */
+static const char* ics_resolve_tzid(const char* tzid) {
+    for (size_t i = 0; i < sizeof(ICS_WINDOWS_ZONES) / sizeof(ICS_WINDOWS_ZONES[0]); i++) {
+        if (strcasecmp(tzid, ICS_WINDOWS_ZONES[i].windows) == 0) {
+            return ICS_WINDOWS_ZONES[i].iana;
+        }
+    }
+    return tz_zone_exists(tzid) != 0 ? tzid : NULL;
+}
+
+/**
+ * DTSTART/DTEND の値を Google Calendar API の日時オブジェクトに変換する関数
+ * 日付（VALUE=DATE または8桁）は date、日時は dateTime と timeZone に変換する。
+ * 各項目の範囲（月ごとの日数とうるう年を含む）は rfc3339_parse_fields() で確認する。
+ * TZID がなく UTC でもない日時（浮動時刻）は、default_tz がなければ変換しない。
+ * TZID と default_tz は ics_resolve_tzid() で IANA の名前にしてから timeZone に使う。
+ *
+ * @param params パラメータ部分
+ * @param params_len パラメータ部分のバイト数
+ * @param value 値
+ * @param default_tz TZID がなく UTC でもない日時に使うタイムゾーン（NULL可）
+ * @param is_date 日付だったかどうかを受け取るポインタ
+ * @param floating タイムゾーンを決められない浮動時刻だったかどうかを受け取るポインタ
+ * @param unknown_zone IANA の名前にできなかったタイムゾーンを受け取るバッファ（見つからなければ空文字列）
+ * @param unknown_zone_size unknown_zone のバイト数
+ * @return 変換したオブジェクト、形式が不正な場合とタイムゾーンを決められない場合はNULL
+ */
+static struct json_object* ics_convert_datetime(const char* params, size_t params_len, const char* value,
+                                                const char* default_tz, int* is_date, int* floating,
+                                                char* unknown_zone, size_t unknown_zone_size) {
+    size_t len = strlen(value);
+    struct rfc3339_time fields;
+    char tzid[128];
+    *floating = 0;
+    unknown_zone[0] = '\0';
+    for (size_t i = 0; i < len; i++) {
+        if (!isdigit((unsigned char)value[i]) && !(i == 8 && value[i] == 'T') && !(i == 15 && value[i] == 'Z')) {
+            return NULL;
+        }
+    }
+
+    char buf[32];
+    if (len == 8) {
+        snprintf(buf, sizeof(buf), "%.4s-%.2s-%.2s", value, value + 4, value + 6);
+    } else if (len == 15 || len == 16) {
+        snprintf(buf, sizeof(buf), "%.4s-%.2s-%.2sT%.2s:%.2s:%.2s%s",
+                 value, value + 4, value + 6, value + 9, value + 11, value + 13, len == 16 ? "Z" : "");
+    } else {
+        return NULL;
+    }
+    if (rfc3339_parse_fields(buf, strlen(buf), &fields) != 0) {
+        return NULL;
+    }
+    int utc = (len == 16);
+    int has_tzid = ics_param(params, params_len, "TZID", tzid, sizeof(tzid));
+    if (len != 8 && !utc && !has_tzid && default_tz == NULL) {
+        *floating = 1;
+        return NULL;
+    }
+    const char* zone = NULL;
+    if (len != 8 && (has_tzid || !utc)) {
+        const char* name = has_tzid ? tzid : default_tz;
+        zone = ics_resolve_tzid(name);
+        if (zone == NULL) {
+            snprintf(unknown_zone, unknown_zone_size, "%s", name);
+            return NULL;
+        }
+    }
+
+    struct json_object* obj = json_object_new_object();
+    if (obj == NULL) {
+        return NULL;
+    }
+    if (len == 8) {
+        *is_date = 1;
+        json_object_object_add(obj, "date", json_object_new_string(buf));
+        return obj;
+    }
+
+    *is_date = 0;
+    json_object_object_add(obj, "dateTime", json_object_new_string(buf));
+    if (zone != NULL) {
+        json_object_object_add(obj, "timeZone", json_object_new_string(zone));
+    }
+    return obj;
+}
+
+/**
+ * DURATION の値（RFC 5545 3.3.6。例: P1D、PT1H30M、P1DT12H、P2W）を解析する関数
+ *
+ * @param value 値
+ * @param days 日数（週は7日とする）を受け取るポインタ
+ * @param seconds 時・分・秒の合計（秒）を受け取るポインタ
+ * @return 成功時は0、形式が不正な場合と負の期間の場合は-1
+ */
+static int ics_parse_duration(const char* value, long* days, long* seconds) {
+    static const char units[] = "WDTHMS";   // 現れてよい順序
+    const char* p = value;
+    size_t next_unit = 0;
+    int in_time = 0;
+    int components = 0;
+    *days = 0;
+    *seconds = 0;
+
+    if (*p == '+') {
+        p++;
+    }
+    if (*p++ != 'P') {
+        return -1;
+    }
+    while (*p) {
+        if (*p == 'T') {
+            if (in_time || next_unit > 3) {
+                return -1;
+            }
+            in_time = 1;
+            next_unit = 3;
+            components = 0;
+            p++;
+            continue;
+        }
+        long n = 0;
+        const char* digits = p;
+        while (isdigit((unsigned char)*p) && n < 100000000) {
+            n = n * 10 + (*p++ - '0');
+        }
+        const char* unit = *p ? strchr(units + next_unit, *p) : NULL;
+        if (p == digits || unit == NULL || *unit == 'T' || (in_time != (unit >= units + 3))) {
+            return -1;
+        }
+        switch (*unit) {
+        case 'W': *days += n * 7; break;
+        case 'D': *days += n; break;
+        case 'H': *seconds += n * 3600; break;
+        case 'M': *seconds += n * 60; break;
+        case 'S': *seconds += n; break;
+        }
+        // 週は単独でしか使えない（dur-week）
+        next_unit = (*unit == 'W') ? sizeof(units) - 1 : (size_t)(unit - units) + 1;
+        components++;
+        p++;
+    }
+    return components > 0 ? 0 : -1;
+}
+
+/**
+ * 開始の日時オブジェクトに期間を加えて、終了の日時オブジェクトを作成する関数
+ * 日時には壁時計の時刻のまま加え、timeZone は開始と同じものを使う
+ * （TZID のある日時で夏時間の切り替えをまたぐ場合、時・分・秒の期間は切り替えの分だけずれる）
+ *
+ * @param start 開始の日時オブジェクト
+ * @param is_date 開始が日付かどうか
+ * @param days 加える日数
+ * @param seconds 加える秒数（日付の場合は0でなければならない）
+ * @return 終了の日時オブジェクト、作成できない場合はNULL
+ */
+static struct json_object* ics_add_duration(struct json_object* start, int is_date, long days, long seconds) {
+    struct json_object* value;
+    struct rfc3339_time fields;
+    if (is_date && seconds != 0) {
+        return NULL;
+    }
+    if (!json_object_object_get_ex(start, is_date ? "date" : "dateTime", &value) ||
+        rfc3339_parse_fields(json_object_get_string(value), (size_t)json_object_get_string_len(value), &fields) != 0) {
+        return NULL;
+    }
+    long long t = rfc3339_to_epoch(&fields) + days * 86400LL + seconds;
+    char buf[RFC3339_UTC_SIZE];
+    rfc3339_format_utc(t, buf);
+    buf[is_date ? 10 : (fields.has_offset ? 20 : 19)] = '\0';
+
+    struct json_object* end = json_object_new_object();
+    if (end == NULL) {
+        return NULL;
+    }
+    json_object_object_add(end, is_date ? "date" : "dateTime", json_object_new_string(buf));
+    if (json_object_object_get_ex(start, "timeZone", &value)) {
+        json_object_object_add(end, "timeZone", json_object_get(value));
+    }
+    return end;
+}
+
+/**
+ * DTEND も DURATION もない場合の終了を作成する関数（RFC 5545 3.6.1）
+ * 終日イベントは開始日の翌日、それ以外は開始と同じ時刻にする
+ *
+ * @param start 開始の日時オブジェクト
+ * @param is_date 開始が日付かどうか
+ * @return 終了の日時オブジェクト、作成できない場合はNULL
+ */
+static struct json_object* ics_default_end(struct json_object* start, int is_date) {
+    return is_date ? ics_add_duration(start, 1, 1, 0) : json_object_get(start);
+}
+
+/**
+ * VEVENT 1件を Google Calendar API のイベントに変換する関数
+ *
+ * @param p VEVENT の先頭（BEGIN:VEVENT の次の行）
+ * @param end VEVENT の終端（END:VEVENT の行の先頭）
+ * @param default_tz TZID のない日時に使うタイムゾーン（NULL可）
+ * @param line 論理行の作業用バッファ
+ * @param text TEXT 値の作業用バッファ
+ * @param error 変換できなかった理由を受け取るポインタ
+ * @param error_detail 理由の詳細（TZID などを含む）を受け取るポインタ（呼び出し側で free する、ない場合はNULL）
+ * @return 変換したイベント、変換できなかった場合はNULL
+ */
+static struct json_object* ics_convert_event(const char* p, const char* end, const char* default_tz,
+                                             struct string_buffer* line, struct string_buffer* text,
+                                             const char** error, char** error_detail) {
+    struct json_object* event = json_object_new_object();
+    struct json_object* recurrence = NULL;
+    struct json_object* start = NULL;
+    int start_is_date = 0;
+    int has_end = 0;
+    int has_duration = 0;
+    long duration_days = 0;
+    long duration_seconds = 0;
+    int has_uid = 0;
+    int depth = 0;  // VALARM などの入れ子のコンポーネントの深さ
+    *error = NULL;
+    *error_detail = NULL;
+
+    if (event == NULL) {
+        *error = "メモリ割り当てに失敗しました";
+        return NULL;
+    }
+
+    while (p < end && *error == NULL) {
+        if (ics_unfold_line(&p, end, line) != 0) {
+            *error = "メモリ割り当てに失敗しました";
+            break;
+        }
+        char* name = line->data;
+        if (line->len == 0) {
+            continue;
+        }
+
+        // 名前[;パラメータ]:値 に分ける（引用符内の ':' は区切りとしない）
+        size_t name_len = strcspn(name, ";:");
+        char* colon = name + name_len;
+        int quoted = 0;
+        while (*colon && (*colon != ':' || quoted)) {
+            if (*colon == '"') {
+                quoted = !quoted;
+            }
+            colon++;
+        }
+        if (*colon != ':') {
+            continue;
+        }
+        const char* params = name + name_len;
+        size_t params_len = (size_t)(colon - params);
+        *colon = '\0';
+        const char* value = colon + 1;
+        size_t value_len = line->len - (size_t)(value - line->data);
+
+#define ICS_NAME_IS(literal) (name_len == sizeof(literal) - 1 && strncasecmp(name, literal, name_len) == 0)
+        if (ICS_NAME_IS("BEGIN")) {
+            depth++;
+        } else if (ICS_NAME_IS("END")) {
+            depth--;
+        } else if (depth > 0) {
+            continue;
+        } else if (ICS_NAME_IS("SUMMARY") || ICS_NAME_IS("DESCRIPTION") || ICS_NAME_IS("LOCATION")) {
+            if (ics_unescape_text(value, value_len, text) != 0) {
+                *error = "メモリ割り当てに失敗しました";
+                break;
+            }
+            const char* key = ICS_NAME_IS("SUMMARY") ? "summary" : ICS_NAME_IS("DESCRIPTION") ? "description" : "location";
+            json_object_object_add(event, key, json_object_new_string_len(text->data, (int)text->len));
+        } else if (ICS_NAME_IS("UID")) {
+            json_object_object_add(event, "iCalUID", json_object_new_string_len(value, (int)value_len));
+            has_uid = 1;
+        } else if (ICS_NAME_IS("DTSTART") || ICS_NAME_IS("DTEND")) {
+            int is_date = 0;
+            int floating = 0;
+            char unknown_zone[128];
+            struct json_object* when = ics_convert_datetime(params, params_len, value, default_tz, &is_date, &floating,
+                                                            unknown_zone, sizeof(unknown_zone));
+            if (when == NULL) {
+                if (unknown_zone[0] != '\0') {
+                    char detail[256];
+                    snprintf(detail, sizeof(detail), "%s の TZID \"%s\" を IANA のタイムゾーン名にできません"
+                             "（Windows のタイムゾーン名か tzdata にある名前が必要です）",
+                             ICS_NAME_IS("DTSTART") ? "DTSTART" : "DTEND", unknown_zone);
+                    *error = "TZID を IANA のタイムゾーン名にできません";
+                    *error_detail = strdup(detail);
+                } else if (floating) {
+                    *error = ICS_NAME_IS("DTSTART")
+                                 ? "DTSTART にタイムゾーンがありません（TZID か X-WR-TIMEZONE が必要です）"
+                                 : "DTEND にタイムゾーンがありません（TZID か X-WR-TIMEZONE が必要です）";
+                } else {
+                    *error = ICS_NAME_IS("DTSTART") ? "DTSTART の形式が不正です" : "DTEND の形式が不正です";
+                }
+                break;
+            }
+            if (ICS_NAME_IS("DTSTART")) {
+                json_object_put(start);
+                start = when;
+                start_is_date = is_date;
+                json_object_object_add(event, "start", json_object_get(when));
+            } else {
+                has_end = 1;
+                json_object_object_add(event, "end", when);
+            }
+        } else if (ICS_NAME_IS("DURATION")) {
+            if (ics_parse_duration(value, &duration_days, &duration_seconds) != 0) {
+                *error = "DURATION の形式が不正です";
+                break;
+            }
+            has_duration = 1;
+        } else if (ICS_NAME_IS("RRULE") || ICS_NAME_IS("EXRULE") || ICS_NAME_IS("RDATE") || ICS_NAME_IS("EXDATE")) {
+            // recurrence には iCalendar の行をそのまま渡す
+            if (recurrence == NULL) {
+                recurrence = json_object_new_array();
+                json_object_object_add(event, "recurrence", recurrence);
+            }
+            *colon = ':';
+            json_object_array_add(recurrence, json_object_new_string_len(line->data, (int)line->len));
+        } else if (ICS_NAME_IS("STATUS") || ICS_NAME_IS("TRANSP")) {
+            char lower[32];
+            size_t n = value_len < sizeof(lower) - 1 ? value_len : sizeof(lower) - 1;
+            for (size_t i = 0; i < n; i++) {
+                lower[i] = (char)tolower((unsigned char)value[i]);
+            }
+            lower[n] = '\0';
+            json_object_object_add(event, ICS_NAME_IS("STATUS") ? "status" : "transparency",
+                                   json_object_new_string(lower));
+        } else if (ICS_NAME_IS("SEQUENCE")) {
+            json_object_object_add(event, "sequence", json_object_new_int(atoi(value)));
+        }
+#undef ICS_NAME_IS
+    }
+
+    if (*error == NULL && !has_uid) {
+        *error = "UID がありません";
+    }
+    if (*error == NULL && start == NULL) {
+        *error = "DTSTART がありません";
+    }
+    if (*error == NULL && !has_end) {
+        // DTEND がなければ DURATION から求め、どちらもなければ RFC 5545 3.6.1 の既定の終了にする
+        struct json_object* computed_end = has_duration
+                                               ? ics_add_duration(start, start_is_date, duration_days, duration_seconds)
+                                               : ics_default_end(start, start_is_date);
+        if (computed_end == NULL) {
+            *error = has_duration ? "DURATION を DTSTART に加えられません（日付の DTSTART には日数か週数を指定します）"
+                                  : "DTEND を補えません";
+        } else {
+            json_object_object_add(event, "end", computed_end);
+        }
+    }
+    if (*error == NULL && recurrence != NULL) {
+        // 繰り返しのあるイベントは API が timeZone を必須とするため、UTC の日時には UTC を指定する
+        struct json_object* when;
+        for (int i = 0; i < 2; i++) {
+            if (json_object_object_get_ex(event, i == 0 ? "start" : "end", &when) &&
+                json_object_object_get_ex(when, "dateTime", NULL) &&
+                !json_object_object_get_ex(when, "timeZone", NULL)) {
+                json_object_object_add(when, "timeZone", json_object_new_string("UTC"));
+            }
+        }
+    }
+    json_object_put(start);
+    if (*error != NULL) {
+        json_object_put(event);
+        return NULL;
+    }
+    return event;
+}
+
+/**
+ * 1ブロック分の VEVENT を変換する関数
+ *
+ * @param reader iCalendar リーダー
+ * @param block 変換結果を格納するブロック（index を設定しておく）
+ * @param line 論理行の作業用バッファ
+ * @param text TEXT 値の作業用バッファ
+ */
+static void ics_parse_block(struct ics_reader* reader, struct ics_block* block,
+                            struct string_buffer* line, struct string_buffer* text) {
+    size_t block_size = ICS_BLOCK_SIZE;
+    size_t begin = block->index * block_size;
+    size_t limit = begin + block_size < reader->size ? begin + block_size : reader->size;
+    const char* data = reader->data;
+
+    block->count = 0;
+
+    // 改行はファイルを1回なめるだけで数え、最後にブロック外にはみ出した分を差し引く
+    size_t counted = begin;         // ここまでの改行を rel_line に数えた位置
+    unsigned long rel_line = 0;
+    size_t pos = ics_find_line(data, begin, reader->size, "BEGIN:VEVENT");
+    while (pos < limit) {
+        rel_line += ics_count_newlines(data + counted, pos - counted);
+        counted = pos;
+
+        // 次の BEGIN:VEVENT までに END:VEVENT がなければ、その VEVENT は壊れている
+        const char* nl = memchr(data + pos, '\n', reader->size - pos);
+        size_t body = nl ? (size_t)(nl - data) + 1 : reader->size;
+        size_t next_begin = ics_find_line(data, body, reader->size, "BEGIN:VEVENT");
+        size_t stop = ics_find_line(data, body, next_begin, "END:VEVENT");
+        size_t next = next_begin;
+        if (stop < next_begin) {
+            nl = memchr(data + stop, '\n', next_begin - stop);
+            next = nl ? (size_t)(nl - data) + 1 : next_begin;
+        }
+
+        if (block->count == block->cap) {
+            size_t new_cap = block->cap ? block->cap * 2 : 256;
+            struct ics_event* events = realloc(block->events, new_cap * sizeof(struct ics_event));
+            if (events == NULL) {
+                break;
+            }
+            block->events = events;
+            block->cap = new_cap;
+        }
+        struct ics_event* ev = &block->events[block->count++];
+        ev->offset = pos;
+        ev->end = next;
+        ev->line = rel_line;
+        rel_line += ics_count_newlines(data + pos, next - pos);
+        counted = next;
+        ev->end_line = rel_line;
+        if (stop == next_begin) {
+            ev->event = NULL;
+            ev->error = "END:VEVENT がありません";
+            ev->error_detail = NULL;
+        } else {
+            ev->event = ics_convert_event(data + body, data + stop, reader->default_tz, line, text,
+                                          &ev->error, &ev->error_detail);
+        }
+
+        pos = next_begin;
+    }
+
+    if (counted <= limit) {
+        block->newlines = rel_line + ics_count_newlines(data + counted, limit - counted);
+    } else {
+        block->newlines = rel_line - ics_count_newlines(data + limit, counted - limit);
+    }
+}
+
+/**
+ * 変換を担当するワーカースレッドの本体
+ * 取り出し側より ring 個以上先のブロックには進まない
+ */
+static void* ics_worker_main(void* arg) {
+    struct ics_reader* reader = arg;
+    struct string_buffer line = {0};
+    struct string_buffer text = {0};
+
+    pthread_mutex_lock(&reader->mutex);
+    for (;;) {
+        while (!reader->stop && reader->next_block < reader->block_count &&
+               reader->next_block >= reader->current + reader->ring) {
+            pthread_cond_wait(&reader->space, &reader->mutex);
+        }
+        if (reader->stop || reader->next_block >= reader->block_count) {
+            break;
+        }
+        struct ics_block* block = &reader->blocks[reader->next_block % reader->ring];
+        block->index = reader->next_block++;
+        block->done = 0;
+        pthread_mutex_unlock(&reader->mutex);
+
+        ics_parse_block(reader, block, &line, &text);
+
+        pthread_mutex_lock(&reader->mutex);
+        block->done = 1;
+        pthread_cond_broadcast(&reader->block_done);
+    }
+    pthread_mutex_unlock(&reader->mutex);
+
+    free(line.data);
+    free(text.data);
+    return NULL;
+}
+
+/**
+ * iCalendar リーダーを閉じる関数
+ * ワーカースレッドを停止し、未取り出しのイベントを解放する
+ *
+ * @param reader 閉じるリーダー
+ */
+void ics_reader_close(struct ics_reader* reader) {
+    pthread_mutex_lock(&reader->mutex);
+    reader->stop = 1;
+    pthread_cond_broadcast(&reader->space);
+    pthread_mutex_unlock(&reader->mutex);
+    for (int i = 0; i < reader->thread_count; i++) {
+        pthread_join(reader->threads[i], NULL);
+    }
+
+    for (size_t i = 0; i < reader->ring && reader->blocks; i++) {
+        struct ics_block* block = &reader->blocks[i];
+        for (size_t j = 0; j < block->count; j++) {
+            json_object_put(block->events[j].event);
+            free(block->events[j].error_detail);
+        }
+        free(block->events);
+    }
+    free(reader->blocks);
+    free(reader->threads);
+    free(reader->default_tz);
+    if (reader->data != NULL) {
+        munmap((void*)reader->data, reader->size);
+    }
+    if (reader->fd >= 0) {
+        close(reader->fd);
+    }
+    pthread_mutex_destroy(&reader->mutex);
+    pthread_cond_destroy(&reader->block_done);
+    pthread_cond_destroy(&reader->space);
+}
+
+/**
+ * iCalendar ファイルを開き、並列変換を開始する関数
+ *
+ * @param reader 初期化するリーダー
+ * @param path 入力ファイルのパス（mmap するため通常のファイルに限る）
+ * @return 成功時は0、失敗時は-1
+ */
+int ics_reader_open(struct ics_reader* reader, const char* path) {
+    memset(reader, 0, sizeof(*reader));
+    reader->path = path;
+    reader->line_base = 1;
+    reader->next_line = 1;
+    pthread_mutex_init(&reader->mutex, NULL);
+    pthread_cond_init(&reader->block_done, NULL);
+    pthread_cond_init(&reader->space, NULL);
+
+    struct stat st;
+    reader->fd = open(path, O_RDONLY);
+    if (reader->fd < 0 || fstat(reader->fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        fprintf(stderr, "エラー: 入力ファイル %s を開けません（iCalendar は通常のファイルのみ対応）\n", path);
+        ics_reader_close(reader);
+        return -1;
+    }
+    reader->size = (size_t)st.st_size;
+    if (reader->size > 0) {
+        void* data = mmap(NULL, reader->size, PROT_READ, MAP_PRIVATE, reader->fd, 0);
+        if (data == MAP_FAILED) {
+            fprintf(stderr, "エラー: 入力ファイル %s を mmap できません: %s\n", path, strerror(errno));
+            ics_reader_close(reader);
+            return -1;
+        }
+        reader->data = data;
+        madvise(data, reader->size, MADV_SEQUENTIAL);
+    }
+
+    // 最初の VEVENT より前のカレンダーのヘッダーから既定のタイムゾーンを取り出す
+    size_t header_end = ics_find_line(reader->data, 0, reader->size, "BEGIN:VEVENT");
+    size_t tz = ics_find_line(reader->data, 0, header_end, "X-WR-TIMEZONE:");
+    if (tz < header_end) {
+        const char* value = reader->data + tz + strlen("X-WR-TIMEZONE:");
+        size_t len = strcspn(value, "\r\n");
+        reader->default_tz = strndup(value, len);
+    }
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    reader->block_count = (reader->size + ICS_BLOCK_SIZE - 1) / ICS_BLOCK_SIZE;
+    reader->thread_count = (int)(cpus < 1 ? 1 : cpus > ICS_MAX_THREADS ? ICS_MAX_THREADS : cpus);
+    if ((size_t)reader->thread_count > reader->block_count) {
+        reader->thread_count = (int)reader->block_count;
+    }
+    reader->ring = (size_t)(reader->thread_count > 0 ? reader->thread_count : 1) * 4;
+    reader->blocks = calloc(reader->ring, sizeof(struct ics_block));
+    reader->threads = calloc(reader->thread_count > 0 ? reader->thread_count : 1, sizeof(pthread_t));
+    if (reader->blocks == NULL || reader->threads == NULL) {
+        fprintf(stderr, "エラー: メモリ割り当てに失敗しました\n");
+        reader->thread_count = 0;
+        ics_reader_close(reader);
+        return -1;
+    }
+
+    int started = 0;
+    for (int i = 0; i < reader->thread_count; i++) {
+        if (pthread_create(&reader->threads[i], NULL, ics_worker_main, reader) != 0) {
+            break;
+        }
+        started++;
+    }
+    if (started == 0 && reader->block_count > 0) {
+        fprintf(stderr, "エラー: 変換スレッドを開始できません\n");
+        ics_reader_close(reader);
+        return -1;
+    }
+    reader->thread_count = started;
+    return 0;
+}
+
+/**
+ * 次のイベントをファイル上の順序で取り出す関数
+ * 変換できなかった VEVENT はエラーを表示して-1を返す
+ *
+ * @param reader iCalendar リーダー
+ * @param out 取り出したイベント（呼び出し側で json_object_put する）
+ * @param offset VEVENT の開始・終了バイトオフセットを受け取る配列（要素数2）
+ * @param line VEVENT の開始・終了行番号を受け取る配列（要素数2）
+ * @return 取り出せた場合は1、EOFの場合は0、変換できなかった場合は-1
+ */
+int ics_reader_next(struct ics_reader* reader, struct json_object** out,
+                    unsigned long long offset[2], unsigned long line[2]) {
+    *out = NULL;
+    for (;;) {
+        if (reader->current >= reader->block_count) {
+            reader->next_offset = reader->size;
+            return 0;
+        }
+        struct ics_block* block = &reader->blocks[reader->current % reader->ring];
+
+        pthread_mutex_lock(&reader->mutex);
+        while (!(block->done && block->index == reader->current)) {
+            pthread_cond_wait(&reader->block_done, &reader->mutex);
+        }
+        pthread_mutex_unlock(&reader->mutex);
+
+        if (reader->event_pos < block->count) {
+            struct ics_event* ev = &block->events[reader->event_pos++];
+            offset[0] = ev->offset;
+            offset[1] = ev->end;
+            line[0] = reader->line_base + ev->line;
+            line[1] = reader->line_base + ev->end_line;
+            reader->next_offset = ev->end;
+            reader->next_line = line[1];
+            if (ev->event == NULL) {
+                fprintf(stderr, "エラー: %s:%lu 行目のイベントを変換できません: %s\n",
+                        reader->path, line[0], ev->error_detail ? ev->error_detail : ev->error);
+                free(ev->error_detail);
+                ev->error_detail = NULL;
+                return -1;
+            }
+            *out = ev->event;
+            ev->event = NULL;
+            return 1;
+        }
+
+        // ブロックを使い終えたらワーカーに返す
+        pthread_mutex_lock(&reader->mutex);
+        reader->line_base += block->newlines;
+        block->count = 0;
+        block->done = 0;
+        reader->event_pos = 0;
+        reader->current++;
+        pthread_cond_broadcast(&reader->space);
+        pthread_mutex_unlock(&reader->mutex);
+    }
+}
+
+// レイテンシのヒストグラムを出力する際の境界（マイクロ秒）
+// 内部のバケットの境界と一致する4の累乗にすることで、バケットを分割せずに累積件数を求められる
+static const unsigned long long metrics_latency_bounds_us[] = {
+    256, 1024, 4096, 16384, 65536, 262144, 1048576, 4194304, 16777216, 67108864,
+};
+
+/**
+ * Prometheus のテキスト形式でカウンターを1行追加する関数
+ */
+static int metrics_append_counter(struct string_buffer* out, const char* name, const char* help,
+                                  const char* type, unsigned long value) {
+    return string_buffer_appendf(out, "# HELP %s %s\n# TYPE %s %s\n%s %lu\n", name, help, name, type, name, value);
+}
+
+/**
+ * 通信時間のヒストグラムを Prometheus の histogram として追加する関数
+ * 値は秒単位に変換する
+ *
+ * @param out 追加先のバッファ
+ * @param kind リクエストの種類のラベル
+ * @param phase 段階のラベル
+ * @param hist 通信時間のヒストグラム
+ * @return 成功時は0、失敗時は-1
+ */
+static int metrics_append_histogram(struct string_buffer* out, const char* kind, const char* phase,
+                                    const struct net_histogram* hist) {
+    unsigned long counts[NET_HIST_BUCKETS];
+    unsigned long total = 0;
+    for (int i = 0; i < NET_HIST_BUCKETS; i++) {
+        counts[i] = atomic_load_explicit(&hist->buckets[i], memory_order_relaxed);
+        total += counts[i];
+    }
+
+    // 上限が境界より小さいバケットを累積する（値は整数のマイクロ秒のため、境界ちょうどの値だけが次の区間に入る）
+    const char* name = "calendar_import_request_phase_seconds";
+    unsigned long cumulative = 0;
+    int bucket = 0;
+    for (size_t b = 0; b < sizeof(metrics_latency_bounds_us) / sizeof(metrics_latency_bounds_us[0]); b++) {
+        while (bucket < NET_HIST_BUCKETS && net_histogram_upper_bound(bucket) < metrics_latency_bounds_us[b]) {
+            cumulative += counts[bucket++];
+        }
+        if (string_buffer_appendf(out, "%s_bucket{kind=\"%s\",phase=\"%s\",le=\"%.6f\"} %lu\n", name, kind, phase,
+                                  metrics_latency_bounds_us[b] / 1e6, cumulative) != 0) {
+            return -1;
+        }
+    }
+    return string_buffer_appendf(out,
+                                 "%s_bucket{kind=\"%s\",phase=\"%s\",le=\"+Inf\"} %lu\n"
+                                 "%s_sum{kind=\"%s\",phase=\"%s\"} %.6f\n"
+                                 "%s_count{kind=\"%s\",phase=\"%s\"} %lu\n",
+                                 name, kind, phase, total,
+                                 name, kind, phase, atomic_load(&hist->sum_us) / 1e6,
+                                 name, kind, phase, total);
+}
+
+/**
+ * 現在のメトリクスを Prometheus のテキスト形式（version 0.0.4）で書き出す関数
+ *
+ * @param out 書き出し先のバッファ（先頭から書き直す）
+ * @return 成功時は0、失敗時は-1
+ */
+int metrics_render(struct string_buffer* out) {
+    int rc = 0;
+    out->len = 0;
+    rc |= metrics_append_counter(out, "calendar_import_events_attempted_total",
+                                 "入力から読み取ったイベントの数", "counter",
+                                 atomic_load(&g_metrics.events_attempted));
+    rc |= metrics_append_counter(out, "calendar_import_events_succeeded_total",
+                                 "インポートに成功したイベントの数", "counter",
+                                 atomic_load(&g_metrics.events_succeeded));
+    rc |= metrics_append_counter(out, "calendar_import_events_skipped_total",
+                                 "前回のインポートから変更がないため送信しなかったイベントの数", "counter",
+                                 atomic_load(&g_metrics.events_skipped));
+    rc |= string_buffer_appendf(out, "# HELP calendar_import_events_failed_total 失敗したイベントの数（理由別）\n"
+                                     "# TYPE calendar_import_events_failed_total counter\n");
+    for (int i = 0; i < IMPORT_FAILURE_REASON_COUNT; i++) {
+        rc |= string_buffer_appendf(out, "calendar_import_events_failed_total{reason=\"%s\"} %lu\n",
+                                    import_failure_reason_names[i], atomic_load(&g_metrics.events_failed[i]));
+    }
+    rc |= metrics_append_counter(out, "calendar_import_retries_total",
+                                 "再送したイベントの数", "counter", atomic_load(&g_metrics.retries));
+    rc |= metrics_append_counter(out, "calendar_import_duplicates_total",
+                                 "登録済み（HTTP 409）として成功扱いにしたイベントの数", "counter",
+                                 atomic_load(&g_metrics.duplicates));
+    rc |= metrics_append_counter(out, "calendar_import_hedged_requests_total",
+                                 "遅いリクエストを複製して送った回数", "counter",
+                                 atomic_load(&g_metrics.hedges_sent));
+    rc |= metrics_append_counter(out, "calendar_import_hedge_wins_total",
+                                 "複製したリクエストが先に応答した回数", "counter",
+                                 atomic_load(&g_metrics.hedges_won));
+    rc |= metrics_append_counter(out, "calendar_import_token_refreshes_total",
+                                 "アクセストークンを更新した回数", "counter",
+                                 atomic_load(&g_metrics.token_refreshes));
+    rc |= metrics_append_counter(out, "calendar_import_token_refresh_failures_total",
+                                 "アクセストークンの更新に失敗した回数", "counter",
+                                 atomic_load(&g_metrics.token_refresh_failures));
+    long in_flight = atomic_load(&g_metrics.in_flight);
+    rc |= metrics_append_counter(out, "calendar_import_requests_in_flight",
+                                 "送信中のHTTPリクエストの数", "gauge", in_flight > 0 ? (unsigned long)in_flight : 0);
+
+    static const struct {
+        const char* name;
+        const char* help;
+        size_t offset;
+    } request_counters[] = {
+        { "calendar_import_http_requests_total", "完了したHTTPリクエストの数",
+          offsetof(struct net_request_stats, requests) },
+        { "calendar_import_http_transport_errors_total", "転送自体が失敗したHTTPリクエストの数",
+          offsetof(struct net_request_stats, failed) },
+        { "calendar_import_http_new_connections_total", "新しく接続したHTTPリクエストの数",
+          offsetof(struct net_request_stats, new_connections) },
+        { "calendar_import_http_sent_bytes_total", "送信した本文のバイト数",
+          offsetof(struct net_request_stats, bytes_sent) },
+        { "calendar_import_http_received_bytes_total", "受信した本文のバイト数",
+          offsetof(struct net_request_stats, bytes_received) },
+    };
+    for (size_t c = 0; c < sizeof(request_counters) / sizeof(request_counters[0]); c++) {
+        rc |= string_buffer_appendf(out, "# HELP %s %s\n# TYPE %s counter\n",
+                                    request_counters[c].name, request_counters[c].help, request_counters[c].name);
+        for (int kind = 0; kind < NET_REQUEST_KIND_COUNT; kind++) {
+            const atomic_ulong* value = (const atomic_ulong*)((const char*)&g_net_stats[kind] + request_counters[c].offset);
+            rc |= string_buffer_appendf(out, "%s{kind=\"%s\"} %lu\n", request_counters[c].name,
+                                        net_request_kind_names[kind], atomic_load(value));
+        }
+    }
+
+    rc |= string_buffer_appendf(out, "# HELP calendar_import_request_phase_seconds 段階ごとの通信時間\n"
+                                     "# TYPE calendar_import_request_phase_seconds histogram\n");
+    for (int kind = 0; kind < NET_REQUEST_KIND_COUNT; kind++) {
+        for (int phase = 0; phase < NET_PHASE_COUNT; phase++) {
+            rc |= metrics_append_histogram(out, net_request_kind_names[kind], net_phase_names[phase],
+                                           &g_net_stats[kind].phases[phase]);
+        }
+    }
+    return rc == 0 ? 0 : -1;
+}
+
+/**
+ * メトリクスを書き出すスレッドの状態
+ * テキストファイル（node_exporter の textfile collector 向け）と localhost のHTTPエンドポイントのどちらか、または両方で公開する
+ */
+struct metrics_exporter {
+    pthread_t thread;
+    const char* file_path;          // 定期的に書き出すファイル（NULLの場合は書き出さない）
+    long interval_ms;               // ファイルを書き出す間隔
+    int listen_fd;                  // HTTPエンドポイントの待ち受けソケット（-1の場合は公開しない）
+    int stop_pipe[2];               // 停止要求を通知するパイプ
+    int running;
+    struct string_buffer body;      // 書き出す内容（スレッド内で使い回す）
+};
+
+static struct metrics_exporter g_metrics_exporter = { .listen_fd = -1, .stop_pipe = { -1, -1 } };
+
+/**
+ * メトリクスをファイルに書き出す関数
+ * 読み取り側が書きかけの内容を読まないよう、一時ファイルに書いてから置き換える
+ *
+ * @param exporter メトリクスの書き出し状態
+ * @return 成功時は0、失敗時は-1
+ */
+static int metrics_write_file(struct metrics_exporter* exporter) {
+    char tmp_path[BUFFER_SIZE];
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", exporter->file_path) >= (int)sizeof(tmp_path) ||
+        metrics_render(&exporter->body) != 0) {
+        return -1;
+    }
+
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "エラー: メトリクスファイル %s を作成できません: %s\n", tmp_path, strerror(errno));
+        return -1;
+    }
+    size_t written = 0;
+    while (written < exporter->body.len) {
+        ssize_t n = write(fd, exporter->body.data + written, exporter->body.len - written);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        written += (size_t)n;
+    }
+    if (close(fd) != 0 || written < exporter->body.len || rename(tmp_path, exporter->file_path) != 0) {
+        fprintf(stderr, "エラー: メトリクスファイル %s の書き込みに失敗しました: %s\n",
+                exporter->file_path, strerror(errno));
+        unlink(tmp_path);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * HTTPエンドポイントへの1件の接続に応答する関数
+ * GET /metrics（または /）にだけメトリクスを返し、応答後に接続を閉じる
+ *
+ * @param exporter メトリクスの書き出し状態
+ * @param fd 受け付けた接続
+ */
+static void metrics_serve_client(struct metrics_exporter* exporter, int fd) {
+    // 応答しない相手でスレッドが止まらないよう、受信と送信に時間制限を設ける
+    struct timeval timeout = { 2, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    char request[2048];
+    size_t len = 0;
+    while (len < sizeof(request) - 1) {
+        ssize_t n = recv(fd, request + len, sizeof(request) - 1 - len, 0);
+        if (n <= 0) {
+            break;
+        }
+        len += (size_t)n;
+        request[len] = '\0';
+        if (strstr(request, "\r\n\r\n") != NULL || strstr(request, "\n\n") != NULL) {
+            break;
+        }
+    }
+    request[len] = '\0';
+
+    const char* status = "404 Not Found";
+    const char* body = "not found\n";
+    size_t body_len = strlen(body);
+    int is_get = strncmp(request, "GET ", 4) == 0;
+    int is_head = strncmp(request, "HEAD ", 5) == 0;
+    const char* path = request + (is_head ? 5 : 4);
+    if ((is_get || is_head) &&
+        (strncmp(path, "/metrics ", 9) == 0 || strncmp(path, "/metrics?", 9) == 0 || strncmp(path, "/ ", 2) == 0)) {
+        if (metrics_render(&exporter->body) == 0) {
+            status = "200 OK";
+            body = exporter->body.data;
+            body_len = exporter->body.len;
+        } else {
+            status = "500 Internal Server Error";
+            body = "error\n";
+            body_len = strlen(body);
+        }
+    } else if (!is_get && !is_head) {
+        status = "405 Method Not Allowed";
+        body = "method not allowed\n";
+        body_len = strlen(body);
+    }
+
+    char header[256];
+    int header_len = snprintf(header, sizeof(header),
+                              "HTTP/1.1 %s\r\n"
+                              "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                              "Content-Length: %zu\r\n"
+                              "Connection: close\r\n\r\n", status, body_len);
+    struct iovec iov[2] = { { header, (size_t)header_len }, { (void*)body, is_head ? 0 : body_len } };
+    struct msghdr msg = { .msg_iov = iov, .msg_iovlen = 2 };
+    while (iov[0].iov_len + iov[1].iov_len > 0) {
+        ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (n <= 0) {
+            break;
+        }
+        for (int i = 0; i < 2 && n > 0; i++) {
+            size_t used = (size_t)n < iov[i].iov_len ? (size_t)n : iov[i].iov_len;
+            iov[i].iov_base = (char*)iov[i].iov_base + used;
+            iov[i].iov_len -= used;
+            n -= (ssize_t)used;
+        }
+    }
+    close(fd);
+}
+
+/**
+ * メトリクスを定期的にファイルへ書き出し、HTTPエンドポイントへの接続に応答するスレッド
+ */
+static void* metrics_exporter_main(void* arg) {
+    struct metrics_exporter* exporter = arg;
+    long long next_write = monotonic_ms();
+
+    for (;;) {
+        long long now = monotonic_ms();
+        if (exporter->file_path && now >= next_write) {
+            metrics_write_file(exporter);
+            next_write = now + exporter->interval_ms;
+        }
+
+        struct pollfd fds[2] = {
+            { exporter->stop_pipe[0], POLLIN, 0 },
+            { exporter->listen_fd, POLLIN, 0 },
+        };
+        int timeout = exporter->file_path ? (int)(next_write - now) : -1;
+        if (poll(fds, exporter->listen_fd >= 0 ? 2 : 1, timeout) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (fds[0].revents) {
+            break;
+        }
+        if (exporter->listen_fd >= 0 && (fds[1].revents & POLLIN)) {
+            int fd = accept4(exporter->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+            if (fd >= 0) {
+                metrics_serve_client(exporter, fd);
+            }
+        }
+    }
+    return NULL;
+}
+
+/**
+ * メトリクスの公開を開始する関数
+ *
+ * @param file_path 定期的に書き出すファイル（不要な場合はNULL）
+ * @param port localhost で待ち受けるポート番号（不要な場合は0）
+ * @param interval_sec ファイルを書き出す間隔（秒）
+ * @return 成功時は0、失敗時は-1
+ */
+int metrics_exporter_start(const char* file_path, int port, long interval_sec) {
+    struct metrics_exporter* exporter = &g_metrics_exporter;
+    exporter->file_path = file_path;
+    exporter->interval_ms = interval_sec * 1000;
+
+    if (port > 0) {
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((uint16_t)port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        int one = 1;
+        exporter->listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (exporter->listen_fd < 0 ||
+            setsockopt(exporter->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0 ||
+            bind(exporter->listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+            listen(exporter->listen_fd, 16) != 0) {
+            fprintf(stderr, "エラー: メトリクスのポート %d で待ち受けできません: %s\n", port, strerror(errno));
+            return -1;
+        }
+    }
+    if (pipe(exporter->stop_pipe) != 0) {
+        fprintf(stderr, "エラー: メトリクスの公開を開始できません: %s\n", strerror(errno));
+        return -1;
+    }
+    if (pthread_create(&exporter->thread, NULL, metrics_exporter_main, exporter) != 0) {
+        fprintf(stderr, "エラー: メトリクス書き出しスレッドの起動に失敗しました\n");
+        return -1;
+    }
+    exporter->running = 1;
+    return 0;
+}
+
+/**
+ * メトリクスの公開を停止する関数
+ * ファイルに書き出している場合は、終了時点の値を最後に書き出す
+ */
+void metrics_exporter_shutdown(void) {
+    struct metrics_exporter* exporter = &g_metrics_exporter;
+    if (exporter->running) {
+        ssize_t ignored = write(exporter->stop_pipe[1], "x", 1);
+        (void)ignored;
+        pthread_join(exporter->thread, NULL);
+        exporter->running = 0;
+        if (exporter->file_path) {
+            metrics_write_file(exporter);
+        }
+    }
+    if (exporter->listen_fd >= 0) {
+        close(exporter->listen_fd);
+        exporter->listen_fd = -1;
+    }
+    for (int i = 0; i < 2; i++) {
+        if (exporter->stop_pipe[i] >= 0) {
+            close(exporter->stop_pipe[i]);
+            exporter->stop_pipe[i] = -1;
+        }
+    }
+    free(exporter->body.data);
+    exporter->body.data = NULL;
+    exporter->body.len = exporter->body.cap = 0;
+}
+
+/**
+ * 同時実行数の適応制御（AIMD）の状態
+ * 成功するたびにウィンドウを広げ、レート制限の応答を受けたら半分に縮める。
+ * 最初のレート制限までは1往復ごとに倍増させ（スロースタート）、
+ * 以降は1往復ごとに1ずつ広げることで、クォータが許す最大の速度を探る。
+ */
+struct rate_controller {
+    int adaptive;                   // 0の場合はウィンドウを max_window に固定する
+    double window;                  // 現在の同時実行ウィンドウ
+    double max_window;              // ウィンドウの上限（--concurrency）
+    double min_seen;                // 実行中に記録したウィンドウの最小値
+    double max_seen;                // 実行中に記録したウィンドウの最大値
+    int slow_start;                 // スロースタート中かどうか
+    long long last_decrease_ms;     // 最後にウィンドウを縮めた時刻
+    long long paused_until_ms;      // Retry-After による送信停止の終了時刻
+    long long paused_total_ms;      // Retry-After で送信を止めた合計時間
+    unsigned long decreases;        // ウィンドウを縮めた回数
+    unsigned long pauses;           // Retry-After で送信を止めた回数
+    unsigned long rate_limited;     // レート制限の応答を受けた回数
+};
+
+/**
+ * 適応制御を初期化する関数
+ *
+ * @param rc 初期化する状態
+ * @param max_window ウィンドウの上限
+ * @param adaptive 適応制御を行うかどうか
+ */
+static void rate_controller_init(struct rate_controller* rc, int max_window, int adaptive) {
+    memset(rc, 0, sizeof(*rc));
+    rc->adaptive = adaptive;
+    rc->max_window = max_window;
+    rc->window = adaptive ? 1.0 : max_window;
+    rc->min_seen = rc->window;
+    rc->max_seen = rc->window;
+    rc->slow_start = 1;
+}
+
+/**
+ * 現在送信してよいリクエスト数の上限を返す関数
+ * Retry-After による停止中は0を返す
+ *
+ * @param rc 適応制御の状態
+ * @param now_ms 現在時刻（monotonic_ms）
+ * @return 同時に処理してよいリクエスト数
+ */
+static int rate_controller_limit(const struct rate_controller* rc, long long now_ms) {
+    if (now_ms < rc->paused_until_ms) {
+        return 0;
+    }
+    return (int)rc->window;
+}
+
+/**
+ * 成功した応答をウィンドウに反映する関数
+ *
+ * @param rc 適応制御の状態
+ */
+static void rate_controller_on_success(struct rate_controller* rc) {
+    if (!rc->adaptive) {
+        return;
+    }
+    rc->window += rc->slow_start ? 1.0 : 1.0 / rc->window;
+    if (rc->window > rc->max_window) {
+        rc->window = rc->max_window;
+    }
+    if (rc->window > rc->max_seen) {
+        rc->max_seen = rc->window;
+    }
+}
+
+/**
+ * レート制限の応答をウィンドウに反映する関数
+ * 同じ混雑に対して何度も縮めないよう、最後に縮めた後に送信したリクエストの応答でのみ縮める
+ *
+ * @param rc 適応制御の状態
+ * @param sent_ms 応答に対応するリクエストを送信した時刻
+ * @param retry_after_sec Retry-After ヘッダーの秒数（ない場合は負の値）
+ */
+static void rate_controller_on_limited(struct rate_controller* rc, long long sent_ms, long retry_after_sec) {
+    long long now = monotonic_ms();
+    rc->rate_limited++;
+
+    if (retry_after_sec > 0) {
+        long long until = now + retry_after_sec * 1000;
+        if (until > rc->paused_until_ms) {
+            rc->paused_total_ms += until - (rc->paused_until_ms > now ? rc->paused_until_ms : now);
+            rc->paused_until_ms = until;
+            rc->pauses++;
+        }
+    }
+
+    if (!rc->adaptive || sent_ms < rc->last_decrease_ms) {
+        return;
+    }
+    rc->slow_start = 0;
+    rc->window /= 2.0;
+    if (rc->window < 1.0) {
+        rc->window = 1.0;
+    }
+    if (rc->window < rc->min_seen) {
+        rc->min_seen = rc->window;
+    }
+    rc->last_decrease_ms = now;
+    rc->decreases++;
+}
+
+/**
+ * インポート対象の1イベント
+ */
+struct import_item {
+    struct json_object* event;      // 送信するイベント（結果を報告するまで保持）
+    unsigned long line;             // 入力ファイル上の行番号（報告用）
+    unsigned long end_line;         // イベントの終わりの行番号
+    unsigned long long offset;      // 入力ファイル上の開始バイトオフセット
+    unsigned long long end;         // 入力ファイル上の終了バイトオフセット
+    unsigned long long seq;         // 受け付け順の通し番号（ウォーターマークの計算用）
+    int tracked;                    // seq を割り当てたかどうか
+    int attempts;                   // これまでに再送した回数
+    uint64_t index_key;             // 重複検出インデックスのキー（記録しない場合は0）
+    uint64_t index_digest;          // 重複検出インデックスに記録する本文のハッシュ
+};
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+/**
+ * SHA-256 の状態
+ */
+struct sha256_ctx {
+    uint32_t state[8];
+    uint64_t length;                // これまでに入力したバイト数
+    unsigned char block[64];
+    size_t used;                    // block に溜まっているバイト数
+};
+
+#define SHA256_ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+/**
+ * 64バイトのブロックを1つ処理する関数
+ */
+static void sha256_compress(struct sha256_ctx* ctx, const unsigned char* block) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) {
+        w[i] = (uint32_t)block[i * 4] << 24 | (uint32_t)block[i * 4 + 1] << 16 |
+               (uint32_t)block[i * 4 + 2] << 8 | (uint32_t)block[i * 4 + 3];
+    }
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = SHA256_ROTR(w[i - 15], 7) ^ SHA256_ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = SHA256_ROTR(w[i - 2], 17) ^ SHA256_ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = ctx->state[0], b = ctx->state[1], c = ctx->state[2], d = ctx->state[3];
+    uint32_t e = ctx->state[4], f = ctx->state[5], g = ctx->state[6], h = ctx->state[7];
+    for (int i = 0; i < 64; i++) {
+        uint32_t t1 = h + (SHA256_ROTR(e, 6) ^ SHA256_ROTR(e, 11) ^ SHA256_ROTR(e, 25)) +
+                      ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+        uint32_t t2 = (SHA256_ROTR(a, 2) ^ SHA256_ROTR(a, 13) ^ SHA256_ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    ctx->state[0] += a; ctx->state[1] += b; ctx->state[2] += c; ctx->state[3] += d;
+    ctx->state[4] += e; ctx->state[5] += f; ctx->state[6] += g; ctx->state[7] += h;
+}
+
+/**
+ * SHA-256 の計算を始める関数
+ */
+static void sha256_init(struct sha256_ctx* ctx) {
+    static const uint32_t initial[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    memcpy(ctx->state, initial, sizeof(initial));
+    ctx->length = 0;
+    ctx->used = 0;
+}
+
+/**
+ * SHA-256 にデータを追加する関数
+ */
+static void sha256_update(struct sha256_ctx* ctx, const void* data, size_t len) {
+    const unsigned char* p = data;
+    ctx->length += len;
+    while (len > 0) {
+        size_t n = 64 - ctx->used;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(ctx->block + ctx->used, p, n);
+        ctx->used += n;
+        p += n;
+        len -= n;
+        if (ctx->used == 64) {
+            sha256_compress(ctx, ctx->block);
+            ctx->used = 0;
+        }
+    }
+}
+
+/**
+ * SHA-256 の計算を終えてダイジェストを取り出す関数
+ */
+static void sha256_final(struct sha256_ctx* ctx, unsigned char digest[32]) {
+    uint64_t bits = ctx->length * 8;
+    unsigned char pad = 0x80;
+    sha256_update(ctx, &pad, 1);
+    pad = 0;
+    while (ctx->used != 56) {
+        sha256_update(ctx, &pad, 1);
+    }
+    unsigned char length[8];
+    for (int i = 0; i < 8; i++) {
+        length[i] = (unsigned char)(bits >> (56 - i * 8));
+    }
+    sha256_update(ctx, length, 8);
+    for (int i = 0; i < 8; i++) {
+        digest[i * 4] = (unsigned char)(ctx->state[i] >> 24);
+        digest[i * 4 + 1] = (unsigned char)(ctx->state[i] >> 16);
+        digest[i * 4 + 2] = (unsigned char)(ctx->state[i] >> 8);
+        digest[i * 4 + 3] = (unsigned char)ctx->state[i];
+    }
+}
+
+/**
+ * iCalUID とカレンダーIDから、送信するイベントのIDを決める関数
+ * 同じイベントを何度送っても同じIDになるため、再送やヘッジで重複したリクエストは
+ * 新しいイベントを作らず 409 になる。
+ * IDは SHA-256 の先頭160ビットを base32hex（小文字）で表した32文字で、
+ * Google Calendar のIDの規則（a〜v と 0〜9、5〜1024文字）を満たす。
+ *
+ * @param calendar_id インポート先のカレンダーID
+ * @param ical_uid イベントの iCalUID
+ * @param out IDを受け取るバッファ（EVENT_ID_LENGTH + 1 バイト以上）
+ */
+void event_id_derive(const char* calendar_id, const char* ical_uid, char out[EVENT_ID_LENGTH + 1]) {
+    static const char alphabet[] = "0123456789abcdefghijklmnopqrstuv";
+    struct sha256_ctx ctx;
+    unsigned char digest[32];
+    sha256_init(&ctx);
+    sha256_update(&ctx, calendar_id, strlen(calendar_id));
+    sha256_update(&ctx, "\n", 1);
+    sha256_update(&ctx, ical_uid, strlen(ical_uid));
+    sha256_final(&ctx, digest);
+
+    // 160ビット = 5ビット × 32文字
+    for (int i = 0; i < EVENT_ID_LENGTH; i++) {
+        int bit = i * 5;
+        unsigned int pair = (unsigned int)digest[bit / 8] << 8 | digest[bit / 8 + 1];
+        out[i] = alphabet[(pair >> (11 - bit % 8)) & 0x1f];
+    }
+    out[EVENT_ID_LENGTH] = '\0';
+}
+
+/**
+ * イベントにIDがなければ、iCalUID から決めたIDを付ける関数
+ *
+ * @param event 送信するイベント
+ * @param calendar_id インポート先のカレンダーID
+ * @return IDを付けた場合は1、すでにある場合や iCalUID がない場合は0、失敗時は-1
+ */
+int event_assign_id(struct json_object* event, const char* calendar_id) {
+    struct json_object* uid;
+    if (json_object_object_get_ex(event, "id", NULL) ||
+        !json_object_object_get_ex(event, "iCalUID", &uid) || !json_object_is_type(uid, json_type_string)) {
+        return 0;
+    }
+    char id[EVENT_ID_LENGTH + 1];
+    event_id_derive(calendar_id, json_object_get_string(uid), id);
+    struct json_object* value = json_object_new_string(id);
+    if (value == NULL || json_object_object_add(event, "id", value) != 0) {
+        json_object_put(value);
+        return -1;
+    }
+    return 1;
+}
+
+/**
+ * 再送を待つ1イベント
+ */
+struct retry_entry {
+    struct import_item item;
+    long long due_ms;               // 再送できるようになる時刻
+    struct retry_entry* next;
+};
+
+/**
+ * 再送待ちのイベントを管理するタイマーホイール
+ * RETRY_WHEEL_TICK_MS ごとの目盛りを RETRY_WHEEL_SLOTS 個の輪に割り当て、登録と取り出しを
+ * 件数によらず一定時間で行う。1周より先の時刻のエントリは、時刻を確かめて次の周まで残す。
+ * 期限を迎えたエントリは到着順の待ち行列に移し、新しい入力より先に送信する。
+ */
+struct retry_wheel {
+    struct retry_entry* slots[RETRY_WHEEL_SLOTS];
+    struct retry_entry* ready_head; // 期限を迎えたエントリ（到着順）
+    struct retry_entry* ready_tail;
+    struct retry_entry* free_list;  // 使い終えたエントリ（再利用する）
+    long long tick;                 // 次に調べる目盛り
+    size_t waiting;                 // 輪に入っているエントリ数
+    size_t ready;                   // 待ち行列に入っているエントリ数
+};
+
+/**
+ * 再送待ちのイベントを登録する関数
+ * イベントの参照はホイールに移る
+ *
+ * @param wheel タイマーホイール
+ * @param item 再送するイベント
+ * @param due_ms 再送できるようになる時刻
+ * @return 成功時は0、失敗時は-1
+ */
+int retry_wheel_add(struct retry_wheel* wheel, const struct import_item* item, long long due_ms) {
+    struct retry_entry* entry = wheel->free_list;
+    if (entry != NULL) {
+        wheel->free_list = entry->next;
+    } else if ((entry = malloc(sizeof(*entry))) == NULL) {
+        fprintf(stderr, "エラー: メモリ割り当てに失敗しました\n");
+        return -1;
+    }
+    entry->item = *item;
+    entry->due_ms = due_ms;
+
+    // 目盛りは切り上げ、その目盛りを調べる時点で必ず期限を過ぎているようにする
+    long long tick = (due_ms + RETRY_WHEEL_TICK_MS - 1) / RETRY_WHEEL_TICK_MS;
+    if (tick < wheel->tick) {
+        tick = wheel->tick;
+    }
+    struct retry_entry** slot = &wheel->slots[tick % RETRY_WHEEL_SLOTS];
+    entry->next = *slot;
+    *slot = entry;
+    wheel->waiting++;
+    return 0;
+}
+
+/**
+ * 現在時刻までの目盛りを進め、期限を迎えたエントリを待ち行列に移す関数
+ *
+ * @param wheel タイマーホイール
+ * @param now_ms 現在時刻
+ */
+void retry_wheel_advance(struct retry_wheel* wheel, long long now_ms) {
+    long long now_tick = now_ms / RETRY_WHEEL_TICK_MS;
+    if (wheel->waiting == 0) {
+        wheel->tick = now_tick + 1;
+        return;
+    }
+    long long ticks = now_tick - wheel->tick + 1;
+    if (ticks > RETRY_WHEEL_SLOTS) {
+        ticks = RETRY_WHEEL_SLOTS;
+    }
+    for (long long t = 0; t < ticks; t++) {
+        struct retry_entry** link = &wheel->slots[(wheel->tick + t) % RETRY_WHEEL_SLOTS];
+        while (*link != NULL) {
+            struct retry_entry* entry = *link;
+            if (entry->due_ms > now_ms) {
+                link = &entry->next;
+                continue;
+            }
+            *link = entry->next;
+            entry->next = NULL;
+            if (wheel->ready_tail) {
+                wheel->ready_tail->next = entry;
+            } else {
+                wheel->ready_head = entry;
+            }
+            wheel->ready_tail = entry;
+            wheel->waiting--;
+            wheel->ready++;
+        }
+    }
+    if (ticks > 0) {
+        wheel->tick = now_tick + 1;
+    }
+}
+
+/**
+ * 期限を迎えた再送のイベントを1件取り出す関数
+ *
+ * @param wheel タイマーホイール
+ * @param item 取り出したイベントを受け取る構造体（イベントの参照は呼び出し側に移る）
+ * @return 取り出した場合は1、待ち行列が空の場合は0
+ */
+int retry_wheel_pop(struct retry_wheel* wheel, struct import_item* item) {
+    struct retry_entry* entry = wheel->ready_head;
+    if (entry == NULL) {
+        return 0;
+    }
+    wheel->ready_head = entry->next;
+    if (wheel->ready_head == NULL) {
+        wheel->ready_tail = NULL;
+    }
+    wheel->ready--;
+    *item = entry->item;
+    entry->next = wheel->free_list;
+    wheel->free_list = entry;
+    return 1;
+}
+
+/**
+ * 次にホイールを進める必要がある時刻までの時間を求める関数
+ * 待ち行列に残っているエントリは送信枠が空くのを待っているため、ここでは数えない
+ *
+ * @param wheel タイマーホイール
+ * @param now_ms 現在時刻
+ * @return 待つ時間（ミリ秒）、輪に再送待ちのイベントがない場合は-1
+ */
+long retry_wheel_timeout(const struct retry_wheel* wheel, long long now_ms) {
+    if (wheel->waiting == 0) {
+        return -1;
+    }
+    for (long long t = 0; t < RETRY_WHEEL_SLOTS; t++) {
+        if (wheel->slots[(wheel->tick + t) % RETRY_WHEEL_SLOTS] != NULL) {
+            long long wake = (wheel->tick + t) * RETRY_WHEEL_TICK_MS;
+            return wake > now_ms ? (long)(wake - now_ms) : 0;
+        }
+    }
+    return RETRY_WHEEL_SLOTS * RETRY_WHEEL_TICK_MS;
+}
+
+/**
+ * 期限にかかわらず、すべてのエントリを待ち行列に移す関数（締め切りで打ち切る場合に使う）
+ *
+ * @param wheel タイマーホイール
+ */
+void retry_wheel_flush(struct retry_wheel* wheel) {
+    long long tick = wheel->tick;
+    retry_wheel_advance(wheel, LLONG_MAX / 2);
+    wheel->tick = tick;
+}
+
+/**
+ * タイマーホイールを解放する関数
+ * 残っているイベントの参照も解放する
+ *
+ * @param wheel タイマーホイール
+ */
+void retry_wheel_free(struct retry_wheel* wheel) {
+    struct import_item item;
+    retry_wheel_flush(wheel);
+    while (retry_wheel_pop(wheel, &item)) {
+        json_object_put(item.event);
+    }
+    while (wheel->free_list) {
+        struct retry_entry* next = wheel->free_list->next;
+        free(wheel->free_list);
+        wheel->free_list = next;
+    }
+}
+
+/**
+ * ジャーナルから読み込んだ1イベント分の記録
+ */
+struct journal_entry {
+    unsigned long long offset;      // 入力ファイル上の開始バイトオフセット
+    unsigned long long end;         // 入力ファイル上の終了バイトオフセット
+    unsigned long line;
+    unsigned long end_line;
+    int state;                      // 0は空き、1は成功、2は失敗
+};
+
+/**
+ * 開始オフセットをキーとする記録のハッシュ表（オープンアドレス法）
+ */
+struct journal_index {
+    struct journal_entry* entries;
+    size_t cap;                     // 2のべき乗
+    size_t count;
+};
+
+/**
+ * ハッシュ表から開始オフセットに対応する記録の格納位置を探す関数
+ *
+ * @param index ハッシュ表
+ * @param offset 開始オフセット
+ * @return 記録、またはそれを格納すべき空き位置
+ */
+static struct journal_entry* journal_index_slot(const struct journal_index* index, unsigned long long offset) {
+    size_t mask = index->cap - 1;
+    size_t i = (size_t)((offset * 0x9E3779B97F4A7C15ULL) >> 20) & mask;
+    while (index->entries[i].state != 0 && index->entries[i].offset != offset) {
+        i = (i + 1) & mask;
+    }
+    return &index->entries[i];
+}
+
+/**
+ * ハッシュ表に記録を追加する関数（同じオフセットの記録は上書きする）
+ *
+ * @param index ハッシュ表
+ * @param entry 追加する記録
+ * @return 成功時は0、失敗時は-1
+ */
+static int journal_index_put(struct journal_index* index, const struct journal_entry* entry) {
+    if ((index->count + 1) * 2 > index->cap) {
+        struct journal_index grown = { NULL, index->cap ? index->cap * 2 : 1024, 0 };
+        grown.entries = calloc(grown.cap, sizeof(struct journal_entry));
+        if (grown.entries == NULL) {
+            fprintf(stderr, "エラー: メモリ割り当てに失敗しました\n");
+            return -1;
+        }
+        for (size_t i = 0; i < index->cap; i++) {
+            if (index->entries[i].state != 0) {
+                *journal_index_slot(&grown, index->entries[i].offset) = index->entries[i];
+                grown.count++;
+            }
+        }
+        free(index->entries);
+        *index = grown;
+    }
+
+    struct journal_entry* slot = journal_index_slot(index, entry->offset);
+    if (slot->state == 0) {
+        index->count++;
+    }
+    *slot = *entry;
+    return 0;
+}
+
+/**
+ * ハッシュ表から記録を探す関数
+ *
+ * @param index ハッシュ表
+ * @param offset 開始オフセット
+ * @return 見つかった記録、ない場合はNULL
+ */
+static const struct journal_entry* journal_index_find(const struct journal_index* index, unsigned long long offset) {
+    if (index->count == 0) {
+        return NULL;
+    }
+    const struct journal_entry* slot = journal_index_slot(index, offset);
+    return slot->state != 0 ? slot : NULL;
+}
+
+/**
+ * 再開に必要な情報
+ * ウォーターマークより前のイベントはすべて結果が記録済みなので、そのうち失敗したものだけを読み直す。
+ * ウォーターマーク以降は先頭から読み進め、成功が記録済みのイベントは解析せずに読み飛ばす。
+ */
+struct import_resume {
+    unsigned long long watermark;   // ここより前のイベントはすべて結果が記録済み
+    unsigned long watermark_line;
+    struct journal_index confirmed; // ウォーターマーク以降で成功が記録済みのイベント
+    struct journal_entry* retry;    // ウォーターマークより前で失敗したイベント（オフセット順）
+    size_t retry_count;
+    size_t retry_next;              // 次に読み直す retry の位置
+    int seeked;                     // ウォーターマークまで移動したかどうか
+    off_t valid_len;                // 途中で切れた末尾の記録を除いたジャーナルの長さ
+    unsigned long skipped;          // 読み飛ばしたイベント数
+    unsigned long retried;          // 読み直したイベント数
+};
+
+/**
+ * 再開情報を解放する関数
+ *
+ * @param resume 解放する再開情報
+ */
+void import_resume_free(struct import_resume* resume) {
+    free(resume->confirmed.entries);
+    free(resume->retry);
+    memset(resume, 0, sizeof(*resume));
+}
+
+/**
+ * 開始オフセットで記録を比較する関数（qsort用）
+ */
+static int journal_entry_compare(const void* a, const void* b) {
+    unsigned long long x = ((const struct journal_entry*)a)->offset;
+    unsigned long long y = ((const struct journal_entry*)b)->offset;
+    return (x > y) - (x < y);
+}
+
+/**
+ * ジャーナルに記録された入力ファイルと、指定された入力ファイルが同じか判定する関数
+ * 相対パス・絶対パス・シンボリックリンクの違いを問わないよう、デバイス番号とiノード番号で比べる
+ * （どちらかを stat できない場合はパスの文字列で比べる）
+ *
+ * @param recorded ジャーナルの H 行に記録されたパス
+ * @param input_path 指定された入力ファイルのパス
+ * @return 同じファイルの場合は1、そうでない場合は0
+ */
+static int journal_same_input(const char* recorded, const char* input_path) {
+    struct stat a, b;
+    if (stat(recorded, &a) == 0 && stat(input_path, &b) == 0) {
+        return a.st_dev == b.st_dev && a.st_ino == b.st_ino;
+    }
+    return strcmp(recorded, input_path) == 0;
+}
+
+/**
+ * ジャーナルを読み込み、再開情報を作成する関数
+ * 同じイベントの記録が複数ある場合は最後の記録を採用する。
+ * 書き込み途中で終了した末尾の不完全な行は無視する。
+ *
+ * @param path ジャーナルのパス
+ * @param input_path 入力ファイルのパス（ジャーナルの記録と一致するか確認する）
+ * @param resume 再開情報を受け取る構造体
+ * @return 読み込んだ場合は1、ジャーナルが存在しない場合は0、失敗時は-1
+ */
+int import_resume_load(const char* path, const char* input_path, struct import_resume* resume) {
+    memset(resume, 0, sizeof(*resume));
+
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        if (errno == ENOENT) {
+            return 0;
+        }
+        fprintf(stderr, "エラー: ジャーナル %s を開けません: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    struct journal_index all = { NULL, 0, 0 };
+    char* line = NULL;
+    size_t line_cap = 0;
+    ssize_t n;
+    int status = 1;
+    while ((n = getline(&line, &line_cap, file)) > 0) {
+        if (line[n - 1] != '\n') {
+            break;
+        }
+        resume->valid_len += n;
+        line[n - 1] = '\0';
+
+        struct journal_entry entry = {0};
+        char state[8];
+        if (line[0] == 'H' && line[1] == '\t') {
+            if (!journal_same_input(line + 2, input_path)) {
+                fprintf(stderr, "エラー: ジャーナル %s は別の入力ファイル (%s) のものです\n", path, line + 2);
+                status = -1;
+                break;
+            }
+        } else if (line[0] == 'W') {
+            sscanf(line, "W\t%llu\t%lu", &resume->watermark, &resume->watermark_line);
+        } else if (line[0] == 'R' &&
+                   sscanf(line, "R\t%llu\t%llu\t%lu\t%lu\t%7[a-z]",
+                          &entry.offset, &entry.end, &entry.line, &entry.end_line, state) == 5) {
+            entry.state = (strcmp(state, "ok") == 0) ? 1 : 2;
+            if (journal_index_put(&all, &entry) != 0) {
+                status = -1;
+                break;
+            }
+        }
+    }
+    free(line);
+    fclose(file);
+
+    // ウォーターマークより前で失敗したものは読み直し、以降で成功したものは読み飛ばす
+    if (status == 1 && all.count > 0) {
+        resume->retry = malloc(all.count * sizeof(struct journal_entry));
+        if (resume->retry == NULL) {
+            fprintf(stderr, "エラー: メモリ割り当てに失敗しました\n");
+            status = -1;
+        }
+        for (size_t i = 0; status == 1 && i < all.cap; i++) {
+            const struct journal_entry* entry = &all.entries[i];
+            if (entry->state == 2 && entry->offset < resume->watermark) {
+                resume->retry[resume->retry_count++] = *entry;
+            } else if (entry->state == 1 && entry->offset >= resume->watermark &&
+                       journal_index_put(&resume->confirmed, entry) != 0) {
+                status = -1;
+            }
+        }
+        if (status == 1) {
+            qsort(resume->retry, resume->retry_count, sizeof(struct journal_entry), journal_entry_compare);
+        }
+    }
+    free(all.entries);
+
+    if (status != 1) {
+        import_resume_free(resume);
+    }
+    return status;
+}
+
+/**
+ * インポート結果のジャーナル
+ * 結果は追記のみで記録し、一定件数または一定時間ごとにまとめて fdatasync する（グループコミット）。
+ *
+ * 書式（タブ区切り、1行1レコード）:
+ *   H  入力ファイルの絶対パス（realpath() で解決できない場合は指定されたパス）
+ *   R  開始オフセット 終了オフセット 開始行 終了行 ok|failed HTTPステータス iCalUID イベントID
+ *   W  ウォーターマーク（ここより前のイベントはすべて記録済み） その位置の行番号
+ */
+struct import_journal {
+    int fd;
+    const char* path;
+    struct string_buffer buf;       // まだ書き込んでいないレコード
+    int unsynced;                   // buf 内のレコード数
+    long long oldest_ms;            // buf 内の最も古いレコードを追加した時刻
+    unsigned long long watermark;   // 最後に書き込んだウォーターマーク
+    unsigned long records;          // 記録したレコード数
+    unsigned long syncs;            // fdatasync した回数
+};
+
+/**
+ * ジャーナルを開く関数
+ *
+ * @param journal 初期化するジャーナル
+ * @param path ジャーナルのパス
+ * @param input_path 入力ファイルのパス
+ * @param resume 追記する場合は再開情報、新しく作成する場合はNULL
+ * @return 成功時は0、失敗時は-1
+ */
+int import_journal_open(struct import_journal* journal, const char* path, const char* input_path,
+                        const struct import_resume* resume) {
+    memset(journal, 0, sizeof(*journal));
+    journal->path = path;
+
+    int flags = O_WRONLY | O_CREAT | O_APPEND | (resume == NULL ? O_TRUNC : 0);
+    journal->fd = open(path, flags, 0600);
+    if (journal->fd < 0) {
+        fprintf(stderr, "エラー: ジャーナル %s を開けません: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    if (resume != NULL) {
+        // 書き込み途中で終了した末尾の行を取り除いてから追記する
+        if (ftruncate(journal->fd, resume->valid_len) != 0) {
+            fprintf(stderr, "エラー: ジャーナル %s を修復できません: %s\n", path, strerror(errno));
+            close(journal->fd);
+            return -1;
+        }
+        journal->watermark = resume->watermark;
+        return 0;
+    }
+
+    // 別の作業ディレクトリから再開しても入力ファイルを確認できるよう、絶対パスで記録する
+    char* resolved = realpath(input_path, NULL);
+    int status = string_buffer_appendf(&journal->buf, "# calendar_import journal v1\nH\t%s\n",
+                                       resolved ? resolved : input_path);
+    free(resolved);
+    if (status != 0) {
+        close(journal->fd);
+        return -1;
+    }
+    journal->oldest_ms = monotonic_ms();
+    return 0;
+}
+
+/**
+ * ジャーナルに書き込む文字列からタブと改行を取り除く関数
+ *
+ * @param dest 書き込み先のバッファ
+ * @param src 元の文字列（NULLまたは空の場合は "-"）
+ * @param dest_size バッファのサイズ
+ */
+static void journal_field(char* dest, const char* src, size_t dest_size) {
+    SAFE_STRCPY(dest, (src && src[0]) ? src : "-", dest_size);
+    for (char* p = dest; *p; p++) {
+        if (*p == '\t' || *p == '\n' || *p == '\r') {
+            *p = ' ';
+        }
+    }
+}
+
+/**
+ * 1件のイベントの結果をジャーナルに追加する関数（書き込みは import_journal_sync で行う）
+ *
+ * @param journal ジャーナル
+ * @param item 対象のイベント
+ * @param ok 成功したかどうか
+ * @param http_status HTTPステータスコード
+ * @param event_id 作成されたイベントのID（不明な場合はNULL）
+ * @return 成功時は0、失敗時は-1
+ */
+int import_journal_record(struct import_journal* journal, const struct import_item* item, int ok,
+                          long http_status, const char* event_id) {
+    struct json_object* value;
+    char uid[512];
+    char id[256];
+    journal_field(uid, (item->event && json_object_object_get_ex(item->event, "iCalUID", &value))
+                       ? json_object_get_string(value) : NULL, sizeof(uid));
+    journal_field(id, event_id, sizeof(id));
+
+    if (journal->unsynced == 0) {
+        journal->oldest_ms = monotonic_ms();
+    }
+    journal->unsynced++;
+    journal->records++;
+    return string_buffer_appendf(&journal->buf, "R\t%llu\t%llu\t%lu\t%lu\t%s\t%ld\t%s\t%s\n",
+                                 item->offset, item->end, item->line, item->end_line,
+                                 ok ? "ok" : "failed", http_status, uid, id);
+}
+
+/**
+ * 溜まったレコードとウォーターマークを書き込み、fdatasync する関数
+ *
+ * @param journal ジャーナル
+ * @param watermark 現在のウォーターマーク
+ * @param watermark_line ウォーターマークの位置の行番号
+ * @return 成功時は0、失敗時は-1
+ */
+int import_journal_sync(struct import_journal* journal, unsigned long long watermark, unsigned long watermark_line) {
+    if (watermark > journal->watermark) {
+        if (string_buffer_appendf(&journal->buf, "W\t%llu\t%lu\n", watermark, watermark_line) != 0) {
+            return -1;
+        }
+        journal->watermark = watermark;
+    }
+    if (journal->buf.len == 0) {
+        return 0;
+    }
+
+    size_t done = 0;
+    while (done < journal->buf.len) {
+        ssize_t n = write(journal->fd, journal->buf.data + done, journal->buf.len - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            fprintf(stderr, "エラー: ジャーナル %s に書き込めません: %s\n", journal->path, strerror(errno));
+            return -1;
+        }
+        done += (size_t)n;
+    }
+    if (fdatasync(journal->fd) != 0) {
+        fprintf(stderr, "エラー: ジャーナル %s を同期できません: %s\n", journal->path, strerror(errno));
+        return -1;
+    }
+    journal->buf.len = 0;
+    journal->unsynced = 0;
+    journal->syncs++;
+    return 0;
+}
+
+/**
+ * 次に fdatasync するまでの残り時間を返す関数
+ *
+ * @param journal ジャーナル
+ * @param now_ms 現在時刻（monotonic_ms）
+ * @return 残りミリ秒（すぐに同期すべき場合は0、溜まったレコードがない場合は-1）
+ */
+static long import_journal_due(const struct import_journal* journal, long long now_ms) {
+    if (journal->unsynced == 0) {
+        return -1;
+    }
+    if (journal->unsynced >= JOURNAL_SYNC_RECORDS) {
+        return 0;
+    }
+    long long remaining = journal->oldest_ms + JOURNAL_SYNC_MS - now_ms;
+    return remaining > 0 ? (long)remaining : 0;
+}
+
+/**
+ * ジャーナルを閉じる関数（書き込んでいないレコードは呼び出し側で同期しておく）
+ *
+ * @param journal 閉じるジャーナル
+ */
+void import_journal_close(struct import_journal* journal) {
+    if (journal->fd >= 0) {
+        close(journal->fd);
+    }
+    journal->fd = -1;
+    free(journal->buf.data);
+    journal->buf.data = NULL;
+}
+
+/**
+ * 重複検出インデックスのファイルの先頭
+ *
+ * インデックスはオープンアドレス法のハッシュテーブルをそのままファイルにしたもので、
+ * mmap するだけで使える（件数によらず読み込みは一定時間）。1件あたり16バイトで、
+ * 負荷率を DEDUP_INDEX_MAX_LOAD_PERCENT % 以下に保つため、1000万件でおよそ256MBになる。
+ */
+struct dedup_index_header {
+    char magic[8];                  // DEDUP_INDEX_MAGIC
+    uint64_t capacity;              // エントリ数（2のべき乗）
+    uint64_t count;                 // 使用中のエントリ数
+    uint64_t reserved;
+};
+
+/**
+ * 重複検出インデックスの1エントリ
+ */
+struct dedup_index_entry {
+    uint64_t key;                   // カレンダーIDと iCalUID のハッシュ（0は空き）
+    uint64_t digest;                // 最後にインポートに成功した本文のハッシュ
+};
+
+/**
+ * 重複検出インデックス
+ * 前回までにインポートした内容と同じイベントを、送信せずに読み飛ばすために使う
+ */
+struct dedup_index {
+    int fd;
+    const char* path;
+    struct dedup_index_header* header;
+    struct dedup_index_entry* entries;
+    size_t map_size;
+    unsigned long updates;          // 追加・更新したエントリ数
+};
+
+/**
+ * インデックスのファイルを指定した容量で作成して mmap する関数
+ *
+ * @param fd 空のファイル
+ * @param capacity エントリ数（2のべき乗）
+ * @param header マップした先頭を受け取るポインタ
+ * @return 成功時はマップしたサイズ、失敗時は0
+ */
+static size_t dedup_index_map_new(int fd, uint64_t capacity, struct dedup_index_header** header) {
+    size_t size = sizeof(struct dedup_index_header) + capacity * sizeof(struct dedup_index_entry);
+    if (ftruncate(fd, (off_t)size) != 0) {
+        return 0;
+    }
+    void* data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        return 0;
+    }
+    *header = data;
+    memcpy((*header)->magic, DEDUP_INDEX_MAGIC, sizeof((*header)->magic));
+    (*header)->capacity = capacity;
+    (*header)->count = 0;
+    return size;
+}
+
+/**
+ * 重複検出インデックスを開く関数（ファイルがない場合は作成する）
+ *
+ * @param index 初期化するインデックス
+ * @param path インデックスのパス
+ * @return 成功時は0、失敗時は-1
+ */
+int dedup_index_open(struct dedup_index* index, const char* path) {
+    memset(index, 0, sizeof(*index));
+    index->path = path;
+    index->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    struct stat st;
+    if (index->fd < 0 || fstat(index->fd, &st) != 0) {
+        fprintf(stderr, "エラー: 重複検出インデックス %s を開けません: %s\n", path, strerror(errno));
+        if (index->fd >= 0) {
+            close(index->fd);
+        }
+        return -1;
+    }
+
+    if (st.st_size == 0) {
+        index->map_size = dedup_index_map_new(index->fd, DEDUP_INDEX_INITIAL_CAPACITY, &index->header);
+    } else if ((size_t)st.st_size >= sizeof(struct dedup_index_header)) {
+        void* data = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, index->fd, 0);
+        if (data != MAP_FAILED) {
+            index->header = data;
+            index->map_size = (size_t)st.st_size;
+        }
+    }
+    if (index->header == NULL) {
+        fprintf(stderr, "エラー: 重複検出インデックス %s を読み込めません: %s\n", path, strerror(errno));
+        close(index->fd);
+        return -1;
+    }
+
+    uint64_t capacity = index->header->capacity;
+    if (memcmp(index->header->magic, DEDUP_INDEX_MAGIC, sizeof(index->header->magic)) != 0 ||
+        capacity == 0 || (capacity & (capacity - 1)) != 0 ||
+        index->map_size != sizeof(struct dedup_index_header) + capacity * sizeof(struct dedup_index_entry)) {
+        fprintf(stderr, "エラー: %s は重複検出インデックスではないか、壊れています\n", path);
+        munmap(index->header, index->map_size);
+        close(index->fd);
+        return -1;
+    }
+    index->entries = (struct dedup_index_entry*)(index->header + 1);
+    return 0;
+}
+
+/**
+ * カレンダーIDと iCalUID からインデックスのキーを求める関数
+ *
+ * @param calendar_id インポート先のカレンダーID
+ * @param ical_uid イベントの iCalUID
+ * @return キー（0にはならない）
+ */
+uint64_t dedup_index_key(const char* calendar_id, const char* ical_uid) {
+    struct sha256_ctx ctx;
+    unsigned char digest[32];
+    sha256_init(&ctx);
+    sha256_update(&ctx, calendar_id, strlen(calendar_id));
+    sha256_update(&ctx, "\n", 1);
+    sha256_update(&ctx, ical_uid, strlen(ical_uid));
+    sha256_final(&ctx, digest);
+    uint64_t key;
+    memcpy(&key, digest, sizeof(key));
+    return key ? key : 1;
+}
+
+static int compare_keys(const void* a, const void* b) {
+    return strcmp(*(const char* const*)a, *(const char* const*)b);
+}
+
+/**
+ * JSON の値を正規化してハッシュに加える関数
+ * オブジェクトのキーは並べ替え、文字列は長さを付けて加えるため、書式やキーの順序の違いは結果に影響しない
+ *
+ * @param ctx ハッシュの計算状態
+ * @param value 対象の値
+ */
+static void event_digest_update(struct sha256_ctx* ctx, struct json_object* value) {
+    char tag[32];
+    size_t len;
+    switch (json_object_get_type(value)) {
+        case json_type_object: {
+            size_t count = (size_t)json_object_object_length(value);
+            const char* stack_keys[64];
+            const char** keys = count <= 64 ? stack_keys : malloc(count * sizeof(*keys));
+            if (keys == NULL) {
+                // ハッシュが一致しなくなるだけなので、比較できない内容として扱う
+                sha256_update(ctx, "!", 1);
+                return;
+            }
+            size_t n = 0;
+            json_object_object_foreach(value, key, member) {
+                (void)member;
+                keys[n++] = key;
+            }
+            qsort(keys, n, sizeof(*keys), compare_keys);
+            len = (size_t)snprintf(tag, sizeof(tag), "{%zu:", n);
+            sha256_update(ctx, tag, len);
+            for (size_t i = 0; i < n; i++) {
+                size_t key_len = strlen(keys[i]);
+                len = (size_t)snprintf(tag, sizeof(tag), "%zu:", key_len);
+                sha256_update(ctx, tag, len);
+                sha256_update(ctx, keys[i], key_len);
+                event_digest_update(ctx, json_object_object_get(value, keys[i]));
+            }
+            if (keys != stack_keys) {
+                free(keys);
+            }
+            break;
+        }
+        case json_type_array: {
+            size_t count = json_object_array_length(value);
+            len = (size_t)snprintf(tag, sizeof(tag), "[%zu:", count);
+            sha256_update(ctx, tag, len);
+            for (size_t i = 0; i < count; i++) {
+                event_digest_update(ctx, json_object_array_get_idx(value, i));
+            }
+            break;
+        }
+        case json_type_string: {
+            size_t str_len = (size_t)json_object_get_string_len(value);
+            len = (size_t)snprintf(tag, sizeof(tag), "s%zu:", str_len);
+            sha256_update(ctx, tag, len);
+            sha256_update(ctx, json_object_get_string(value), str_len);
+            break;
+        }
+        default: {
+            const char* text = json_object_to_json_string_ext(value, JSON_C_TO_STRING_PLAIN);
+            sha256_update(ctx, "v", 1);
+            sha256_update(ctx, text, strlen(text) + 1);
+            break;
+        }
+    }
+}
+
+/**
+ * 文字列の項目をハッシュに加える関数（項目がない場合や文字列でない場合は既定値を使う）
+ */
+static void event_digest_string(struct sha256_ctx* ctx, struct json_object* event, const char* key,
+                                const char* default_value) {
+    struct json_object* value;
+    const char* text = default_value;
+    if (json_object_object_get_ex(event, key, &value) && json_object_is_type(value, json_type_string)) {
+        text = json_object_get_string(value);
+    }
+    char tag[32];
+    size_t len = strlen(text);
+    sha256_update(ctx, tag, (size_t)snprintf(tag, sizeof(tag), "s%zu:", len));
+    sha256_update(ctx, text, len);
+}
+
+/**
+ * 開始・終了の日時を正規化してハッシュに加える関数
+ *
+ * 日付はそのまま、日時は UNIX時間にして加える。オフセットのない日時は timeZone の壁時計として変換する。
+ * API は日時をカレンダーのオフセットで書き直して返すため、書き方の違いは結果に影響しない。
+ * timeZone は繰り返しの展開にだけ影響し、API は送らなかった場合もカレンダーの既定値を補うため、
+ * 繰り返しのある日時イベントでだけ加える。
+ *
+ * @param ctx ハッシュの計算状態
+ * @param event イベント
+ * @param key "start" または "end"
+ * @param recurring 繰り返しのあるイベントかどうか
+ */
+static void event_digest_time(struct sha256_ctx* ctx, struct json_object* event, const char* key, int recurring) {
+    struct json_object* when;
+    struct json_object* value;
+    char tag[48];
+    if (!json_object_object_get_ex(event, key, &when) || !json_object_is_type(when, json_type_object)) {
+        sha256_update(ctx, "-", 1);
+        return;
+    }
+    if (json_object_object_get_ex(when, "date", &value)) {
+        sha256_update(ctx, "d", 1);
+        event_digest_string(ctx, when, "date", "");
+        return;
+    }
+
+    const char* zone = NULL;
+    if (json_object_object_get_ex(when, "timeZone", &value) && json_object_is_type(value, json_type_string)) {
+        zone = json_object_get_string(value);
+    }
+    struct rfc3339_time fields;
+    long long t = 0;
+    int converted = 0;
+    if (json_object_object_get_ex(when, "dateTime", &value) && json_object_is_type(value, json_type_string) &&
+        rfc3339_parse_fields(json_object_get_string(value), (size_t)json_object_get_string_len(value), &fields) == 0 &&
+        fields.has_time) {
+        t = rfc3339_to_epoch(&fields);
+        converted = fields.has_offset || (zone != NULL && tz_wall_to_epoch(zone, t, &t) == 0);
+    }
+    if (converted) {
+        sha256_update(ctx, tag, (size_t)snprintf(tag, sizeof(tag), "t%lld;", t));
+    } else {
+        // 解釈できない日時は書かれたまま比べる
+        sha256_update(ctx, "w", 1);
+        event_digest_string(ctx, when, "dateTime", "");
+    }
+    if (recurring) {
+        event_digest_string(ctx, when, "timeZone", "");
+    }
+}
+
+/**
+ * イベントの内容のハッシュを求める関数
+ *
+ * このツールが送る項目（summary、description、location、start、end、recurrence、status、transparency）だけを
+ * 正規化して計算する。API が補う項目（reminders、eventType など）や書き直す日時の表記は結果に影響しないため、
+ * ローカルのイベントと events.list が返したイベントの内容が同じかどうかを比べられる。
+ *
+ * @param event イベント
+ * @return ハッシュ
+ */
+uint64_t dedup_index_digest(struct json_object* event) {
+    struct sha256_ctx ctx;
+    unsigned char digest[32];
+    sha256_init(&ctx);
+    event_digest_string(&ctx, event, "summary", "");
+    event_digest_string(&ctx, event, "description", "");
+    event_digest_string(&ctx, event, "location", "");
+    // 状態と予定の公開方法は、省略すると API が既定値を補う
+    event_digest_string(&ctx, event, "status", "confirmed");
+    event_digest_string(&ctx, event, "transparency", "opaque");
+
+    struct json_object* recurrence;
+    int recurring = json_object_object_get_ex(event, "recurrence", &recurrence) &&
+                    json_object_is_type(recurrence, json_type_array) && json_object_array_length(recurrence) > 0;
+    if (recurring) {
+        event_digest_update(&ctx, recurrence);
+    } else {
+        sha256_update(&ctx, "[0:", 3);
+    }
+    event_digest_time(&ctx, event, "start", recurring);
+    event_digest_time(&ctx, event, "end", recurring);
+    sha256_final(&ctx, digest);
+    uint64_t value;
+    memcpy(&value, digest, sizeof(value));
+    return value;
+}
+
+/**
+ * キーのエントリ、またはキーを入れるべき空きエントリを探す関数（線形探索）
+ */
+static struct dedup_index_entry* dedup_index_probe(struct dedup_index_entry* entries, uint64_t capacity, uint64_t key) {
+    uint64_t mask = capacity - 1;
+    for (uint64_t i = key & mask;; i = (i + 1) & mask) {
+        if (entries[i].key == key || entries[i].key == 0) {
+            return &entries[i];
+        }
+    }
+}
+
+/**
+ * 前回インポートした本文と同じかどうかを調べる関数
+ *
+ * @param index インデックス
+ * @param key dedup_index_key() の値
+ * @param digest dedup_index_digest() の値
+ * @return 同じ場合は1、変更された場合や未登録の場合は0
+ */
+int dedup_index_unchanged(const struct dedup_index* index, uint64_t key, uint64_t digest) {
+    const struct dedup_index_entry* entry = dedup_index_probe(index->entries, index->header->capacity, key);
+    return entry->key == key && entry->digest == digest;
+}
+
+/**
+ * インデックスの容量を2倍にする関数
+ * 新しいファイルに詰め直してから置き換えるため、途中で中断しても元のインデックスは残る
+ *
+ * @param index インデックス
+ * @return 成功時は0、失敗時は-1
+ */
+static int dedup_index_grow(struct dedup_index* index) {
+    char tmp_path[BUFFER_SIZE];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", index->path);
+    int fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        fprintf(stderr, "エラー: %s を作成できません: %s\n", tmp_path, strerror(errno));
+        return -1;
+    }
+
+    uint64_t capacity = index->header->capacity * 2;
+    struct dedup_index_header* header = NULL;
+    size_t size = dedup_index_map_new(fd, capacity, &header);
+    if (size == 0) {
+        fprintf(stderr, "エラー: 重複検出インデックスを拡張できません: %s\n", strerror(errno));
+        close(fd);
+        unlink(tmp_path);
+        return -1;
+    }
+    struct dedup_index_entry* entries = (struct dedup_index_entry*)(header + 1);
+    for (uint64_t i = 0; i < index->header->capacity; i++) {
+        if (index->entries[i].key != 0) {
+            *dedup_index_probe(entries, capacity, index->entries[i].key) = index->entries[i];
+        }
+    }
+    header->count = index->header->count;
+
+    if (msync(header, size, MS_SYNC) != 0 || rename(tmp_path, index->path) != 0) {
+        fprintf(stderr, "エラー: 重複検出インデックス %s を置き換えられません: %s\n", index->path, strerror(errno));
+        munmap(header, size);
+        close(fd);
+        unlink(tmp_path);
+        return -1;
+    }
+    munmap(index->header, index->map_size);
+    close(index->fd);
+    index->fd = fd;
+    index->header = header;
+    index->entries = entries;
+    index->map_size = size;
+    return 0;
+}
+
+/**
+ * インポートに成功したイベントの本文のハッシュを記録する関数
+ *
+ * @param index インデックス
+ * @param key dedup_index_key() の値
+ * @param digest dedup_index_digest() の値
+ * @return 成功時は0、失敗時は-1
+ */
+int dedup_index_put(struct dedup_index* index, uint64_t key, uint64_t digest) {
+    struct dedup_index_entry* entry = dedup_index_probe(index->entries, index->header->capacity, key);
+    if (entry->key == 0) {
+        if ((index->header->count + 1) * 100 > index->header->capacity * DEDUP_INDEX_MAX_LOAD_PERCENT) {
+            if (dedup_index_grow(index) != 0) {
+                return -1;
+            }
+            entry = dedup_index_probe(index->entries, index->header->capacity, key);
+        }
+        index->header->count++;
+    }
+    // 中断してもキーだけが残ることのないよう、ハッシュを先に書く
+    entry->digest = digest;
+    entry->key = key;
+    index->updates++;
+    return 0;
+}
+
+/**
+ * エントリを削除する関数
+ * 線形探索の列が途切れないよう、後ろに続くエントリを空いた位置へ詰める
+ *
+ * @param index インデックス
+ * @param key dedup_index_key() の値
+ */
+void dedup_index_remove(struct dedup_index* index, uint64_t key) {
+    uint64_t mask = index->header->capacity - 1;
+    struct dedup_index_entry* entries = index->entries;
+    struct dedup_index_entry* entry = dedup_index_probe(entries, index->header->capacity, key);
+    if (entry->key == 0) {
+        return;
+    }
+    uint64_t hole = (uint64_t)(entry - entries);
+    for (uint64_t i = (hole + 1) & mask; entries[i].key != 0; i = (i + 1) & mask) {
+        // 本来の位置が (hole, i] の範囲にあるエントリは動かせない
+        uint64_t home = entries[i].key & mask;
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            entries[hole] = entries[i];
+            hole = i;
+        }
+    }
+    entries[hole].key = 0;
+    entries[hole].digest = 0;
+    index->header->count--;
+    index->updates++;
+}
+
+/**
+ * すべてのエントリを削除する関数（容量はそのまま）
+ *
+ * @param index インデックス
+ */
+void dedup_index_clear(struct dedup_index* index) {
+    memset(index->entries, 0, index->header->capacity * sizeof(struct dedup_index_entry));
+    index->header->count = 0;
+}
+
+/**
+ * 重複検出インデックスをディスクに書き戻して閉じる関数
+ *
+ * @param index 閉じるインデックス
+ */
+void dedup_index_close(struct dedup_index* index) {
+    if (index->header != NULL) {
+        if (msync(index->header, index->map_size, MS_SYNC) != 0) {
+            fprintf(stderr, "エラー: 重複検出インデックス %s を書き込めません: %s\n", index->path, strerror(errno));
+        }
+        munmap(index->header, index->map_size);
+        index->header = NULL;
+    }
+    if (index->fd >= 0) {
+        close(index->fd);
+    }
+    index->fd = -1;
+}
+
+/**
+ * 受け付けたイベントを結果が確定するまで受け付け順に保持するキュー
+ * 先頭から連続して確定したものを取り除き、残った先頭の位置をウォーターマークとする。
+ */
+struct settle_queue {
+    struct settle_entry {
+        unsigned long long offset;
+        unsigned long line;
+        int done;
+    }* entries;
+    size_t cap;
+    size_t head;                    // 先頭の格納位置
+    size_t count;
+    unsigned long long head_seq;    // 先頭のイベントの通し番号
+};
+
+/**
+ * キューの末尾にイベントを追加する関数
+ *
+ * @param queue キュー
+ * @param item 追加するイベント（seq と tracked を設定する）
+ * @return 成功時は0、失敗時は-1
+ */
+static int settle_queue_push(struct settle_queue* queue, struct import_item* item) {
+    if (queue->count == queue->cap) {
+        size_t new_cap = queue->cap ? queue->cap * 2 : 1024;
+        struct settle_entry* entries = malloc(new_cap * sizeof(struct settle_entry));
+        if (entries == NULL) {
+            fprintf(stderr, "エラー: メモリ割り当てに失敗しました\n");
+            return -1;
+        }
+        for (size_t i = 0; i < queue->count; i++) {
+            entries[i] = queue->entries[(queue->head + i) % queue->cap];
+        }
+        free(queue->entries);
+        queue->entries = entries;
+        queue->cap = new_cap;
+        queue->head = 0;
+    }
+
+    struct settle_entry* entry = &queue->entries[(queue->head + queue->count) % queue->cap];
+    entry->offset = item->offset;
+    entry->line = item->line;
+    entry->done = 0;
+    item->seq = queue->head_seq + queue->count;
+    item->tracked = 1;
+    queue->count++;
+    return 0;
+}
+
+/**
+ * イベントの結果が確定したことを記録し、先頭から確定済みのものを取り除く関数
+ *
+ * @param queue キュー
+ * @param seq 確定したイベントの通し番号
+ */
+static void settle_queue_done(struct settle_queue* queue, unsigned long long seq) {
+    queue->entries[(queue->head + (size_t)(seq - queue->head_seq)) % queue->cap].done = 1;
+    while (queue->count > 0 && queue->entries[queue->head].done) {
+        queue->head = (queue->head + 1) % queue->cap;
+        queue->count--;
+        queue->head_seq++;
+    }
+}
+
+/**
+ * 並行インポートエンジンの転送スロット
+ * イージーハンドルはスロットごとに1つ作成し、転送のたびに再利用する。
+ * 1回の転送で1件のイベント、またはバッチリクエストとして複数件のイベントを送信する。
+ */
+struct import_slot {
+    CURL* curl;                     // このスロット専用のイージーハンドル
+    struct MemoryStruct response;   // バッチレスポンスの受信バッファ（転送ごとに空にして再利用する）
+    struct response_parser parser;  // 単独リクエストのレスポンスを受信しながら解析するパーサー
+    struct request_headers headers; // アクセストークンを含むヘッダーリスト（トークンの更新時だけ作り直す）
+    int configured;                 // ハンドルに設定済みの送信方法（0: 未設定、1: 単独、2: バッチ）
+    struct curl_slist* configured_headers; // ハンドルに設定済みのヘッダーリスト
+    struct string_buffer body;      // バッチリクエストの本文（再利用する）
+    struct import_item items[MAX_BATCH_SIZE];
+    int item_count;                 // この転送に含まれるイベント数
+    int batched;                    // バッチエンドポイントに送信したかどうか
+    long long started_ms;           // 転送を開始した時刻
+    int busy;                       // 転送中かどうか
+    struct import_slot* twin;       // 同じイベントを送っているもう一方のスロット（ヘッジ中のみ）
+    int hedge;                      // 遅いリクエストを複製したスロットかどうか
+    int hedged;                     // この転送のイベントを別のスロットでも送ったかどうか
+};
+
+/**
+ * 直近の転送時間からヘッジのしきい値（p95）を求めるための記録
+ */
+struct latency_window {
+    long samples[HEDGE_WINDOW];     // 直近の転送時間（ミリ秒、リングバッファ）
+    int count;
+    int next;
+    int since_update;               // p95 を計算し直してから記録した件数
+    long p95_ms;
+};
+
+static int compare_long(const void* a, const void* b) {
+    long x = *(const long*)a;
+    long y = *(const long*)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * 転送時間を記録し、一定件数ごとに p95 を計算し直す関数
+ *
+ * @param window 記録先
+ * @param elapsed_ms 転送時間（ミリ秒）
+ */
+static void latency_window_record(struct latency_window* window, long elapsed_ms) {
+    window->samples[window->next] = elapsed_ms;
+    window->next = (window->next + 1) % HEDGE_WINDOW;
+    if (window->count < HEDGE_WINDOW) {
+        window->count++;
+    }
+    if (++window->since_update < 16 && window->p95_ms > 0) {
+        return;
+    }
+    window->since_update = 0;
+
+    long sorted[HEDGE_WINDOW];
+    memcpy(sorted, window->samples, window->count * sizeof(long));
+    qsort(sorted, window->count, sizeof(long), compare_long);
+    window->p95_ms = sorted[(window->count * 95) / 100];
+}
+
+/**
+ * 並行インポートエンジン構造体
+ * 1つのスレッドから curl_multi を使って最大 concurrency 件のリクエストを同時に処理する。
+ * batch_size が2以上の場合は、イベントを multipart/mixed のバッチリクエストにまとめて送信する。
+ */
+struct import_engine {
+    const struct app_config* config; // 開始時点の設定（実行中は差し替えない）
+    CURLM* multi;
+    struct import_slot* slots;
+    int concurrency;                // 同時に処理するリクエストの上限
+    int slot_count;                 // スロット数（concurrency にヘッジ用の予備を加えた数）
+    int in_flight;                  // 現在処理中のリクエスト数（ヘッジした複製を除く）
+    int hedge_slots;                // ヘッジした複製に使える予備のスロット数
+    int hedging;                    // 現在処理中のヘッジした複製の数
+    int batch_size;                 // 1回のバッチリクエストにまとめるイベント数の上限
+    long batch_flush_ms;            // 未送信のイベントを溜めておく最大時間
+    int max_streams;                // HTTP/2の1接続あたりの同時ストリーム数の上限
+    struct rate_controller rate;    // 同時実行数の適応制御
+    char boundary[64];              // バッチリクエストの区切り文字列
+    struct request_template request; // インポート先のURLとバッチ用のヘッダー
+    struct import_item pending[MAX_BATCH_SIZE];
+    int pending_count;              // 送信待ちのイベント数
+    long long pending_since;        // 最も古い送信待ちイベントを受け取った時刻
+    const char* input_path;         // 報告用の入力ファイルパス
+    struct import_journal* journal; // 結果を記録するジャーナル（記録しない場合はNULL）
+    struct dedup_index* index;      // 変更のないイベントを読み飛ばすためのインデックス（使わない場合はNULL）
+    struct import_resume* resume;   // 再開情報（再開しない場合はNULL）
+    struct settle_queue settled;    // ウォーターマークの計算に使う未確定イベントのキュー
+    struct retry_wheel retries;     // 再送待ちのイベント
+    int max_retries;                // 1件のイベントを再送する最大回数
+    long long deadline_ms;          // 締め切りの時刻（monotonic_ms() の値、締め切りがない場合は0）
+    int deadline_reached;           // 締め切りを過ぎて新しい送信をやめたかどうか
+    unsigned long succeeded;
+    unsigned long failed;
+    unsigned long retried;          // 再送を登録した回数
+    unsigned long requests;         // 送信したHTTPリクエスト数
+    int event_ids;                  // iCalUID から決めたIDをイベントに付けるかどうか
+    int hedge;                      // 遅いリクエストを複製して送るかどうか
+    struct latency_window latency;  // ヘッジのしきい値の計算に使う転送時間
+    unsigned long duplicates;       // 409 を成功として扱ったイベント数
+    unsigned long conflicts;        // この実行で送る前から登録済みだった（409）ため失敗にしたイベント数
+    unsigned long skipped;          // 前回と内容が同じため送信しなかったイベント数
+    unsigned long hedges;           // 複製して送ったリクエスト数
+    unsigned long hedge_wins;       // 複製した方が先に応答した回数
+    // 転送が完了するたびに呼び出す関数（ベンチマーク用、不要な場合はNULL）
+    void (*on_transfer)(void* arg, CURL* handle, int event_count, long long total_us);
+    void* on_transfer_arg;
+};
+
+/**
+ * 並行インポートエンジンを初期化する関数
+ * 同時実行数やバッチサイズなどは設定の tuning から取得する
+ *
+ * @param engine 初期化するエンジン
+ * @param config 使用する設定
+ * @return 成功時は0、失敗時は-1
+ */
+int import_engine_init(struct import_engine* engine, const struct app_config* config) {
+    memset(engine, 0, sizeof(*engine));
+    engine->config = config;
+    engine->concurrency = config->tuning.concurrency;
+    engine->batch_size = config->tuning.batch_size;
+    engine->batch_flush_ms = config->tuning.batch_flush_ms;
+    engine->max_streams = config->tuning.max_streams;
+    engine->max_retries = config->tuning.max_retries;
+    engine->event_ids = config->tuning.event_ids;
+    engine->hedge = config->tuning.hedge;
+    rate_controller_init(&engine->rate, engine->concurrency, config->tuning.adaptive);
+
+    // ヘッジした複製は同時実行数の枠の外で、予備のスロットを使って送る
+    if (engine->hedge) {
+        engine->hedge_slots = engine->concurrency * HEDGE_BUDGET_PERCENT / 100;
+        if (engine->hedge_slots < 1) {
+            engine->hedge_slots = 1;
+        }
+    }
+    engine->slot_count = engine->concurrency + engine->hedge_slots;
+    int concurrency = engine->slot_count;
+    snprintf(engine->boundary, sizeof(engine->boundary), "batch_calendar_import_%lx_%lx",
+             (unsigned long)getpid(), (unsigned long)time(NULL));
+    if (request_template_init(&engine->request, config, config->calendar_id, engine->boundary) != 0) {
+        return -1;
+    }
+
+    engine->multi = curl_multi_init();
+    engine->slots = calloc(concurrency, sizeof(struct import_slot));
+    if (!engine->multi || !engine->slots) {
+        fprintf(stderr, "エラー: 並行インポートエンジンの初期化に失敗しました\n");
+        free(engine->slots);
+        if (engine->multi) {
+            curl_multi_cleanup(engine->multi);
+        }
+        request_template_free(&engine->request);
+        return -1;
+    }
+
+    // HTTP/2では並行リクエストを同じ接続に多重化し、上限を超えた分だけ新しい接続を張る
+    curl_multi_setopt(engine->multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+    curl_multi_setopt(engine->multi, CURLMOPT_MAX_CONCURRENT_STREAMS, (long)engine->max_streams);
+
+    for (int i = 0; i < concurrency; i++) {
+        engine->slots[i].curl = curl_easy_init();
+        if (!engine->slots[i].curl ||
+            memory_struct_init(&engine->slots[i].response, MAX_RESPONSE_SIZE) != 0 ||
+            response_parser_init(&engine->slots[i].parser, MAX_RESPONSE_SIZE) != 0) {
+            fprintf(stderr, "エラー: 並行インポートエンジンの初期化に失敗しました\n");
+            for (int j = 0; j <= i; j++) {
+                if (engine->slots[j].curl) {
+                    curl_easy_cleanup(engine->slots[j].curl);
+                }
+                free(engine->slots[j].response.memory);
+                response_parser_free(&engine->slots[j].parser);
+            }
+            free(engine->slots);
+            curl_multi_cleanup(engine->multi);
+            request_template_free(&engine->request);
+            return -1;
+        }
+        // 転送ごとに変わらないオプションはここで一度だけ設定する
+        http_session_prepare(engine->slots[i].curl);
+        curl_easy_setopt(engine->slots[i].curl, CURLOPT_PRIVATE, (void *)&engine->slots[i]);
+    }
+    return 0;
+}
+
+/**
+ * 並行インポートエンジンを解放する関数
+ *
+ * @param engine 解放するエンジン
+ */
+void import_engine_cleanup(struct import_engine* engine) {
+    for (int i = 0; i < engine->slot_count; i++) {
+        struct import_slot* slot = &engine->slots[i];
+        if (slot->busy) {
+            curl_multi_remove_handle(engine->multi, slot->curl);
+        }
+        for (int j = 0; j < slot->item_count; j++) {
+            json_object_put(slot->items[j].event);
+        }
+        arena_free(&slot->headers.arena);
+        free(slot->response.memory);
+        response_parser_free(&slot->parser);
+        free(slot->body.data);
+        curl_easy_cleanup(slot->curl);
+    }
+    for (int i = 0; i < engine->pending_count; i++) {
+        json_object_put(engine->pending[i].event);
+    }
+    retry_wheel_free(&engine->retries);
+    free(engine->settled.entries);
+    free(engine->slots);
+    curl_multi_cleanup(engine->multi);
+    request_template_free(&engine->request);
+}
+
+/**
+ * 1件のイベントの結果を確定させ、ジャーナルに記録する関数
+ * 成功したイベントは重複検出インデックスにも記録する。
+ * ジャーナルやインデックスへの記録に失敗した場合は、以降の記録を中止してインポートを続ける
+ *
+ * @param engine 並行インポートエンジン
+ * @param item 対象のイベント
+ * @param ok 成功したかどうか
+ * @param http_status HTTPステータスコード
+ * @param event_id 作成されたイベントのID（不明な場合はNULL）
+ */
+static void import_engine_settle(struct import_engine* engine, const struct import_item* item, int ok,
+                                 long http_status, const char* event_id) {
+    if (ok && engine->index != NULL && item->index_key != 0 &&
+        dedup_index_put(engine->index, item->index_key, item->index_digest) != 0) {
+        fprintf(stderr, "エラー: 重複検出インデックス %s への記録を中止します\n", engine->index->path);
+        engine->index = NULL;
+    }
+    if (engine->journal == NULL) {
+        return;
+    }
+    if (item->tracked) {
+        settle_queue_done(&engine->settled, item->seq);
+    }
+
+    if (import_journal_record(engine->journal, item, ok, http_status, event_id) != 0) {
+        fprintf(stderr, "エラー: ジャーナル %s への記録を中止します\n", engine->journal->path);
+        engine->journal = NULL;
+    }
+}
+
+/**
+ * 失敗したイベントを再送待ちに登録する関数
+ * 再送の上限に達した場合や、再送の時刻が締め切りを過ぎる場合は登録しない
+ *
+ * @param engine 並行インポートエンジン
+ * @param item 対象のイベント
+ * @param retry_after Retry-After ヘッダーの秒数（ない場合は負の値）
+ * @param cause 失敗の内容（表示用）
+ * @return 登録した場合は1、しなかった場合は0
+ */
+static int import_engine_retry(struct import_engine* engine, const struct import_item* item,
+                               long retry_after, const char* cause) {
+    if (item->attempts >= engine->max_retries || engine->deadline_reached) {
+        return 0;
+    }
+    long long now = monotonic_ms();
+    long delay = retry_backoff_ms(item->attempts + 1, retry_after);
+    if (engine->deadline_ms > 0 && now + delay >= engine->deadline_ms) {
+        return 0;
+    }
+
+    struct import_item retry = *item;
+    retry.attempts++;
+    json_object_get(retry.event);
+    if (retry_wheel_add(&engine->retries, &retry, now + delay) != 0) {
+        json_object_put(retry.event);
+        return 0;
+    }
+    fprintf(stderr, "%s:%lu 行目: %s のため %.1f 秒後に再送します（%d/%d 回目）\n",
+            engine->input_path, item->line, cause, delay / 1000.0, retry.attempts, engine->max_retries);
+    engine->retried++;
+    atomic_fetch_add_explicit(&g_metrics.retries, 1, memory_order_relaxed);
+    return 1;
+}
+
+/**
+ * 1件のイベントの結果を報告する関数
+ *
+ * 結果は同時実行数の適応制御とジャーナルにも反映する。
+ * 一時的なエラーで失敗したイベントは再送待ちに登録し、最終的な結果が出るまで確定させない。
+ *
+ * @param engine 並行インポートエンジン
+ * @param slot イベントを送信したスロット
+ * @param item 対象のイベント
+ * @param http_status HTTPステータスコード（転送エラーの場合は0）
+ * @param error 転送エラーの説明（HTTPレスポンスを受け取った場合はNULL）
+ * @param transient error が一時的なもので、再送すれば成功し得るかどうか
+ * @param response レスポンスから取り出した項目
+ * @param retry_after Retry-After ヘッダーの秒数（ない場合は負の値）
+ */
+static void import_engine_report(struct import_engine* engine, const struct import_slot* slot,
+                                 const struct import_item* item, long http_status, const char* error,
+                                 int transient, const struct api_response* response, long retry_after) {
+    if (error != NULL) {
+        if (transient && import_engine_retry(engine, item, -1, error)) {
+            return;
+        }
+        fprintf(stderr, "エラー: %s:%lu 行目: インポートに失敗しました: %s\n",
+                engine->input_path, item->line, error);
+        engine->failed++;
+        metrics_count_failure(IMPORT_FAILURE_TRANSPORT);
+        import_engine_settle(engine, item, 0, 0, NULL);
+    } else if (http_status == 409 && engine->event_ids && !item->attempts && !slot->hedged) {
+        // この実行ではまだ送っていないイベントのIDが登録済みだった。
+        // 以前に別の内容で登録されたものかもしれないため、成功として扱わずインデックスにも記録しない
+        fprintf(stderr, "エラー: %s:%lu 行目: 同じIDのイベントが既に登録されています (HTTP 409)。"
+                "この実行で送ったものではないため、内容が同じとは限りません\n",
+                engine->input_path, item->line);
+        engine->failed++;
+        engine->conflicts++;
+        metrics_count_failure(IMPORT_FAILURE_CLIENT);
+        import_engine_settle(engine, item, 0, http_status, NULL);
+    } else if (http_status == 409 && engine->event_ids) {
+        // この実行の以前の試行やヘッジした複製が先に届いて登録済みになったため、成功として扱う
+        struct json_object* id = NULL;
+        json_object_object_get_ex(item->event, "id", &id);
+        rate_controller_on_success(&engine->rate);
+        printf("%s:%lu 行目: 既に登録済みです (HTTP %ld)\n", engine->input_path, item->line, http_status);
+        engine->succeeded++;
+        engine->duplicates++;
+        atomic_fetch_add_explicit(&g_metrics.events_succeeded, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&g_metrics.duplicates, 1, memory_order_relaxed);
+        import_engine_settle(engine, item, 1, http_status, id ? json_object_get_string(id) : NULL);
+    } else if (http_status < 200 || http_status >= 300) {
+        const char* reason = response->reason;
+        int rate_limited = is_rate_limited(http_status, reason);
+        if (rate_limited) {
+            rate_controller_on_limited(&engine->rate, slot->started_ms, retry_after);
+        }
+        if (is_retryable_response(http_status, reason)) {
+            char cause[96];
+            snprintf(cause, sizeof(cause), "HTTP %ld%s%s", http_status, reason[0] ? " " : "", reason);
+            if (import_engine_retry(engine, item, retry_after, cause)) {
+                return;
+            }
+        }
+
+        if (rate_limited) {
+            metrics_count_failure(IMPORT_FAILURE_RATE_LIMITED);
+        } else if (http_status >= 400 && http_status < 500) {
+            metrics_count_failure(IMPORT_FAILURE_CLIENT);
+        } else if (http_status >= 500 && http_status < 600) {
+            metrics_count_failure(IMPORT_FAILURE_SERVER);
+        } else {
+            metrics_count_failure(IMPORT_FAILURE_HTTP_OTHER);
+        }
+        fprintf(stderr, "エラー: %s:%lu 行目: インポートに失敗しました (HTTP %ld%s%s): %s\n",
+                engine->input_path, item->line, http_status, reason[0] ? " " : "", reason,
+                response->message[0] ? response->message : response->snippet);
+        engine->failed++;
+        import_engine_settle(engine, item, 0, http_status, NULL);
+    } else {
+        rate_controller_on_success(&engine->rate);
+        printf("%s:%lu 行目: インポートしました (HTTP %ld)\n", engine->input_path, item->line, http_status);
+        engine->succeeded++;
+        atomic_fetch_add_explicit(&g_metrics.events_succeeded, 1, memory_order_relaxed);
+        import_engine_settle(engine, item, 1, http_status, response->id);
+    }
+}
+
+/**
+ * 締め切りを過ぎたため送信しなかったイベントを失敗として確定させる関数
+ *
+ * @param engine 並行インポートエンジン
+ * @param item 対象のイベント（参照はこの関数で解放する）
+ */
+static void import_engine_expire(struct import_engine* engine, struct import_item* item) {
+    fprintf(stderr, "エラー: %s:%lu 行目: 締め切りを過ぎたため送信しませんでした\n", engine->input_path, item->line);
+    engine->failed++;
+    metrics_count_failure(IMPORT_FAILURE_DEADLINE);
+    import_engine_settle(engine, item, 0, 0, NULL);
+    json_object_put(item->event);
+}
+
+/**
+ * 前回インポートした内容から変わっていないイベントを読み飛ばす関数
+ * 変わっている場合は、成功時にインデックスへ記録するキーとハッシュを item に設定する
+ *
+ * @param engine 並行インポートエンジン
+ * @param item 読み取ったイベント（読み飛ばす場合は参照をこの関数で解放する）
+ * @return 読み飛ばした場合は1、送信する場合は0
+ */
+static int import_engine_unchanged(struct import_engine* engine, struct import_item* item) {
+    struct json_object* uid;
+    if (!json_object_object_get_ex(item->event, "iCalUID", &uid) || !json_object_is_type(uid, json_type_string)) {
+        return 0;
+    }
+    item->index_key = dedup_index_key(engine->config->calendar_id, json_object_get_string(uid));
+    item->index_digest = dedup_index_digest(item->event);
+    if (!dedup_index_unchanged(engine->index, item->index_key, item->index_digest)) {
+        return 0;
+    }
+
+    engine->skipped++;
+    atomic_fetch_add_explicit(&g_metrics.events_skipped, 1, memory_order_relaxed);
+    item->index_key = 0;
+    struct json_object* id = NULL;
+    json_object_object_get_ex(item->event, "id", &id);
+    import_engine_settle(engine, item, 1, 0, id ? json_object_get_string(id) : NULL);
+    json_object_put(item->event);
+    return 1;
+}
+
+/**
+ * 送信待ちのイベントをリクエストの本文に書き出す関数
+ * 1件だけの場合はイベントのJSON、複数件の場合はバッチリクエストの multipart の本文にする
+ *
+ * @param engine 並行インポートエンジン
+ * @param slot 送信に使うスロット
+ * @return 成功時は0、失敗時は-1
+ */
+static int import_engine_build_body(struct import_engine* engine, struct import_slot* slot) {
+    slot->body.len = 0;
+    if (!slot->batched) {
+        return json_write_value(&slot->body, slot->items[0].event);
+    }
+    for (int i = 0; i < slot->item_count; i++) {
+        if (string_buffer_appendf(&slot->body,
+                                  "--%s\r\n"
+                                  "Content-Type: application/http\r\n"
+                                  "Content-ID: <item-%d>\r\n"
+                                  "\r\n"
+                                  "POST %s\r\n"
+                                  "Content-Type: application/json\r\n"
+                                  "\r\n",
+                                  engine->boundary, i + 1, engine->request.batch_path) != 0 ||
+            json_write_value(&slot->body, slot->items[i].event) != 0 ||
+            string_buffer_append(&slot->body, "\r\n", 2) != 0) {
+            return -1;
+        }
+    }
+    return string_buffer_appendf(&slot->body, "--%s--\r\n", engine->boundary);
+}
+
+/**
+ * スロットに入れたイベントの転送を開始する関数
+ * 1件だけの場合は通常のインポートエンドポイント、複数件の場合はバッチエンドポイントを使う。
+ *
+ * @param engine 並行インポートエンジン
+ * @param slot 送信に使うスロット（items と item_count を設定済みであること）
+ * @param transient 失敗が一時的なものかどうかを受け取るポインタ
+ * @return 成功時はNULL、失敗時はエラーの説明
+ */
+static const char* import_engine_send(struct import_engine* engine, struct import_slot* slot, int* transient) {
+    slot->batched = (slot->item_count > 1);
+    memory_struct_reset(&slot->response);
+    response_parser_reset(&slot->parser);
+
+    // ヘッダーリストはトークンが更新されたときだけ作り直す（このスロットは転送中ではない）
+    const char* error = NULL;
+    *transient = 0;
+    if (request_headers_update(&slot->headers, &engine->request) != 0) {
+        error = "有効なアクセストークンの取得に失敗しました";
+        *transient = 1;
+    } else if (import_engine_build_body(engine, slot) != 0) {
+        error = "メモリ割り当てに失敗しました";
+    }
+
+    if (error == NULL) {
+        CURL* curl = slot->curl;
+        // URL・ヘッダー・受信先は前回の転送と変わった場合だけ設定し直す
+        int mode = slot->batched ? 2 : 1;
+        struct curl_slist* headers = slot->batched ? slot->headers.batch : slot->headers.single;
+        if (slot->configured != mode) {
+            if (slot->batched) {
+                curl_easy_setopt(curl, CURLOPT_URL, engine->config->batch_url);
+                curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
+                curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&slot->response);
+            } else {
+                curl_easy_setopt(curl, CURLOPT_URL, engine->request.url);
+                // 単独のインポートはレスポンスを溜めずに受信しながら解析する
+                curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, ResponseParserCallback);
+                curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&slot->parser);
+            }
+            slot->configured = mode;
+        }
+        if (slot->configured_headers != headers) {
+            curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+            slot->configured_headers = headers;
+        }
+        // 締め切りがある場合は、転送も締め切りまでに打ち切る
+        if (engine->deadline_ms > 0) {
+            long long remaining = engine->deadline_ms - monotonic_ms();
+            curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, remaining > 1 ? (long)remaining : 1L);
+        }
+
+        // 本文はバッチでも1件でもスロットのバッファに書き出してある
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, slot->body.data);
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)slot->body.len);
+
+        CURLMcode mres = curl_multi_add_handle(engine->multi, curl);
+        if (mres != CURLM_OK) {
+            error = curl_multi_strerror(mres);
+        }
+    }
+    if (error != NULL) {
+        return error;
+    }
+
+    slot->busy = 1;
+    slot->started_ms = monotonic_ms();
+    if (slot->hedge) {
+        engine->hedging++;
+    } else {
+        engine->in_flight++;
+    }
+    engine->requests++;
+    atomic_fetch_add_explicit(&g_metrics.in_flight, 1, memory_order_relaxed);
+    return NULL;
+}
+
+/**
+ * 空いているスロットを探す関数
+ *
+ * @param engine 並行インポートエンジン
+ * @return 空いているスロット（ない場合はNULL）
+ */
+static struct import_slot* import_engine_idle_slot(struct import_engine* engine) {
+    for (int i = 0; i < engine->slot_count; i++) {
+        if (!engine->slots[i].busy) {
+            return &engine->slots[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * 送信待ちのイベントを空いているスロットで送信する関数
+ * 開始できなかったイベントは失敗として数える（一時的なエラーの場合は再送待ちに登録する）。
+ *
+ * @param engine 並行インポートエンジン
+ */
+static void import_engine_flush(struct import_engine* engine) {
+    struct import_slot* slot = import_engine_idle_slot(engine);
+
+    memcpy(slot->items, engine->pending, engine->pending_count * sizeof(struct import_item));
+    slot->item_count = engine->pending_count;
+    slot->twin = NULL;
+    slot->hedge = 0;
+    engine->pending_count = 0;
+
+    int transient;
+    const char* error = import_engine_send(engine, slot, &transient);
+    if (error != NULL) {
+        for (int i = 0; i < slot->item_count; i++) {
+            import_engine_report(engine, slot, &slot->items[i], 0, error, transient, NULL, -1);
+            json_object_put(slot->items[i].event);
+        }
+        slot->item_count = 0;
+    }
+}
+
+/**
+ * 転送に使ったスロットを空きに戻す関数
+ *
+ * @param engine 並行インポートエンジン
+ * @param slot 対象のスロット（イベントの参照もここで解放する）
+ */
+static void import_engine_release(struct import_engine* engine, struct import_slot* slot) {
+    curl_multi_remove_handle(engine->multi, slot->curl);
+    for (int i = 0; i < slot->item_count; i++) {
+        json_object_put(slot->items[i].event);
+    }
+    if (slot->hedge) {
+        engine->hedging--;
+    } else {
+        engine->in_flight--;
+    }
+    slot->item_count = 0;
+    slot->busy = 0;
+    slot->twin = NULL;
+    slot->hedge = 0;
+    slot->hedged = 0;
+    atomic_fetch_sub_explicit(&g_metrics.in_flight, 1, memory_order_relaxed);
+}
+
+/**
+ * 直近の p95 を超えても応答のないリクエストを、空いているスロットで複製して送る関数
+ *
+ * 複製はイベントに決まったIDが付いている場合だけ送る。同じIDのイベントは1件しか作られないため、
+ * 両方がサーバーに届いても重複せず、遅れて届いた方は409になる。
+ * 複製は予備のスロットで送り、数は送信したリクエストの HEDGE_BUDGET_PERCENT % までに抑える。
+ * レート制限で同時実行数を絞っている間は、サーバーの負荷を増やさないよう複製しない。
+ *
+ * @param engine 並行インポートエンジン
+ * @param now 現在時刻（monotonic_ms() の値）
+ * @return 次に確認すべきまでのミリ秒（確認が不要な場合は-1）
+ */
+static long import_engine_hedge(struct import_engine* engine, long long now) {
+    if (!engine->hedge || engine->latency.count < HEDGE_MIN_SAMPLES || engine->deadline_reached) {
+        return -1;
+    }
+    long threshold = engine->latency.p95_ms > 0 ? engine->latency.p95_ms : 1;
+    long wait = -1;
+
+    for (int i = 0; i < engine->slot_count; i++) {
+        struct import_slot* slot = &engine->slots[i];
+        if (!slot->busy || slot->twin != NULL || slot->hedge) {
+            continue;
+        }
+        long long due = slot->started_ms + threshold;
+        if (due > now) {
+            if (wait < 0 || due - now < wait) {
+                wait = (long)(due - now);
+            }
+            continue;
+        }
+        if ((engine->hedges + 1) * 100 > engine->requests * HEDGE_BUDGET_PERCENT ||
+            engine->hedging >= engine->hedge_slots ||
+            rate_controller_limit(&engine->rate, now) < engine->concurrency) {
+            // 枠が空くのは転送の完了時なので、ここでは待ち時間を返さない
+            break;
+        }
+        int has_ids = 1;
+        for (int j = 0; j < slot->item_count && has_ids; j++) {
+            has_ids = json_object_object_get_ex(slot->items[j].event, "id", NULL);
+        }
+        struct import_slot* copy = has_ids ? import_engine_idle_slot(engine) : NULL;
+        if (copy == NULL) {
+            continue;
+        }
+
+        memcpy(copy->items, slot->items, slot->item_count * sizeof(struct import_item));
+        copy->item_count = slot->item_count;
+        copy->hedge = 1;
+        for (int j = 0; j < copy->item_count; j++) {
+            json_object_get(copy->items[j].event);
+        }
+        int transient;
+        if (import_engine_send(engine, copy, &transient) != NULL) {
+            for (int j = 0; j < copy->item_count; j++) {
+                json_object_put(copy->items[j].event);
+            }
+            copy->item_count = 0;
+            copy->hedge = 0;
+            break;
+        }
+        copy->twin = slot;
+        slot->twin = copy;
+        copy->hedged = 1;
+        slot->hedged = 1;
+        engine->hedges++;
+        atomic_fetch_add_explicit(&g_metrics.hedges_sent, 1, memory_order_relaxed);
+    }
+    return wait;
+}
+
+/**
+ * 行の終わりを探し、次の行の先頭を返す関数（CRLFとLFの両方に対応）
+ *
+ * @param p 行の先頭
+ * @param end 探索範囲の終端
+ * @param line_end 行末（改行文字の直前）を受け取るポインタ
+ * @return 次の行の先頭
+ */
+static const char* next_line(const char* p, const char* end, const char** line_end) {
+    const char* nl = memchr(p, '\n', end - p);
+    if (nl == NULL) {
+        *line_end = end;
+        return end;
+    }
+    *line_end = (nl > p && nl[-1] == '\r') ? nl - 1 : nl;
+    return nl + 1;
+}
+
+/**
+ * バッチレスポンス（multipart/mixed）を解析し、各パートの結果を対応するイベントに報告する関数
+ * レスポンスに含まれなかったイベントは失敗として報告する
+ *
+ * @param engine 並行インポートエンジン
+ * @param slot 完了したスロット
+ */
+static void import_engine_finish_batch(struct import_engine* engine, struct import_slot* slot) {
+    int reported[MAX_BATCH_SIZE] = {0};
+    const char* content_type = NULL;
+    char delimiter[256];
+    size_t delimiter_len = 0;
+
+    curl_easy_getinfo(slot->curl, CURLINFO_CONTENT_TYPE, &content_type);
+    const char* boundary = content_type ? strstr(content_type, "boundary=") : NULL;
+    if (boundary != NULL) {
+        boundary += strlen("boundary=");
+        if (*boundary == '"') {
+            boundary++;
+        }
+        size_t boundary_len = strcspn(boundary, "\"; \t\r\n");
+        if (boundary_len > 0 && boundary_len + 2 < sizeof(delimiter)) {
+            delimiter_len = (size_t)snprintf(delimiter, sizeof(delimiter), "--%.*s", (int)boundary_len, boundary);
+        }
+    }
+
+    const char* end = slot->response.memory + slot->response.size;
+    const char* p = delimiter_len ? memmem(slot->response.memory, slot->response.size, delimiter, delimiter_len) : NULL;
+
+    while (p != NULL) {
+        p += delimiter_len;
+        if (end - p >= 2 && p[0] == '-' && p[1] == '-') {
+            break;  // 終端の区切り
+        }
+        const char* line_end;
+        p = next_line(p, end, &line_end);
+
+        const char* part_end = memmem(p, end - p, delimiter, delimiter_len);
+        if (part_end == NULL) {
+            part_end = end;
+        }
+
+        // パートのヘッダーから Content-ID: <response-item-N> を取り出す
+        int index = 0;
+        long retry_after = -1;
+        while (p < part_end) {
+            const char* line = p;
+            p = next_line(p, part_end, &line_end);
+            if (line_end == line) {
+                break;
+            }
+            if ((size_t)(line_end - line) > 11 && strncasecmp(line, "Content-ID:", 11) == 0) {
+                const char* q = line_end;
+                while (q > line && !isdigit((unsigned char)q[-1])) {
+                    q--;
+                }
+                while (q > line && isdigit((unsigned char)q[-1])) {
+                    q--;
+                }
+                index = atoi(q);
+            }
+        }
+
+        // 埋め込まれたHTTPレスポンスのステータス行とヘッダーを読み飛ばす
+        long http_status = 0;
+        const char* status_line = p;
+        p = next_line(p, part_end, &line_end);
+        if (line_end - status_line > 5 && strncmp(status_line, "HTTP/", 5) == 0) {
+            const char* sp = memchr(status_line, ' ', line_end - status_line);
+            if (sp != NULL) {
+                http_status = strtol(sp + 1, NULL, 10);
+            }
+        }
+        while (p < part_end) {
+            const char* line = p;
+            p = next_line(p, part_end, &line_end);
+            if (line_end == line) {
+                break;
+            }
+            if ((size_t)(line_end - line) > 12 && strncasecmp(line, "Retry-After:", 12) == 0) {
+                retry_after = strtol(line + 12, NULL, 10);
+            }
+        }
+
+        const char* body_end = part_end;
+        while (body_end > p && (body_end[-1] == '\r' || body_end[-1] == '\n')) {
+            body_end--;
+        }
+
+        if (index >= 1 && index <= slot->item_count && !reported[index - 1]) {
+            struct api_response response;
+            api_response_parse(&response, p, (size_t)(body_end - p));
+            reported[index - 1] = 1;
+            import_engine_report(engine, slot, &slot->items[index - 1], http_status, NULL, 0, &response, retry_after);
+        }
+
+        p = (part_end < end) ? part_end : NULL;
+    }
+
+    for (int i = 0; i < slot->item_count; i++) {
+        if (!reported[i]) {
+            import_engine_report(engine, slot, &slot->items[i], 0, "バッチレスポンスに結果が含まれていません", 1, NULL, -1);
+        }
+    }
+}
+
+/**
+ * 完了した転送の結果を報告し、スロットを解放する関数
+ *
+ * @param engine 並行インポートエンジン
+ * @param msg curl_multi_info_read() が返した完了メッセージ
+ */
+static void import_engine_finish(struct import_engine* engine, CURLMsg* msg) {
+    struct import_slot* slot = NULL;
+    curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&slot);
+
+    long http_status = 0;
+    curl_off_t retry_after = -1;
+    curl_easy_getinfo(msg->easy_handle, CURLINFO_RESPONSE_CODE, &http_status);
+    curl_easy_getinfo(msg->easy_handle, CURLINFO_RETRY_AFTER, &retry_after);
+
+    net_stats_record(slot->batched ? NET_REQUEST_BATCH : NET_REQUEST_IMPORT, msg->easy_handle, msg->data.result);
+    int ok = (msg->data.result == CURLE_OK && ((http_status >= 200 && http_status < 300) || http_status == 409));
+    if (ok) {
+        latency_window_record(&engine->latency, (long)(monotonic_ms() - slot->started_ms));
+    }
+
+    struct import_slot* twin = slot->twin;
+    if (twin != NULL) {
+        if (!ok) {
+            // もう一方の転送がまだ続いているため、結果はそちらに任せる
+            twin->twin = NULL;
+            import_engine_release(engine, slot);
+            return;
+        }
+        // 先に成功した方を採用し、もう一方は取り消す
+        import_engine_release(engine, twin);
+        if (slot->hedge) {
+            engine->hedge_wins++;
+            atomic_fetch_add_explicit(&g_metrics.hedges_won, 1, memory_order_relaxed);
+        }
+    }
+
+    if (msg->data.result != CURLE_OK || !slot->batched || http_status < 200 || http_status >= 300) {
+        // 転送エラーやバッチ全体のエラーは、含まれるすべてのイベントに同じ結果を報告する
+        const char* error = (msg->data.result != CURLE_OK) ? curl_easy_strerror(msg->data.result) : NULL;
+        int transient = is_retryable_transfer_error(msg->data.result);
+        struct api_response batch_response;
+        const struct api_response* response = &slot->parser.result;
+        if (slot->batched) {
+            api_response_parse(&batch_response, slot->response.memory, slot->response.size);
+            response = &batch_response;
+        }
+        for (int i = 0; i < slot->item_count; i++) {
+            import_engine_report(engine, slot, &slot->items[i], http_status, error, transient, response, (long)retry_after);
+        }
+    } else {
+        import_engine_finish_batch(engine, slot);
+    }
+
+    if (engine->on_transfer) {
+        curl_off_t total_us = 0;
+        curl_easy_getinfo(msg->easy_handle, CURLINFO_TOTAL_TIME_T, &total_us);
+        engine->on_transfer(engine->on_transfer_arg, msg->easy_handle, slot->item_count, (long long)total_us);
+    }
+
+    import_engine_release(engine, slot);
+}
+
+/**
+ * 一括インポートの入力
+ * JSONL と iCalendar のどちらか一方のリーダーを持つ
+ */
+struct import_source {
+    const char* path;               // 報告用の入力ファイルパス
+    struct jsonl_reader* jsonl;     // JSONL 入力の場合のリーダー
+    struct ics_reader* ics;         // iCalendar 入力の場合のリーダー
+};
+
+/**
+ * JSONL 入力から次のイベントを取り出す関数
+ * 再開時は、ウォーターマークより前で失敗したイベントを先に読み直し、その後ウォーターマークから読み進める。
+ * 成功がジャーナルに記録済みのイベントは、解析も送信もせずに読み飛ばす。
+ *
+ * @param engine 並行インポートエンジン
+ * @param reader JSONLリーダー
+ * @param item 取り出したイベントを受け取る構造体
+ * @return jsonl_reader_next() と同じ（不正な行の場合も item に位置を設定する）
+ */
+static int import_engine_next_jsonl(struct import_engine* engine, struct jsonl_reader* reader, struct import_item* item) {
+    struct import_resume* resume = engine->resume;
+    int retrying = 0;
+
+    memset(item, 0, sizeof(*item));
+    if (resume != NULL && resume->retry_next < resume->retry_count) {
+        const struct journal_entry* entry = &resume->retry[resume->retry_next++];
+        if (jsonl_reader_seek(reader, entry->offset, entry->line) != 0) {
+            return -2;
+        }
+        resume->retried++;
+        atomic_fetch_add_explicit(&g_metrics.retries, 1, memory_order_relaxed);
+        retrying = 1;
+    } else if (resume != NULL) {
+        if (!resume->seeked) {
+            if (jsonl_reader_seek(reader, resume->watermark, resume->watermark_line) != 0) {
+                return -2;
+            }
+            resume->seeked = 1;
+        }
+        while (jsonl_reader_skip_space(reader) == 1) {
+            const struct journal_entry* entry =
+                journal_index_find(&resume->confirmed, reader->base_offset + reader->pos);
+            if (entry == NULL) {
+                break;
+            }
+            if (jsonl_reader_seek(reader, entry->end, entry->end_line) != 0) {
+                return -2;
+            }
+            resume->skipped++;
+        }
+    }
+
+    int status = jsonl_reader_next(reader, &item->event);
+    if (status == 1 || status == -1) {
+        item->line = reader->value_line;
+        item->offset = reader->value_offset;
+        item->end = reader->base_offset + reader->pos;
+        item->end_line = reader->line;
+    }
+    if (retrying && (status == 0 || status == 2)) {
+        fprintf(stderr, "エラー: ジャーナルの記録が入力ファイル %s の内容と一致しません\n", reader->path);
+        return -2;
+    }
+    if (status == 1 && !retrying && engine->journal != NULL &&
+        settle_queue_push(&engine->settled, item) != 0) {
+        json_object_put(item->event);
+        return -2;
+    }
+    return status;
+}
+
+/**
+ * iCalendar 入力から次のイベントを取り出す関数
+ * VEVENT はすべて変換されるため、再開時は変換後に記録済みのものを送信せずに捨てる。
+ *
+ * @param engine 並行インポートエンジン
+ * @param reader iCalendar リーダー
+ * @param item 取り出したイベントを受け取る構造体
+ * @return ics_reader_next() と同じ（変換できなかった場合も item に位置を設定する）
+ */
+static int import_engine_next_ics(struct import_engine* engine, struct ics_reader* reader, struct import_item* item) {
+    struct import_resume* resume = engine->resume;
+    for (;;) {
+        unsigned long long offset[2];
+        unsigned long line[2];
+        memset(item, 0, sizeof(*item));
+        int status = ics_reader_next(reader, &item->event, offset, line);
+        if (status == 0) {
+            return 0;
+        }
+        item->offset = offset[0];
+        item->end = offset[1];
+        item->line = line[0];
+        item->end_line = line[1];
+
+        int retrying = 0;
+        if (resume != NULL) {
+            resume->seeked = 1;
+            int skip;
+            if (item->offset < resume->watermark) {
+                struct journal_entry key = { .offset = item->offset };
+                retrying = bsearch(&key, resume->retry, resume->retry_count, sizeof(struct journal_entry),
+                                   journal_entry_compare) != NULL;
+                skip = !retrying;
+            } else {
+                skip = journal_index_find(&resume->confirmed, item->offset) != NULL;
+            }
+            if (skip) {
+                json_object_put(item->event);
+                resume->skipped++;
+                continue;
+            }
+            resume->retried += retrying;
+            atomic_fetch_add_explicit(&g_metrics.retries, (unsigned long)retrying, memory_order_relaxed);
+        }
+
+        if (status == 1 && !retrying && engine->journal != NULL &&
+            settle_queue_push(&engine->settled, item) != 0) {
+            json_object_put(item->event);
+            return -2;
+        }
+        return status;
+    }
+}
+
+/**
+ * 入力から次のイベントを取り出す関数
+ *
+ * @param engine 並行インポートエンジン
+ * @param source 入力
+ * @param item 取り出したイベントを受け取る構造体
+ * @return 取り出せた場合は1、EOFの場合は0、そのイベントが不正な場合は-1、読み取りエラーの場合は-2、
+ *         非ブロッキング入力でデータがまだ届いていない場合は2
+ */
+static int import_engine_next(struct import_engine* engine, struct import_source* source, struct import_item* item) {
+    if (source->ics != NULL) {
+        return import_engine_next_ics(engine, source->ics, item);
+    }
+    return import_engine_next_jsonl(engine, source->jsonl, item);
+}
+
+/**
+ * 現在のウォーターマーク（ここより前のイベントはすべて結果が確定している位置）を求める関数
+ *
+ * @param engine 並行インポートエンジン
+ * @param source 入力
+ * @param line ウォーターマークの位置の行番号を受け取るポインタ
+ * @return ウォーターマークのバイトオフセット
+ */
+static unsigned long long import_engine_watermark(const struct import_engine* engine,
+                                                  const struct import_source* source, unsigned long* line) {
+    const struct settle_queue* queue = &engine->settled;
+    if (queue->count > 0) {
+        *line = queue->entries[queue->head].line;
+        return queue->entries[queue->head].offset;
+    }
+    if (engine->resume != NULL && !engine->resume->seeked) {
+        *line = engine->resume->watermark_line;
+        return engine->resume->watermark;
+    }
+    if (source->ics != NULL) {
+        *line = source->ics->next_line;
+        return source->ics->next_offset;
+    }
+    const struct jsonl_reader* reader = source->jsonl;
+    if (reader->in_value || reader->skipping) {
+        *line = reader->value_line;
+        return reader->value_offset;
+    }
+    *line = reader->line;
+    return reader->base_offset + reader->pos;
+}
+
+/**
+ * 溜まったジャーナルのレコードを、グループコミットの条件を満たしていれば書き込む関数
+ *
+ * @param engine 並行インポートエンジン
+ * @param source 入力
+ * @param force 条件にかかわらず書き込むかどうか
+ */
+static void import_engine_sync_journal(struct import_engine* engine, const struct import_source* source, int force) {
+    if (engine->journal == NULL) {
+        return;
+    }
+    if (!force && import_journal_due(engine->journal, monotonic_ms()) != 0) {
+        return;
+    }
+    unsigned long line;
+    unsigned long long watermark = import_engine_watermark(engine, source, &line);
+    if (import_journal_sync(engine->journal, watermark, line) != 0) {
+        fprintf(stderr, "エラー: ジャーナル %s への記録を中止します\n", engine->journal->path);
+        engine->journal = NULL;
+    }
+}
+
+/**
+ * 入力からイベントを読み出し、並行してインポートする関数
+ * 転送中のリクエストが concurrency 件になるまで新しいイベントを投入し、
+ * 完了したものから順に結果を報告する。
+ * バッチモードでは batch_size 件溜まるか batch_flush_ms が経過した時点でまとめて送信する。
+ *
+ * @param engine 並行インポートエンジン
+ * @param source 入力
+ * @return 入力を最後まで読めた場合は0、読み取りエラーの場合は-1
+ */
+int import_engine_run(struct import_engine* engine, struct import_source* source) {
+    int input_done = 0;
+    int read_error = 0;
+
+    engine->input_path = source->path;
+
+    for (;;) {
+        int input_waiting = 0;
+
+        // 締め切りを過ぎたら入力の読み取りと再送をやめ、送信中の転送の完了だけを待つ
+        if (engine->deadline_ms > 0 && !engine->deadline_reached && monotonic_ms() >= engine->deadline_ms) {
+            struct import_item item;
+            engine->deadline_reached = 1;
+            input_done = 1;
+            fprintf(stderr, "エラー: 締め切りに達したため、%s の残りのイベントの送信を中止します\n", engine->input_path);
+            retry_wheel_flush(&engine->retries);
+            while (retry_wheel_pop(&engine->retries, &item)) {
+                import_engine_expire(engine, &item);
+            }
+            for (int i = 0; i < engine->pending_count; i++) {
+                import_engine_expire(engine, &engine->pending[i]);
+            }
+            engine->pending_count = 0;
+        }
+        retry_wheel_advance(&engine->retries, monotonic_ms());
+
+        while (engine->in_flight < rate_controller_limit(&engine->rate, monotonic_ms())) {
+            struct import_item item;
+            int status;
+            // 再送の期限を迎えたイベントは、新しい入力より先に送信する
+            if (retry_wheel_pop(&engine->retries, &item)) {
+                status = 1;
+            } else if (input_done) {
+                break;
+            } else {
+                status = import_engine_next(engine, source, &item);
+                if (status == 1) {
+                    atomic_fetch_add_explicit(&g_metrics.events_attempted, 1, memory_order_relaxed);
+                    // 再送やヘッジで同じイベントが二重に作られないよう、iCalUID から決まるIDを付ける
+                    if (engine->event_ids && event_assign_id(item.event, engine->config->calendar_id) < 0) {
+                        fprintf(stderr, "エラー: %s:%lu 行目: イベントIDの設定に失敗しました\n",
+                                engine->input_path, item.line);
+                        json_object_put(item.event);
+                        item.event = NULL;
+                        status = -1;
+                    } else if (engine->index != NULL && import_engine_unchanged(engine, &item)) {
+                        continue;
+                    }
+                }
+            }
+            if (status == 2) {
+                input_waiting = 1;
+                break;
+            }
+            if (status == -1) {
+                engine->failed++;
+                atomic_fetch_add_explicit(&g_metrics.events_attempted, 1, memory_order_relaxed);
+                metrics_count_failure(IMPORT_FAILURE_INVALID_INPUT);
+                import_engine_settle(engine, &item, 0, 0, NULL);
+                continue;
+            }
+            if (status != 1) {
+                read_error = (status == -2);
+                input_done = 1;
+                break;
+            }
+
+            if (engine->pending_count == 0) {
+                engine->pending_since = monotonic_ms();
+            }
+            engine->pending[engine->pending_count++] = item;
+            if (engine->pending_count == engine->batch_size) {
+                import_engine_flush(engine);
+            }
+        }
+
+        // バッチが満たない場合でも、入力の終わりか待ち時間の上限で送信する
+        long wait_ms = 1000;
+        long long now = monotonic_ms();
+        if (engine->pending_count > 0) {
+            long long elapsed = now - engine->pending_since;
+            if (input_done || elapsed >= engine->batch_flush_ms) {
+                if (engine->in_flight < rate_controller_limit(&engine->rate, now)) {
+                    import_engine_flush(engine);
+                }
+            } else {
+                wait_ms = (long)(engine->batch_flush_ms - elapsed);
+            }
+        }
+        // Retry-After による停止中は、停止が明けた時点で送信を再開する
+        if (now < engine->rate.paused_until_ms && engine->rate.paused_until_ms - now < wait_ms) {
+            wait_ms = (long)(engine->rate.paused_until_ms - now);
+        }
+        // ジャーナルはグループコミットの期限までに書き込む
+        long journal_due = engine->journal ? import_journal_due(engine->journal, now) : -1;
+        if (journal_due >= 0 && journal_due < wait_ms) {
+            wait_ms = journal_due;
+        }
+        // 再送待ちのイベントは期限を迎えたら送信し、締め切りを過ぎたら打ち切る
+        long retry_due = retry_wheel_timeout(&engine->retries, now);
+        if (retry_due >= 0 && retry_due < wait_ms) {
+            wait_ms = retry_due;
+        }
+        if (engine->deadline_ms > 0 && !engine->deadline_reached && engine->deadline_ms - now < wait_ms) {
+            wait_ms = engine->deadline_ms > now ? (long)(engine->deadline_ms - now) : 0;
+        }
+        // p95 を超えて応答のないリクエストは複製して送る
+        long hedge_due = import_engine_hedge(engine, now);
+        if (hedge_due >= 0 && hedge_due < wait_ms) {
+            wait_ms = hedge_due;
+        }
+
+        if (input_done && engine->in_flight == 0 && engine->hedging == 0 && engine->pending_count == 0 &&
+            engine->retries.waiting == 0 && engine->retries.ready == 0) {
+            import_engine_sync_journal(engine, source, 1);
+            break;
+        }
+
+        int running = 0;
+        CURLMcode mres = curl_multi_perform(engine->multi, &running);
+        // 応答の速いサーバーでは送信と同じ呼び出しの中で転送が終わることがあるため、
+        // その場合は待たずに完了を処理する
+        if (running < engine->in_flight + engine->hedging) {
+            wait_ms = 0;
+        }
+        if (mres == CURLM_OK) {
+            // 入力待ちの場合は入力ファイルディスクリプタも一緒に監視する
+            struct curl_waitfd input_fd = { source->jsonl ? source->jsonl->fd : -1, CURL_WAIT_POLLIN, 0 };
+            mres = curl_multi_poll(engine->multi, input_waiting ? &input_fd : NULL,
+                                   input_waiting ? 1 : 0, (int)wait_ms, NULL);
+        }
+        if (mres != CURLM_OK) {
+            fprintf(stderr, "エラー: curl_multi の処理に失敗しました: %s\n", curl_multi_strerror(mres));
+            import_engine_sync_journal(engine, source, 1);
+            return -1;
+        }
+        curl_multi_perform(engine->multi, &running);
+
+        CURLMsg* msg;
+        int msgs_left;
+        while ((msg = curl_multi_info_read(engine->multi, &msgs_left)) != NULL) {
+            if (msg->msg == CURLMSG_DONE) {
+                import_engine_finish(engine, msg);
+            }
+        }
+        import_engine_sync_journal(engine, source, 0);
+    }
+
+    return read_error ? -1 : 0;
+}
+
+/**
+ * 入力ファイルを形式に応じたリーダーで開く関数
+ * 拡張子が .ics の場合は iCalendar、それ以外は JSONL として扱う
+ *
+ * @param source 初期化する入力
+ * @param path 入力ファイルのパス
+ * @param jsonl JSONL の場合に使うリーダー
+ * @param ics iCalendar の場合に使うリーダー
+ * @return 成功時は0、失敗時は-1
+ */
+int import_source_open(struct import_source* source, const char* path,
+                       struct jsonl_reader* jsonl, struct ics_reader* ics) {
+    size_t len = strlen(path);
+    memset(source, 0, sizeof(*source));
+    source->path = path;
+    if (len > 4 && strcasecmp(path + len - 4, ".ics") == 0) {
+        if (ics_reader_open(ics, path) != 0) {
+            return -1;
+        }
+        source->ics = ics;
+    } else {
+        if (jsonl_reader_open(jsonl, path) != 0) {
+            return -1;
+        }
+        source->jsonl = jsonl;
+    }
+    return 0;
+}
+
+/**
+ * 入力を閉じる関数
+ *
+ * @param source 閉じる入力
+ */
+void import_source_close(struct import_source* source) {
+    if (source->ics != NULL) {
+        ics_reader_close(source->ics);
+    }
+    if (source->jsonl != NULL) {
+        jsonl_reader_close(source->jsonl);
+    }
+}
+
+/**
+ * ファイルからイベントを一括インポートする関数
+ * JSONL は1イベントずつストリーム処理され、全体がメモリに読み込まれることはない。
+ * iCalendar は mmap したファイルを複数のスレッドで並列に変換しながら送信する。
+ *
+ * @param config 使用する設定
+ * @param input_path 入力ファイルのパス（JSONL の場合は "-" で標準入力）
+ * @param journal_path 結果を記録するジャーナルのパス（記録しない場合はNULL）
+ * @param index_path 重複検出インデックスのパス（使わない場合はNULL）
+ * @param resume ジャーナルをもとに前回の続きから再開するかどうか
+ * @param deadline_ms 締め切りの時刻（monotonic_ms() の値、締め切りがない場合は0）
+ * @return すべて成功した場合は0、失敗したイベントがあった場合や締め切りで打ち切った場合は-1
+ */
+int import_events_from_file(const struct app_config* config, const char* input_path,
+                            const char* journal_path, const char* index_path, int resume, long long deadline_ms) {
+    struct import_resume resume_state;
+    int resume_loaded = 0;
+    if (resume) {
+        resume_loaded = import_resume_load(journal_path, input_path, &resume_state);
+        if (resume_loaded < 0) {
+            return -1;
+        }
+        if (resume_loaded == 0) {
+            printf("ジャーナル %s がないため、最初からインポートします\n", journal_path);
+        }
+    }
+
+    struct jsonl_reader jsonl;
+    struct ics_reader ics;
+    struct import_source source;
+    if (import_source_open(&source, input_path, &jsonl, &ics) != 0) {
+        if (resume_loaded) {
+            import_resume_free(&resume_state);
+        }
+        return -1;
+    }
+
+    struct import_engine engine;
+    if (import_engine_init(&engine, config) != 0) {
+        import_source_close(&source);
+        if (resume_loaded) {
+            import_resume_free(&resume_state);
+        }
+        return -1;
+    }
+
+    struct import_journal journal;
+    if (journal_path != NULL) {
+        if (import_journal_open(&journal, journal_path, input_path, resume_loaded ? &resume_state : NULL) != 0) {
+            import_engine_cleanup(&engine);
+            import_source_close(&source);
+            if (resume_loaded) {
+                import_resume_free(&resume_state);
+            }
+            return -1;
+        }
+        engine.journal = &journal;
+        engine.resume = resume_loaded ? &resume_state : NULL;
+    }
+    struct dedup_index index;
+    if (index_path != NULL) {
+        if (dedup_index_open(&index, index_path) != 0) {
+            if (journal_path != NULL) {
+                import_journal_close(&journal);
+            }
+            import_engine_cleanup(&engine);
+            import_source_close(&source);
+            if (resume_loaded) {
+                import_resume_free(&resume_state);
+            }
+            return -1;
+        }
+        engine.index = &index;
+        printf("重複検出インデックス %s: %llu 件を登録済み\n", index_path, (unsigned long long)index.header->count);
+    }
+    engine.deadline_ms = deadline_ms;
+
+    unsigned long allocations_before = atomic_load(&g_response_allocations);
+    unsigned long chunks_before = atomic_load(&g_arena_chunk_allocations);
+    int status = import_engine_run(&engine, &source);
+    unsigned long failed = engine.failed;
+    int deadline_reached = engine.deadline_reached;
+    const struct rate_controller* rate = &engine.rate;
+    unsigned long allocations = atomic_load(&g_response_allocations) - allocations_before;
+    unsigned long chunks = atomic_load(&g_arena_chunk_allocations) - chunks_before;
+    unsigned long events = engine.succeeded + engine.failed;
+
+    printf("\n一括インポート結果: 成功 %lu 件 / 失敗 %lu 件（HTTPリクエスト %lu 回、再送 %lu 回）\n",
+           engine.succeeded, engine.failed, engine.requests, engine.retried);
+    if (index_path != NULL) {
+        printf("変更がないため送信しなかったイベント: %lu 件（インデックスに記録 %lu 件）\n",
+               engine.skipped, index.updates);
+    }
+    if (engine.duplicates > 0) {
+        printf("登録済み（HTTP 409）として成功扱いにしたイベント: %lu 件\n", engine.duplicates);
+    }
+    if (engine.conflicts > 0) {
+        printf("この実行の前から登録済み（HTTP 409）のため失敗にしたイベント: %lu 件\n", engine.conflicts);
+    }
+    if (engine.hedge) {
+        printf("ヘッジ: 複製 %lu 回 / 複製が先に応答 %lu 回（しきい値 p95 %ld ミリ秒）\n",
+               engine.hedges, engine.hedge_wins, engine.latency.p95_ms);
+    }
+    if (engine.deadline_reached) {
+        printf("締め切りに達したため、入力の途中で終了しました%s\n",
+               journal_path != NULL ? "（--resume で続きから再開できます）" : "");
+    }
+    printf("同時実行ウィンドウ: 終了時 %.1f / 最小 %.1f / 最大 %.1f（上限 %d%s）\n",
+           rate->window, rate->min_seen, rate->max_seen, engine.concurrency, rate->adaptive ? "" : "、固定");
+    printf("レート制限: 応答 %lu 回 / ウィンドウ縮小 %lu 回 / Retry-After による停止 %lu 回（合計 %.1f 秒）\n",
+           rate->rate_limited, rate->decreases, rate->pauses, rate->paused_total_ms / 1000.0);
+    printf("レスポンスバッファ: 確保・拡張 %lu 回（1イベントあたり %.3f 回、スロットごとの初期確保を除く）\n",
+           allocations, events ? (double)allocations / events : 0.0);
+    printf("リクエスト用アリーナ: チャンク確保 %lu 回（HTTPリクエスト %lu 回に対して）\n", chunks, engine.requests);
+    if (journal_path != NULL) {
+        printf("ジャーナル: 記録 %lu 件 / 同期 %lu 回 / 記録済みで読み飛ばし %lu 件 / 失敗分の再送 %lu 件\n",
+               journal.records, journal.syncs, resume_loaded ? resume_state.skipped : 0,
+               resume_loaded ? resume_state.retried : 0);
+        import_journal_close(&journal);
+    }
+    if (index_path != NULL) {
+        dedup_index_close(&index);
+    }
+
+    import_engine_cleanup(&engine);
+    import_source_close(&source);
+    if (resume_loaded) {
+        import_resume_free(&resume_state);
+    }
+    return (status == 0 && failed == 0 && !deadline_reached) ? 0 : -1;
+}
+
+/**
+ * events.list の1ページ
+ */
+struct sync_page {
+    struct json_object* body;       // 解析したレスポンス
+    struct sync_page* next;
+};
+
+/**
+ * events.list のページを先読みするスレッドの状態
+ *
+ * ページの取得と解析は別のスレッドで行い、メインスレッドが前のページを状態に反映している間に
+ * 次のページを取得しておく。次のページの要求には前のページの nextPageToken が必要なため、
+ * 取得自体は1ページずつ順に行い、先読みは SYNC_PREFETCH_PAGES ページまでとする。
+ */
+struct sync_fetcher {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    struct sync_page* head;         // 取得済みで未処理のページ（取得順）
+    struct sync_page* tail;
+    int queued;                     // 未処理のページ数
+    int done;                       // 最後のページまで取得したか、取得に失敗したか
+    int stop;                       // 取得の中止を求められたか
+    int failed;                     // 取得に失敗したか
+    long http_status;               // 失敗した場合のHTTPステータス（410は完全な同期が必要）
+    const struct request_template* tmpl;
+    const char* sync_token;         // 差分を取得する場合の同期トークン（完全な同期の場合はNULL）
+    int max_retries;                // 一時的なエラーで失敗したページを取得し直す最大回数
+    char next_sync_token[1024];     // 最後のページの nextSyncToken
+    unsigned long pages;            // 取得したページ数
+};
+
+/**
+ * events.list の1ページを取得して解析する関数
+ * 一時的なエラーの場合は、バックオフしながら max_retries 回まで再送する
+ *
+ * @param fetcher 先読みの状態
+ * @param headers アクセストークンを含むヘッダーリスト
+ * @param response レスポンスの受信バッファ
+ * @param page_token 取得するページ（最初のページの場合は空文字列）
+ * @return 解析したレスポンス、失敗時はNULL（fetcher->http_status に最後のステータスを設定する）
+ */
+static struct json_object* sync_fetch_page(struct sync_fetcher* fetcher, struct request_headers* headers,
+                                           struct MemoryStruct* response, const char* page_token) {
+    struct string_buffer url = {0};
+    struct json_object* body = NULL;
+    int max_retries = fetcher->max_retries;
+
+    for (int attempt = 0;; attempt++) {
+        CURL* curl = http_session_acquire();
+        if (curl == NULL) {
+            break;
+        }
+        if (request_headers_update(headers, fetcher->tmpl) != 0) {
+            fprintf(stderr, "エラー: 有効なアクセストークンの取得に失敗しました\n");
+            break;
+        }
+        char* sync_token = fetcher->sync_token ? curl_easy_escape(curl, fetcher->sync_token, 0) : NULL;
+        char* page = page_token[0] ? curl_easy_escape(curl, page_token, 0) : NULL;
+        url.len = 0;
+        int rc = string_buffer_appendf(&url, "%s?maxResults=%d&showDeleted=true%s%s%s%s", fetcher->tmpl->list_url,
+                                       SYNC_PAGE_SIZE, sync_token ? "&syncToken=" : "", sync_token ? sync_token : "",
+                                       page ? "&pageToken=" : "", page ? page : "");
+        curl_free(sync_token);
+        curl_free(page);
+        if (rc != 0) {
+            fprintf(stderr, "エラー: URLの生成に失敗しました\n");
+            break;
+        }
+
+        memory_struct_reset(response);
+        curl_easy_setopt(curl, CURLOPT_URL, url.data);
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers->single);
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)response);
+        curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
+
+        CURLcode res = curl_easy_perform(curl);
+        net_stats_record(NET_REQUEST_LIST, curl, res);
+        long http_status = 0;
+        curl_off_t retry_after = -1;
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_status);
+        curl_easy_getinfo(curl, CURLINFO_RETRY_AFTER, &retry_after);
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, NULL);
+        fetcher->http_status = http_status;
+
+        int retryable;
+        if (res != CURLE_OK) {
+            fprintf(stderr, "エラー: イベント一覧の取得に失敗しました: %s\n", curl_easy_strerror(res));
+            retryable = is_retryable_transfer_error(res);
+        } else if (http_status >= 200 && http_status < 300) {
+            body = json_tokener_parse(response->memory ? response->memory : "");
+            if (!json_object_is_type(body, json_type_object)) {
+                fprintf(stderr, "エラー: イベント一覧のレスポンスを解析できません\n");
+                json_object_put(body);
+                body = NULL;
+            }
+            break;
+        } else {
+            struct api_response parsed;
+            api_response_parse(&parsed, response->memory, response->size);
+            if (http_status == 410) {
+                break;  // 同期トークンが無効になった（呼び出し側で完全な同期をやり直す）
+            }
+            fprintf(stderr, "エラー: イベント一覧の取得に失敗しました (HTTP %ld%s%s): %s\n", http_status,
+                    parsed.reason[0] ? " " : "", parsed.reason, parsed.message[0] ? parsed.message : parsed.snippet);
+            retryable = is_retryable_response(http_status, parsed.reason);
+        }
+
+        if (!retryable || attempt >= max_retries) {
+            break;
+        }
+        long delay = retry_backoff_ms(attempt + 1, (long)retry_after);
+        fprintf(stderr, "%.1f 秒後に再送します（%d/%d 回目）\n", delay / 1000.0, attempt + 1, max_retries);
+        struct timespec wait = { delay / 1000, (delay % 1000) * 1000000L };
+        while (nanosleep(&wait, &wait) != 0 && errno == EINTR) {
+        }
+    }
+
+    free(url.data);
+    return body;
+}
+
+/**
+ * events.list のページを最後まで順に取得するスレッド
+ */
+static void* sync_fetcher_main(void* arg) {
+    struct sync_fetcher* fetcher = arg;
+    struct request_headers headers = {0};
+    struct MemoryStruct response;
+    char page_token[1024] = "";
+    int ok = (memory_struct_init(&response, MAX_RESPONSE_SIZE) == 0);
+
+    while (ok) {
+        struct json_object* body = sync_fetch_page(fetcher, &headers, &response, page_token);
+        struct sync_page* page = body ? malloc(sizeof(*page)) : NULL;
+        if (page == NULL) {
+            json_object_put(body);
+            ok = 0;
+            break;
+        }
+        page->body = body;
+        page->next = NULL;
+
+        struct json_object* token;
+        int last = !json_object_object_get_ex(body, "nextPageToken", &token);
+        if (!last) {
+            SAFE_STRCPY(page_token, json_object_get_string(token), sizeof(page_token));
+        }
+
+        pthread_mutex_lock(&fetcher->lock);
+        while (fetcher->queued >= SYNC_PREFETCH_PAGES && !fetcher->stop) {
+            pthread_cond_wait(&fetcher->changed, &fetcher->lock);
+        }
+        if (fetcher->stop) {
+            pthread_mutex_unlock(&fetcher->lock);
+            json_object_put(body);
+            free(page);
+            break;
+        }
+        if (last && json_object_object_get_ex(body, "nextSyncToken", &token)) {
+            SAFE_STRCPY(fetcher->next_sync_token, json_object_get_string(token), sizeof(fetcher->next_sync_token));
+        }
+        if (fetcher->tail) {
+            fetcher->tail->next = page;
+        } else {
+            fetcher->head = page;
+        }
+        fetcher->tail = page;
+        fetcher->queued++;
+        fetcher->pages++;
+        fetcher->done = last;
+        pthread_cond_broadcast(&fetcher->changed);
+        pthread_mutex_unlock(&fetcher->lock);
+        if (last) {
+            break;
+        }
+    }
+
+    pthread_mutex_lock(&fetcher->lock);
+    if (!ok) {
+        fetcher->failed = 1;
+    }
+    fetcher->done = 1;
+    pthread_cond_broadcast(&fetcher->changed);
+    pthread_mutex_unlock(&fetcher->lock);
+
+    arena_free(&headers.arena);
+    free(response.memory);
+    http_session_release_thread();
+    return NULL;
+}
+
+/**
+ * 取得済みの次のページを取り出す関数（まだ取得中の場合は待つ）
+ *
+ * @param fetcher 先読みの状態
+ * @return 次のページのレスポンス、最後のページまで取り出した場合や取得に失敗した場合はNULL
+ */
+static struct json_object* sync_fetcher_next(struct sync_fetcher* fetcher) {
+    pthread_mutex_lock(&fetcher->lock);
+    while (fetcher->head == NULL && !fetcher->done) {
+        pthread_cond_wait(&fetcher->changed, &fetcher->lock);
+    }
+    struct sync_page* page = fetcher->head;
+    if (page != NULL) {
+        fetcher->head = page->next;
+        if (fetcher->head == NULL) {
+            fetcher->tail = NULL;
+        }
+        fetcher->queued--;
+        pthread_cond_broadcast(&fetcher->changed);
+    }
+    pthread_mutex_unlock(&fetcher->lock);
+
+    struct json_object* body = page ? page->body : NULL;
+    free(page);
+    return body;
+}
+
+/**
+ * イベントIDからインデックスのキーを求める関数
+ * event_id_derive() で作ったIDは dedup_index_key() と同じハッシュの先頭を base32hex にしたものなので、
+ * 削除されたイベントのように iCalUID が返されない場合でもキーを復元できる
+ *
+ * @param id イベントID
+ * @param key キーを受け取るポインタ
+ * @return 復元できた場合は1、このツールが付けたIDでない場合は0
+ */
+static int event_id_key(const char* id, uint64_t* key) {
+    unsigned char bytes[EVENT_ID_LENGTH * 5 / 8];
+    if (strlen(id) != EVENT_ID_LENGTH) {
+        return 0;
+    }
+    uint32_t acc = 0;
+    int bits = 0;
+    size_t n = 0;
+    for (const char* p = id; *p; p++) {
+        int v;
+        if (*p >= '0' && *p <= '9') {
+            v = *p - '0';
+        } else if (*p >= 'a' && *p <= 'v') {
+            v = *p - 'a' + 10;
+        } else {
+            return 0;
+        }
+        acc = (acc << 5) | (uint32_t)v;
+        bits += 5;
+        if (bits >= 8) {
+            bits -= 8;
+            bytes[n++] = (unsigned char)(acc >> bits);
+        }
+    }
+    memcpy(key, bytes, sizeof(*key));
+    if (*key == 0) {
+        *key = 1;
+    }
+    return 1;
+}
+
+/**
+ * 同期の状態（同期トークン）を読み込む関数
+ *
+ * @param path 同期トークンのファイル
+ * @param token トークンを受け取るバッファ
+ * @param size token のサイズ
+ * @return 読み込んだ場合は1、ファイルがない場合は0、失敗時は-1
+ */
+static int sync_token_load(const char* path, char* token, size_t size) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        if (errno == ENOENT) {
+            return 0;
+        }
+        fprintf(stderr, "エラー: 同期トークン %s を読み込めません: %s\n", path, strerror(errno));
+        return -1;
+    }
+    int loaded = (fgets(token, (int)size, file) != NULL);
+    fclose(file);
+    token[loaded ? strcspn(token, "\r\n") : 0] = '\0';
+    return token[0] ? 1 : 0;
+}
+
+/**
+ * 同期トークンを保存する関数（一時ファイルに書いてから置き換える）
+ *
+ * @param path 同期トークンのファイル
+ * @param token 保存するトークン
+ * @return 成功時は0、失敗時は-1
+ */
+static int sync_token_save(const char* path, const char* token) {
+    char tmp_path[BUFFER_SIZE];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    size_t len = strlen(token);
+    int ok = (fd >= 0 && write(fd, token, len) == (ssize_t)len && write(fd, "\n", 1) == 1 && fsync(fd) == 0);
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (!ok || rename(tmp_path, path) != 0) {
+        fprintf(stderr, "エラー: 同期トークン %s を保存できません: %s\n", path, strerror(errno));
+        unlink(tmp_path);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * カレンダーの変更を events.list で取得し、状態（重複検出インデックス）に反映する関数
+ *
+ * 同期トークンがある場合はその後の変更だけを取得し、ない場合はすべてのイベントを取得して状態を作り直す。
+ * 削除されたイベントは状態から除くため、次のインポートで送り直される。
+ *
+ * @param config 使用する設定
+ * @param index 状態を記録するインデックス
+ * @param token_path 同期トークンのファイル
+ * @param sync_token 前回の同期トークン（完全な同期の場合はNULL）
+ * @return 成功時は0、同期トークンが無効になった（HTTP 410）場合は1、失敗時は-1
+ */
+static int sync_pull(const struct app_config* config, struct dedup_index* index, const char* token_path,
+                     const char* sync_token) {
+    struct request_template tmpl;
+    if (request_template_init(&tmpl, config, config->calendar_id, NULL) != 0) {
+        return -1;
+    }
+    if (sync_token == NULL) {
+        // 作り直している途中で中断した状態に、古いトークンの差分を適用しないようにする
+        if (unlink(token_path) != 0 && errno != ENOENT) {
+            fprintf(stderr, "エラー: 同期トークン %s を削除できません: %s\n", token_path, strerror(errno));
+            request_template_free(&tmpl);
+            return -1;
+        }
+        dedup_index_clear(index);
+    }
+
+    struct sync_fetcher fetcher;
+    memset(&fetcher, 0, sizeof(fetcher));
+    fetcher.tmpl = &tmpl;
+    fetcher.sync_token = sync_token;
+    fetcher.max_retries = config->tuning.max_retries;
+    pthread_mutex_init(&fetcher.lock, NULL);
+    pthread_cond_init(&fetcher.changed, NULL);
+    if (pthread_create(&fetcher.thread, NULL, sync_fetcher_main, &fetcher) != 0) {
+        fprintf(stderr, "エラー: イベント一覧を取得するスレッドを開始できません\n");
+        pthread_cond_destroy(&fetcher.changed);
+        pthread_mutex_destroy(&fetcher.lock);
+        request_template_free(&tmpl);
+        return -1;
+    }
+
+    unsigned long updated = 0;
+    unsigned long removed = 0;
+    int status = 0;
+    struct json_object* body;
+    while ((body = sync_fetcher_next(&fetcher)) != NULL) {
+        struct json_object* items;
+        size_t count = json_object_object_get_ex(body, "items", &items) && json_object_is_type(items, json_type_array)
+                       ? json_object_array_length(items) : 0;
+        for (size_t i = 0; i < count && status == 0; i++) {
+            struct json_object* event = json_object_array_get_idx(items, i);
+            struct json_object* value;
+            uint64_t key;
+            if (json_object_object_get_ex(event, "iCalUID", &value) && json_object_is_type(value, json_type_string)) {
+                key = dedup_index_key(config->calendar_id, json_object_get_string(value));
+            } else if (!json_object_object_get_ex(event, "id", &value) || !event_id_key(json_object_get_string(value), &key)) {
+                continue;
+            }
+
+            if (json_object_object_get_ex(event, "status", &value) &&
+                strcmp(json_object_get_string(value), "cancelled") == 0) {
+                dedup_index_remove(index, key);
+                removed++;
+            } else if (dedup_index_put(index, key, dedup_index_digest(event)) == 0) {
+                updated++;
+            } else {
+                status = -1;
+            }
+        }
+        json_object_put(body);
+        if (status != 0) {
+            break;
+        }
+    }
+
+    pthread_mutex_lock(&fetcher.lock);
+    fetcher.stop = 1;
+    pthread_cond_broadcast(&fetcher.changed);
+    pthread_mutex_unlock(&fetcher.lock);
+    pthread_join(fetcher.thread, NULL);
+    while ((body = sync_fetcher_next(&fetcher)) != NULL) {
+        json_object_put(body);
+    }
+    pthread_cond_destroy(&fetcher.changed);
+    pthread_mutex_destroy(&fetcher.lock);
+    request_template_free(&tmpl);
+
+    if (status == 0 && fetcher.failed) {
+        status = (fetcher.http_status == 410) ? 1 : -1;
+    }
+    if (status == 0 && fetcher.next_sync_token[0] == '\0') {
+        fprintf(stderr, "エラー: イベント一覧のレスポンスに nextSyncToken が含まれていません\n");
+        status = -1;
+    }
+    if (status == 0) {
+        printf("カレンダーの%s: %lu ページ、更新 %lu 件、削除 %lu 件（状態 %llu 件）\n",
+               sync_token ? "差分" : "全イベント", fetcher.pages, updated, removed,
+               (unsigned long long)index->header->count);
+        // 状態をディスクに書き戻してからトークンを進める
+        if (msync(index->header, index->map_size, MS_SYNC) != 0 ||
+            sync_token_save(token_path, fetcher.next_sync_token) != 0) {
+            status = -1;
+        }
+    }
+    return status;
+}
+
+/**
+ * カレンダーと同期してから、内容の異なるイベントだけをインポートする関数
+ *
+ * 1. events.list でカレンダーの変更（初回や同期トークンが無効になった場合はすべてのイベント）を取得し、
+ *    イベントごとの内容のハッシュを状態ファイルに記録する
+ * 2. 入力ファイルのイベントのうち、状態と内容が異なるものだけを送信する
+ * 状態ファイルは --dedup-index と同じ形式で、同期トークンは 状態ファイル名.token に保存する。
+ *
+ * @param config 使用する設定
+ * @param input_path 入力ファイルのパス
+ * @param state_path 状態ファイルのパス
+ * @param journal_path 結果を記録するジャーナルのパス（記録しない場合はNULL）
+ * @param resume ジャーナルをもとに前回の続きから再開するかどうか
+ * @param deadline_ms 締め切りの時刻（monotonic_ms() の値、締め切りがない場合は0）
+ * @return すべて成功した場合は0、それ以外は-1
+ */
+int sync_events_from_file(const struct app_config* config, const char* input_path, const char* state_path,
+                          const char* journal_path, int resume, long long deadline_ms) {
+    char token_path[BUFFER_SIZE];
+    char sync_token[1024];
+    snprintf(token_path, sizeof(token_path), "%s.token", state_path);
+
+    struct dedup_index index;
+    if (dedup_index_open(&index, state_path) != 0) {
+        return -1;
+    }
+    int loaded = sync_token_load(token_path, sync_token, sizeof(sync_token));
+    int status = (loaded < 0) ? -1 : sync_pull(config, &index, token_path, loaded ? sync_token : NULL);
+    if (status == 1) {
+        printf("同期トークンが無効になったため（HTTP 410）、すべてのイベントを取得し直します\n");
+        status = sync_pull(config, &index, token_path, NULL);
+    }
+    dedup_index_close(&index);
+    if (status != 0) {
+        fprintf(stderr, "エラー: カレンダーとの同期に失敗しました\n");
+        return -1;
+    }
+
+    return import_events_from_file(config, input_path, journal_path, state_path, resume, deadline_ms);
+}
+
+/**
+ * エクスポートの条件
+ */
+struct export_options {
+    long long time_min;             // 開始時刻の下限（終了時刻がこれより後のイベントを含む、指定しない場合は LLONG_MIN）
+    long long time_max;             // 開始時刻の上限（含まない、指定しない場合は LLONG_MAX）
+    int shards;                     // 時間範囲の分割数（0の場合は同時実行数の EXPORT_SHARDS_PER_SLOT 倍）
+    int sorted;                     // 開始時刻の順に並べて書き出すかどうか
+};
+
+/**
+ * 並べ替えて書き出すイベントの記録（--sorted の場合）
+ */
+struct export_record {
+    long long start;                // 開始時刻（UNIX時間、解析できない場合は LLONG_MIN）
+    unsigned long long offset;      // 一時ファイル内の位置
+    size_t len;                     // 改行を含む長さ
+};
+
+/**
+ * エクスポートする時間範囲の1区間（シャード）
+ *
+ * events.list のページは前のページの nextPageToken がないと要求できないため、1区間の中では順に取得し、
+ * 区間どうしを並行に取得する。区間の境界をまたぐイベントは両方の区間で返されるため、
+ * 開始時刻がその区間に含まれるイベントだけを書き出す。
+ */
+struct export_shard {
+    long long time_min;             // 書き出す開始時刻の下限（含む、確認しない場合は LLONG_MIN）
+    long long time_max;             // 書き出す開始時刻の上限（含まない、確認しない場合は LLONG_MAX）
+    long long query_min;            // events.list に指定する timeMin（指定しない場合は LLONG_MIN）
+    long long query_max;            // events.list に指定する timeMax（指定しない場合は LLONG_MAX）
+    char* page_token;               // 次に取得するページ（最初のページの場合はNULL）
+    int started;                    // 最初のページを要求したか
+    int busy;                       // ページを取得中か
+    int done;                       // 最後のページまで取得したか
+    int attempt;                    // 現在のページの再送回数
+    long long retry_at_ms;          // 再送する時刻（monotonic_ms() の値）
+    struct export_record* records;  // 並べ替え用の記録（--sorted の場合）
+    size_t record_count;
+    size_t record_cap;
+};
+
+/**
+ * エクスポートの転送スロット
+ */
+struct export_slot {
+    CURL* curl;                     // このスロット専用のイージーハンドル
+    struct MemoryStruct response;   // レスポンスの受信バッファ（転送ごとに空にして再利用する）
+    struct request_headers headers; // アクセストークンを含むヘッダーリスト
+    struct string_buffer url;       // 要求するURL（再利用する）
+    struct export_shard* shard;     // 取得中の区間（空いている場合はNULL）
+};
+
+/**
+ * 並行エクスポートエンジン構造体
+ * 1つのスレッドから curl_multi を使い、最大 concurrency 個の区間のページを同時に取得する。
+ * 受け取ったページはすぐに書き出すため、メモリの使用量はイベント数によらず一定になる。
+ * --sorted の場合は、各区間のイベントを一時ファイルに溜めておき、その区間とそれより前の区間が
+ * すべて揃った時点で、区間の中を開始時刻の順に並べて書き出す。
+ */
+struct export_engine {
+    const struct app_config* config;
+    CURLM* multi;
+    struct request_template request; // events.list のURL
+    struct export_slot* slots;
+    int concurrency;                // 同時に取得するページ数の上限
+    int in_flight;                  // 取得中のページ数
+    int max_retries;                // 1ページを再送する最大回数
+    struct export_shard* shards;
+    int shard_count;
+    int next_shard;                 // まだ開始していない最初の区間
+    int first_open;                 // 最後まで取得していない最初の区間
+    int done_count;                 // 最後まで取得した区間の数
+    int merged;                     // 書き出した区間の数（--sorted の場合）
+    int sorted;
+    FILE* out;                      // 出力先
+    FILE* spool;                    // 並べ替える前のイベントを溜める一時ファイル（--sorted の場合）
+    unsigned long long spool_size;
+    struct string_buffer page;      // 1ページ分の出力（再利用する）
+    int failed;                     // 取得や書き出しに失敗したか（以降は新しいページを要求しない）
+    unsigned long events;           // 書き出したイベント数
+    unsigned long pages;            // 取得したページ数
+    unsigned long requests;         // 送信したHTTPリクエスト数
+};
+
+/**
+ * イベントの開始時刻を求める関数
+ *
+ * @param event イベントリソース
+ * @param start 開始時刻（UNIX時間）を受け取るポインタ
+ * @return 成功時は0、開始時刻がないか解析できない場合は-1
+ */
+static int export_event_start(struct json_object* event, long long* start) {
+    struct json_object* when;
+    struct json_object* value;
+    if (!json_object_object_get_ex(event, "start", &when) ||
+        !(json_object_object_get_ex(when, "dateTime", &value) || json_object_object_get_ex(when, "date", &value))) {
+        return -1;
+    }
+    // API は dateTime に常にオフセットを付けるが、付いていない場合は（モックサーバーと同じく）UTC とみなす
+    struct rfc3339_time t;
+    if (rfc3339_parse_fields(json_object_get_string(value), (size_t)json_object_get_string_len(value), &t) != 0) {
+        return -1;
+    }
+    *start = rfc3339_to_epoch(&t);
+    return 0;
+}
+
+static int export_record_compare(const void* a, const void* b) {
+    const struct export_record* x = a;
+    const struct export_record* y = b;
+    if (x->start != y->start) {
+        return (x->start > y->start) - (x->start < y->start);
+    }
+    return (x->offset > y->offset) - (x->offset < y->offset);
+}
+
+/**
+ * 時間範囲を区間に分ける関数
+ *
+ * 範囲を指定しない場合は、現在の前後（過去 EXPORT_DEFAULT_PAST_SECONDS、未来 EXPORT_DEFAULT_FUTURE_SECONDS）を
+ * 等分し、最初と最後の区間はそれより前・後のイベントもすべて含める。
+ * 終日イベントの開始時刻はカレンダーのタイムゾーンによらずその日の0時（UTC）とみなすため、
+ * 区間の境界の前後 EXPORT_SHARD_MARGIN_SECONDS を余分に要求し、書き出すかどうかは開始時刻で決める。
+ *
+ * @param engine 並行エクスポートエンジン
+ * @param options エクスポートの条件
+ * @return 成功時は0、失敗時は-1
+ */
+static int export_engine_split(struct export_engine* engine, const struct export_options* options) {
+    long long now = (long long)time(NULL);
+    long long lo = (options->time_min != LLONG_MIN) ? options->time_min : now - EXPORT_DEFAULT_PAST_SECONDS;
+    long long hi = (options->time_max != LLONG_MAX) ? options->time_max : now + EXPORT_DEFAULT_FUTURE_SECONDS;
+    int count = (options->shards > 0) ? options->shards : engine->concurrency * EXPORT_SHARDS_PER_SLOT;
+    if (count > EXPORT_MAX_SHARDS) {
+        count = EXPORT_MAX_SHARDS;
+    }
+    // 区間が狭すぎると、境界の前後で重複して取得するイベントの割合が増える
+    long long span = hi - lo;
+    if (span / count < EXPORT_MIN_SHARD_SECONDS) {
+        count = (int)(span / EXPORT_MIN_SHARD_SECONDS);
+    }
+    if (count < 1) {
+        count = 1;
+    }
+
+    engine->shards = calloc(count, sizeof(struct export_shard));
+    if (engine->shards == NULL) {
+        fprintf(stderr, "エラー: メモリ割り当てに失敗しました\n");
+        return -1;
+    }
+    engine->shard_count = count;
+    for (int i = 0; i < count; i++) {
+        struct export_shard* shard = &engine->shards[i];
+        if (i == 0) {
+            shard->time_min = LLONG_MIN;
+            shard->query_min = options->time_min;
+        } else {
+            shard->time_min = lo + span * i / count;
+            shard->query_min = shard->time_min - EXPORT_SHARD_MARGIN_SECONDS;
+        }
+        if (i == count - 1) {
+            shard->time_max = LLONG_MAX;
+            shard->query_max = options->time_max;
+        } else {
+            shard->time_max = lo + span * (i + 1) / count;
+            shard->query_max = shard->time_max + EXPORT_SHARD_MARGIN_SECONDS;
+        }
+    }
+    return 0;
+}
+
+/**
+ * 並行エクスポートエンジンを初期化する関数
+ *
+ * @param engine 初期化するエンジン
+ * @param config 使用する設定
+ * @param options エクスポートの条件
+ * @param out 出力先
+ * @return 成功時は0、失敗時は-1
+ */
+static int export_engine_init(struct export_engine* engine, const struct app_config* config,
+                              const struct export_options* options, FILE* out) {
+    memset(engine, 0, sizeof(*engine));
+    engine->config = config;
+    engine->concurrency = config->tuning.concurrency;
+    engine->max_retries = config->tuning.max_retries;
+    engine->sorted = options->sorted;
+    engine->out = out;
+    if (request_template_init(&engine->request, config, config->calendar_id, NULL) != 0) {
+        return -1;
+    }
+    if (export_engine_split(engine, options) != 0) {
+        request_template_free(&engine->request);
+        return -1;
+    }
+
+    engine->multi = curl_multi_init();
+    engine->slots = calloc(engine->concurrency, sizeof(struct export_slot));
+    engine->spool = engine->sorted ? tmpfile() : NULL;
+    if (!engine->multi || !engine->slots || (engine->sorted && !engine->spool)) {
+        fprintf(stderr, "エラー: 並行エクスポートエンジンの初期化に失敗しました\n");
+        goto fail;
+    }
+    curl_multi_setopt(engine->multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+    curl_multi_setopt(engine->multi, CURLMOPT_MAX_CONCURRENT_STREAMS, (long)config->tuning.max_streams);
+
+    for (int i = 0; i < engine->concurrency; i++) {
+        struct export_slot* slot = &engine->slots[i];
+        slot->curl = curl_easy_init();
+        if (!slot->curl || memory_struct_init(&slot->response, MAX_RESPONSE_SIZE) != 0) {
+            fprintf(stderr, "エラー: 並行エクスポートエンジンの初期化に失敗しました\n");
+            goto fail;
+        }
+        http_session_prepare(slot->curl);
+        curl_easy_setopt(slot->curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
+        curl_easy_setopt(slot->curl, CURLOPT_WRITEDATA, (void *)&slot->response);
+        curl_easy_setopt(slot->curl, CURLOPT_ACCEPT_ENCODING, "");
+        curl_easy_setopt(slot->curl, CURLOPT_PRIVATE, (void *)slot);
+    }
+    return 0;
+
+fail:
+    for (int i = 0; engine->slots && i < engine->concurrency; i++) {
+        if (engine->slots[i].curl) {
+            curl_easy_cleanup(engine->slots[i].curl);
+        }
+        free(engine->slots[i].response.memory);
+    }
+    free(engine->slots);
+    if (engine->spool) {
+        fclose(engine->spool);
+    }
+    if (engine->multi) {
+        curl_multi_cleanup(engine->multi);
+    }
+    free(engine->shards);
+    request_template_free(&engine->request);
+    return -1;
+}
+
+/**
+ * 並行エクスポートエンジンを解放する関数
+ *
+ * @param engine 解放するエンジン
+ */
+static void export_engine_cleanup(struct export_engine* engine) {
+    for (int i = 0; i < engine->concurrency; i++) {
+        struct export_slot* slot = &engine->slots[i];
+        if (slot->shard) {
+            curl_multi_remove_handle(engine->multi, slot->curl);
+        }
+        arena_free(&slot->headers.arena);
+        free(slot->response.memory);
+        free(slot->url.data);
+        curl_easy_cleanup(slot->curl);
+    }
+    for (int i = 0; i < engine->shard_count; i++) {
+        free(engine->shards[i].page_token);
+        free(engine->shards[i].records);
+    }
+    if (engine->spool) {
+        fclose(engine->spool);
+    }
+    free(engine->page.data);
+    free(engine->slots);
+    free(engine->shards);
+    curl_multi_cleanup(engine->multi);
+    request_template_free(&engine->request);
+}
+
+/**
+ * 次にページを要求する区間を選ぶ関数
+ * 取得中の区間の続きを新しい区間より先に要求し、書き出しを待たせている区間を早く終わらせる
+ *
+ * @param engine 並行エクスポートエンジン
+ * @param now 現在時刻（monotonic_ms() の値）
+ * @param wait_ms 再送待ちの区間がある場合に、最も早い再送までのミリ秒を設定する
+ * @return 要求する区間（ない場合はNULL）
+ */
+static struct export_shard* export_engine_next_shard(struct export_engine* engine, long long now, long* wait_ms) {
+    while (engine->first_open < engine->next_shard && engine->shards[engine->first_open].done) {
+        engine->first_open++;
+    }
+    for (int i = engine->first_open; i < engine->next_shard; i++) {
+        struct export_shard* shard = &engine->shards[i];
+        if (shard->busy || shard->done) {
+            continue;
+        }
+        if (shard->retry_at_ms > now) {
+            if (shard->retry_at_ms - now < *wait_ms) {
+                *wait_ms = (long)(shard->retry_at_ms - now);
+            }
+            continue;
+        }
+        return shard;
+    }
+    if (engine->next_shard < engine->shard_count) {
+        return &engine->shards[engine->next_shard++];
+    }
+    return NULL;
+}
+
+/**
+ * 区間の次のページを要求する関数
+ *
+ * @param engine 並行エクスポートエンジン
+ * @param slot 使用するスロット（空いていること）
+ * @param shard 要求する区間
+ * @return 成功時は0、失敗時は-1
+ */
+static int export_engine_send(struct export_engine* engine, struct export_slot* slot, struct export_shard* shard) {
+    if (request_headers_update(&slot->headers, &engine->request) != 0) {
+        fprintf(stderr, "エラー: 有効なアクセストークンの取得に失敗しました\n");
+        return -1;
+    }
+
+    char time_min[RFC3339_UTC_SIZE];
+    char time_max[RFC3339_UTC_SIZE];
+    slot->url.len = 0;
+    int rc = string_buffer_appendf(&slot->url, "%s?maxResults=%d", engine->request.list_url, SYNC_PAGE_SIZE);
+    if (rc == 0 && shard->query_min != LLONG_MIN) {
+        rfc3339_format_utc(shard->query_min, time_min);
+        rc = string_buffer_appendf(&slot->url, "&timeMin=%s", time_min);
+    }
+    if (rc == 0 && shard->query_max != LLONG_MAX) {
+        rfc3339_format_utc(shard->query_max, time_max);
+        rc = string_buffer_appendf(&slot->url, "&timeMax=%s", time_max);
+    }
+    if (rc == 0 && shard->page_token) {
+        char* page = curl_easy_escape(slot->curl, shard->page_token, 0);
+        rc = page ? string_buffer_appendf(&slot->url, "&pageToken=%s", page) : -1;
+        curl_free(page);
+    }
+    if (rc != 0) {
+        fprintf(stderr, "エラー: URLの生成に失敗しました\n");
+        return -1;
+    }
+
+    memory_struct_reset(&slot->response);
+    curl_easy_setopt(slot->curl, CURLOPT_URL, slot->url.data);
+    curl_easy_setopt(slot->curl, CURLOPT_HTTPHEADER, slot->headers.single);
+    CURLMcode mres = curl_multi_add_handle(engine->multi, slot->curl);
+    if (mres != CURLM_OK) {
+        fprintf(stderr, "エラー: curl_multi の処理に失敗しました: %s\n", curl_multi_strerror(mres));
+        return -1;
+    }
+    slot->shard = shard;
+    shard->busy = 1;
+    shard->started = 1;
+    engine->in_flight++;
+    engine->requests++;
+    return 0;
+}
+
+/**
+ * 書き出しの順番が来た区間を、開始時刻の順に並べて書き出す関数（--sorted の場合）
+ *
+ * @param engine 並行エクスポートエンジン
+ * @return 成功時は0、失敗時は-1
+ */
+static int export_engine_merge(struct export_engine* engine) {
+    while (engine->merged < engine->shard_count && engine->shards[engine->merged].done) {
+        struct export_shard* shard = &engine->shards[engine->merged];
+        if (shard->record_count > 0) {
+            void* map = mmap(NULL, engine->spool_size, PROT_READ, MAP_PRIVATE, fileno(engine->spool), 0);
+            if (map == MAP_FAILED) {
+                fprintf(stderr, "エラー: 一時ファイルを読み込めません: %s\n", strerror(errno));
+                return -1;
+            }
+            qsort(shard->records, shard->record_count, sizeof(struct export_record), export_record_compare);
+            int ok = 1;
+            for (size_t i = 0; i < shard->record_count && ok; i++) {
+                const struct export_record* record = &shard->records[i];
+                ok = (fwrite((const char*)map + record->offset, 1, record->len, engine->out) == record->len);
+            }
+            munmap(map, engine->spool_size);
+            if (!ok) {
+                fprintf(stderr, "エラー: エクスポートの書き出しに失敗しました: %s\n", strerror(errno));
+                return -1;
+            }
+        }
+        free(shard->records);
+        shard->records = NULL;
+        shard->record_count = shard->record_cap = 0;
+        engine->merged++;
+    }
+    return 0;
+}
+
+/**
+ * 取得した1ページのイベントのうち、開始時刻が区間に含まれるものを書き出す関数
+ * 開始時刻を解析できないイベントはどの区間にも属さないため、最初の区間でだけ書き出す
+ * （各区間の問い合わせが重なるため、すべての区間で書き出すと重複する）
+ *
+ * @param engine 並行エクスポートエンジン
+ * @param shard ページを取得した区間
+ * @param body ページのレスポンス
+ * @return 成功時は0、失敗時は-1
+ */
+static int export_engine_write_page(struct export_engine* engine, struct export_shard* shard,
+                                    struct json_object* body) {
+    struct json_object* items;
+    size_t count = json_object_object_get_ex(body, "items", &items) && json_object_is_type(items, json_type_array)
+                   ? json_object_array_length(items) : 0;
+    engine->page.len = 0;
+    for (size_t i = 0; i < count; i++) {
+        struct json_object* event = json_object_array_get_idx(items, i);
+        long long start;
+        if (export_event_start(event, &start) != 0) {
+            if (shard != &engine->shards[0]) {
+                continue;
+            }
+            start = LLONG_MIN;
+        } else if (start < shard->time_min || start >= shard->time_max) {
+            continue;
+        }
+
+        size_t offset = engine->page.len;
+        if (json_write_value(&engine->page, event) != 0 || string_buffer_append(&engine->page, "\n", 1) != 0) {
+            return -1;
+        }
+        if (engine->sorted) {
+            if (shard->record_count == shard->record_cap) {
+                size_t cap = shard->record_cap ? shard->record_cap * 2 : 256;
+                struct export_record* records = realloc(shard->records, cap * sizeof(*records));
+                if (records == NULL) {
+                    fprintf(stderr, "エラー: メモリ割り当てに失敗しました\n");
+                    return -1;
+                }
+                shard->records = records;
+                shard->record_cap = cap;
+            }
+            struct export_record* record = &shard->records[shard->record_count++];
+            record->start = start;
+            record->offset = engine->spool_size + offset;
+            record->len = engine->page.len - offset;
+        }
+        engine->events++;
+    }
+
+    if (engine->page.len == 0) {
+        return 0;
+    }
+    if (engine->sorted) {
+        if (pwrite(fileno(engine->spool), engine->page.data, engine->page.len, (off_t)engine->spool_size) !=
+            (ssize_t)engine->page.len) {
+            fprintf(stderr, "エラー: 一時ファイルに書き込めません: %s\n", strerror(errno));
+            return -1;
+        }
+        engine->spool_size += engine->page.len;
+    } else if (fwrite(engine->page.data, 1, engine->page.len, engine->out) != engine->page.len) {
+        fprintf(stderr, "エラー: エクスポートの書き出しに失敗しました: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * 完了したページの取得を処理する関数
+ * 一時的なエラーの場合は、バックオフしてから同じページを max_retries 回まで要求し直す
+ *
+ * @param engine 並行エクスポートエンジン
+ * @param msg curl_multi_info_read() で取得した完了メッセージ
+ */
+static void export_engine_finish(struct export_engine* engine, CURLMsg* msg) {
+    struct export_slot* slot = NULL;
+    curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&slot);
+    struct export_shard* shard = slot->shard;
+
+    long http_status = 0;
+    curl_off_t retry_after = -1;
+    curl_easy_getinfo(msg->easy_handle, CURLINFO_RESPONSE_CODE, &http_status);
+    curl_easy_getinfo(msg->easy_handle, CURLINFO_RETRY_AFTER, &retry_after);
+    net_stats_record(NET_REQUEST_LIST, msg->easy_handle, msg->data.result);
+    curl_multi_remove_handle(engine->multi, slot->curl);
+    slot->shard = NULL;
+    shard->busy = 0;
+    engine->in_flight--;
+
+    int retryable = 0;
+    if (msg->data.result != CURLE_OK) {
+        fprintf(stderr, "エラー: イベント一覧の取得に失敗しました: %s\n", curl_easy_strerror(msg->data.result));
+        retryable = is_retryable_transfer_error(msg->data.result);
+    } else if (http_status >= 200 && http_status < 300) {
+        struct json_object* body = json_tokener_parse(slot->response.memory ? slot->response.memory : "");
+        if (!json_object_is_type(body, json_type_object)) {
+            fprintf(stderr, "エラー: イベント一覧のレスポンスを解析できません\n");
+            json_object_put(body);
+            engine->failed = 1;
+            return;
+        }
+        struct json_object* token;
+        char* next = NULL;
+        if (json_object_object_get_ex(body, "nextPageToken", &token) &&
+            (next = strdup(json_object_get_string(token))) == NULL) {
+            fprintf(stderr, "エラー: メモリ割り当てに失敗しました\n");
+            engine->failed = 1;
+        }
+        if (!engine->failed && export_engine_write_page(engine, shard, body) != 0) {
+            engine->failed = 1;
+        }
+        json_object_put(body);
+        free(shard->page_token);
+        shard->page_token = next;
+        shard->attempt = 0;
+        engine->pages++;
+        if (next == NULL) {
+            shard->done = 1;
+            engine->done_count++;
+        }
+        if (engine->sorted && !engine->failed && export_engine_merge(engine) != 0) {
+            engine->failed = 1;
+        }
+        return;
+    } else {
+        struct api_response parsed;
+        api_response_parse(&parsed, slot->response.memory, slot->response.size);
+        fprintf(stderr, "エラー: イベント一覧の取得に失敗しました (HTTP %ld%s%s): %s\n", http_status,
+                parsed.reason[0] ? " " : "", parsed.reason, parsed.message[0] ? parsed.message : parsed.snippet);
+        retryable = is_retryable_response(http_status, parsed.reason);
+    }
+
+    if (!retryable || shard->attempt >= engine->max_retries) {
+        engine->failed = 1;
+        return;
+    }
+    shard->attempt++;
+    long delay = retry_backoff_ms(shard->attempt, (long)retry_after);
+    shard->retry_at_ms = monotonic_ms() + delay;
+    fprintf(stderr, "%.1f 秒後に再送します（%d/%d 回目）\n", delay / 1000.0, shard->attempt, engine->max_retries);
+}
+
+/**
+ * すべての区間を最後まで取得するまで、ページの要求と書き出しを繰り返す関数
+ * 失敗した場合は新しいページを要求せず、取得中のページの完了を待ってから戻る
+ *
+ * @param engine 並行エクスポートエンジン
+ * @return 成功時は0、失敗時は-1
+ */
+static int export_engine_run(struct export_engine* engine) {
+    for (;;) {
+        long wait_ms = 1000;
+        long long now = monotonic_ms();
+        while (!engine->failed && engine->in_flight < engine->concurrency) {
+            struct export_shard* shard = export_engine_next_shard(engine, now, &wait_ms);
+            if (shard == NULL) {
+                break;
+            }
+            struct export_slot* slot = NULL;
+            for (int i = 0; i < engine->concurrency && slot == NULL; i++) {
+                if (engine->slots[i].shard == NULL) {
+                    slot = &engine->slots[i];
+                }
+            }
+            if (export_engine_send(engine, slot, shard) != 0) {
+                engine->failed = 1;
+            }
+        }
+        if (engine->in_flight == 0 && (engine->failed || engine->done_count == engine->shard_count)) {
+            break;
+        }
+
+        int running = 0;
+        CURLMcode mres = curl_multi_perform(engine->multi, &running);
+        if (running < engine->in_flight) {
+            wait_ms = 0;
+        }
+        if (mres == CURLM_OK) {
+            mres = curl_multi_poll(engine->multi, NULL, 0, (int)wait_ms, NULL);
+        }
+        if (mres != CURLM_OK) {
+            fprintf(stderr, "エラー: curl_multi の処理に失敗しました: %s\n", curl_multi_strerror(mres));
+            return -1;
+        }
+        curl_multi_perform(engine->multi, &running);
+
+        CURLMsg* msg;
+        int msgs_left;
+        while ((msg = curl_multi_info_read(engine->multi, &msgs_left)) != NULL) {
+            if (msg->msg == CURLMSG_DONE) {
+                export_engine_finish(engine, msg);
+            }
+        }
+    }
+    return engine->failed ? -1 : 0;
+}
+
+/**
+ * カレンダーのイベントを JSONL に書き出す関数
+ *
+ * 時間範囲を区間に分け、区間ごとに events.list のページを並行に取得して、届いたページから順に書き出す。
+ * ファイルに書き出す場合は一時ファイルに書いてから置き換えるため、失敗しても前回の出力は残る。
+ *
+ * @param config 使用する設定
+ * @param output_path 出力ファイルのパス（output_fd を使う場合は報告用の名前）
+ * @param output_fd 書き出し先のファイルディスクリプタ（標準出力の場合、ファイルに書き出す場合は-1）
+ * @param options エクスポートの条件
+ * @return 成功時は0、失敗時は-1
+ */
+int export_events_to_file(const struct app_config* config, const char* output_path, int output_fd,
+                          const struct export_options* options) {
+    char tmp_path[BUFFER_SIZE];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", output_path);
+    FILE* out = (output_fd >= 0) ? fdopen(output_fd, "w") : fopen(tmp_path, "w");
+    if (out == NULL) {
+        fprintf(stderr, "エラー: 出力ファイル %s を開けません: %s\n", output_fd >= 0 ? output_path : tmp_path,
+                strerror(errno));
+        return -1;
+    }
+
+    struct export_engine engine;
+    long long started = monotonic_ms();
+    int status = export_engine_init(&engine, config, options, out);
+    if (status == 0) {
+        status = export_engine_run(&engine);
+        printf("%lu 件のイベントを %s に書き出しました（%d 区間、%lu ページ、%lu リクエスト、%.1f 秒）\n",
+               engine.events, output_path, engine.shard_count, engine.pages, engine.requests,
+               (monotonic_ms() - started) / 1000.0);
+        export_engine_cleanup(&engine);
+    }
+
+    if (fflush(out) != 0 || (output_fd < 0 && fsync(fileno(out)) != 0)) {
+        fprintf(stderr, "エラー: エクスポートの書き出しに失敗しました: %s\n", strerror(errno));
+        status = -1;
+    }
+    fclose(out);
+    if (output_fd < 0) {
+        if (status == 0 && rename(tmp_path, output_path) != 0) {
+            fprintf(stderr, "エラー: 出力ファイル %s を置き換えられません: %s\n", output_path, strerror(errno));
+            status = -1;
+        }
+        if (status != 0) {
+            unlink(tmp_path);
+        }
+    }
+    if (status != 0) {
+        fprintf(stderr, "エラー: カレンダーのエクスポートに失敗しました\n");
+    }
+    return status;
+}
+
+/**
+ * プロンプトで入力された1件のイベントをインポートする関数
+ *
+ * @param calendar_id インポート先のカレンダーID
+ * @return 成功時は0、失敗時は-1
+ */
+int import_event_interactive(const char* calendar_id) {
+    char event_summary[MAX_INPUT_LENGTH];
+    char event_start[MAX_INPUT_LENGTH];
+    char event_end[MAX_INPUT_LENGTH];
+
+    get_event_details(event_summary, event_start, event_end);
+
+    struct event_fields event = { .summary = event_summary, .reminders_use_default = -1, .sequence = -1 };
+    event.start.date_time = event_start;
+    event.end.date_time = event_end;
+
+    struct string_buffer event_data = {0};
+    if (json_write_event(&event_data, &event) != 0) {
+        free(event_data.data);
+        return -1;
+    }
+
+    int result = import_event(calendar_id, event_data.data);
+    free(event_data.data);
+
+    if (result == 0) {
+        printf("イベントが正常にインポートされました。\n");
+    } else {
+        fprintf(stderr, "エラー: イベントのインポートに失敗しました。\n");
+    }
+    return result;
+}
+
+// ベンチマークなどから関数だけを取り込む場合は CALENDAR_IMPORT_NO_MAIN を定義する
+#ifndef CALENDAR_IMPORT_NO_MAIN
+/**
+ * メイン関数
+ * プログラムの全体的な流れを制御する
+ */
+int main(int argc, char* argv[]) {
+    setlocale(LC_ALL, "");  // 日本語出力のために必要
+
+    static const struct option long_options[] = {
+        {"input",       required_argument, NULL, 'i'},
+        {"concurrency", required_argument, NULL, 'c'},
+        {"batch-size",  required_argument, NULL, 'b'},
+        {"batch-flush-ms", required_argument, NULL, 'f'},
+        {"http-version", required_argument, NULL, 'v'},
+        {"max-streams", required_argument, NULL, 's'},
+        {"token-refresh-margin", required_argument, NULL, 'm'},
+        {"watch-config", no_argument,     NULL, 'w'},
+        {"fixed-concurrency", no_argument, NULL, 'F'},
+        {"journal",     required_argument, NULL, 'j'},
+        {"resume",      no_argument,       NULL, 'r'},
+        {"max-retries", required_argument, NULL, 'R'},
+        {"no-event-ids", no_argument,     NULL, 'N'},
+        {"hedge",       no_argument,       NULL, 'H'},
+        {"deadline",    required_argument, NULL, 'D'},
+        {"dedup-index", required_argument, NULL, 'x'},
+        {"sync",        required_argument, NULL, 'S'},
+        {"export",      required_argument, NULL, 'E'},
+        {"time-min",    required_argument, NULL, 't'},
+        {"time-max",    required_argument, NULL, 'T'},
+        {"shards",      required_argument, NULL, 'k'},
+        {"sorted",      no_argument,       NULL, 'O'},
+        {"metrics-file", required_argument, NULL, 'M'},
+        {"metrics-port", required_argument, NULL, 'P'},
+        {"metrics-interval", required_argument, NULL, 'I'},
+        {"help",        no_argument,       NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+
+    // ここで指定された値は config.json の値より優先され、範囲の検証は config_load() で行う
+    struct import_tuning* overrides = &g_tuning_overrides;
+    const char* input_path = NULL;
+    const char* journal_path = NULL;
+    char default_journal[BUFFER_SIZE];
+    const char* index_path = NULL;
+    const char* sync_path = NULL;
+    const char* export_path = NULL;
+    struct export_options export_options = { LLONG_MIN, LLONG_MAX, 0, 0 };
+    int export_fd = -1;
+    const char* metrics_file = NULL;
+    int metrics_port = 0;
+    long metrics_interval = DEFAULT_METRICS_INTERVAL;
+    long long deadline_ms = 0;
+    int resume = 0;
+    int watch_config = 0;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "i:c:b:f:v:s:m:wFj:rR:NHD:x:S:E:t:T:k:OM:P:I:h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'i':
+                input_path = optarg;
+                break;
+            case 'c':
+                overrides->concurrency = atoi(optarg);
+                break;
+            case 'b':
+                overrides->batch_size = atoi(optarg);
+                break;
+            case 'f':
+                overrides->batch_flush_ms = atol(optarg);
+                break;
+            case 'v':
+                overrides->http_version = parse_http_version(optarg);
+                if (overrides->http_version < 0) {
+                    fprintf(stderr, "エラー: --http-version には 1.1、2 または h2c を指定してください\n");
+                    return 1;
+                }
+                break;
+            case 's':
+                overrides->max_streams = atoi(optarg);
+                break;
+            case 'm':
+                overrides->token_refresh_margin = atol(optarg);
+                break;
+            case 'w':
+                watch_config = 1;
+                break;
+            case 'F':
+                overrides->adaptive = 0;
+                break;
+            case 'j':
+                journal_path = optarg;
+                break;
+            case 'r':
+                resume = 1;
+                break;
+            case 'R':
+                overrides->max_retries = atoi(optarg);
+                break;
+            case 'N':
+                overrides->event_ids = 0;
+                break;
+            case 'H':
+                overrides->hedge = 1;
+                break;
+            case 'D':
+                if (atol(optarg) <= 0) {
+                    fprintf(stderr, "エラー: --deadline には1以上の秒数を指定してください\n");
+                    return 1;
+                }
+                // 締め切りは起動時点から数え、認証やトークンの取得にかかる時間も含める
+                deadline_ms = monotonic_ms() + atol(optarg) * 1000LL;
+                break;
+            case 'x':
+                index_path = optarg;
+                break;
+            case 'S':
+                sync_path = optarg;
+                break;
+            case 'E':
+                export_path = optarg;
+                break;
+            case 't':
+            case 'T':
+                if (rfc3339_parse(optarg, opt == 't' ? &export_options.time_min : &export_options.time_max) != 0) {
+                    fprintf(stderr, "エラー: --time-min と --time-max には RFC 3339 の日時（例: 2024-01-01T00:00:00Z）"
+                            "または日付を指定してください\n");
+                    return 1;
+                }
+                break;
+            case 'k':
+                export_options.shards = atoi(optarg);
+                if (export_options.shards <= 0 || export_options.shards > EXPORT_MAX_SHARDS) {
+                    fprintf(stderr, "エラー: --shards には 1〜%d を指定してください\n", EXPORT_MAX_SHARDS);
+                    return 1;
+                }
+                break;
+            case 'O':
+                export_options.sorted = 1;
+                break;
+            case 'M':
+                metrics_file = optarg;
+                break;
+            case 'P':
+                metrics_port = atoi(optarg);
+                if (metrics_port <= 0 || metrics_port > 65535) {
+                    fprintf(stderr, "エラー: --metrics-port には 1〜65535 を指定してください\n");
+                    return 1;
+                }
+                break;
+            case 'I':
+                metrics_interval = atol(optarg);
+                if (metrics_interval <= 0) {
+                    fprintf(stderr, "エラー: --metrics-interval には1以上の秒数を指定してください\n");
+                    return 1;
+                }
+                break;
+            case 'h':
+                print_usage();
+                return 0;
+            default:
+                print_usage();
+                return 1;
+        }
+    }
+
+    if ((journal_path != NULL || resume) && input_path == NULL) {
+        fprintf(stderr, "エラー: --journal と --resume は --input と一緒に指定してください\n");
+        return 1;
+    }
+    if (sync_path != NULL && (input_path == NULL || index_path != NULL)) {
+        fprintf(stderr, "エラー: --sync は --input と一緒に、--dedup-index を指定せずに使用してください\n");
+        return 1;
+    }
+    if (export_path != NULL && (input_path != NULL || sync_path != NULL || index_path != NULL)) {
+        fprintf(stderr, "エラー: --export は --input、--sync、--dedup-index と一緒に指定できません\n");
+        return 1;
+    }
+    if (export_path == NULL && (export_options.time_min != LLONG_MIN || export_options.time_max != LLONG_MAX ||
+                                export_options.shards > 0 || export_options.sorted)) {
+        fprintf(stderr, "エラー: --time-min、--time-max、--shards、--sorted は --export と一緒に指定してください\n");
+        return 1;
+    }
+    if (export_options.time_min != LLONG_MIN && export_options.time_max != LLONG_MAX &&
+        export_options.time_min >= export_options.time_max) {
+        fprintf(stderr, "エラー: --time-max には --time-min より後の日時を指定してください\n");
+        return 1;
+    }
+    if (resume && strcmp(input_path, "-") == 0) {
+        fprintf(stderr, "エラー: --resume では標準入力ではなく通常のファイルを指定してください\n");
+        return 1;
+    }
+    if (resume && journal_path == NULL) {
+        snprintf(default_journal, sizeof(default_journal), "%s.journal", input_path);
+        journal_path = default_journal;
+    }
+
+    // 標準出力にはイベントだけを書き出すため、メッセージはすべて標準エラー出力に回す
+    if (export_path != NULL && strcmp(export_path, "-") == 0) {
+        export_fd = dup(STDOUT_FILENO);
+        if (export_fd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+            fprintf(stderr, "エラー: 標準出力を切り替えられません: %s\n", strerror(errno));
+            return 1;
+        }
+        setvbuf(stdout, NULL, _IOLBF, 0);
+    }
+
+    printf("Google Calendar イベントインポートツール\n\n");
+
+    // SIGUSR1 は全スレッドでマスクするため、設定の監視やトークン更新のスレッドより先に開始する
+    if (net_stats_start() != 0) {
+        return 1;
+    }
+
+    // ここから先の終了はすべて done: の後始末を通す（開始していない処理の終了は何もしない）
+    int result = -1;
+    const struct app_config* config = NULL;
+    if (config_init() != 0) {
+        fprintf(stderr, "エラー: 設定の読み込みに失敗しました\n");
+        goto done;
+    }
+    // 実行中に設定が再読み込みされても、インポート先は開始時点の設定に固定する
+    config = config_acquire();
+    if (watch_config && config_watch_start() != 0) {
+        goto done;
+    }
+
+    if (http_session_init(config->tuning.http_version) != 0) {
+        goto done;
+    }
+
+    // トークンファイルが存在しない場合、OAuth フローを実行
+    FILE* token_file = fopen(TOKEN_FILE, "r");
+    if (token_file == NULL) {
+        printf("初回認証が必要です。\n");
+        if (perform_oauth_flow() != 0) {
+            fprintf(stderr, "エラー: 認証に失敗しました\n");
+            goto done;
+        }
+    } else {
+        fclose(token_file);
+    }
+
+    // 一括インポートとエクスポートでは有効期限が近づいたトークンを別スレッドで先回りして更新する
+    if (token_cache_init(input_path != NULL || export_path != NULL) != 0) {
+        fprintf(stderr, "エラー: アクセストークンの読み込みに失敗しました\n");
+        goto done;
+    }
+
+    // 設定とトークンの確認がすべて済んでから公開を始める（失敗した起動の空のメトリクスを残さない）
+    if ((metrics_file != NULL || metrics_port > 0) &&
+        metrics_exporter_start(metrics_file, metrics_port, metrics_interval) != 0) {
+        goto done;
+    }
+
+    if (export_path != NULL) {
+        result = export_events_to_file(config, export_fd >= 0 ? "標準出力" : export_path, export_fd, &export_options);
+    } else if (sync_path != NULL) {
+        result = sync_events_from_file(config, input_path, sync_path, journal_path, resume, deadline_ms);
+    } else if (input_path != NULL) {
+        result = import_events_from_file(config, input_path, journal_path, index_path, resume, deadline_ms);
+    } else {
+        result = import_event_interactive(config->calendar_id);
+    }
+
+done:
+    token_cache_shutdown();
+    metrics_exporter_shutdown();
+    net_stats_shutdown();
+    http_session_cleanup();
+    if (config) {
+        config_release(config);
+    }
+    config_shutdown();
+    return result == 0 ? 0 : 1;
+}
+#endif  // CALENDAR_IMPORT_NO_MAIN
+
+// エラーハンドリング用のマクロ
+#define HANDLE_ERROR(condition, message) \
+    do { \
+        if (condition) { \
+            fprintf(stderr, "エラー: %s\n", message); \
+            exit(1); \
+        } \
+    } while(0)
+
+// メモリ解放用のマクロ
+#define SAFE_FREE(ptr) \
+    do { \
+        if (ptr) { \
+            free(ptr); \
+            ptr = NULL; \
+        } \
+    } while(0)